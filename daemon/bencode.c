@@ -6,8 +6,8 @@
 #include <assert.h>
 #include <string.h>
 #include <ctype.h>
-#include <json-glib/json-glib.h>
 #include "helpers.h"
+#include "jsonlib.h"
 
 /* set to 0 for alloc debugging, e.g. through valgrind */
 #define BENCODE_MIN_BUFFER_PIECE_LEN	512
@@ -810,168 +810,147 @@ ssize_t bencode_valid(const char *s, size_t len) {
 
 
 
-static bencode_item_t *bencode_convert_json_node(bencode_buffer_t *buf, JsonNode *node);
-
-static bencode_item_t *bencode_convert_json_dict(bencode_buffer_t *buf, JsonNode *node) {
-	JsonObject *obj = json_node_get_object(node);
-	if (!obj)
-		return NULL;
-	bencode_item_t *dict = bencode_dictionary(buf);
-	if (!dict)
+static bencode_item_t *bencode_json_string(bencode_buffer_t *buf, const struct json_token *tok) {
+	if (!tok->escaped)
+		return bencode_string_len(buf, tok->s.s, tok->s.len);
+	char *s = bencode_buffer_alloc(buf, tok->s.len);
+	if (!s)
 		return NULL;
-
-	JsonObjectIter iter;
-	json_object_iter_init(&iter, obj);
-	const char *key;
-	JsonNode *value;
-	while (json_object_iter_next(&iter, &key, &value)) {
-		if (!key || !value)
-			return NULL;
-		bencode_item_t *b_val = bencode_convert_json_node(buf, value);
-		if (!b_val)
-			return NULL;
-		bencode_dictionary_add(dict, key, b_val);
-	}
-	return dict;
+	size_t len = json_token_unescape(tok, s);
+	return bencode_string_len(buf, s, len);
 }
 
-static bencode_item_t *bencode_convert_json_array(bencode_buffer_t *buf, JsonNode *node) {
-	JsonArray *arr = json_node_get_array(node);
-	if (!arr)
-		return NULL;
-	bencode_item_t *list = bencode_list(buf);
-	if (!list)
+// dictionary with a lookup hash, same as produced by bencode_decode()
+static bencode_item_t *bencode_json_dictionary(bencode_buffer_t *buf) {
+	bencode_item_t *ret = __bencode_item_alloc(buf, sizeof(struct __bencode_hash));
+	if (!ret)
 		return NULL;
-	guint len = json_array_get_length(arr);
-	for (guint i = 0; i < len; i++) {
-		JsonNode *el = json_array_get_element(arr, i);
-		if (!el)
-			return NULL;
-		bencode_item_t *it = bencode_convert_json_node(buf, el);
-		if (!it)
-			return NULL;
-		bencode_list_add(list, it);
-	}
-	return list;
+	__bencode_dictionary_init(ret);
+	ret->value = 1;
+	memset(ret->__buf, 0, sizeof(struct __bencode_hash));
+	return ret;
 }
 
-static bencode_item_t *bencode_convert_json_value(bencode_buffer_t *buf, JsonNode *node) {
-	GType type = json_node_get_value_type(node);
-	switch (type) {
-		case G_TYPE_STRING:;
-			const char *s = json_node_get_string(node);
-			if (!s)
+bencode_item_t *bencode_decode_json(bencode_buffer_t *buf, const char *s, size_t len) {
+	struct json_tokenizer tok;
+	struct json_token t;
+	bencode_item_t *stack[JSON_MAX_DEPTH];
+	unsigned int depth = 0;
+	bencode_item_t *root = NULL;
+	bencode_item_t *key = NULL;
+
+	json_tokenizer_init(&tok, s, len);
+
+	while (true) {
+		bencode_item_t *item;
+
+		switch (json_tokenizer_next(&tok, &t)) {
+			case JSON_TOK_END:
+				return root;
+			case JSON_TOK_OBJECT_BEGIN:
+				item = bencode_json_dictionary(buf);
+				break;
+			case JSON_TOK_ARRAY_BEGIN:
+				item = bencode_list(buf);
+				break;
+			case JSON_TOK_OBJECT_END:
+			case JSON_TOK_ARRAY_END:
+				depth--;
+				continue;
+			case JSON_TOK_KEY:
+				key = bencode_json_string(buf, &t);
+				if (!key)
+					return NULL;
+				continue;
+			case JSON_TOK_STRING:
+				item = bencode_json_string(buf, &t);
+				break;
+			case JSON_TOK_INT:
+			case JSON_TOK_BOOL:
+				item = bencode_integer(buf, t.i);
+				break;
+			default:
+				// syntax error, or unsupported type
 				return NULL;
-			return bencode_string(buf, s);
-		case G_TYPE_INT:
-		case G_TYPE_UINT:
-		case G_TYPE_LONG:
-		case G_TYPE_ULONG:
-		case G_TYPE_INT64:
-		case G_TYPE_UINT64:
-		case G_TYPE_BOOLEAN:;
-			gint64 i = json_node_get_int(node);
-			return bencode_integer(buf, i);
-		// everything else is unsupported
-	}
-	return NULL;
-}
+		}
 
-static bencode_item_t *bencode_convert_json_node(bencode_buffer_t *buf, JsonNode *node) {
-	JsonNodeType type = json_node_get_node_type(node);
-	switch (type) {
-		case JSON_NODE_OBJECT:
-			return bencode_convert_json_dict(buf, node);
-		case JSON_NODE_ARRAY:
-			return bencode_convert_json_array(buf, node);
-		case JSON_NODE_VALUE:
-			return bencode_convert_json_value(buf, node);
-		default:
+		if (!item)
 			return NULL;
-	}
-}
 
-bencode_item_t *bencode_convert_json(bencode_buffer_t *buf, JsonParser *json) {
-	JsonNode *root = json_parser_get_root(json);
-	if (!root)
-		return NULL;
-	return bencode_convert_json_node(buf, root);
+		if (!depth)
+			root = item;
+		else if (stack[depth - 1]->type == BENCODE_DICTIONARY) {
+			__bencode_container_add(stack[depth - 1], key);
+			__bencode_container_add(stack[depth - 1], item);
+			__bencode_hash_insert(key, (void *) stack[depth - 1]->__buf);
+		}
+		else
+			__bencode_container_add(stack[depth - 1], item);
+
+		if (item->type == BENCODE_DICTIONARY || item->type == BENCODE_LIST)
+			stack[depth++] = item;
+	}
 }
 
 
 
-gboolean bencode_collapse_json_item(bencode_item_t *item, JsonBuilder *builder);
+static bool bencode_collapse_json_item(bencode_item_t *item, struct json_writer *w);
 
-gboolean bencode_collapse_json_list(bencode_item_t *item, JsonBuilder *builder) {
-	json_builder_begin_array(builder);
+static bool bencode_collapse_json_list(bencode_item_t *item, struct json_writer *w) {
+	json_writer_begin_array(w);
 	for (bencode_item_t *el = item->child; el; el = el->sibling) {
-		if (!bencode_collapse_json_item(el, builder))
-			return FALSE;
+		if (!bencode_collapse_json_item(el, w))
+			return false;
 	}
-	json_builder_end_array(builder);
-	return TRUE;
-}
-
-gboolean bencode_collapse_json_string(bencode_item_t *item, JsonBuilder *builder) {
-	char buf[item->iov[1].iov_len + 1];
-	memcpy(buf, item->iov[1].iov_base, item->iov[1].iov_len);
-	buf[item->iov[1].iov_len] = '\0';
-	json_builder_add_string_value(builder, buf);
-	return TRUE;
+	json_writer_end_array(w);
+	return true;
 }
 
-gboolean bencode_collapse_json_dict(bencode_item_t *item, JsonBuilder *builder) {
-	json_builder_begin_object(builder);
+static bool bencode_collapse_json_dict(bencode_item_t *item, struct json_writer *w) {
+	json_writer_begin_object(w);
 	bencode_item_t *val;
 	for (bencode_item_t *key = item->child; key; key = val->sibling) {
 		val = key->sibling;
 		if (key->type != BENCODE_STRING)
-			return FALSE;
-
-		char buf[key->iov[1].iov_len + 1];
-		memcpy(buf, key->iov[1].iov_base, key->iov[1].iov_len);
-		buf[key->iov[1].iov_len] = '\0';
+			return false;
 
-		json_builder_set_member_name(builder, buf);
+		json_writer_key_len(w, key->iov[1].iov_base, key->iov[1].iov_len);
 
-		if (!bencode_collapse_json_item(val, builder))
-			return FALSE;
+		if (!bencode_collapse_json_item(val, w))
+			return false;
 	}
-	json_builder_end_object(builder);
-	return TRUE;
-}
-
-gboolean bencode_collapse_json_int(bencode_item_t *item, JsonBuilder *builder) {
-	json_builder_add_int_value(builder, item->value);
-	return TRUE;
+	json_writer_end_object(w);
+	return true;
 }
 
-gboolean bencode_collapse_json_item(bencode_item_t *item, JsonBuilder *builder) {
+static bool bencode_collapse_json_item(bencode_item_t *item, struct json_writer *w) {
 	switch (item->type) {
 		case BENCODE_LIST:
-			return bencode_collapse_json_list(item, builder);
+			return bencode_collapse_json_list(item, w);
 		case BENCODE_STRING:
-			return bencode_collapse_json_string(item, builder);
+			json_writer_string_len(w, item->iov[1].iov_base, item->iov[1].iov_len);
+			return true;
 		case BENCODE_DICTIONARY:
-			return bencode_collapse_json_dict(item, builder);
+			return bencode_collapse_json_dict(item, w);
 		case BENCODE_INTEGER:
-			return bencode_collapse_json_int(item, builder);
+			json_writer_int(w, item->value);
+			return true;
 		default:
-			return FALSE;
+			return false;
 	}
 }
 
 str *bencode_collapse_str_json(bencode_item_t *root, str *out) {
-	JsonBuilder *builder = json_builder_new();
-	if (!bencode_collapse_json_item(root, builder))
+	struct json_writer *w = json_writer_new();
+	if (!bencode_collapse_json_item(root, w))
 		goto err;
-	char *result = glib_json_print(builder);
+	char *result = json_writer_finish(w);
 	out->s = result;
 	out->len = strlen(result);
 	bencode_buffer_destroy_add(root->buffer, free, result);
 	return out;
 
 err:
-	g_object_unref(builder);
+	json_writer_free(w);
 	return NULL;
 }
@@ -63,8 +63,7 @@ struct xmlrpc_helper {
 	GQueue			strings;
 };
 
-rwlock_t rtpe_callhash_lock;
-GHashTable *rtpe_callhash;
+struct callhash_shard rtpe_callhash[CALLHASH_SHARDS];
 struct call_iterator_list rtpe_call_iterators[NUM_CALL_ITERATORS];
 static struct mqtt_timer *global_mqtt_timer;
 
@@ -518,11 +517,18 @@ enum thread_looper_action call_timer() {
 #undef DS
 
 
+// the hash table within the shard uses the same hash, so the shard is picked from all bits
+INLINE struct callhash_shard *callhash_shard(const str *callid) {
+	return &rtpe_callhash[(str_hash(callid) * 0x9e3779b1u) >> (32 - CALLHASH_SHARD_BITS)];
+}
+
 int call_init() {
-	rtpe_callhash = g_hash_table_new(str_hash, str_equal);
-	if (!rtpe_callhash)
-		return -1;
-	rwlock_init(&rtpe_callhash_lock);
+	for (int i = 0; i < CALLHASH_SHARDS; i++) {
+		rtpe_callhash[i].ht = g_hash_table_new(str_hash, str_equal);
+		if (!rtpe_callhash[i].ht)
+			return -1;
+		rwlock_init(&rtpe_callhash[i].lock);
+	}
 
 	for (int i = 0; i < NUM_CALL_ITERATORS; i++)
 		mutex_init(&rtpe_call_iterators[i].lock);
@@ -581,22 +587,64 @@ static void __call_iterator_remove(struct call *c) {
 }
 void call_free(void) {
 	mqtt_timer_stop(&global_mqtt_timer);
-	GList *ll = g_hash_table_get_values(rtpe_callhash);
-	for (GList *l = ll; l; l = l->next) {
-		struct call *c = l->data;
-		__call_iterator_remove(c);
-		__call_cleanup(c);
-		obj_put(c);
+	for (int i = 0; i < CALLHASH_SHARDS; i++) {
+		GList *ll = g_hash_table_get_values(rtpe_callhash[i].ht);
+		for (GList *l = ll; l; l = l->next) {
+			struct call *c = l->data;
+			__call_iterator_remove(c);
+			__call_cleanup(c);
+			obj_put(c);
+		}
+		g_list_free(ll);
+		g_hash_table_destroy(rtpe_callhash[i].ht);
+		rtpe_callhash[i].ht = NULL;
 	}
-	g_list_free(ll);
-	g_hash_table_destroy(rtpe_callhash);
 }
 
 
 
+// out of line as statistics.h can't be relied upon to be fully included in call.h
+void *__call_malloc(struct call *c, size_t l) {
+	void *ret = call_buffer_alloc(&c->buffer, l);
+	c->mem_usage += l;
+	RTPE_GAUGE_ADD(call_memory, l);
+	return ret;
+}
+
+/* monologues, medias, streams and endpoint maps are carved out of larger chunks
+ * taken from the call buffer. they're never freed individually, so this saves one
+ * allocation per object and keeps each call's objects close together in memory. */
+#define CALL_ARENA_CHUNK	16384
+#define CALL_ARENA_ALIGN	16
+
+void *call_obj_alloc0(struct call *c, size_t l) {
+	void *ret;
+
+	l = (l + CALL_ARENA_ALIGN - 1) & ~((size_t) CALL_ARENA_ALIGN - 1);
+
+	mutex_lock(&c->buffer_lock);
+	if (l > CALL_ARENA_CHUNK / 4)
+		ret = __call_malloc(c, l);
+	else {
+		if (l > c->arena_left) {
+			c->arena = __call_malloc(c, CALL_ARENA_CHUNK + CALL_ARENA_ALIGN);
+			c->arena = (char *) (((uintptr_t) c->arena + CALL_ARENA_ALIGN - 1)
+					& ~((uintptr_t) CALL_ARENA_ALIGN - 1));
+			c->arena_left = CALL_ARENA_CHUNK;
+		}
+		ret = c->arena;
+		c->arena += l;
+		c->arena_left -= l;
+	}
+	mutex_unlock(&c->buffer_lock);
+
+	memset(ret, 0, l);
+	return ret;
+}
+
 struct call_media *call_media_new(struct call *call) {
 	struct call_media *med;
-	med = uid_slice_alloc0(med, &call->medias);
+	med = call_uid_alloc0(call, med, &call->medias);
 	med->call = call;
 	codec_store_init(&med->codecs, med);
 	med->media_subscribers_ht = g_hash_table_new(g_direct_hash, g_direct_equal);
@@ -616,7 +664,7 @@ static struct call_media *__get_media(struct call_monologue *ml, const struct st
 		// in this case, the media sections are out of order and the media ID
 		// string is used to determine which media section to operate on. this
 		// info must be present and valid.
-		med = g_hash_table_lookup(ml->media_ids, &sp->media_id);
+		med = lazy_str_ht_lookup(ml->media_ids, &sp->media_id);
 		if (med)
 			return med;
 		ilogs(ice, LOG_ERR, "Received trickle ICE SDP fragment with unknown media ID '"
@@ -773,7 +821,7 @@ static struct endpoint_map *__get_endpoint_map(struct call_media *media, unsigne
 	}
 	else {
 		__C_DBG("allocating new %sendpoint map", ep ? "" : "wildcard ");
-		em = uid_slice_alloc0(em, &media->call->endpoint_maps);
+		em = call_uid_alloc0(media->call, em, &media->call->endpoint_maps);
 		if (ep)
 			em->endpoint = *ep;
 		else
@@ -889,7 +937,7 @@ static void __rtp_stats_free(void *p) {
 struct packet_stream *__packet_stream_new(struct call *call) {
 	struct packet_stream *stream;
 
-	stream = uid_slice_alloc0(stream, &call->streams);
+	stream = call_uid_alloc0(call, stream, &call->streams);
 	mutex_init(&stream->in_lock);
 	mutex_init(&stream->out_lock);
 	stream->call = call;
@@ -2193,7 +2241,7 @@ static void __update_media_id(struct call_media *media, struct call_media *other
 			if (sp->media_id.s)
 				call_str_cpy(call, &other_media->media_id, &sp->media_id);
 			if (other_media->media_id.s)
-				g_hash_table_insert(other_ml->media_ids, &other_media->media_id,
+				lazy_str_ht_insert(&other_ml->media_ids, &other_media->media_id,
 						other_media);
 		}
 		else {
@@ -2202,9 +2250,9 @@ static void __update_media_id(struct call_media *media, struct call_media *other
 			if (sp->media_id.s) {
 				if (str_cmp_str(&other_media->media_id, &sp->media_id)) {
 					// mismatch - update
-					g_hash_table_remove(other_ml->media_ids, &other_media->media_id);
+					lazy_str_ht_remove(other_ml->media_ids, &other_media->media_id);
 					call_str_cpy(call, &other_media->media_id, &sp->media_id);
-					g_hash_table_insert(other_ml->media_ids, &other_media->media_id,
+					lazy_str_ht_insert(&other_ml->media_ids, &other_media->media_id,
 							other_media);
 				}
 			}
@@ -2225,7 +2273,7 @@ static void __update_media_id(struct call_media *media, struct call_media *other
 				call_str_cpy_c(call, &media->media_id, buf);
 			}
 			if (media->media_id.s)
-				g_hash_table_insert(ml->media_ids, &media->media_id, media);
+				lazy_str_ht_insert(&ml->media_ids, &media->media_id, media);
 		}
 		else {
 			// we already have a media ID. keep what we have and ignore what's
@@ -2593,7 +2641,7 @@ static void __call_monologue_init_from_flags(struct call_monologue *ml, struct s
 
 	if (flags && flags->label.s) {
 		call_str_cpy(call, &ml->label, &flags->label);
-		g_hash_table_replace(call->labels, &ml->label, ml);
+		lazy_str_ht_replace(&call->labels, &ml->label, ml);
 	}
 
 }
@@ -3249,7 +3297,7 @@ static void __subscribe_matched_medias(struct call_monologue * a_ml, struct call
 
 		/* first try matching based on media_id */
 		if (a_media->media_id.s) {
-			b_media = g_hash_table_lookup(b_ml->media_ids, &a_media->media_id);
+			b_media = lazy_str_ht_lookup(b_ml->media_ids, &a_media->media_id);
 			if (b_media) {
 				__subscribe_medias_both_ways(a_media, b_media);
 				continue; /* we found a matched one, go ahead to another one */
@@ -3692,18 +3740,19 @@ void call_destroy(struct call *c) {
 		return;
 	}
 
-	rwlock_lock_w(&rtpe_callhash_lock);
+	struct callhash_shard *shard = callhash_shard(&c->callid);
+	rwlock_lock_w(&shard->lock);
 	struct call *call_ht = NULL;
-	g_hash_table_steal_extended(rtpe_callhash, &c->callid, NULL, (void **) &call_ht);
+	g_hash_table_steal_extended(shard->ht, &c->callid, NULL, (void **) &call_ht);
 	if (call_ht) {
 		if (call_ht != c) {
-			g_hash_table_insert(rtpe_callhash, &call_ht->callid, call_ht);
+			g_hash_table_insert(shard->ht, &call_ht->callid, call_ht);
 			call_ht = NULL;
 		}
 		else
 			RTPE_GAUGE_DEC(total_sessions);
 	}
-	rwlock_unlock_w(&rtpe_callhash_lock);
+	rwlock_unlock_w(&shard->lock);
 
 	// if call not found in callhash => previously deleted
 	if (!call_ht)
@@ -3815,7 +3864,7 @@ void call_destroy(struct call *c) {
 			}
 		}
 
-		k = g_hash_table_get_values(ml->ssrc_hash->ht);
+		k = g_list_copy(ml->ssrc_hash->q.head);
 		while (k) {
 			struct ssrc_entry_call *se = k->data;
 
@@ -3933,7 +3982,6 @@ void call_media_free(struct call_media **mdp) {
 	g_queue_clear_full(&md->media_subscribers, media_subscription_free);
 	g_queue_clear_full(&md->media_subscriptions, media_subscription_free);
 	mutex_destroy(&md->dtmf_lock);
-	g_slice_free1(sizeof(*md), md);
 	*mdp = NULL;
 }
 
@@ -3944,7 +3992,7 @@ void call_subscription_free(void *p) {
 void __monologue_free(struct call_monologue *m) {
 	g_ptr_array_free(m->medias, true);
 	g_hash_table_destroy(m->associated_tags);
-	g_hash_table_destroy(m->media_ids);
+	lazy_str_ht_destroy(&m->media_ids);
 	free_ssrc_hash(&m->ssrc_hash);
 	if (m->last_out_sdp)
 		g_string_free(m->last_out_sdp, TRUE);
@@ -3955,7 +4003,6 @@ void __monologue_free(struct call_monologue *m) {
 	g_hash_table_destroy(m->subscriptions_ht);
 	g_queue_clear_full(&m->subscribers, call_subscription_free);
 	g_queue_clear_full(&m->subscriptions, call_subscription_free);
-	g_slice_free1(sizeof(*m), m);
 }
 
 static void __call_free(void *p) {
@@ -3985,12 +4032,11 @@ static void __call_free(void *p) {
 		em = g_queue_pop_head(&c->endpoint_maps);
 
 		g_queue_clear_full(&em->intf_sfds, (void *) free_intf_list);
-		g_slice_free1(sizeof(*em), em);
 	}
 
 	g_hash_table_destroy(c->tags);
-	g_hash_table_destroy(c->viabranches);
-	g_hash_table_destroy(c->labels);
+	lazy_str_ht_destroy(&c->viabranches);
+	lazy_str_ht_destroy(&c->labels);
 
 	while (c->streams.head) {
 		ps = g_queue_pop_head(&c->streams);
@@ -4001,9 +4047,9 @@ static void __call_free(void *p) {
 			ssrc_ctx_put(&ps->ssrc_in[u]);
 		for (unsigned int u = 0; u < G_N_ELEMENTS(ps->ssrc_out); u++)
 			ssrc_ctx_put(&ps->ssrc_out[u]);
-		g_slice_free1(sizeof(*ps), ps);
 	}
 
+	RTPE_GAUGE_ADD(call_memory, -c->mem_usage);
 	call_buffer_free(&c->buffer);
 	mutex_destroy(&c->buffer_lock);
 	rwlock_destroy(&c->master_lock);
@@ -4020,8 +4066,6 @@ static struct call *call_create(const str *callid) {
 	call_buffer_init(&c->buffer);
 	rwlock_init(&c->master_lock);
 	c->tags = g_hash_table_new(str_hash, str_equal);
-	c->viabranches = g_hash_table_new(str_hash, str_equal);
-	c->labels = g_hash_table_new(str_hash, str_equal);
 	call_str_cpy(c, &c->callid, callid);
 	c->created = rtpe_now;
 	c->dtls_cert = dtls_cert();
@@ -4042,26 +4086,27 @@ static struct call *call_create(const str *callid) {
 /* returns call with master_lock held in W */
 struct call *call_get_or_create(const str *callid, bool exclusive) {
 	struct call *c;
+	struct callhash_shard *shard = callhash_shard(callid);
 
 restart:
-	rwlock_lock_r(&rtpe_callhash_lock);
-	c = g_hash_table_lookup(rtpe_callhash, callid);
+	rwlock_lock_r(&shard->lock);
+	c = g_hash_table_lookup(shard->ht, callid);
 	if (!c) {
-		rwlock_unlock_r(&rtpe_callhash_lock);
+		rwlock_unlock_r(&shard->lock);
 		/* completely new call-id, create call */
 		c = call_create(callid);
-		rwlock_lock_w(&rtpe_callhash_lock);
-		if (g_hash_table_lookup(rtpe_callhash, callid)) {
+		rwlock_lock_w(&shard->lock);
+		if (g_hash_table_lookup(shard->ht, callid)) {
 			/* preempted */
-			rwlock_unlock_w(&rtpe_callhash_lock);
+			rwlock_unlock_w(&shard->lock);
 			obj_put(c);
 			goto restart;
 		}
-		g_hash_table_insert(rtpe_callhash, &c->callid, obj_get(c));
+		g_hash_table_insert(shard->ht, &c->callid, obj_get(c));
 		RTPE_GAUGE_INC(total_sessions);
 
 		rwlock_lock_w(&c->master_lock);
-		rwlock_unlock_w(&rtpe_callhash_lock);
+		rwlock_unlock_w(&shard->lock);
 
 		for (int i = 0; i < NUM_CALL_ITERATORS; i++) {
 			c->iterator[i].link.data = obj_get(c);
@@ -4100,7 +4145,7 @@ restart:
 			obj_hold(c);
 			rwlock_lock_w(&c->master_lock);
 		}
-		rwlock_unlock_r(&rtpe_callhash_lock);
+		rwlock_unlock_r(&shard->lock);
 	}
 
 	if (c)
@@ -4119,17 +4164,18 @@ restart:
  */
 struct call *call_get(const str *callid) {
 	struct call *ret;
+	struct callhash_shard *shard = callhash_shard(callid);
 
-	rwlock_lock_r(&rtpe_callhash_lock);
-	ret = g_hash_table_lookup(rtpe_callhash, callid);
+	rwlock_lock_r(&shard->lock);
+	ret = g_hash_table_lookup(shard->ht, callid);
 	if (!ret) {
-		rwlock_unlock_r(&rtpe_callhash_lock);
+		rwlock_unlock_r(&shard->lock);
 		return NULL;
 	}
 
 	rwlock_lock_w(&ret->master_lock);
 	obj_hold(ret);
-	rwlock_unlock_r(&rtpe_callhash_lock);
+	rwlock_unlock_r(&shard->lock);
 
 	log_info_call(ret);
 	return ret;
@@ -4154,13 +4200,12 @@ struct call_monologue *__monologue_create(struct call *call) {
 	struct call_monologue *ret;
 
 	__C_DBG("creating new monologue");
-	ret = uid_slice_alloc0(ret, &call->monologues);
+	ret = call_uid_alloc0(call, ret, &call->monologues);
 
 	ret->call = call;
 	ret->created = rtpe_now.tv_sec;
 	ret->associated_tags = g_hash_table_new(g_direct_hash, g_direct_equal);
 	ret->medias = g_ptr_array_new();
-	ret->media_ids = g_hash_table_new(str_hash, str_equal);
 	ret->ssrc_hash = create_ssrc_hash_call();
 	ret->subscribers_ht = g_hash_table_new(g_direct_hash, g_direct_equal);
 	ret->subscriptions_ht = g_hash_table_new(g_direct_hash, g_direct_equal);
@@ -4195,9 +4240,9 @@ void __monologue_viabranch(struct call_monologue *ml, const str *viabranch) {
 
 	__C_DBG("tagging monologue with viabranch '"STR_FORMAT"'", STR_FMT(viabranch));
 	if (ml->viabranch.s)
-		g_hash_table_remove(call->viabranches, &ml->viabranch);
+		lazy_str_ht_remove(call->viabranches, &ml->viabranch);
 	call_str_cpy(call, &ml->viabranch, viabranch);
-	g_hash_table_insert(call->viabranches, &ml->viabranch, ml);
+	lazy_str_ht_insert(&call->viabranches, &ml->viabranch, ml);
 }
 
 static void __unconfirm_sinks(GQueue *q, const char *reason) {
@@ -4291,7 +4336,7 @@ void monologue_destroy(struct call_monologue *monologue) {
 
 	g_hash_table_remove(call->tags, &monologue->tag);
 	if (monologue->viabranch.s)
-		g_hash_table_remove(call->viabranches, &monologue->viabranch);
+		lazy_str_ht_remove(call->viabranches, &monologue->viabranch);
 
 	// close sockets
 	for (unsigned int i = 0; i < monologue->medias->len; i++) {
@@ -4559,7 +4604,7 @@ static int call_get_monologue_new(struct call_monologue *monologues[2], struct c
 		/* dialogue still intact */
 		goto monologues_intact;
 	} else {
-		os = g_hash_table_lookup(call->viabranches, viabranch);
+		os = lazy_str_ht_lookup(call->viabranches, viabranch);
 		if (os) {
 			/* previously seen branch. use it */
 			__monologue_unkernelize(os, "dialogue/branch association changed");
@@ -4660,7 +4705,7 @@ static int call_get_dialogue(struct call_monologue *monologues[2], struct call *
 	else {
 		/* perhaps we can determine the monologue from the viabranch */
 		if (viabranch)
-			ft = g_hash_table_lookup(call->viabranches, viabranch);
+			ft = lazy_str_ht_lookup(call->viabranches, viabranch);
 	}
 
 	if (!ft) {
@@ -4759,7 +4804,7 @@ int call_delete_branch(struct call *c, const str *branch,
 
 	if ((!totag || !totag->len) && branch && branch->len) {
 		// try a via-branch match
-		ml = g_hash_table_lookup(c->viabranches, branch);
+		ml = lazy_str_ht_lookup(c->viabranches, branch);
 		if (ml)
 			goto do_delete;
 	}
@@ -4770,7 +4815,7 @@ int call_delete_branch(struct call *c, const str *branch,
 	if (!ml) {
 		if (branch && branch->len) {
 			// also try a via-branch match here
-			ml = g_hash_table_lookup(c->viabranches, branch);
+			ml = lazy_str_ht_lookup(c->viabranches, branch);
 			if (ml)
 				goto do_delete;
 		}
@@ -449,11 +449,9 @@ static void call_status_iterator(struct call *c, struct streambuf_stream *s) {
 }
 
 void calls_status_tcp(struct streambuf_stream *s) {
-	rwlock_lock_r(&rtpe_callhash_lock);
 	streambuf_printf(s->outbuf, "proxy %u "UINT64F"/%i/%i\n",
-		g_hash_table_size(rtpe_callhash),
+		(unsigned int) atomic64_get(&rtpe_stats_gauge.total_sessions),
 		atomic64_get(&rtpe_stats_rate.bytes_user) + atomic64_get(&rtpe_stats_rate.bytes_kernel), 0, 0);
-	rwlock_unlock_r(&rtpe_callhash_lock);
 
 	ITERATE_CALL_LIST_START(CALL_ITERATOR_MAIN, c);
 		call_status_iterator(c, s);
@@ -1886,13 +1884,59 @@ void call_ng_free_flags(struct sdp_ng_flags *flags) {
 	ng_sdp_attr_manipulations_free(flags->sdp_manipulations);
 }
 
-static enum load_limit_reasons call_offer_session_limit(void) {
+// projects the occupancy of each class of worker threads with the new session added to it,
+// assuming 20 ms packets in both directions of each stream. plain forwarding is charged at the
+// measured per-packet latency of the poller threads, transcoding at the estimated cost of the
+// most expensive codec requested, to the codec worker threads if there are any
+static enum load_limit_reasons call_offer_thread_limit(const struct sdp_ng_flags *flags, GQueue *streams) {
+	long long pps = 2 * 50 * MAX(streams->length, 1);
+	long long work_ns[__THREAD_LOAD_TYPES] = {0,};
+
+	work_ns[THREAD_LOAD_POLLER] = pps * g_atomic_int_get(&thread_load_stats[THREAD_LOAD_POLLER].latency_ns);
+
+	// without codec threads, transcoding runs in the pollers and is already part of their
+	// latency. only with codec threads is it separate work that needs estimating
+	if (rtpe_config.codec_threads > 0) {
+		long long codec_ns = 0;
+		for (GList *l = flags->codec_transcode.head; l; l = l->next)
+			codec_ns = MAX(codec_ns, codec_cost_estimate(l->data));
+		work_ns[THREAD_LOAD_CODEC] = pps * codec_ns;
+	}
+
+	for (unsigned int t = 0; t < __THREAD_LOAD_TYPES; t++) {
+		int threads = g_atomic_int_get(&thread_load_stats[t].threads);
+		if (t == THREAD_LOAD_CODEC && !threads)
+			threads = rtpe_config.codec_threads; // not started up yet
+		if (!threads)
+			continue;
+		// ns per second to percent times 100
+		long long occupancy;
+		if (t == THREAD_LOAD_CODEC) {
+			// a handler's packets always go to the same worker, so any single
+			// one of them must be able to take the new call
+			occupancy = g_atomic_int_get(&thread_load_stats[t].occupancy_max)
+				+ work_ns[t] / 100000;
+		}
+		else
+			occupancy = g_atomic_int_get(&thread_load_stats[t].occupancy)
+				+ work_ns[t] / 100000 / threads;
+		if (occupancy >= rtpe_config.thread_load_limit) {
+			ilog(LOG_WARN, "Thread occupancy limit exceeded (%s threads projected at %.1f%% > %.1f%%)",
+					thread_load_type_names[t],
+					(double) occupancy / 100.0, (double) rtpe_config.thread_load_limit / 100.0);
+			return LOAD_LIMIT_THREADS;
+		}
+	}
+
+	return LOAD_LIMIT_NONE;
+}
+
+static enum load_limit_reasons call_offer_session_limit(const struct sdp_ng_flags *flags, GQueue *streams) {
 	enum load_limit_reasons ret = LOAD_LIMIT_NONE;
 
 	rwlock_lock_r(&rtpe_config.config_lock);
 	if (rtpe_config.max_sessions>=0) {
-		rwlock_lock_r(&rtpe_callhash_lock);
-		if (g_hash_table_size(rtpe_callhash) -
+		if (atomic64_get(&rtpe_stats_gauge.total_sessions) -
 				atomic64_get(&rtpe_stats_gauge.foreign_sessions) >= rtpe_config.max_sessions)
 		{
 			/* foreign calls can't get rejected
@@ -1902,7 +1946,6 @@ static enum load_limit_reasons call_offer_session_limit(void) {
 
 			ret = LOAD_LIMIT_MAX_SESSIONS;
 		}
-		rwlock_unlock_r(&rtpe_callhash_lock);
 	}
 
 	if (ret == LOAD_LIMIT_NONE && rtpe_config.load_limit) {
@@ -1933,6 +1976,9 @@ static enum load_limit_reasons call_offer_session_limit(void) {
 		}
 	}
 
+	if (ret == LOAD_LIMIT_NONE && rtpe_config.thread_load_limit)
+		ret = call_offer_thread_limit(flags, streams);
+
 	rwlock_unlock_r(&rtpe_config.config_lock);
 
 	return ret;
@@ -2010,7 +2056,7 @@ static const char *call_offer_answer_ng(struct ng_buffer *ngbuf, bencode_item_t
 	}
 
 	if (opmode == OP_OFFER && !call) {
-		enum load_limit_reasons limit = call_offer_session_limit();
+		enum load_limit_reasons limit = call_offer_session_limit(&flags, &streams);
 		if (limit != LOAD_LIMIT_NONE) {
 			if (!flags.supports_load_limit)
 				errstr = "Parallel session limit reached"; // legacy protocol
@@ -2416,7 +2462,7 @@ static void ng_stats_ssrc_mos_entry_dict_avg(bencode_item_t *ent, const char *la
 }
 
 static void ng_stats_ssrc(bencode_item_t *dict, struct ssrc_hash *ht) {
-	GList *ll = g_hash_table_get_values(ht->ht);
+	GList *ll = g_list_copy(ht->q.head);
 
 	for (GList *l = ll; l; l = l->next) {
 		struct ssrc_entry_call *se = l->data;
@@ -2485,6 +2531,9 @@ void ng_call_stats(struct call *call, const str *fromtag, const str *totag, benc
 	bencode_dictionary_add_integer(output, "created", call->created.tv_sec);
 	bencode_dictionary_add_integer(output, "created_us", call->created.tv_usec);
 	bencode_dictionary_add_integer(output, "last signal", call->last_signal);
+	mutex_lock(&call->buffer_lock);
+	bencode_dictionary_add_integer(output, "memory", call->mem_usage);
+	mutex_unlock(&call->buffer_lock);
 	ssrc = bencode_dictionary_add_dictionary(output, "SSRC");
 
 	tags = bencode_dictionary_add_dictionary(output, "tags");
@@ -2535,14 +2584,19 @@ static void ng_list_calls(bencode_item_t *output, long long int limit) {
 	GHashTableIter iter;
 	gpointer key, value;
 
-	rwlock_lock_r(&rtpe_callhash_lock);
+	for (int i = 0; i < CALLHASH_SHARDS && limit; i++) {
+		struct callhash_shard *shard = &rtpe_callhash[i];
 
-	g_hash_table_iter_init (&iter, rtpe_callhash);
-	while (limit-- && g_hash_table_iter_next (&iter, &key, &value)) {
-		bencode_list_add_str_dup(output, key);
-	}
+		rwlock_lock_r(&shard->lock);
+
+		g_hash_table_iter_init (&iter, shard->ht);
+		while (limit && g_hash_table_iter_next (&iter, &key, &value)) {
+			bencode_list_add_str_dup(output, key);
+			limit--;
+		}
 
-	rwlock_unlock_r(&rtpe_callhash_lock);
+		rwlock_unlock_r(&shard->lock);
+	}
 }
 
 
@@ -2678,7 +2732,7 @@ static const char *media_block_match1(struct call *call, struct call_monologue *
 		struct sdp_ng_flags *flags)
 {
 	if (flags->label.s) {
-		*monologue = g_hash_table_lookup(call->labels, &flags->label);
+		*monologue = lazy_str_ht_lookup(call->labels, &flags->label);
 		if (!*monologue)
 			return "No monologue matching the given label";
 	}
@@ -2741,7 +2795,7 @@ static const char *media_block_match(struct call **call, struct call_monologue *
 	// for generic ops, handle set-label here if given
 	if (opmode == OP_OTHER && flags->set_label.len && *monologue) {
 		call_str_cpy(*call, &(*monologue)->label, &flags->set_label);
-		g_hash_table_replace((*call)->labels, &(*monologue)->label, *monologue);
+		lazy_str_ht_replace(&(*call)->labels, &(*monologue)->label, *monologue);
 	}
 
 	return NULL;
@@ -3035,7 +3089,7 @@ static const char *call_block_silence_media(bencode_item_t *input, bool on_off,
 			g_queue_push_tail(&sinks, sink);
 		}
 		else if (flags.to_label.len) {
-			struct call_monologue *sink = g_hash_table_lookup(call->labels, &flags.to_label);
+			struct call_monologue *sink = lazy_str_ht_lookup(call->labels, &flags.to_label);
 			if (!sink) {
 				ilog(LOG_WARN, "Media flow '" STR_FORMAT_M "' -> label '" STR_FORMAT "' doesn't "
 						"exist for media %s (to-label not found)",
@@ -410,6 +410,7 @@ static void cli_incoming_diff_or_revert(struct cli_writer *cw, char* option) {
 	rwlock_lock_w(&rtpe_config.config_lock);
 	int_diff_print(max_sessions, "max-sessions");
 	int_diff_print(cpu_limit, "max-cpu");
+	int_diff_print(thread_load_limit, "max-thread-load");
 	int_diff_print(load_limit, "max-load");
 	int_diff_print(bw_limit, "max-bw");
 	int_diff_print(timeout, "timeout");
@@ -478,11 +479,10 @@ static void cli_incoming_list_totals(str *instr, struct cli_writer *cw) {
 }
 
 static void cli_incoming_list_numsessions(str *instr, struct cli_writer *cw) {
-       rwlock_lock_r(&rtpe_callhash_lock);
-       cw->cw_printf(cw, "Current sessions own: "UINT64F"\n", g_hash_table_size(rtpe_callhash) - atomic64_get(&rtpe_stats_gauge.foreign_sessions));
+       uint64_t total = atomic64_get(&rtpe_stats_gauge.total_sessions);
+       cw->cw_printf(cw, "Current sessions own: "UINT64F"\n", total - atomic64_get(&rtpe_stats_gauge.foreign_sessions));
        cw->cw_printf(cw, "Current sessions foreign: "UINT64F"\n", atomic64_get(&rtpe_stats_gauge.foreign_sessions));
-       cw->cw_printf(cw, "Current sessions total: %i\n", g_hash_table_size(rtpe_callhash));
-       rwlock_unlock_r(&rtpe_callhash_lock);
+       cw->cw_printf(cw, "Current sessions total: %i\n", (int) total);
        cw->cw_printf(cw, "Current transcoded media: "UINT64F"\n", atomic64_get(&rtpe_stats_gauge.transcoded_media));
        cw->cw_printf(cw, "Current sessions ipv4 only media: " UINT64F "\n",
 		       atomic64_get(&rtpe_stats_gauge.ipv4_sessions));
@@ -490,6 +490,8 @@ static void cli_incoming_list_numsessions(str *instr, struct cli_writer *cw) {
 		       atomic64_get(&rtpe_stats_gauge.ipv6_sessions));
        cw->cw_printf(cw, "Current sessions ip mixed  media: " UINT64F "\n",
 		       atomic64_get(&rtpe_stats_gauge.mixed_sessions));
+       cw->cw_printf(cw, "Current call memory: " UINT64F " bytes\n",
+		       atomic64_get(&rtpe_stats_gauge.call_memory));
 }
 
 static void cli_incoming_list_maxsessions(str *instr, struct cli_writer *cw) {
@@ -18,6 +18,8 @@
 #include "log_funcs.h"
 #include "mqtt.h"
 #include "audio_player.h"
+#include "load.h"
+#include "rtpengine_g711.h"
 #ifdef WITH_TRANSCODING
 #include "fix_frame_channel_layout.h"
 #endif
@@ -35,6 +37,7 @@ struct mqtt_timer {
 	struct mqtt_timer **self;
 	struct call *call;
 	struct call_media *media;
+	long long interval_us;
 };
 struct timer_callback {
 	struct codec_timer ct;
@@ -95,12 +98,7 @@ static GList *__codec_store_delete_link(GList *link, struct codec_store *cs) {
 #ifdef WITH_TRANSCODING
 
 
-#include <spandsp/telephony.h>
-#include <spandsp/super_tone_rx.h>
-#include <spandsp/logging.h>
-#include <spandsp/dtmf.h>
 #include "resample.h"
-#include "dtmf_rx_fillin.h"
 
 
 
@@ -130,6 +128,18 @@ struct dtx_packet {
 			struct transcode_packet *packet, struct media_packet *mp);
 };
 
+// transcoding offloaded from the media threads. each worker runs a single thread, and all
+// packets for one input SSRC handler go to the same worker, so they're processed in order
+struct codec_worker {
+	GThreadPool *pool;
+	struct codec_worker_stats *stats;
+};
+struct codec_worker_job {
+	struct dtx_packet *dtxp;
+	long long queued; // monotonic us
+};
+static struct codec_worker *codec_workers;
+
 typedef int (*encoder_input_func_t)(encoder_t *enc, AVFrame *frame,
 		int (*callback)(encoder_t *, void *u1, void *u2), void *u1, void *u2);
 typedef int (*packet_input_func_t)(struct codec_ssrc_handler *ch, struct codec_ssrc_handler *input_ch,
@@ -163,11 +173,6 @@ struct delay_frame {
 	int seq_adj;
 };
 
-struct silence_event {
-	uint64_t start;
-	uint64_t end;
-};
-
 struct codec_ssrc_handler {
 	struct ssrc_entry h; // must be first
 	struct codec_handler *handler;
@@ -183,7 +188,7 @@ struct codec_ssrc_handler {
 	struct dtx_buffer *dtx_buffer;
 
 	// DTMF DSP stuff
-	dtmf_rx_state_t *dtmf_dsp;
+	struct dtmf_detect *dtmf_dsp;
 	resample_t dtmf_resampler;
 	format_t dtmf_format;
 	uint64_t dtmf_ts, last_dtmf_event_ts;
@@ -192,7 +197,7 @@ struct codec_ssrc_handler {
 	struct dtmf_event dtmf_state; // state tracker for DTMF actions
 
 	// silence detection
-	GQueue silence_events;
+	struct silence_ring silence_events;
 
 	// DTMF audio suppression
 	unsigned long dtmf_start_ts;
@@ -202,6 +207,9 @@ struct codec_ssrc_handler {
 	uint64_t skip_pts;
 
 	unsigned int rtp_mark:1;
+
+	// set with the call locked in W: pending codec worker jobs are discarded
+	bool stopped;
 };
 struct transcode_packet {
 	seq_packet_t p; // must be first
@@ -231,6 +239,7 @@ struct rtcp_timer {
 
 
 static codec_handler_func handler_func_passthrough_ssrc;
+static codec_handler_func handler_func_g711;
 static codec_handler_func handler_func_transcode;
 static codec_handler_func handler_func_playback;
 static codec_handler_func handler_func_inject_dtmf;
@@ -260,6 +269,12 @@ static int __buffer_dtx(struct dtx_buffer *dtxb, struct codec_ssrc_handler *ch,
 		int (*dtx_func)(struct codec_ssrc_handler *ch, struct codec_ssrc_handler *input_ch,
 			struct transcode_packet *packet,
 			struct media_packet *mp));
+static bool __codec_worker_push(struct codec_ssrc_handler *decoder_handler,
+		struct codec_ssrc_handler *input_handler,
+		struct transcode_packet *packet, struct media_packet *mp,
+		int (*func)(struct codec_ssrc_handler *ch, struct codec_ssrc_handler *input_ch,
+			struct transcode_packet *packet,
+			struct media_packet *mp));
 static void __dtx_shutdown(struct dtx_buffer *dtxb);
 static struct codec_handler *__input_handler(struct codec_handler *h, struct media_packet *mp);
 
@@ -301,6 +316,7 @@ static void __handler_shutdown(struct codec_handler *handler) {
 		obj_put(&handler->ssrc_handler->h);
 	handler->ssrc_handler = NULL;
 	handler->kernelize = 0;
+	handler->kernel_transcode = RTPE_PT_PASSTHROUGH;
 	handler->transcoder = 0;
 	handler->output_handler = handler; // reset to default
 	handler->packet_decoded = packet_decoded_fifo;
@@ -504,6 +520,50 @@ static void __make_transcoder(struct codec_handler *handler, struct rtp_payload_
 	__make_transcoder_full(handler, dest, output_transcoders, dtmf_payload_type, pcm_dtmf_detect,
 			cn_payload_type, packet_decoded_fifo, __ssrc_handler_transcode_new);
 }
+// A-law <> u-law can be done with a table lookup per byte, which the kernel module can do too.
+// Only used if nothing else that needs a full transcoder is requested.
+static enum rtpengine_pt_transcode __g711_transcode_mode(struct codec_handler *handler,
+		const struct rtp_payload_type *dest)
+{
+	const struct rtp_payload_type *src = &handler->source_pt;
+
+	if (src->clock_rate != 8000 || dest->clock_rate != 8000)
+		return RTPE_PT_PASSTHROUGH;
+	if (src->channels != 1 || dest->channels != 1)
+		return RTPE_PT_PASSTHROUGH;
+	if (src->ptime && dest->ptime && src->ptime != dest->ptime)
+		return RTPE_PT_PASSTHROUGH;
+	if (handler->media->buffer_delay || rtpe_config.dtx_delay)
+		return RTPE_PT_PASSTHROUGH;
+	if (!src->codec_def || !dest->codec_def)
+		return RTPE_PT_PASSTHROUGH;
+	if (src->codec_def->avcodec_id == AV_CODEC_ID_PCM_ALAW
+			&& dest->codec_def->avcodec_id == AV_CODEC_ID_PCM_MULAW)
+		return RTPE_PT_ALAW_TO_ULAW;
+	if (src->codec_def->avcodec_id == AV_CODEC_ID_PCM_MULAW
+			&& dest->codec_def->avcodec_id == AV_CODEC_ID_PCM_ALAW)
+		return RTPE_PT_ULAW_TO_ALAW;
+	return RTPE_PT_PASSTHROUGH;
+}
+static void __make_g711_converter(struct codec_handler *handler, struct rtp_payload_type *dest,
+		enum rtpengine_pt_transcode mode)
+{
+	if (handler->handler_func == handler_func_g711 && handler->kernel_transcode == mode
+			&& rtp_payload_type_eq_exact(dest, &handler->dest_pt))
+		return;
+
+	__handler_shutdown(handler);
+	ilogs(codec, LOG_DEBUG, "Using G.711 converter for " STR_FORMAT " (%i) -> " STR_FORMAT " (%i)",
+			STR_FMT(&handler->source_pt.encoding_with_params),
+			handler->source_pt.payload_type,
+			STR_FMT(&dest->encoding_with_params),
+			dest->payload_type);
+	rtp_payload_type_copy(&handler->dest_pt, dest);
+	handler->handler_func = handler_func_g711;
+	handler->kernel_transcode = mode;
+	handler->kernelize = 1;
+	handler->ssrc_hash = create_ssrc_hash_full(__ssrc_handler_new, handler);
+}
 static void __make_audio_player_decoder(struct codec_handler *handler, struct rtp_payload_type *dest,
 		bool pcm_dtmf_detect)
 {
@@ -1359,7 +1419,14 @@ transcode:
 			}
 		}
 		is_transcoding = true;
-		if (!use_audio_player)
+		enum rtpengine_pt_transcode g711_mode = RTPE_PT_PASSTHROUGH;
+		if (!use_audio_player && !recv_dtmf_pt && !recv_cn_pt && !sink_dtmf_pt && !sink_cn_pt
+				&& !pcm_dtmf_detect && !do_pcm_dtmf_blocking && !do_dtmf_blocking
+				&& !ML_ISSET(sink->monologue, INJECT_DTMF))
+			g711_mode = __g711_transcode_mode(handler, sink_pt);
+		if (g711_mode != RTPE_PT_PASSTHROUGH)
+			__make_g711_converter(handler, sink_pt, g711_mode);
+		else if (!use_audio_player)
 			__make_transcoder(handler, sink_pt, output_transcoders,
 					sink_dtmf_pt ? sink_dtmf_pt->payload_type : -1,
 					pcm_dtmf_detect, sink_cn_pt ? sink_cn_pt->payload_type : -1);
@@ -1536,7 +1603,7 @@ static void __mqtt_timer_run_summary(struct codec_timer *ct) {
 	mqtt_timer_run_summary();
 }
 static void __codec_mqtt_timer_schedule(struct mqtt_timer *mqt) {
-	timeval_add_usec(&mqt->ct.next, rtpe_config.mqtt_publish_interval * 1000);
+	timeval_add_usec(&mqt->ct.next, mqt->interval_us);
 	timerthread_obj_schedule_abs(&mqt->ct.tt_obj, &mqt->ct.next);
 }
 // master lock held in W
@@ -1550,6 +1617,7 @@ void mqtt_timer_start(struct mqtt_timer **mqtp, struct call *call, struct call_m
 	mqt->self = mqtp;
 	mqt->media = media;
 	mqt->ct.next = rtpe_now;
+	mqt->interval_us = rtpe_config.mqtt_publish_interval * 1000LL;
 
 	if (media)
 		mqt->ct.timer_func = __mqtt_timer_run_media;
@@ -1557,10 +1625,21 @@ void mqtt_timer_start(struct mqtt_timer **mqtp, struct call *call, struct call_m
 		mqt->ct.timer_func = __mqtt_timer_run_call;
 	else {
 		// global or summary
-		mqt->ct.timer_func = mqtt_publish_scope() == MPS_GLOBAL
-			? __mqtt_timer_run_global : __mqtt_timer_run_summary;
+		if (mqtt_publish_scope() == MPS_GLOBAL) {
+			mqt->ct.timer_func = __mqtt_timer_run_global;
+			// builds up its message in slices, see mqtt_timer_run_global()
+			mqt->interval_us /= MQTT_GLOBAL_SLICES;
+		}
+		else
+			mqt->ct.timer_func = __mqtt_timer_run_summary;
 	}
 
+	// random phase for per-call and per-media timers, so that calls set up in a burst
+	// don't all publish at the same time
+	if (call && mqt->interval_us > 0)
+		timeval_add_usec(&mqt->ct.next, (long long) (ssl_random() % mqt->interval_us)
+				- mqt->interval_us);
+
 	__codec_mqtt_timer_schedule(mqt);
 }
 
@@ -2238,6 +2317,8 @@ static int packet_dtmf(struct codec_ssrc_handler *ch, struct codec_ssrc_handler
 
 				if (__buffer_dtx(input_ch->dtx_buffer, ch, input_ch, dup, mp, packet_dtmf_fwd))
 					ret = 1; // consumed
+				else if (__codec_worker_push(ch, input_ch, dup, mp, packet_dtmf_fwd))
+					ret = 1; // consumed
 				else
 					ret = packet_dtmf_fwd(ch, input_ch, dup, mp);
 
@@ -2263,6 +2344,8 @@ static int packet_dtmf(struct codec_ssrc_handler *ch, struct codec_ssrc_handler
 		// pass through
 		if (__buffer_dtx(input_ch->dtx_buffer, ch, input_ch, packet, mp, packet_dtmf_fwd))
 			ret = 1; // consumed
+		else if (__codec_worker_push(ch, input_ch, packet, mp, packet_dtmf_fwd))
+			ret = 1; // consumed
 		else
 			ret = packet_dtmf_fwd(ch, input_ch, packet, mp);
 	}
@@ -2565,6 +2648,49 @@ static int handler_func_passthrough_ssrc(struct codec_handler *h, struct media_p
 }
 
 
+static int handler_func_g711(struct codec_handler *h, struct media_packet *mp) {
+	if (G_UNLIKELY(!mp->rtp))
+		return handler_func_passthrough(h, mp);
+	if (!handler_silence_block(h, mp))
+		return 0;
+	if (G_UNLIKELY(mp->raw.len > MAX_RTP_PACKET_SIZE))
+		return 0;
+
+	uint32_t ts = ntohl(mp->rtp->timestamp);
+	codec_calc_jitter(mp->ssrc_in, ts, h->source_pt.clock_rate, &mp->tv);
+	codec_calc_lost(mp->ssrc_in, ntohs(mp->rtp->seq_num));
+
+	ML_CLEAR(mp->media->monologue, DTMF_INJECTION_ACTIVE);
+
+	// convert into a copy as other sinks may want the original
+	char buf[MAX_RTP_PACKET_SIZE];
+	memcpy(buf, mp->raw.s, mp->raw.len);
+
+	const unsigned char *table = (h->kernel_transcode == RTPE_PT_ALAW_TO_ULAW)
+		? g711_alaw_to_ulaw : g711_ulaw_to_alaw;
+	unsigned char *pl = (unsigned char *) buf + (mp->payload.s - mp->raw.s);
+	for (size_t i = 0; i < mp->payload.len; i++)
+		pl[i] = table[pl[i]];
+
+	// same header manipulations as SSRC passthrough, plus the new PT
+	struct rtp_header *r = (void *) buf;
+	r->m_pt = (mp->rtp->m_pt & 0x80) | h->dest_pt.payload_type;
+	r->ssrc = htonl(mp->ssrc_out->parent->h.ssrc);
+	r->seq_num = htons(ntohs(mp->rtp->seq_num) + mp->ssrc_out->parent->seq_diff);
+
+	str orig_raw = mp->raw;
+	struct rtp_header *orig_rtp = mp->rtp;
+	mp->raw.s = buf;
+	mp->rtp = r;
+
+	__buffer_delay_raw(h->delay_buffer, h, codec_add_raw_packet_dup, mp, h->source_pt.clock_rate);
+
+	mp->raw = orig_raw;
+	mp->rtp = orig_rtp;
+
+	return 0;
+}
+
 static void __transcode_packet_free(struct transcode_packet *p) {
 	free(p->payload);
 	g_slice_free1(sizeof(*p), p);
@@ -2805,21 +2931,13 @@ static void __buffer_delay_seq(struct delay_buffer *dbuf, struct media_packet *m
 	dframe->seq_adj += seq_adj;
 }
 
-// consumes `packet` if buffered (returns 1)
-// `packet` can be NULL (discarded packet for seq tracking)
-static int __buffer_dtx(struct dtx_buffer *dtxb, struct codec_ssrc_handler *decoder_handler,
+static struct dtx_packet *dtx_packet_new(struct codec_ssrc_handler *decoder_handler,
 		struct codec_ssrc_handler *input_handler,
 		struct transcode_packet *packet, struct media_packet *mp,
 		int (*dtx_func)(struct codec_ssrc_handler *ch, struct codec_ssrc_handler *input_ch,
 			struct transcode_packet *packet,
 			struct media_packet *mp))
 {
-	if (!dtxb || !mp->sfd || !mp->ssrc_in || !mp->ssrc_out)
-		return 0;
-
-	unsigned long ts = packet ? packet->ts : 0;
-
-	// allocate packet object
 	struct dtx_packet *dtxp = g_slice_alloc0(sizeof(*dtxp));
 	dtxp->packet = packet;
 	dtxp->dtx_func = dtx_func;
@@ -2828,6 +2946,24 @@ static int __buffer_dtx(struct dtx_buffer *dtxb, struct codec_ssrc_handler *deco
 	if (input_handler)
 		dtxp->input_handler = obj_get(&input_handler->h);
 	media_packet_copy(&dtxp->mp, mp);
+	return dtxp;
+}
+
+// consumes `packet` if buffered (returns 1)
+// `packet` can be NULL (discarded packet for seq tracking)
+static int __buffer_dtx(struct dtx_buffer *dtxb, struct codec_ssrc_handler *decoder_handler,
+		struct codec_ssrc_handler *input_handler,
+		struct transcode_packet *packet, struct media_packet *mp,
+		int (*dtx_func)(struct codec_ssrc_handler *ch, struct codec_ssrc_handler *input_ch,
+			struct transcode_packet *packet,
+			struct media_packet *mp))
+{
+	if (!dtxb || !mp->sfd || !mp->ssrc_in || !mp->ssrc_out)
+		return 0;
+
+	unsigned long ts = packet ? packet->ts : 0;
+
+	struct dtx_packet *dtxp = dtx_packet_new(decoder_handler, input_handler, packet, mp, dtx_func);
 
 	// add to processing queue
 
@@ -2868,24 +3004,28 @@ static void delay_frame_free(struct delay_frame *dframe) {
 		__transcode_packet_free(dframe->packet);
 	g_slice_free1(sizeof(*dframe), dframe);
 }
-static void delay_frame_send(struct delay_frame *dframe) {
+// sends out the output queue of a media packet processed outside of the receiving context
+static void __media_packet_send_deferred(struct media_packet *mp) {
 	// XXX this should be unified with other instances of the same code
-	struct sink_handler *sh = &dframe->mp.sink;
+	struct sink_handler *sh = &mp->sink;
 	struct packet_stream *sink = sh->sink;
 
 	if (!sink)
-		media_socket_dequeue(&dframe->mp, NULL); // just free
+		media_socket_dequeue(mp, NULL); // just free
 	else {
-		if (sh->handler && media_packet_encrypt(sh->handler->out->rtp_crypt, sink, &dframe->mp))
+		if (sh->handler && media_packet_encrypt(sh->handler->out->rtp_crypt, sink, mp))
 			ilogs(transcoding, LOG_ERR | LOG_FLAG_LIMIT, "Error encrypting buffered RTP media");
 
 		mutex_lock(&sink->out_lock);
-		if (media_socket_dequeue(&dframe->mp, sink))
+		if (media_socket_dequeue(mp, sink))
 			ilogs(transcoding, LOG_ERR | LOG_FLAG_LIMIT,
 					"Error sending buffered media to RTP sink");
 		mutex_unlock(&sink->out_lock);
 	}
 }
+static void delay_frame_send(struct delay_frame *dframe) {
+	__media_packet_send_deferred(&dframe->mp);
+}
 static void delay_frame_flush(struct delay_buffer *dbuf, struct delay_frame *dframe) {
 	// call is locked in W here
 	__delay_frame_process(dbuf, dframe);
@@ -2910,6 +3050,159 @@ static void dtx_buffer_stop(struct dtx_buffer **dtxbp) {
 }
 
 
+// hands the packet over to the codec worker responsible for `input_handler`. returns true
+// if this was done, in which case `packet` (if any) has been consumed. `packet` can be
+// NULL, same as with __buffer_dtx
+static bool __codec_worker_push(struct codec_ssrc_handler *decoder_handler,
+		struct codec_ssrc_handler *input_handler,
+		struct transcode_packet *packet, struct media_packet *mp,
+		int (*func)(struct codec_ssrc_handler *ch, struct codec_ssrc_handler *input_ch,
+			struct transcode_packet *packet,
+			struct media_packet *mp))
+{
+	if (!codec_workers || !decoder_handler || !input_handler)
+		return false;
+	// the DTX buffer already does its processing in the timer thread
+	if (input_handler->dtx_buffer)
+		return false;
+	if (!mp->sfd || !mp->ssrc_in || !mp->ssrc_out)
+		return false;
+
+	unsigned int idx = (GPOINTER_TO_UINT(input_handler) >> 4) % rtpe_config.codec_threads;
+	struct codec_worker *w = &codec_workers[idx];
+
+	struct codec_worker_job *job = g_slice_alloc(sizeof(*job));
+	job->dtxp = dtx_packet_new(decoder_handler, input_handler, packet, mp, func);
+	job->queued = clock_ns(CLOCK_MONOTONIC) / 1000;
+
+	atomic64_inc(&w->stats->queued);
+	g_thread_pool_push(w->pool, job, NULL);
+
+	return true;
+}
+
+static void codec_worker_run(void *p, void *u) {
+	struct codec_worker_job *job = p;
+	struct codec_worker *w = u;
+	struct dtx_packet *dtxp = job->dtxp;
+	struct media_packet *mp = &dtxp->mp;
+
+	thread_load_register(THREAD_LOAD_CODEC);
+	long long load_start = thread_load_start();
+
+	long long start = clock_ns(CLOCK_MONOTONIC) / 1000;
+	atomic64_dec(&w->stats->queued);
+	atomic64_add(&w->stats->wait_us, start - job->queued);
+
+	if (rtpe_shutdown)
+		goto out;
+
+	struct call *call = mp->sfd->call;
+	log_info_stream_fd(mp->sfd);
+	rwlock_lock_r(&call->master_lock);
+	gettimeofday(&rtpe_now, NULL);
+
+	// the stream may have gone away or the handlers may have been replaced while
+	// the job was queued
+	if (mp->sfd->stream && !dtxp->decoder_handler->stopped && !dtxp->input_handler->stopped) {
+		__ssrc_lock_both(mp);
+		int ret = dtxp->dtx_func(dtxp->decoder_handler, dtxp->input_handler, dtxp->packet, mp);
+		__ssrc_unlock_both(mp);
+
+		if (ret == 1)
+			dtxp->packet = NULL; // consumed
+		else if (ret < 0)
+			ilogs(transcoding, LOG_WARN | LOG_FLAG_LIMIT,
+					"Decoder error while processing RTP packet in codec worker");
+
+		__media_packet_send_deferred(mp);
+	}
+
+	rwlock_unlock_r(&call->master_lock);
+	log_info_pop();
+
+out:
+	dtx_packet_free(dtxp);
+	g_slice_free1(sizeof(*job), job);
+
+	atomic64_inc(&w->stats->jobs);
+	atomic64_add(&w->stats->busy_us, clock_ns(CLOCK_MONOTONIC) / 1000 - start);
+	thread_load_done(load_start);
+}
+
+
+static void codec_cost_update(struct codec_stats *stats, long long cost) {
+	// racy but good enough for an estimate
+	long long avg = atomic64_get(&stats->cost_ns);
+	atomic64_set(&stats->cost_ns, avg ? avg + (cost - avg) / 8 : cost);
+}
+
+// rough CPU time to transcode one 20 ms packet from or to the given codec, used until an
+// actual figure has been measured
+static const struct {
+	const char *name;
+	long long cost_ns;
+} codec_cost_defaults[] = {
+	{ "PCMA",	2000 },
+	{ "PCMU",	2000 },
+	{ "G722",	20000 },
+	{ "G729",	60000 },
+	{ "speex",	80000 },
+	{ "iLBC",	100000 },
+	{ "opus",	150000 },
+	{ "AMR",	150000 },
+	{ "AMR-WB",	250000 },
+	{ "EVS",	500000 },
+};
+#define CODEC_COST_UNKNOWN 100000
+
+// matches "name/..." at the start of either side of a "src -> dst" stats chain
+static bool codec_chain_contains(const char *chain, const str *name) {
+	for (int side = 0; side < 2 && chain; side++) {
+		if (!strncasecmp(chain, name->s, name->len)
+				&& (chain[name->len] == '/' || chain[name->len] == ' ' || chain[name->len] == '\0'))
+			return true;
+		chain = strstr(chain, " -> ");
+		if (chain)
+			chain += 4;
+	}
+	return false;
+}
+
+// estimated CPU time in ns per packet when transcoding from or to the given codec, which
+// can be given with or without clock rate and channels. measured figures take precedence
+// over the built-in defaults
+long long codec_cost_estimate(const str *codec) {
+	str name = *codec;
+	char *slash = memchr(name.s, '/', name.len);
+	if (slash)
+		name.len = slash - name.s;
+
+	long long ret = 0;
+
+	mutex_lock(&rtpe_codec_stats_lock);
+	GHashTableIter iter;
+	g_hash_table_iter_init(&iter, rtpe_codec_stats);
+	struct codec_stats *stats;
+	while (g_hash_table_iter_next(&iter, NULL, (void **) &stats)) {
+		if (codec_chain_contains(stats->chain, &name))
+			ret = MAX(ret, atomic64_get(&stats->cost_ns));
+	}
+	mutex_unlock(&rtpe_codec_stats_lock);
+
+	if (ret)
+		return ret;
+
+	for (unsigned int i = 0; i < G_N_ELEMENTS(codec_cost_defaults); i++) {
+		const char *def = codec_cost_defaults[i].name;
+		if (strlen(def) == name.len && !strncasecmp(name.s, def, name.len))
+			return codec_cost_defaults[i].cost_ns;
+	}
+
+	return CODEC_COST_UNKNOWN;
+}
+
+
 static void delay_frame_manipulate(struct delay_frame *dframe) {
 	struct call_media *media = dframe->mp.media;
 	if (!media)
@@ -3587,6 +3880,7 @@ static void __delay_buffer_setup(struct delay_buffer **dbufp,
 }
 static void __ssrc_handler_stop(void *p, void *arg) {
 	struct codec_ssrc_handler *ch = p;
+	ch->stopped = true;
 	if (ch->dtx_buffer) {
 		mutex_lock(&ch->dtx_buffer->lock);
 		__dtx_shutdown(ch->dtx_buffer);
@@ -3613,72 +3907,27 @@ void codec_handlers_stop(GQueue *q) {
 
 
 
-static void silence_event_free(void *p) {
-	g_slice_free1(sizeof(struct silence_event), p);
-}
-
-#define __silence_detect_type(type) \
-static void __silence_detect_ ## type(struct codec_ssrc_handler *ch, AVFrame *frame, type thres) { \
-	type *s = (void *) frame->data[0]; \
-	struct silence_event *last = g_queue_peek_tail(&ch->silence_events); \
- \
-	if (last && last->end) /* last event finished? */ \
-		last = NULL; \
- \
-	for (unsigned int i = 0; i < frame->nb_samples; i++) { \
-		if (s[i] <= thres && s[1] >= -thres) { \
-			/* silence */ \
-			if (!last) { \
-				/* new event */ \
-				last = g_slice_alloc0(sizeof(*last)); \
-				last->start = frame->pts + i; \
-				g_queue_push_tail(&ch->silence_events, last); \
-			} \
-		} \
-		else { \
-			/* not silence */ \
-			if (last && !last->end) { \
-				/* close off event */ \
-				last->end = frame->pts + i; \
-				last = NULL; \
-			} \
-		} \
-	} \
-}
+#define SILENCE_RING_SIZE 16 // initial number of silence runs, grown on demand
 
-__silence_detect_type(double)
-__silence_detect_type(float)
-__silence_detect_type(int32_t)
-__silence_detect_type(int16_t)
-
-static void __silence_detect(struct codec_ssrc_handler *ch, AVFrame *frame) {
+// single pass over each decoded frame, appending to the silence runs in `silence_events`
+static void __frame_analyse(struct codec_ssrc_handler *ch, AVFrame *frame) {
 	if (!rtpe_config.silence_detect_int)
 		return;
 	if (ch->handler->cn_payload_type < 0)
 		return;
-	switch (frame->format) {
-		case AV_SAMPLE_FMT_DBL:
-			__silence_detect_double(ch, frame, rtpe_config.silence_detect_double);
-			break;
-		case AV_SAMPLE_FMT_FLT:
-			__silence_detect_float(ch, frame, rtpe_config.silence_detect_double);
-			break;
-		case AV_SAMPLE_FMT_S32:
-			__silence_detect_int32_t(ch, frame, rtpe_config.silence_detect_int);
-			break;
-		case AV_SAMPLE_FMT_S16:
-			__silence_detect_int16_t(ch, frame, rtpe_config.silence_detect_int >> 16);
-			break;
-		default:
-			ilogs(transcoding, LOG_WARN | LOG_FLAG_LIMIT, "Unsupported sample format %i for silence detection",
-					frame->format);
-	}
-}
-static int is_silence_event(str *inout, GQueue *events, uint64_t pts, uint64_t duration) {
+	if (!ch->silence_events.runs)
+		silence_ring_init(&ch->silence_events, SILENCE_RING_SIZE);
+	if (!frame_analyse(&ch->silence_events, frame->format, frame->data[0],
+				frame->nb_samples, frame->pts,
+				rtpe_config.silence_detect_int, rtpe_config.silence_detect_double))
+		ilogs(transcoding, LOG_WARN | LOG_FLAG_LIMIT, "Unsupported sample format %i for silence detection",
+				frame->format);
+}
+static int is_silence_event(str *inout, struct silence_ring *events, uint64_t pts, uint64_t duration) {
 	uint64_t end = pts + duration;
+	struct silence_run *first;
 
-	while (events->length) {
-		struct silence_event *first = g_queue_peek_head(events);
+	while ((first = silence_ring_head(events))) {
 		if (first->start > pts) // future event
 			return 0;
 		if (!first->end) // ongoing event
@@ -3686,14 +3935,11 @@ static int is_silence_event(str *inout, GQueue *events, uint64_t pts, uint64_t d
 		if (first->end > end) // event finished with end in the future
 			goto silence;
 		// event has ended: remove it
-		g_queue_pop_head(events);
+		silence_ring_pop(events);
 		// does the event fill the entire span?
-		if (first->end == end) {
-			silence_event_free(first);
+		if (first->end == end)
 			goto silence;
-		}
 		// keep going, there might be more
-		silence_event_free(first);
 	}
 	return 0;
 
@@ -3713,11 +3959,8 @@ static bool __ssrc_handler_decode_common(struct codec_ssrc_handler *ch, struct c
 	if (h->pcm_dtmf_detect) {
 		ilogs(codec, LOG_DEBUG, "Inserting DTMF DSP for output payload type %i", h->dtmf_payload_type);
 		ch->dtmf_format = (format_t) { .clockrate = 8000, .channels = 1, .format = AV_SAMPLE_FMT_S16 };
-		ch->dtmf_dsp = dtmf_rx_init(NULL, NULL, NULL);
-		if (!ch->dtmf_dsp)
-			ilogs(codec, LOG_ERR, "Failed to allocate DTMF RX context");
-		else
-			dtmf_rx_set_realtime_callback(ch->dtmf_dsp, __dtmf_dsp_callback, ch);
+		ch->dtmf_dsp = g_slice_alloc(sizeof(*ch->dtmf_dsp));
+		dtmf_detect_init(ch->dtmf_dsp, __dtmf_dsp_callback, ch);
 	}
 
 	ch->decoder = decoder_new_fmtp(h->source_pt.codec_def, h->source_pt.clock_rate, h->source_pt.channels,
@@ -3859,10 +4102,10 @@ static void __free_ssrc_handler(void *chp) {
 	if (ch->sample_buffer)
 		g_string_free(ch->sample_buffer, TRUE);
 	if (ch->dtmf_dsp)
-		dtmf_rx_free(ch->dtmf_dsp);
+		g_slice_free1(sizeof(*ch->dtmf_dsp), ch->dtmf_dsp);
 	resample_shutdown(&ch->dtmf_resampler);
 	g_queue_clear_full(&ch->dtmf_events, dtmf_event_free);
-	g_queue_clear_full(&ch->silence_events, silence_event_free);
+	silence_ring_free(&ch->silence_events);
 	dtx_buffer_stop(&ch->dtx_buffer);
 }
 
@@ -3995,23 +4238,13 @@ static void __dtmf_detect(struct codec_ssrc_handler *ch, AVFrame *frame) {
 			dsp_frame->nb_samples);
 
 	if (dsp_frame->pts > ch->dtmf_ts)
-		dtmf_rx_fillin(ch->dtmf_dsp, dsp_frame->pts - ch->dtmf_ts);
+		dtmf_detect_fillin(ch->dtmf_dsp, dsp_frame->pts - ch->dtmf_ts);
 	else if (dsp_frame->pts < ch->dtmf_ts)
 		ilogs(transcoding, LOG_ERR | LOG_FLAG_LIMIT, "DTMF TS seems to run backwards (%lu < %lu)",
 				(unsigned long) dsp_frame->pts,
 				(unsigned long) ch->dtmf_ts);
 
-	int num_samples = dsp_frame->nb_samples;
-	int16_t *samples = (void *) dsp_frame->extended_data[0];
-	while (num_samples > 0) {
-		int ret = dtmf_rx(ch->dtmf_dsp, samples, num_samples);
-		if (ret < 0 || ret >= num_samples) {
-			ilogs(transcoding, LOG_ERR | LOG_FLAG_LIMIT, "DTMF DSP returned error %i", ret);
-			break;
-		}
-		samples += num_samples - ret;
-		num_samples = ret;
-	}
+	dtmf_detect_samples(ch->dtmf_dsp, (void *) dsp_frame->extended_data[0], dsp_frame->nb_samples);
 	ch->dtmf_ts = dsp_frame->pts + dsp_frame->nb_samples;
 	av_frame_free(&dsp_frame);
 }
@@ -4067,7 +4300,7 @@ static int packet_decoded_common(decoder_t *decoder, AVFrame *frame, void *u1, v
 	}
 
 	__dtmf_detect(ch, frame);
-	__silence_detect(ch, frame);
+	__frame_analyse(ch, frame);
 
 	// locking deliberately ignored
 	if (mp->media_out)
@@ -4115,6 +4348,9 @@ static int __rtp_decode(struct codec_ssrc_handler *ch, struct codec_ssrc_handler
 {
 	int ret = 0;
 	if (packet) {
+		struct codec_stats *stats = rtpe_config.thread_load_limit ? ch->handler->stats_entry : NULL;
+		long long cost_start = stats ? clock_ns(CLOCK_THREAD_CPUTIME_ID) : 0;
+
 		if (ch->chain) {
 			static const struct fraction chain_fact = {1,1};
 			AVPacket *pkt = codec_chain_input_data(ch->chain, packet->payload, packet->ts);
@@ -4127,6 +4363,9 @@ static int __rtp_decode(struct codec_ssrc_handler *ch, struct codec_ssrc_handler
 			ret = decoder_input_data_ptime(ch->decoder, packet->payload, packet->ts, &mp->ptime,
 					ch->handler->packet_decoded,
 					ch, mp);
+
+		if (stats)
+			codec_cost_update(stats, clock_ns(CLOCK_THREAD_CPUTIME_ID) - cost_start);
 	}
 	__buffer_delay_seq(input_ch->handler->delay_buffer, mp, -1);
 	return ret;
@@ -4157,6 +4396,8 @@ static int packet_decode(struct codec_ssrc_handler *ch, struct codec_ssrc_handle
 
 	if (__buffer_dtx(input_ch->dtx_buffer, ch, input_ch, packet, mp, __rtp_decode))
 		ret = 1; // consumed
+	else if (__codec_worker_push(ch, input_ch, packet, mp, __rtp_decode))
+		ret = packet ? 1 : 0; // consumed if there was one
 	else {
 		ilogs(transcoding, LOG_DEBUG, "Decoding RTP packet now");
 		ret = __rtp_decode(ch, input_ch, packet, mp);
@@ -5524,8 +5765,38 @@ static void codec_timers_run(void *p) {
 
 void codecs_init(void) {
 	timerthread_init(&codec_timers_thread, codec_timers_run);
+
+#ifdef WITH_TRANSCODING
+	if (rtpe_config.codec_threads > 0) {
+		rtpe_codec_worker_stats = g_new0(struct codec_worker_stats, rtpe_config.codec_threads);
+		codec_workers = g_new0(struct codec_worker, rtpe_config.codec_threads);
+		for (int i = 0; i < rtpe_config.codec_threads; i++) {
+			codec_workers[i].stats = &rtpe_codec_worker_stats[i];
+			codec_workers[i].pool = g_thread_pool_new(codec_worker_run, &codec_workers[i],
+					1, TRUE, NULL);
+		}
+	}
+#endif
+}
+// queued jobs still run to completion and reference their calls, so this must
+// be called before calls are freed
+void codecs_stop(void) {
+#ifdef WITH_TRANSCODING
+	if (codec_workers) {
+		for (int i = 0; i < rtpe_config.codec_threads; i++)
+			g_thread_pool_free(codec_workers[i].pool, FALSE, TRUE);
+		g_free(codec_workers);
+		codec_workers = NULL;
+	}
+#endif
 }
 void codecs_cleanup(void) {
+#ifdef WITH_TRANSCODING
+	codecs_stop();
+	g_free(rtpe_codec_worker_stats);
+	rtpe_codec_worker_stats = NULL;
+#endif
+
 	timerthread_free(&codec_timers_thread);
 }
 void codec_timers_loop(void *p) {
@@ -4,7 +4,6 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <assert.h>
-#include <json-glib/json-glib.h>
 
 #include "obj.h"
 #include "poller.h"
@@ -34,6 +33,7 @@ const char magic_load_limit_strings[__LOAD_LIMIT_MAX][64] = {
 	[LOAD_LIMIT_CPU] = "CPU usage limit exceeded",
 	[LOAD_LIMIT_LOAD] = "Load limit exceeded",
 	[LOAD_LIMIT_BW] = "Bandwidth limit exceeded",
+	[LOAD_LIMIT_THREADS] = "Thread occupancy limit exceeded",
 };
 const char *ng_command_strings[NGC_COUNT] = {
 	"ping", "offer", "answer", "delete", "query", "list",
@@ -191,13 +191,8 @@ int control_ng_process(str *buf, const endpoint_t *sin, char *addr, const sockad
 	}
 	else if (data.s[0] == '{') {
 		collapse_func = bencode_collapse_str_json;
-		JsonParser *json = json_parser_new();
-		bencode_buffer_destroy_add(&ngbuf->buffer, g_object_unref, json);
+		dict = bencode_decode_json(&ngbuf->buffer, data.s, data.len);
 		errstr = "Failed to parse JSON document";
-		if (!json_parser_load_from_data(json, data.s, data.len, NULL))
-			goto err_send;
-		dict = bencode_convert_json(&ngbuf->buffer, json);
-		errstr = "Could not decode bencode dictionary";
 		if (!dict || dict->type != BENCODE_DICTIONARY)
 			goto err_send;
 	}
@@ -19,6 +19,8 @@
 #include "call.h"
 #include "poller.h"
 #include "ice.h"
+#include "statistics.h"
+#include "log_funcs.h"
 
 
 #if OPENSSL_VERSION_NUMBER >= 0x10002000L
@@ -39,6 +41,7 @@
 
 
 #define CERT_EXPIRY_TIME (60*60*24*30) /* 30 days */
+#define SSL_POOL_SIZE 32 /* per role */
 
 struct dtls_connection *dtls_ptr(struct stream_fd *sfd) {
 	if (!sfd)
@@ -57,6 +60,8 @@ static char ciphers_str[1024];
 
 
 
+static int verify_callback(int ok, X509_STORE_CTX *store);
+static void dtls_worker(void *p, void *u);
 static unsigned int sha_1_func(unsigned char *, X509 *);
 static unsigned int sha_224_func(unsigned char *, X509 *);
 static unsigned int sha_256_func(unsigned char *, X509 *);
@@ -101,6 +106,16 @@ const int num_hash_funcs = G_N_ELEMENTS(hash_funcs);
 static struct dtls_cert *__dtls_cert;
 static rwlock_t __dtls_cert_lock;
 
+// handshake packets are processed by one of these, each running a single thread, so that
+// packets of one stream are always handled in order
+static GThreadPool **dtls_worker_pools;
+struct dtls_job {
+	struct stream_fd *sfd;
+	endpoint_t fsin;
+	size_t len;
+	char buf[];
+};
+
 
 
 const struct dtls_hash_func *dtls_find_hash_func(const str *s) {
@@ -121,6 +136,14 @@ const struct dtls_hash_func *dtls_find_hash_func(const str *s) {
 static void cert_free(void *p) {
 	struct dtls_cert *cert = p;
 
+	for (int i = 0; i < G_N_ELEMENTS(cert->ssl_pool); i++) {
+		SSL *ssl;
+		while ((ssl = g_queue_pop_head(&cert->ssl_pool[i])))
+			SSL_free(ssl);
+		if (cert->ssl_ctx[i])
+			SSL_CTX_free(cert->ssl_ctx[i]);
+	}
+	mutex_destroy(&cert->pool_lock);
 	if (cert->pkey)
 		EVP_PKEY_free(cert->pkey);
 	if (cert->x509)
@@ -184,6 +207,113 @@ static void dump_cert(struct dtls_cert *cert) {
 	buf_dump_free(buf, len);
 }
 
+// one shared context per role and certificate, configured once
+static SSL_CTX *cert_ssl_ctx(struct dtls_cert *cert, int active) {
+#if OPENSSL_VERSION_NUMBER >= 0x10002000L
+	SSL_CTX *ctx = SSL_CTX_new(active ? DTLS_client_method() : DTLS_server_method());
+#else
+	SSL_CTX *ctx = SSL_CTX_new(active ? DTLSv1_client_method() : DTLSv1_server_method());
+#endif
+	if (!ctx)
+		return NULL;
+
+	if (SSL_CTX_use_certificate(ctx, cert->x509) != 1)
+		goto error;
+	if (SSL_CTX_use_PrivateKey(ctx, cert->pkey) != 1)
+		goto error;
+
+	SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT,
+			verify_callback);
+	SSL_CTX_set_verify_depth(ctx, 4);
+	SSL_CTX_set_cipher_list(ctx, rtpe_config.dtls_ciphers);
+
+	if (SSL_CTX_set_tlsext_use_srtp(ctx, ciphers_str))
+		goto error;
+	if (SSL_CTX_set_read_ahead(ctx, 1))
+		goto error;
+
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+	int ec_groups[1] = { NID_X9_62_prime256v1 };
+	SSL_CTX_set1_groups(ctx, &ec_groups, G_N_ELEMENTS(ec_groups));
+#else // <3.0
+	EC_KEY* ecdh = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
+	if (ecdh == NULL)
+		goto error;
+	SSL_CTX_set_options(ctx, SSL_OP_SINGLE_ECDH_USE);
+	SSL_CTX_set_tmp_ecdh(ctx, ecdh);
+	EC_KEY_free(ecdh);
+#endif
+
+#if defined(SSL_OP_NO_QUERY_MTU)
+	SSL_CTX_set_options(ctx, SSL_OP_NO_QUERY_MTU);
+#endif
+
+	return ctx;
+
+error:
+	SSL_CTX_free(ctx);
+	return NULL;
+}
+
+static SSL *cert_ssl_new(struct dtls_cert *cert, int active) {
+	SSL *ssl = SSL_new(cert->ssl_ctx[active]);
+	if (!ssl)
+		return NULL;
+
+	BIO *r_bio = BIO_new(BIO_s_mem());
+	BIO *w_bio = BIO_new(BIO_s_mem());
+	if (!r_bio || !w_bio) {
+		if (r_bio)
+			BIO_free(r_bio);
+		if (w_bio)
+			BIO_free(w_bio);
+		SSL_free(ssl);
+		return NULL;
+	}
+	SSL_set_bio(ssl, r_bio, w_bio);
+
+#if defined(SSL_OP_NO_QUERY_MTU)
+	SSL_set_mtu(ssl, rtpe_config.dtls_mtu);
+#if defined(DTLS_set_link_mtu) || defined(DTLS_CTRL_SET_LINK_MTU) || OPENSSL_VERSION_NUMBER >= 0x10100000L
+	DTLS_set_link_mtu(ssl, rtpe_config.dtls_mtu);
+#endif
+#endif
+
+	return ssl;
+}
+
+// takes a ready SSL object from the pool, or creates a new one if the pool is empty
+static SSL *cert_ssl_get(struct dtls_cert *cert, int active) {
+	SSL *ssl;
+	{
+		LOCK(&cert->pool_lock);
+		ssl = g_queue_pop_head(&cert->ssl_pool[active]);
+	}
+	if (ssl)
+		return ssl;
+	return cert_ssl_new(cert, active);
+}
+
+// tops up the pool of SSL objects. SSL objects are created without holding the lock
+void dtls_pool_fill(struct dtls_cert *cert) {
+	for (int active = 0; active < G_N_ELEMENTS(cert->ssl_pool); active++) {
+		while (true) {
+			{
+				LOCK(&cert->pool_lock);
+				if (cert->ssl_pool[active].length >= SSL_POOL_SIZE)
+					break;
+			}
+			SSL *ssl = cert_ssl_new(cert, active);
+			if (!ssl)
+				break;
+			LOCK(&cert->pool_lock);
+			g_queue_push_tail(&cert->ssl_pool[active], ssl);
+		}
+	}
+}
+
 static int cert_init(void) {
 	X509 *x509 = NULL;
 	EVP_PKEY *pkey = NULL;
@@ -195,7 +325,7 @@ static int cert_init(void) {
 #endif
 	ASN1_INTEGER *asn1_serial_number;
 	X509_NAME *name;
-	struct dtls_cert *new_cert;
+	struct dtls_cert *new_cert = NULL;
 
 	ilogs(crypto, LOG_INFO, "Generating new DTLS certificate");
 
@@ -333,9 +463,20 @@ static int cert_init(void) {
 	new_cert->x509 = x509;
 	new_cert->pkey = pkey;
 	new_cert->expires = time(NULL) + CERT_EXPIRY_TIME;
+	mutex_init(&new_cert->pool_lock);
+	x509 = NULL;
+	pkey = NULL;
+
+	for (int i = 0; i < G_N_ELEMENTS(new_cert->ssl_ctx); i++) {
+		new_cert->ssl_ctx[i] = cert_ssl_ctx(new_cert, i);
+		if (!new_cert->ssl_ctx[i])
+			goto err;
+	}
 
 	dump_cert(new_cert);
 
+	dtls_pool_fill(new_cert);
+
 	/* swap out certs */
 
 	rwlock_lock_w(&__dtls_cert_lock);
@@ -373,6 +514,8 @@ err:
 		X509_free(x509);
 	if (serial_number)
 		BN_free(serial_number);
+	if (new_cert)
+		obj_put(new_cert);
 
 	return -1;
 }
@@ -382,8 +525,6 @@ int dtls_init() {
 	char *p;
 
 	rwlock_init(&__dtls_cert_lock);
-	if (cert_init())
-		return -1;
 
 	p = ciphers_str;
 	for (i = 0; i < num_crypto_suites; i++) {
@@ -398,6 +539,15 @@ int dtls_init() {
 
 	p[-1] = '\0';
 
+	if (cert_init())
+		return -1;
+
+	if (rtpe_config.dtls_threads > 0) {
+		dtls_worker_pools = g_new0(GThreadPool *, rtpe_config.dtls_threads);
+		for (i = 0; i < rtpe_config.dtls_threads; i++)
+			dtls_worker_pools[i] = g_thread_pool_new(dtls_worker, NULL, 1, TRUE, NULL);
+	}
+
 	return 0;
 }
 
@@ -420,10 +570,21 @@ out:
 	return TLA_CONTINUE;
 }
 
+static enum thread_looper_action __dtls_pool_timer(void) {
+	struct dtls_cert *c = dtls_cert();
+	if (!c)
+		return TLA_BREAK;
+	dtls_pool_fill(c);
+	obj_put(c);
+	return TLA_CONTINUE;
+}
+
 void dtls_timer(void) {
 	thread_create_looper(__dtls_timer, rtpe_config.idle_scheduling,
 			rtpe_config.idle_priority, "DTLS refresh",
 			((long long) CERT_EXPIRY_TIME / 7) * 1000000);
+	thread_create_looper(__dtls_pool_timer, rtpe_config.idle_scheduling,
+			rtpe_config.idle_priority, "DTLS pool", 1000000);
 }
 
 static unsigned int generic_func(unsigned char *o, X509 *x, const EVP_MD *md) {
@@ -470,7 +631,20 @@ struct dtls_cert *dtls_cert() {
 	return ret;
 }
 
+// queued handshake packets still run to completion and reference their streams,
+// so this must be called before calls are freed
+void dtls_stop(void) {
+	if (dtls_worker_pools) {
+		for (int i = 0; i < rtpe_config.dtls_threads; i++)
+			g_thread_pool_free(dtls_worker_pools[i], FALSE, TRUE);
+		g_free(dtls_worker_pools);
+		dtls_worker_pools = NULL;
+	}
+}
+
 void dtls_cert_free(void) {
+	dtls_stop();
+
 	rwlock_lock_w(&__dtls_cert_lock);
 
 	if (__dtls_cert)
@@ -552,10 +726,17 @@ static int try_connect(struct dtls_connection *d) {
 
 	if (d->connected)
 		ret = SSL_read(d->ssl, buf, sizeof(buf)); /* retransmission after connected - handshake lost */
-	else if (d->active)
-		ret = SSL_connect(d->ssl);
-	else
-		ret = SSL_accept(d->ssl);
+	else {
+		struct timespec start, end;
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+		if (d->active)
+			ret = SSL_connect(d->ssl);
+		else
+			ret = SSL_accept(d->ssl);
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+		RTPE_STATS_ADD(dtls_handshake_time, (end.tv_sec - start.tv_sec) * 1000000LL
+				+ (end.tv_nsec - start.tv_nsec) / 1000);
+	}
 
 	code = SSL_get_error(d->ssl, ret);
 
@@ -568,6 +749,7 @@ static int try_connect(struct dtls_connection *d) {
 				ilogs(crypto, LOG_DEBUG, "DTLS handshake successful");
 				d->connected = 1;
 				ret = 1;
+				RTPE_STATS_INC(dtls_handshakes);
 			}
 			break;
 
@@ -588,6 +770,8 @@ static int try_connect(struct dtls_connection *d) {
 			ret = ERR_peek_last_error();
 			ilogs(crypto, LOG_ERROR, "DTLS error: %i (%s)", code, ERR_reason_error_string(ret));
 			ret = -1;
+			if (!d->connected)
+				RTPE_STATS_INC(dtls_handshake_failures);
 			break;
 	}
 
@@ -614,62 +798,14 @@ int dtls_connection_init(struct dtls_connection *d, struct packet_stream *ps, in
 
 	ilogs(crypto, LOG_DEBUG, "Creating %s DTLS connection context", active ? "active" : "passive");
 
-#if OPENSSL_VERSION_NUMBER >= 0x10002000L
-	d->ssl_ctx = SSL_CTX_new(active ? DTLS_client_method() : DTLS_server_method());
-#else
-	d->ssl_ctx = SSL_CTX_new(active ? DTLSv1_client_method() : DTLSv1_server_method());
-#endif
-	if (!d->ssl_ctx)
-		goto error;
-
-	if (SSL_CTX_use_certificate(d->ssl_ctx, cert->x509) != 1)
-		goto error;
-	if (SSL_CTX_use_PrivateKey(d->ssl_ctx, cert->pkey) != 1)
-		goto error;
-
-	SSL_CTX_set_verify(d->ssl_ctx, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT,
-			verify_callback);
-	SSL_CTX_set_verify_depth(d->ssl_ctx, 4);
-	SSL_CTX_set_cipher_list(d->ssl_ctx, rtpe_config.dtls_ciphers);
-
-	if (SSL_CTX_set_tlsext_use_srtp(d->ssl_ctx, ciphers_str))
-		goto error;
-	if (SSL_CTX_set_read_ahead(d->ssl_ctx, 1))
-		goto error;
-
-	d->ssl = SSL_new(d->ssl_ctx);
+	d->ssl = cert_ssl_get(cert, active ? 1 : 0);
 	if (!d->ssl)
 		goto error;
-
-	d->r_bio = BIO_new(BIO_s_mem());
-	d->w_bio = BIO_new(BIO_s_mem());
-	if (!d->r_bio || !d->w_bio)
-		goto error;
+	d->r_bio = SSL_get_rbio(d->ssl);
+	d->w_bio = SSL_get_wbio(d->ssl);
 
 	SSL_set_app_data(d->ssl, d);
-	SSL_set_bio(d->ssl, d->r_bio, d->w_bio);
 	d->init = 1;
-	SSL_set_mode(d->ssl, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
-
-#if OPENSSL_VERSION_NUMBER >= 0x30000000L
-	int ec_groups[1] = { NID_X9_62_prime256v1 };
-	SSL_set1_groups(d->ssl, &ec_groups, G_N_ELEMENTS(ec_groups));
-#else // <3.0
-	EC_KEY* ecdh = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1);
-	if (ecdh == NULL)
-		goto error;
-	SSL_set_options(d->ssl, SSL_OP_SINGLE_ECDH_USE);
-	SSL_set_tmp_ecdh(d->ssl, ecdh);
-	EC_KEY_free(ecdh);
-#endif
-
-#if defined(SSL_OP_NO_QUERY_MTU)
-	SSL_CTX_set_options(d->ssl_ctx, SSL_OP_NO_QUERY_MTU);
-	SSL_set_mtu(d->ssl, rtpe_config.dtls_mtu);
-#if defined(DTLS_set_link_mtu) || defined(DTLS_CTRL_SET_LINK_MTU) || OPENSSL_VERSION_NUMBER >= 0x10100000L
-	DTLS_set_link_mtu(d->ssl, rtpe_config.dtls_mtu);
-#endif
-#endif
 
 	d->active = active ? -1 : 0;
 
@@ -680,16 +816,6 @@ done:
 
 error:
 	err = ERR_peek_last_error();
-	if (!d->init) {
-		if (d->r_bio)
-			BIO_free(d->r_bio);
-		if (d->w_bio)
-			BIO_free(d->w_bio);
-	}
-	if (d->ssl)
-		SSL_free(d->ssl);
-	if (d->ssl_ctx)
-		SSL_CTX_free(d->ssl_ctx);
 	ZERO(*d);
 	ilogs(crypto, LOG_ERROR, "Failed to init DTLS connection: %s", ERR_reason_error_string(err));
 	return -1;
@@ -779,7 +905,7 @@ error:
 }
 
 /* called with call locked in W or R with ps->in_lock held */
-int dtls(struct stream_fd *sfd, const str *s, const endpoint_t *fsin) {
+static int __dtls(struct stream_fd *sfd, const str *s, const endpoint_t *fsin) {
 	struct packet_stream *ps = sfd->stream;
 	int ret;
 	unsigned char buf[0x10000];
@@ -882,6 +1008,56 @@ int dtls(struct stream_fd *sfd, const str *s, const endpoint_t *fsin) {
 	return 0;
 }
 
+static void dtls_worker(void *p, void *u) {
+	struct dtls_job *job = p;
+	struct stream_fd *sfd = job->sfd;
+	struct call *call = sfd->call;
+
+	if (rtpe_shutdown)
+		goto out;
+
+	log_info_stream_fd(sfd);
+	rwlock_lock_r(&call->master_lock);
+	gettimeofday(&rtpe_now, NULL);
+
+	// stream may have gone away while the job was queued
+	struct packet_stream *ps = sfd->stream;
+	if (ps) {
+		str s = STR_INIT_LEN(job->buf, job->len);
+		mutex_lock(&ps->in_lock);
+		__dtls(sfd, &s, &job->fsin);
+		mutex_unlock(&ps->in_lock);
+	}
+
+	rwlock_unlock_r(&call->master_lock);
+	log_info_pop();
+
+out:
+	obj_put(sfd);
+	g_free(job);
+}
+
+/* called with call locked in W or R with ps->in_lock held */
+int dtls(struct stream_fd *sfd, const str *s, const endpoint_t *fsin) {
+	// packets received while the handshake is in progress are handed to a worker
+	// thread, so that the crypto operations don't hold up the media thread
+	if (s && fsin && dtls_worker_pools && sfd->stream && MEDIA_ISSET(sfd->stream->media, DTLS)) {
+		struct dtls_connection *d = dtls_ptr(sfd);
+		if (d && d->init && d->ssl && !d->connected) {
+			struct dtls_job *job = g_malloc(sizeof(*job) + s->len);
+			job->sfd = obj_get(sfd);
+			job->fsin = *fsin;
+			job->len = s->len;
+			memcpy(job->buf, s->s, s->len);
+			unsigned int idx = (GPOINTER_TO_UINT(sfd->stream) >> 4) % rtpe_config.dtls_threads;
+			g_thread_pool_push(dtls_worker_pools[idx], job, NULL);
+			return 0;
+		}
+	}
+
+	return __dtls(sfd, s, fsin);
+}
+
 /* call must be locked */
 void dtls_shutdown(struct packet_stream *ps) {
 
@@ -928,18 +1104,9 @@ void dtls_shutdown(struct packet_stream *ps) {
 }
 
 void dtls_connection_cleanup(struct dtls_connection *c) {
-	if (c->ssl_ctx || c->ssl)
+	if (c->ssl) {
 		ilogs(crypto, LOG_DEBUG, "Resetting DTLS connection context");
-
-	if (c->ssl_ctx)
-		SSL_CTX_free(c->ssl_ctx);
-	if (c->ssl)
-		SSL_free(c->ssl);
-	if (!c->init) {
-		if (c->r_bio)
-			BIO_free(c->r_bio);
-		if (c->w_bio)
-			BIO_free(c->w_bio);
+		SSL_free(c->ssl); // also frees the BIOs
 	}
 	ZERO(*c);
 }
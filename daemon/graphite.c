@@ -15,6 +15,7 @@
 #include <stdlib.h>
 #include <sys/time.h>
 #include <string.h>
+#include <time.h>
 
 #include "log.h"
 #include "call.h"
@@ -25,14 +26,48 @@
 
 struct timeval rtpe_latest_graphite_interval_start;
 
+// upper limit for data not yet accepted by the socket. a new interval's data is dropped
+// when it would go over this
+#define GRAPHITE_BACKLOG_MAX (1024 * 1024)
+
 static socket_t graphite_sock;
 static int connection_state = STATE_DISCONNECTED;
-//struct totalstats totalstats_prev;
-static time_t next_run;
-// HEAD: static time_t rtpe_now, next_run;
+static long long next_run; // monotonic, microseconds
 static char* graphite_prefix = NULL;
+static size_t graphite_prefix_len;
 static struct timeval graphite_interval_tv;
 
+// data to send, starting at graphite_out_pos
+static GString *graphite_out;
+static size_t graphite_out_pos;
+
+// "<prefix><command>..." metric names, built once
+enum {
+	GNG_TIME_MIN = 0,
+	GNG_TIME_MAX,
+	GNG_TIME_AVG,
+	GNG_PS_MIN,
+	GNG_PS_MAX,
+	GNG_PS_AVG,
+	GNG_COUNT,
+
+	__GNG_NUM
+};
+static const char *graphite_ng_suffixes[__GNG_NUM] = {
+	[GNG_TIME_MIN]	= "_time_min",
+	[GNG_TIME_MAX]	= "_time_max",
+	[GNG_TIME_AVG]	= "_time_avg",
+	[GNG_PS_MIN]	= "s_ps_min",
+	[GNG_PS_MAX]	= "s_ps_max",
+	[GNG_PS_AVG]	= "s_ps_avg",
+	[GNG_COUNT]	= "_count",
+};
+static GString *graphite_ng_names[NGC_COUNT][__GNG_NUM];
+
+// " <timestamp>\n", the same for all lines of one run
+static char graphite_ts[32];
+static size_t graphite_ts_len;
+
 struct global_stats_counter rtpe_stats_graphite_diff;		// per-interval increases
 static struct global_stats_counter rtpe_stats_graphite_intv;	// copied out when graphite stats run
 
@@ -55,10 +90,40 @@ void set_graphite_interval_tv(struct timeval *tv) {
 
 void set_prefix(char* prefix) {
 	graphite_prefix = g_strdup(prefix);
+	graphite_prefix_len = strlen(prefix);
 }
 
 void free_prefix(void) {
 	g_free(graphite_prefix);
+	for (int i = 0; i < NGC_COUNT; i++) {
+		for (int j = 0; j < __GNG_NUM; j++) {
+			if (graphite_ng_names[i][j])
+				g_string_free(graphite_ng_names[i][j], TRUE);
+			graphite_ng_names[i][j] = NULL;
+		}
+	}
+	if (graphite_out)
+		g_string_free(graphite_out, TRUE);
+	graphite_out = NULL;
+}
+
+static void graphite_names_init(void) {
+	if (graphite_ng_names[0][0])
+		return;
+	for (int i = 0; i < NGC_COUNT; i++) {
+		for (int j = 0; j < __GNG_NUM; j++) {
+			GString *s = graphite_ng_names[i][j] = g_string_new(graphite_prefix);
+			g_string_append(s, ng_command_strings[i]);
+			g_string_append(s, graphite_ng_suffixes[j]);
+			g_string_append_c(s, ' ');
+		}
+	}
+}
+
+static long long graphite_mono_us(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
 }
 
 static int connect_to_graphite_server(const endpoint_t *graphite_ep) {
@@ -81,8 +146,10 @@ static int connect_to_graphite_server(const endpoint_t *graphite_ep) {
 		ilog(LOG_ERROR,"Couldn't make socket for connecting to graphite.");
 		return -1;
 	}
-	if (rc == 0)
+	if (rc == 0) {
 		ilog(LOG_INFO, "Graphite server connected.");
+		connection_state = STATE_CONNECTED;
+	}
 	else {
 		/* EINPROGRESS */
 		ilog(LOG_INFO, "Connection to graphite is in progress.");
@@ -92,7 +159,61 @@ static int connect_to_graphite_server(const endpoint_t *graphite_ep) {
 	return 0;
 }
 
-GString *print_graphite_data(void) {
+// formatting helpers, avoiding printf for the bulk of the output
+
+INLINE void gp_name(GString *s, const char *name) {
+	if (graphite_prefix_len)
+		g_string_append_len(s, graphite_prefix, graphite_prefix_len);
+	g_string_append(s, name);
+	g_string_append_c(s, ' ');
+}
+static void gp_uint(GString *s, uint64_t v) {
+	char buf[24];
+	char *p = buf + sizeof(buf);
+	do {
+		*--p = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	g_string_append_len(s, p, buf + sizeof(buf) - p);
+}
+static void gp_int(GString *s, int64_t v) {
+	if (v < 0) {
+		g_string_append_c(s, '-');
+		gp_uint(s, -(uint64_t) v);
+	}
+	else
+		gp_uint(s, v);
+}
+// microseconds as seconds with 6 decimals, same as printing us/1000000.0 with "%.6f"
+static void gp_usec(GString *s, int64_t us) {
+	uint64_t u = us;
+	if (us < 0) {
+		g_string_append_c(s, '-');
+		u = -(uint64_t) us;
+	}
+	gp_uint(s, u / 1000000);
+	char frac[7] = ".";
+	u %= 1000000;
+	for (int i = 6; i >= 1; i--) {
+		frac[i] = '0' + u % 10;
+		u /= 10;
+	}
+	g_string_append_len(s, frac, 7);
+}
+INLINE void gp_end(GString *s) {
+	g_string_append_len(s, graphite_ts, graphite_ts_len);
+}
+
+#define GPU(name, v) do { gp_name(s, name); gp_uint(s, v); gp_end(s); } while (0)
+#define GPUS(name, v) do { gp_name(s, name); gp_usec(s, v); gp_end(s); } while (0)
+#define GPNG(i, n, fn, v) do { \
+		g_string_append_len(s, graphite_ng_names[i][n]->str, graphite_ng_names[i][n]->len); \
+		fn(s, v); \
+		gp_end(s); \
+	} while (0)
+
+// appends the metric lines for one interval to the string
+static void graphite_print(GString *s) {
 
 	long long time_diff_us = timeval_diff(&rtpe_now, &rtpe_latest_graphite_interval_start);
 	rtpe_latest_graphite_interval_start = rtpe_now;
@@ -109,24 +230,18 @@ GString *print_graphite_data(void) {
 	stats_sampled_min_max_sample(&rtpe_sampled_graphite_min_max, &rtpe_sampled_graphite_min_max_sampled);
 	stats_sampled_avg(&rtpe_sampled_graphite_avg, &rtpe_sampled_graphite_min_max_diff);
 
-	GString *graph_str = g_string_new("");
-
-#define GPF(fmt, ...) \
-	if (graphite_prefix) \
-		g_string_append(graph_str, graphite_prefix); \
-	g_string_append_printf(graph_str, fmt " %llu\n", ##__VA_ARGS__, (unsigned long long)rtpe_now.tv_sec)
+	graphite_names_init();
+	graphite_ts_len = snprintf(graphite_ts, sizeof(graphite_ts), " %llu\n",
+			(unsigned long long) rtpe_now.tv_sec);
 
 	for (int i = 0; i < NGC_COUNT; i++) {
-		GPF("%s_time_min %.6f", ng_command_strings[i],
-				(double) atomic64_get(&rtpe_sampled_graphite_min_max_sampled.min.ng_command_times[i]) / 1000000.0);
-		GPF("%s_time_max %.6f", ng_command_strings[i],
-				(double) atomic64_get(&rtpe_sampled_graphite_min_max_sampled.max.ng_command_times[i]) / 1000000.0);
-		GPF("%s_time_avg %.6f", ng_command_strings[i],
-				(double) atomic64_get(&rtpe_sampled_graphite_avg.avg.ng_command_times[i]) / 1000000.0);
+		GPNG(i, GNG_TIME_MIN, gp_usec, atomic64_get(&rtpe_sampled_graphite_min_max_sampled.min.ng_command_times[i]));
+		GPNG(i, GNG_TIME_MAX, gp_usec, atomic64_get(&rtpe_sampled_graphite_min_max_sampled.max.ng_command_times[i]));
+		GPNG(i, GNG_TIME_AVG, gp_usec, atomic64_get(&rtpe_sampled_graphite_avg.avg.ng_command_times[i]));
 
-		GPF("%ss_ps_min " UINT64F, ng_command_strings[i], atomic64_get(&rtpe_rate_graphite_min_max_avg_sampled.min.ng_commands[i]));
-		GPF("%ss_ps_max " UINT64F, ng_command_strings[i], atomic64_get(&rtpe_rate_graphite_min_max_avg_sampled.max.ng_commands[i]));
-		GPF("%ss_ps_avg " UINT64F, ng_command_strings[i], atomic64_get(&rtpe_rate_graphite_min_max_avg_sampled.avg.ng_commands[i]));
+		GPNG(i, GNG_PS_MIN, gp_uint, atomic64_get(&rtpe_rate_graphite_min_max_avg_sampled.min.ng_commands[i]));
+		GPNG(i, GNG_PS_MAX, gp_uint, atomic64_get(&rtpe_rate_graphite_min_max_avg_sampled.max.ng_commands[i]));
+		GPNG(i, GNG_PS_AVG, gp_uint, atomic64_get(&rtpe_rate_graphite_min_max_avg_sampled.avg.ng_commands[i]));
 
 		ilog(LOG_DEBUG, "Min/Max/Avg %s processing delay: %.6f/%.6f/%.6f sec",
 			ng_command_strings[i],
@@ -134,48 +249,44 @@ GString *print_graphite_data(void) {
 			(double) atomic64_get(&rtpe_sampled_graphite_min_max_sampled.max.ng_command_times[i]) / 1000000.0,
 			(double) atomic64_get(&rtpe_sampled_graphite_avg.avg.ng_command_times[i]) / 1000000.0);
 
-		GPF("%s_count %" PRIu64, ng_command_strings[i], atomic64_get(&rtpe_stats.ng_commands[i]));
+		GPNG(i, GNG_COUNT, gp_uint, atomic64_get(&rtpe_stats.ng_commands[i]));
 	}
 
-	GPF("call_dur %.6f", (double) atomic64_get_na(&rtpe_stats_graphite_diff.total_calls_duration_intv) / 1000000.0);
-	struct timeval avg_duration;
+	GPUS("call_dur", atomic64_get_na(&rtpe_stats_graphite_diff.total_calls_duration_intv));
 	uint64_t managed_sess = atomic64_get_na(&rtpe_stats_graphite_diff.managed_sess);
-	if (managed_sess)
-		timeval_from_us(&avg_duration, atomic64_get_na(&rtpe_stats_graphite_diff.call_duration) / managed_sess);
-	else
-		avg_duration = (struct timeval) {0,0};
-	GPF("average_call_dur %llu.%06llu",(unsigned long long)avg_duration.tv_sec,(unsigned long long)avg_duration.tv_usec);
-	GPF("forced_term_sess "UINT64F, atomic64_get_na(&rtpe_stats_graphite_diff.forced_term_sess));
-	GPF("managed_sess "UINT64F, atomic64_get(&rtpe_stats.managed_sess));
-	GPF("managed_sess_min "UINT64F, atomic64_get_na(&rtpe_gauge_graphite_min_max_sampled.min.total_sessions));
-	GPF("managed_sess_max "UINT64F, atomic64_get_na(&rtpe_gauge_graphite_min_max_sampled.max.total_sessions));
-	GPF("current_sessions_total "UINT64F, atomic64_get(&rtpe_stats_gauge.total_sessions));
-	GPF("current_sessions_own "UINT64F, atomic64_get(&rtpe_stats_gauge.total_sessions) - atomic64_get(&rtpe_stats_gauge.foreign_sessions));
-	GPF("current_sessions_foreign "UINT64F, atomic64_get(&rtpe_stats_gauge.foreign_sessions));
-	GPF("current_transcoded_media "UINT64F, atomic64_get(&rtpe_stats_gauge.transcoded_media));
-	GPF("current_sessions_ipv4 "UINT64F, atomic64_get(&rtpe_stats_gauge.ipv4_sessions));
-	GPF("current_sessions_ipv6 "UINT64F, atomic64_get(&rtpe_stats_gauge.ipv6_sessions));
-	GPF("current_sessions_mixed "UINT64F, atomic64_get(&rtpe_stats_gauge.mixed_sessions));
-	GPF("nopacket_relayed_sess "UINT64F, atomic64_get_na(&rtpe_stats_graphite_diff.nopacket_relayed_sess));
-	GPF("oneway_stream_sess "UINT64F, atomic64_get_na(&rtpe_stats_graphite_diff.oneway_stream_sess));
-	GPF("regular_term_sess "UINT64F, atomic64_get_na(&rtpe_stats_graphite_diff.regular_term_sess));
-	GPF("relayed_errors_user "UINT64F, atomic64_get_na(&rtpe_stats_graphite_diff.errors_user));
-	GPF("relayed_packets_user "UINT64F, atomic64_get_na(&rtpe_stats_graphite_diff.packets_user));
-	GPF("relayed_bytes_user "UINT64F, atomic64_get_na(&rtpe_stats_graphite_diff.bytes_user));
-	GPF("relayed_errors_kernel "UINT64F, atomic64_get_na(&rtpe_stats_graphite_diff.errors_kernel));
-	GPF("relayed_packets_kernel "UINT64F, atomic64_get_na(&rtpe_stats_graphite_diff.packets_kernel));
-	GPF("relayed_bytes_kernel "UINT64F, atomic64_get_na(&rtpe_stats_graphite_diff.bytes_kernel));
-	GPF("relayed_errors "UINT64F, atomic64_get_na(&rtpe_stats_graphite_diff.errors_user) +
+	GPUS("average_call_dur", managed_sess
+			? atomic64_get_na(&rtpe_stats_graphite_diff.call_duration) / managed_sess : 0);
+	GPU("forced_term_sess", atomic64_get_na(&rtpe_stats_graphite_diff.forced_term_sess));
+	GPU("managed_sess", atomic64_get(&rtpe_stats.managed_sess));
+	GPU("managed_sess_min", atomic64_get_na(&rtpe_gauge_graphite_min_max_sampled.min.total_sessions));
+	GPU("managed_sess_max", atomic64_get_na(&rtpe_gauge_graphite_min_max_sampled.max.total_sessions));
+	GPU("current_sessions_total", atomic64_get(&rtpe_stats_gauge.total_sessions));
+	GPU("current_sessions_own", atomic64_get(&rtpe_stats_gauge.total_sessions) - atomic64_get(&rtpe_stats_gauge.foreign_sessions));
+	GPU("current_sessions_foreign", atomic64_get(&rtpe_stats_gauge.foreign_sessions));
+	GPU("current_transcoded_media", atomic64_get(&rtpe_stats_gauge.transcoded_media));
+	GPU("current_sessions_ipv4", atomic64_get(&rtpe_stats_gauge.ipv4_sessions));
+	GPU("current_sessions_ipv6", atomic64_get(&rtpe_stats_gauge.ipv6_sessions));
+	GPU("current_sessions_mixed", atomic64_get(&rtpe_stats_gauge.mixed_sessions));
+	GPU("nopacket_relayed_sess", atomic64_get_na(&rtpe_stats_graphite_diff.nopacket_relayed_sess));
+	GPU("oneway_stream_sess", atomic64_get_na(&rtpe_stats_graphite_diff.oneway_stream_sess));
+	GPU("regular_term_sess", atomic64_get_na(&rtpe_stats_graphite_diff.regular_term_sess));
+	GPU("relayed_errors_user", atomic64_get_na(&rtpe_stats_graphite_diff.errors_user));
+	GPU("relayed_packets_user", atomic64_get_na(&rtpe_stats_graphite_diff.packets_user));
+	GPU("relayed_bytes_user", atomic64_get_na(&rtpe_stats_graphite_diff.bytes_user));
+	GPU("relayed_errors_kernel", atomic64_get_na(&rtpe_stats_graphite_diff.errors_kernel));
+	GPU("relayed_packets_kernel", atomic64_get_na(&rtpe_stats_graphite_diff.packets_kernel));
+	GPU("relayed_bytes_kernel", atomic64_get_na(&rtpe_stats_graphite_diff.bytes_kernel));
+	GPU("relayed_errors", atomic64_get_na(&rtpe_stats_graphite_diff.errors_user) +
 			atomic64_get_na(&rtpe_stats_graphite_diff.errors_kernel));
-	GPF("relayed_packets "UINT64F, atomic64_get_na(&rtpe_stats_graphite_diff.packets_user) +
+	GPU("relayed_packets", atomic64_get_na(&rtpe_stats_graphite_diff.packets_user) +
 			atomic64_get_na(&rtpe_stats_graphite_diff.packets_kernel));
-	GPF("relayed_bytes "UINT64F, atomic64_get_na(&rtpe_stats_graphite_diff.bytes_user) +
+	GPU("relayed_bytes", atomic64_get_na(&rtpe_stats_graphite_diff.bytes_user) +
 			atomic64_get_na(&rtpe_stats_graphite_diff.bytes_kernel));
-	GPF("silent_timeout_sess "UINT64F, atomic64_get_na(&rtpe_stats_graphite_diff.silent_timeout_sess));
-	GPF("final_timeout_sess "UINT64F, atomic64_get_na(&rtpe_stats_graphite_diff.final_timeout_sess));
-	GPF("offer_timeout_sess "UINT64F, atomic64_get_na(&rtpe_stats_graphite_diff.offer_timeout_sess));
-	GPF("timeout_sess "UINT64F, atomic64_get_na(&rtpe_stats_graphite_diff.timeout_sess));
-	GPF("reject_sess "UINT64F, atomic64_get_na(&rtpe_stats_graphite_diff.rejected_sess));
+	GPU("silent_timeout_sess", atomic64_get_na(&rtpe_stats_graphite_diff.silent_timeout_sess));
+	GPU("final_timeout_sess", atomic64_get_na(&rtpe_stats_graphite_diff.final_timeout_sess));
+	GPU("offer_timeout_sess", atomic64_get_na(&rtpe_stats_graphite_diff.offer_timeout_sess));
+	GPU("timeout_sess", atomic64_get_na(&rtpe_stats_graphite_diff.timeout_sess));
+	GPU("reject_sess", atomic64_get_na(&rtpe_stats_graphite_diff.rejected_sess));
 
 	for (GList *l = all_local_interfaces.head; l; l = l->next) {
 		struct local_intf *lif = l->data;
@@ -183,12 +294,19 @@ GString *print_graphite_data(void) {
 		if (lif->logical->preferred_family != lif->spec->local_address.addr.family)
 			continue;
 		int num_ports = lif->spec->port_pool.max - lif->spec->port_pool.min + 1;
-		GPF("ports_free_%s_%s %i", lif->logical->name.s,
-				sockaddr_print_buf(&lif->spec->local_address.addr),
-				g_hash_table_size(lif->spec->port_pool.free_ports_ht));
-		GPF("ports_used_%s_%s %i", lif->logical->name.s,
-				sockaddr_print_buf(&lif->spec->local_address.addr),
-				num_ports - g_hash_table_size(lif->spec->port_pool.free_ports_ht));
+		int free_ports = g_hash_table_size(lif->spec->port_pool.free_ports_ht);
+		const char *addr = sockaddr_print_buf(&lif->spec->local_address.addr);
+		for (int used = 0; used < 2; used++) {
+			if (graphite_prefix_len)
+				g_string_append_len(s, graphite_prefix, graphite_prefix_len);
+			g_string_append(s, used ? "ports_used_" : "ports_free_");
+			g_string_append_len(s, lif->logical->name.s, lif->logical->name.len);
+			g_string_append_c(s, '_');
+			g_string_append(s, addr);
+			g_string_append_c(s, ' ');
+			gp_int(s, used ? num_ports - free_ports : free_ports);
+			gp_end(s);
+		}
 	}
 
 	mutex_lock(&rtpe_codec_stats_lock);
@@ -199,16 +317,30 @@ GString *print_graphite_data(void) {
 	for (GList *l = chains; l; l = l->next) {
 		char *chain = l->data;
 		struct codec_stats *stats_entry = g_hash_table_lookup(rtpe_codec_stats, chain);
-		GPF("transcoder_%s %i", stats_entry->chain_brief,
-				g_atomic_int_get(&stats_entry->num_transcoders));
+		size_t name_start = s->len;
+		if (graphite_prefix_len)
+			g_string_append_len(s, graphite_prefix, graphite_prefix_len);
+		g_string_append(s, "transcoder_");
+		g_string_append(s, stats_entry->chain_brief);
+		size_t name_len = s->len - name_start;
+		g_string_append_c(s, ' ');
+		gp_int(s, g_atomic_int_get(&stats_entry->num_transcoders));
+		gp_end(s);
 		if (g_atomic_int_get(&stats_entry->last_tv_sec[idx]) != last_tv_sec)
 			continue;
-		GPF("transcoder_%s_packets %llu", stats_entry->chain_brief,
-				(unsigned long long) atomic64_get(&stats_entry->packets_input[idx]));
-		GPF("transcoder_%s_bytes %llu", stats_entry->chain_brief,
-				(unsigned long long) atomic64_get(&stats_entry->bytes_input[idx]));
-		GPF("transcoder_%s_samples %llu", stats_entry->chain_brief,
-				(unsigned long long) atomic64_get(&stats_entry->pcm_samples[idx]));
+		static const char *suffixes[3] = { "_packets ", "_bytes ", "_samples " };
+		uint64_t values[3] = {
+			atomic64_get(&stats_entry->packets_input[idx]),
+			atomic64_get(&stats_entry->bytes_input[idx]),
+			atomic64_get(&stats_entry->pcm_samples[idx]),
+		};
+		for (int j = 0; j < 3; j++) {
+			// repeat the name from the line above
+			g_string_append_len(s, s->str + name_start, name_len);
+			g_string_append(s, suffixes[j]);
+			gp_uint(s, values[j]);
+			gp_end(s);
+		}
 	}
 
 	mutex_unlock(&rtpe_codec_stats_lock);
@@ -221,10 +353,56 @@ GString *print_graphite_data(void) {
 			(unsigned long long) atomic64_get_na(&rtpe_gauge_graphite_min_max_sampled.max.total_sessions),
 			(double) atomic64_get_na(&rtpe_stats_graphite_diff.total_calls_duration_intv) / 1000000.0,
 			(unsigned long long ) rtpe_now.tv_sec);
+}
+
+#undef GPU
+#undef GPUS
+#undef GPNG
 
+GString *print_graphite_data(void) {
+	GString *graph_str = g_string_new("");
+	graphite_print(graph_str);
 	return graph_str;
 }
 
+static void graphite_disconnect(void) {
+	close_socket(&graphite_sock);
+	connection_state = STATE_DISCONNECTED;
+	// a new connection must not start with the rest of a line
+	if (graphite_out)
+		g_string_truncate(graphite_out, 0);
+	graphite_out_pos = 0;
+}
+
+// writes out as much of the backlog as the socket takes without blocking
+static int graphite_flush(void) {
+	while (graphite_out_pos < graphite_out->len) {
+		ssize_t rc = send(graphite_sock.fd, graphite_out->str + graphite_out_pos,
+				graphite_out->len - graphite_out_pos, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EWOULDBLOCK || errno == EAGAIN)
+				break;
+			ilog(LOG_ERROR,"Could not write to graphite socket (%s). " \
+					"Disconnecting graphite server.", strerror(errno));
+			return -1;
+		}
+		graphite_out_pos += rc;
+	}
+
+	if (graphite_out_pos == graphite_out->len) {
+		g_string_truncate(graphite_out, 0);
+		graphite_out_pos = 0;
+	}
+	else if (graphite_out_pos >= graphite_out->len / 2) {
+		g_string_erase(graphite_out, 0, graphite_out_pos);
+		graphite_out_pos = 0;
+	}
+
+	return 0;
+}
+
 static int send_graphite_data(void) {
 
 	if (graphite_sock.fd < 0) {
@@ -232,90 +410,91 @@ static int send_graphite_data(void) {
 		return -1;
 	}
 
-	GString *graph_str = print_graphite_data();
-
-	size_t sent = 0;
-	int blockings = 10; // let it block that many times
-	while (sent < graph_str->len) {
-		int rc = write(graphite_sock.fd, graph_str->str + sent, graph_str->len - sent);
-		if (rc<0) {
-			if (blockings <= 0 || (errno != EWOULDBLOCK && errno != EAGAIN && errno != EINTR)) {
-				ilog(LOG_ERROR,"Could not write to graphite socket (%s). " \
-						"Disconnecting graphite server.", strerror(errno));
-				goto error;
-			}
-			rc = 0;
-		}
-		if (rc == 0) {
-			// poor man's blocking handling
-			blockings--;
-			usleep(500000);
-			continue;
-		}
-		sent += rc;
+	if (!graphite_out)
+		graphite_out = g_string_sized_new(65536);
+
+	// the stats must be sampled in any case to keep the intervals right, but if the
+	// server can't keep up, the new data is discarded
+	size_t old_len = graphite_out->len;
+	graphite_print(graphite_out);
+	if (graphite_out->len - graphite_out_pos > GRAPHITE_BACKLOG_MAX) {
+		ilog(LOG_WARN | LOG_FLAG_LIMIT, "Graphite server is not keeping up, " \
+				"discarding data (%zu bytes pending)", old_len - graphite_out_pos);
+		g_string_truncate(graphite_out, old_len);
 	}
 
-	g_string_free(graph_str, TRUE);
-	return 0;
-
-error:
-	g_string_free(graph_str, TRUE);
-	close_socket(&graphite_sock);
-	return -1;
+	return graphite_flush();
 }
 
 
-static void graphite_loop_run(endpoint_t *graphite_ep, int seconds) {
-
-	int rc=0;
-	struct pollfd wfds[1];
+// waits for up to the given time (but no longer than 100 ms) while completing a
+// connection in progress and writing out pending data
+static void graphite_wait(long long us) {
+	int ms = MIN(us / 1000 + 1, 100);
 
-        if (!graphite_ep) {
-                ilog(LOG_ERROR, "NULL graphite_ep");
-                return ;
-        }
+	bool pending = graphite_out && graphite_out_pos < graphite_out->len;
+	if (graphite_sock.fd < 0 || connection_state == STATE_DISCONNECTED
+			|| (connection_state == STATE_CONNECTED && !pending))
+	{
+		usleep(ms * 1000);
+		return;
+	}
 
-	if (connection_state == STATE_IN_PROGRESS && graphite_sock.fd >= 0) {
-		wfds[0].fd=graphite_sock.fd;
-		wfds[0].events = POLLOUT | POLLERR | POLLHUP | POLLNVAL;
+	struct pollfd pfd = { .fd = graphite_sock.fd, .events = POLLOUT };
 
-		rc = poll(wfds,1,1000);
-		if (rc == -1) {
-			ilog(LOG_ERROR,"Error on the socket.");
-			close_socket(&graphite_sock);
-			connection_state = STATE_DISCONNECTED;
+	int rc = poll(&pfd, 1, ms);
+	if (rc == -1) {
+		if (errno == EINTR)
 			return;
-		} else if (rc==0) {
-			// timeout
+		ilog(LOG_ERROR,"Error on the socket.");
+		graphite_disconnect();
+		return;
+	}
+	if (rc == 0) // timeout
+		return;
+
+	if (!(pfd.revents & POLLOUT)) {
+		ilog(LOG_WARN,"fd is active but not ready for writing, poll events=%x", pfd.revents);
+		graphite_disconnect();
+		return;
+	}
+
+	if (connection_state == STATE_IN_PROGRESS) {
+		rc = socket_error(&graphite_sock);
+		if (rc < 0) ilog(LOG_ERROR,"getsockopt failure.");
+		if (rc != 0) {
+			ilog(LOG_ERROR,"Socket connect failed. fd: %i, Reason: %s\n",graphite_sock.fd, strerror(rc));
+			graphite_disconnect();
 			return;
-		} else {
-			if (!(wfds[0].revents & POLLOUT)) {
-				ilog(LOG_WARN,"fd is active but not ready for writing, poll events=%x",wfds[0].revents);
-				close_socket(&graphite_sock);
-				connection_state = STATE_DISCONNECTED;
-				return;
-			}
-			rc = socket_error(&graphite_sock);
-			if (rc < 0) ilog(LOG_ERROR,"getsockopt failure.");
-			if (rc != 0) {
-				ilog(LOG_ERROR,"Socket connect failed. fd: %i, Reason: %s\n",graphite_sock.fd, strerror(rc));
-				close_socket(&graphite_sock);
-				connection_state = STATE_DISCONNECTED;
-				return;
-			}
-			ilog(LOG_INFO, "Graphite server connected.");
-			connection_state = STATE_CONNECTED;
-			next_run=0; // fake next run to skip sleep after reconnect
 		}
+		ilog(LOG_INFO, "Graphite server connected.");
+		connection_state = STATE_CONNECTED;
+		next_run = 0; // send right away after reconnect
+		return;
 	}
 
-	gettimeofday(&rtpe_now, NULL);
-	if (rtpe_now.tv_sec < next_run) {
-		usleep(100000);
+	if (graphite_flush())
+		graphite_disconnect();
+}
+
+
+static void graphite_loop_run(endpoint_t *graphite_ep, long long interval) {
+
+        if (!graphite_ep) {
+                ilog(LOG_ERROR, "NULL graphite_ep");
+                return ;
+        }
+
+	long long now = graphite_mono_us();
+	if (now < next_run) {
+		graphite_wait(next_run - now);
 		return;
 	}
 
-	next_run = rtpe_now.tv_sec + seconds;
+	// fixed schedule, unless we've fallen behind by a whole interval
+	next_run += interval;
+	if (next_run <= now)
+		next_run = now + interval;
 
 	if (graphite_sock.fd < 0 && connection_state == STATE_DISCONNECTED) {
 		connect_to_graphite_server(graphite_ep);
@@ -325,11 +504,9 @@ static void graphite_loop_run(endpoint_t *graphite_ep, int seconds) {
 		add_total_calls_duration_in_interval(&graphite_interval_tv);
 
 		gettimeofday(&rtpe_now, NULL);
-		rc = send_graphite_data();
-		if (rc < 0) {
+		if (send_graphite_data() < 0) {
 			ilog(LOG_ERROR,"Sending graphite data failed.");
-			close_socket(&graphite_sock);
-			connection_state = STATE_DISCONNECTED;
+			graphite_disconnect();
 		}
 	}
 
@@ -341,8 +518,13 @@ void graphite_loop(void *d) {
 		rtpe_config.graphite_interval=1;
 	}
 
+	// normally the configured interval, see set_graphite_interval_tv()
+	long long interval = timeval_us(&graphite_interval_tv);
+	if (interval <= 0)
+		interval = rtpe_config.graphite_interval * 1000000LL;
+
 	connect_to_graphite_server(&rtpe_config.graphite_ep);
 
 	while (!rtpe_shutdown)
-		graphite_loop_run(&rtpe_config.graphite_ep, rtpe_config.graphite_interval); // time in seconds
+		graphite_loop_run(&rtpe_config.graphite_ep, interval);
 }
@@ -8,30 +8,58 @@
 #include <string.h>
 #include <glib.h>
 #include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include "log.h"
 #include "helpers.h"
 #include "str.h"
+#include "main.h"
+#include "statistics.h"
 
 
 
 
-#define SEND_QUEUE_LIMIT 200
+// largest HEP packet that can be queued, anything bigger is dropped
+#define HOMER_MSG_MAX 4096
+// max number of messages handed to the kernel in one go
+#define HOMER_BATCH 64
 
 
 
 
-struct homer_sender {
-	mutex_t		lock;
+struct homer_msg {
+	int		seq;		// ring position this slot is ready for, see below
+	unsigned int	len;
+	char		buf[HOMER_MSG_MAX];
+};
 
+struct homer_sender {
 	endpoint_t	endpoint;
 	int		protocol;
 	int		capture_id;
+	unsigned int	sample;
+
+	// Bounded lock-free MPSC ring. Producers claim slot `head` by advancing it and
+	// publish it by setting its `seq` to head + 1. The exporter thread is the only
+	// consumer and hands the slot back by setting `seq` to tail + ring size.
+	struct homer_msg *ring;
+	unsigned int	ring_mask;
+	int		head;
+
+	// the exporter thread sleeps on `cond` when the ring is empty. producers only take
+	// the lock to wake it up if `sleeping` is set
+	mutex_t		lock;
+	cond_t		cond;
+	int		sleeping;
+
+	// everything below is only touched by the exporter thread
+	unsigned int	tail;
+	unsigned int	partial;	// bytes of the message at `tail` already written
 	socket_t	socket;
 	time_t		retry;
-
-	GQueue		send_queue;
-	GString		*partial;
+	uint64_t	drops_logged;
+	time_t		drops_log_time;
 
 	int		(*state)(struct homer_sender *);
 };
@@ -43,8 +71,8 @@ static struct homer_sender *main_homer_sender;
 
 
 
-static int send_hepv3 (GString *s, const str *id, int, const endpoint_t *src, const endpoint_t *dst,
-		const struct timeval *);
+static int send_hepv3 (char *buffer, size_t bufsize, const str *s, const str *id, int,
+		const endpoint_t *src, const endpoint_t *dst, const struct timeval *);
 
 // state handlers
 static int __established(struct homer_sender *hs);
@@ -54,6 +82,41 @@ static int __no_socket(struct homer_sender *hs);
 
 
 
+// producer side: returns NULL if the ring is full
+static struct homer_msg *homer_ring_claim(struct homer_sender *hs, unsigned int *posp) {
+	unsigned int pos = g_atomic_int_get(&hs->head);
+
+	while (1) {
+		struct homer_msg *m = &hs->ring[pos & hs->ring_mask];
+		int diff = (int) ((unsigned int) g_atomic_int_get(&m->seq) - pos);
+		if (diff == 0) {
+			if (g_atomic_int_compare_and_exchange(&hs->head, (int) pos, (int) (pos + 1))) {
+				*posp = pos;
+				return m;
+			}
+		}
+		else if (diff < 0)
+			return NULL; // not consumed yet
+		pos = g_atomic_int_get(&hs->head);
+	}
+}
+
+// consumer side: the `idx`th message after the tail, if it's been published yet
+static struct homer_msg *homer_ring_peek(struct homer_sender *hs, unsigned int idx) {
+	unsigned int pos = hs->tail + idx;
+	struct homer_msg *m = &hs->ring[pos & hs->ring_mask];
+	if ((unsigned int) g_atomic_int_get(&m->seq) != pos + 1)
+		return NULL;
+	return m;
+}
+
+static void homer_ring_release(struct homer_sender *hs) {
+	struct homer_msg *m = &hs->ring[hs->tail & hs->ring_mask];
+	g_atomic_int_set(&m->seq, (int) (hs->tail + hs->ring_mask + 1));
+	hs->tail++;
+	hs->partial = 0;
+}
+
 static void __reset(struct homer_sender *hs) {
 	close_socket(&hs->socket);
 	hs->state = __no_socket;
@@ -61,40 +124,12 @@ static void __reset(struct homer_sender *hs) {
 
 	// discard partially written packet
 	if (hs->partial)
-		g_string_free(hs->partial, TRUE);
-	hs->partial = NULL;
-}
-
-static int __attempt_send(struct homer_sender *hs, GString *gs) {
-	int ret;
-
-	ret = write(hs->socket.fd, gs->str, gs->len);
-	if (ret == gs->len) {
-		// full write
-		g_string_free(gs, TRUE);
-		return 0;
-	}
-	if (ret < 0) {
-		if (errno != EWOULDBLOCK && errno != EAGAIN) {
-			ilog(LOG_ERR, "Write error to Homer at %s: %s",
-					endpoint_print_buf(&hs->endpoint), strerror(errno));
-			__reset(hs);
-			return 1;
-		}
-		ilog(LOG_DEBUG, "Home write blocked");
-		// XXX use poller for blocked writes?
-		return 2;
-	}
-	// partial write
-	ilog(LOG_DEBUG, "Home write blocked (partial write)");
-	g_string_erase(gs, 0, ret);
-	return 3;
+		homer_ring_release(hs);
 }
 
 static int __established(struct homer_sender *hs) {
 	char buf[16];
 	int ret;
-	GString *gs;
 
 	// test connection with a dummy read
 	ret = read(hs->socket.fd, buf, sizeof(buf));
@@ -108,35 +143,6 @@ static int __established(struct homer_sender *hs) {
 	}
 	// XXX handle return data from Homer?
 
-	if (hs->partial) {
-		ilog(LOG_DEBUG, "dequeue partial packet to Homer");
-		ret = __attempt_send(hs, hs->partial);
-		if (ret == 3 || ret == 2) // partial write or not sent at all
-			return 0;
-		if (ret == 1) // write error, takes care of deleting hs->partial
-			return -1;
-		// ret == 0 -> sent OK, drop through to unqueue
-		hs->partial = NULL;
-	}
-
-	// unqueue as much as we can
-	while ((gs = g_queue_pop_head(&hs->send_queue))) {
-		ilog(LOG_DEBUG, "dequeue send queue to Homer");
-		ret = __attempt_send(hs, gs);
-		if (ret == 0) // everything sent OK
-			continue;
-		if (ret == 3) { // partial write
-			hs->partial = gs;
-			return 0;
-		}
-		g_queue_push_head(&hs->send_queue, gs);
-		if (ret == 1) // write error
-			return -1;
-		// ret == 2 -> blocked
-		return 0;
-	}
-
-	// everything unqueued
 	return 0;
 }
 
@@ -181,6 +187,165 @@ static int __no_socket(struct homer_sender *hs) {
 	return __check_conn(hs, ret);
 }
 
+// collects up to HOMER_BATCH queued messages, starting with what's left of a partially
+// written one
+static unsigned int homer_ring_batch(struct homer_sender *hs, struct iovec *iov) {
+	unsigned int num = 0;
+	struct homer_msg *m;
+
+	while (num < HOMER_BATCH && (m = homer_ring_peek(hs, num))) {
+		if (!m->len) {
+			// failed to render, can only be skipped once it's at the tail
+			if (num)
+				break;
+			homer_ring_release(hs);
+			continue;
+		}
+		iov[num].iov_base = m->buf;
+		iov[num].iov_len = m->len;
+		num++;
+	}
+
+	if (num) {
+		iov[0].iov_base += hs->partial;
+		iov[0].iov_len -= hs->partial;
+	}
+
+	return num;
+}
+
+static void homer_write_error(struct homer_sender *hs) {
+	ilog(LOG_ERR, "Write error to Homer at %s: %s",
+			endpoint_print_buf(&hs->endpoint), strerror(errno));
+	__reset(hs);
+}
+
+// UDP: one datagram per message, all in one syscall
+static unsigned int homer_flush_dgram(struct homer_sender *hs) {
+	struct iovec iov[HOMER_BATCH];
+	struct mmsghdr mm[HOMER_BATCH];
+
+	unsigned int num = homer_ring_batch(hs, iov);
+	if (!num)
+		return 0;
+
+	for (unsigned int i = 0; i < num; i++)
+		mm[i] = (struct mmsghdr) { .msg_hdr = { .msg_iov = &iov[i], .msg_iovlen = 1 } };
+
+	int ret = sendmmsg(hs->socket.fd, mm, num, MSG_DONTWAIT);
+	if (ret < 0) {
+		if (errno != EWOULDBLOCK && errno != EAGAIN)
+			homer_write_error(hs);
+		else
+			ilog(LOG_DEBUG, "Homer write blocked");
+		return 0;
+	}
+
+	for (int i = 0; i < ret; i++)
+		homer_ring_release(hs);
+	RTPE_STATS_ADD(homer_messages, ret);
+
+	return ret;
+}
+
+// TCP: gathered into one write, which may end in the middle of a message
+static unsigned int homer_flush_stream(struct homer_sender *hs) {
+	struct iovec iov[HOMER_BATCH];
+
+	unsigned int num = homer_ring_batch(hs, iov);
+	if (!num)
+		return 0;
+
+	ssize_t ret = writev(hs->socket.fd, iov, num);
+	if (ret < 0) {
+		if (errno != EWOULDBLOCK && errno != EAGAIN)
+			homer_write_error(hs);
+		else
+			ilog(LOG_DEBUG, "Homer write blocked");
+		return 0;
+	}
+
+	unsigned int done = 0;
+	while (done < num && ret >= iov[done].iov_len) {
+		ret -= iov[done].iov_len;
+		homer_ring_release(hs);
+		done++;
+	}
+	RTPE_STATS_ADD(homer_messages, done);
+
+	if (done < num) {
+		ilog(LOG_DEBUG, "Homer write blocked (partial write)");
+		hs->partial += ret;
+		return 0;
+	}
+
+	return num;
+}
+
+// runs in its own thread
+enum thread_looper_action homer_exporter(void) {
+	struct homer_sender *hs = main_homer_sender;
+
+	if (!hs)
+		return TLA_BREAK;
+
+	hs->state(hs);
+	if (hs->state == __established) {
+		unsigned int (*flush)(struct homer_sender *) =
+			(hs->protocol == SOCK_STREAM) ? homer_flush_stream : homer_flush_dgram;
+		while (flush(hs) == HOMER_BATCH)
+			;
+	}
+
+	uint64_t drops = atomic64_get(&rtpe_stats.homer_drops);
+	if (drops != hs->drops_logged && rtpe_now.tv_sec != hs->drops_log_time) {
+		ilog(LOG_WARN, "Dropped %" PRIu64 " Homer message(s) as the send queue was full",
+				drops - hs->drops_logged);
+		hs->drops_logged = drops;
+		hs->drops_log_time = rtpe_now.tv_sec;
+	}
+
+	return TLA_CONTINUE;
+}
+
+// runs in its own thread
+void homer_loop(void *p) {
+	struct homer_sender *hs = main_homer_sender;
+
+	struct thread_waker waker = { .lock = &hs->lock, .cond = &hs->cond };
+	thread_waker_add(&waker);
+
+	while (!rtpe_shutdown) {
+		gettimeofday(&rtpe_now, NULL);
+
+		unsigned int tail = hs->tail;
+		homer_exporter();
+
+		// more work queued up while we were sending
+		bool backlog = homer_ring_peek(hs, 0) != NULL;
+		if (backlog && hs->tail != tail)
+			continue;
+
+		mutex_lock(&hs->lock);
+		g_atomic_int_set(&hs->sleeping, 1);
+		// re-check after announcing ourselves, so that a wake-up can't get lost
+		if (backlog || !homer_ring_peek(hs, 0)) {
+			// if the socket is blocked or not connected, retry sending the backlog
+			// shortly. otherwise wait for a new message, waking up regularly to
+			// handle reconnects
+			struct timeval tv;
+			gettimeofday(&tv, NULL);
+			timeval_add_usec(&tv, backlog ? 10000 : 1000000);
+			if (!rtpe_shutdown)
+				cond_timedwait(&hs->cond, &hs->lock, &tv);
+		}
+		g_atomic_int_set(&hs->sleeping, 0);
+		mutex_unlock(&hs->lock);
+	}
+
+	thread_waker_del(&waker);
+}
+
 void homer_sender_init(const endpoint_t *ep, int protocol, int capture_id) {
 	struct homer_sender *ret;
 
@@ -191,11 +356,22 @@ void homer_sender_init(const endpoint_t *ep, int protocol, int capture_id) {
 
 	ret = malloc(sizeof(*ret));
 	ZERO(*ret);
-	mutex_init(&ret->lock);
 	ret->endpoint = *ep;
 	ret->protocol = protocol;
 	ret->capture_id = capture_id;
+	ret->sample = rtpe_config.homer_sample;
 	ret->retry = time(NULL);
+	ret->drops_logged = atomic64_get(&rtpe_stats.homer_drops);
+
+	unsigned int size = 1;
+	while (size < rtpe_config.homer_queue)
+		size <<= 1;
+	ret->ring = g_new0(struct homer_msg, size);
+	ret->ring_mask = size - 1;
+	for (unsigned int i = 0; i < size; i++)
+		ret->ring[i].seq = i;
+	mutex_init(&ret->lock);
+	cond_init(&ret->cond);
 
 	ret->state = __no_socket;
 
@@ -204,35 +380,61 @@ void homer_sender_init(const endpoint_t *ep, int protocol, int capture_id) {
 	return;
 }
 
-// takes over the GString
-int homer_send(GString *s, const str *id, const endpoint_t *src,
+void homer_sender_free(void) {
+	struct homer_sender *hs = main_homer_sender;
+	if (!hs)
+		return;
+	main_homer_sender = NULL;
+	close_socket(&hs->socket);
+	g_free(hs->ring);
+	mutex_destroy(&hs->lock);
+	free(hs);
+}
+
+// only a few calls are exported if sampling is enabled, chosen by call ID
+static bool homer_sampled(struct homer_sender *hs, const str *id) {
+	if (hs->sample <= 1)
+		return true;
+	return (str_hash(id) % hs->sample) == 0;
+}
+
+// the HEP packet is rendered straight into the send queue, never blocks
+int homer_send(const str *s, const str *id, const endpoint_t *src,
 		const endpoint_t *dst, const struct timeval *tv)
 {
-	if (!main_homer_sender)
-		goto out;
-	if (!s)
-		goto out;
-	if (!s->len) // empty write, shouldn't happen
-		goto out;
-
-	ilog(LOG_DEBUG, "JSON to send to Homer: '"STR_FORMAT"'", G_STR_FMT(s));
-
-	if (send_hepv3(s, id, main_homer_sender->capture_id, src, dst, tv))
-		goto out;
-
-	mutex_lock(&main_homer_sender->lock);
-	if (main_homer_sender->send_queue.length < SEND_QUEUE_LIMIT) {
-		g_queue_push_tail(&main_homer_sender->send_queue, s);
-		s = NULL;
+	struct homer_sender *hs = main_homer_sender;
+
+	if (!hs)
+		return 0;
+	if (!s || !s->len) // empty write, shouldn't happen
+		return 0;
+	if (!homer_sampled(hs, id))
+		return 0;
+
+	ilog(LOG_DEBUG, "JSON to send to Homer: '"STR_FORMAT"'", STR_FMT(s));
+
+	unsigned int pos;
+	struct homer_msg *m = homer_ring_claim(hs, &pos);
+	if (!m) {
+		RTPE_STATS_INC(homer_drops);
+		return 0;
+	}
+
+	int len = send_hepv3(m->buf, sizeof(m->buf), s, id, hs->capture_id, src, dst, tv);
+	if (len < 0) {
+		ilog(LOG_WARN, "Homer message too large (%zu bytes of JSON), dropping", s->len);
+		RTPE_STATS_INC(homer_drops);
+		len = 0;
+	}
+	m->len = len;
+	g_atomic_int_set(&m->seq, (int) (pos + 1));
+
+	if (g_atomic_int_get(&hs->sleeping)) {
+		mutex_lock(&hs->lock);
+		cond_signal(&hs->cond);
+		mutex_unlock(&hs->lock);
 	}
-	else
-		ilog(LOG_ERR, "Send queue length limit (%i) reached, dropping Homer message", SEND_QUEUE_LIMIT);
-	main_homer_sender->state(main_homer_sender);
-	mutex_unlock(&main_homer_sender->lock);
-
-out:
-	if (s)
-		g_string_free(s, TRUE);
+
 	return 0;
 }
 
@@ -323,13 +525,12 @@ typedef struct hep_generic hep_generic_t;
 
 #define PROTO_RTCP_JSON   0x05
 
-// modifies the GString in place
-static int send_hepv3 (GString *s, const str *id, int capt_id, const endpoint_t *src, const endpoint_t *dst,
-		const struct timeval *tv)
+// renders the HEP packet for payload `s` into `buffer`, returns its length or -1 if it doesn't fit
+static int send_hepv3 (char *buffer, size_t bufsize, const str *s, const str *id, int capt_id,
+		const endpoint_t *src, const endpoint_t *dst, const struct timeval *tv)
 {
 
-    struct hep_generic *hg=NULL;
-    void* buffer;
+    struct hep_generic hg_s, *hg=&hg_s;
     unsigned int buflen=0, iplen=0,tlen=0;
     hep_chunk_ip4_t src_ip4, dst_ip4;
     hep_chunk_ip6_t src_ip6, dst_ip6;
@@ -338,7 +539,6 @@ static int send_hepv3 (GString *s, const str *id, int capt_id, const endpoint_t
     hep_chunk_t correlation_chunk;
     //static int errors = 0;
 
-    hg = malloc(sizeof(struct hep_generic));
     memset(hg, 0, sizeof(struct hep_generic));
 
 
@@ -460,16 +660,12 @@ static int send_hepv3 (GString *s, const str *id, int capt_id, const endpoint_t
              tlen += id->len;
     //}
 
+    if (tlen > bufsize)
+        return -1;
+
     /* total */
     hg->header.length = htons(tlen);
 
-    buffer = (void*)malloc(tlen);
-    if (buffer==0){
-        ilog(LOG_ERR, "ERROR: out of memory");
-        free(hg);
-        return -1;
-    }
-
     memcpy((void*) buffer, hg, sizeof(struct hep_generic));
     buflen = sizeof(struct hep_generic);
 
@@ -521,7 +717,7 @@ static int send_hepv3 (GString *s, const str *id, int capt_id, const endpoint_t
     buflen +=  sizeof(struct hep_chunk);
 
     /* Now copying payload self */
-    memcpy((void*) buffer+buflen, s->str, s->len);
+    memcpy((void*) buffer+buflen, s->s, s->len);
     buflen+=s->len;
 
 #if 0
@@ -555,14 +751,9 @@ static int send_hepv3 (GString *s, const str *id, int capt_id, const endpoint_t
     }
 #endif
 
-    g_string_truncate(s, 0);
-    g_string_append_len(s, buffer, buflen);
-
-    /* FREE */
-    free(buffer);
-    free(hg);
+    assert(buflen == tlen);
 
-    return 0;
+    return tlen;
 }
 
 int has_homer() {
@@ -104,7 +104,7 @@ static void ice_update_media_streams(struct call_monologue *ml, GQueue *streams)
 		struct call_media *media = NULL;
 
 		if (sp->media_id.len)
-			media = g_hash_table_lookup(ml->media_ids, &sp->media_id);
+			media = lazy_str_ht_lookup(ml->media_ids, &sp->media_id);
 		else if (sp->index > 0) {
 			unsigned int arr_idx = sp->index - 1;
 			if (arr_idx < ml->medias->len)
@@ -401,6 +401,14 @@ static int __pair_prio_cmp(const void *a, const void *b) {
 	return 0;
 }
 
+// called with the call locked in W, as STUN processing uses the keys with the call locked in R
+static void __ice_agent_pwd_key(struct ice_agent *ag, unsigned int idx) {
+	if (ag->pwd[idx].s)
+		hmac_sha1_key_init(&ag->pwd_key[idx], ag->pwd[idx].s, ag->pwd[idx].len);
+	else
+		hmac_sha1_key_clear(&ag->pwd_key[idx]);
+}
+
 static void __ice_agent_initialize(struct ice_agent *ag) {
 	struct call_media *media = ag->media;
 	struct call *call = ag->call;
@@ -422,6 +430,7 @@ static void __ice_agent_initialize(struct ice_agent *ag) {
 
 	create_random_ice_string(call, &ag->ufrag[1], 8);
 	create_random_ice_string(call, &ag->pwd[1], 26);
+	__ice_agent_pwd_key(ag, 1);
 
 	atomic64_set(&ag->last_activity, rtpe_now.tv_sec);
 }
@@ -476,6 +485,7 @@ static void __ice_restart(struct ice_agent *ag) {
 	ag->pwd[0] = STR_NULL;
 	ag->ufrag[1] = STR_NULL;
 	ag->pwd[1] = STR_NULL;
+	__ice_agent_pwd_key(ag, 0);
 	__ice_reset(ag);
 }
 
@@ -522,8 +532,10 @@ void ice_update(struct ice_agent *ag, struct stream_params *sp, bool allow_reset
 		/* update remote info */
 		if (sp->ice_ufrag.s)
 			call_str_cpy(call, &ag->ufrag[0], &sp->ice_ufrag);
-		if (sp->ice_pwd.s)
+		if (sp->ice_pwd.s) {
 			call_str_cpy(call, &ag->pwd[0], &sp->ice_pwd);
+			__ice_agent_pwd_key(ag, 0);
+		}
 
 		candidates = &sp->ice_candidates;
 	}
@@ -704,6 +716,8 @@ static void __ice_agent_free(void *p) {
 	__DBG("freeing ice_agent");
 
 	__ice_agent_free_components(ag);
+	hmac_sha1_key_clear(&ag->pwd_key[0]);
+	hmac_sha1_key_clear(&ag->pwd_key[1]);
 	mutex_destroy(&ag->lock);
 
 	obj_put(ag->call);
@@ -818,7 +832,7 @@ static void __do_ice_check(struct ice_candidate_pair *pair) {
 			PAIR_FMT(pair), sockaddr_print_buf(&pair->local_intf->spec->local_address.addr),
 			FMT_M(endpoint_print_buf(&pair->remote_candidate->endpoint)));
 
-	stun_binding_request(&pair->remote_candidate->endpoint, transact, &ag->pwd[0], ag->ufrag,
+	stun_binding_request(&pair->remote_candidate->endpoint, transact, &ag->pwd_key[0], ag->ufrag,
 			AGENT_ISSET(ag, CONTROLLING), tie_breaker,
 			prio, &sfd->socket,
 			PAIR_ISSET(pair, TO_USE));
@@ -10,6 +10,11 @@
 #include "call_interfaces.h"
 #include "rtplib.h"
 #include "ice.h"
+#include "jsonlib.h"
+
+
+// must be a power of two
+#define JANUS_SHARDS 32
 
 
 struct janus_session { // "login" session
@@ -18,15 +23,20 @@ struct janus_session { // "login" session
 	mutex_t lock;
 	time_t last_act;
 	GHashTable *websockets; // controlling transports, websocket_conn -> websocket_conn
-	GHashTable *handles; // handle ID -> 0x1. handle ID owned by janus_handles
+	GHashTable *handles; // handle ID -> 0x1
 };
 struct janus_handle { // corresponds to a conference participant
+	struct obj obj;
 	uint64_t id;
-	struct janus_session *session; // holds a reference
+	mutex_t lock; // serialises requests for this handle, protects `room` and `destroyed`
+	struct janus_session *session; // holds a reference, never changes
 	uint64_t room;
+	bool destroyed; // detached, no longer accepts requests
 };
 struct janus_room {
+	struct obj obj;
 	uint64_t id;
+	mutex_t lock; // protects the tables below
 	str call_id;
 	int num_publishers;
 	uint64_t handle_id; // controlling handle which created the room
@@ -34,13 +44,62 @@ struct janus_room {
 	GHashTable *subscribers; // handle ID -> subscribed feed ID
 	GHashTable *feeds; // feed ID -> handle ID
 };
+struct janus_shard {
+	mutex_t lock;
+	GHashTable *ht; // ID -> obj. holds a reference. key is owned by the obj
+};
 
 
-static mutex_t janus_lock;
+// Lock order: handle lock, room lock, call master lock, session lock, websocket_conn lock.
+// Shard locks are leaf locks and are only ever held for a lookup, insertion or removal.
+static mutex_t janus_tokens_lock;
 static GHashTable *janus_tokens; // auth tokens, currently mostly unused
-static GHashTable *janus_sessions; // session ID -> session. holds a session reference
-static GHashTable *janus_handles; // handle ID -> handle
-static GHashTable *janus_rooms; // room ID -> room
+static struct janus_shard janus_sessions[JANUS_SHARDS]; // session ID -> session
+static struct janus_shard janus_handles[JANUS_SHARDS]; // handle ID -> handle
+static struct janus_shard janus_rooms[JANUS_SHARDS]; // room ID -> room
+
+
+INLINE struct janus_shard *janus_shard(struct janus_shard *shards, uint64_t id) {
+	return &shards[(id ^ (id >> 32)) & (JANUS_SHARDS - 1)];
+}
+// returns the object with a new reference held, or NULL
+static void *janus_shard_get(struct janus_shard *shards, uint64_t id) {
+	struct janus_shard *sh = janus_shard(shards, id);
+	LOCK(&sh->lock);
+	struct obj *ret = g_hash_table_lookup(sh->ht, &id);
+	if (ret)
+		obj_hold_o(ret);
+	return ret;
+}
+// `key` must point into the object. takes a new reference on success
+static bool janus_shard_add(struct janus_shard *shards, uint64_t *key, struct obj *o) {
+	struct janus_shard *sh = janus_shard(shards, *key);
+	LOCK(&sh->lock);
+	if (g_hash_table_lookup(sh->ht, key))
+		return false;
+	g_hash_table_insert(sh->ht, key, obj_get_o(o));
+	return true;
+}
+// returns the removed object and passes the table's reference to the caller, or NULL
+static void *janus_shard_steal(struct janus_shard *shards, uint64_t id) {
+	struct janus_shard *sh = janus_shard(shards, id);
+	LOCK(&sh->lock);
+	void *ret = NULL;
+	g_hash_table_steal_extended(sh->ht, &id, NULL, &ret);
+	return ret;
+}
+static void janus_shards_init(struct janus_shard *shards) {
+	for (unsigned int i = 0; i < JANUS_SHARDS; i++) {
+		mutex_init(&shards[i].lock);
+		shards[i].ht = g_hash_table_new(g_int64_hash, g_int64_equal);
+	}
+}
+static void janus_shards_free(struct janus_shard *shards) {
+	for (unsigned int i = 0; i < JANUS_SHARDS; i++) {
+		mutex_destroy(&shards[i].lock);
+		g_hash_table_destroy(shards[i].ht);
+	}
+}
 
 
 static void __janus_session_free(void *p) {
@@ -53,15 +112,24 @@ static void __janus_session_free(void *p) {
 	g_hash_table_destroy(s->handles);
 	mutex_destroy(&s->lock);
 }
+static void __janus_handle_free(void *p) {
+	struct janus_handle *h = p;
+	if (h->session)
+		obj_put(h->session);
+	mutex_destroy(&h->lock);
+}
+static void __janus_room_free(void *p) {
+	struct janus_room *r = p;
+	g_free(r->call_id.s);
+	g_hash_table_destroy(r->publishers);
+	g_hash_table_destroy(r->subscribers);
+	g_hash_table_destroy(r->feeds);
+	mutex_destroy(&r->lock);
+}
 
 
-// XXX we have several hash tables that hold references to objs - unify all these
 static struct janus_session *janus_get_session(uint64_t id) {
-	mutex_lock(&janus_lock);
-	struct janus_session *ret = g_hash_table_lookup(janus_sessions, &id);
-	if (ret)
-		obj_hold(ret);
-	mutex_unlock(&janus_lock);
+	struct janus_session *ret = janus_shard_get(janus_sessions, id);
 	if (!ret)
 		return NULL;
 	mutex_lock(&ret->lock);
@@ -71,6 +139,31 @@ static struct janus_session *janus_get_session(uint64_t id) {
 }
 
 
+// returns the room locked and with a reference held
+static struct janus_room *janus_get_room(uint64_t id) {
+	if (!id)
+		return NULL;
+	struct janus_room *ret = janus_shard_get(janus_rooms, id);
+	if (!ret)
+		return NULL;
+	mutex_lock(&ret->lock);
+	return ret;
+}
+static void janus_room_unlock_release(struct janus_room **rp) {
+	if (!*rp)
+		return;
+	mutex_unlock(&(*rp)->lock);
+	obj_put(*rp);
+}
+
+
+static void janus_handle_release(struct janus_handle **hp) {
+	if (!*hp)
+		return;
+	obj_put(*hp);
+}
+
+
 static uint64_t *uint64_dup(uint64_t u) {
 	uint64_t *ret = g_malloc(sizeof(*ret));
 	*ret = u;
@@ -107,8 +200,8 @@ static struct call_monologue *janus_get_monologue(uint64_t handle_id, struct cal
 
 // frees 'builder'
 // sends a single final response message to a received websocket message. requires a response code
-static void janus_send_json_sync_response(struct websocket_message *wm, JsonBuilder *builder, int code) {
-	char *result = glib_json_print(builder);
+static void janus_send_json_sync_response(struct websocket_message *wm, struct json_writer *builder, int code) {
+	char *result = json_writer_finish(builder);
 
 	if (wm->method == M_WEBSOCKET)
 		websocket_write_text(wm->wc, result, true);
@@ -124,8 +217,8 @@ static void janus_send_json_sync_response(struct websocket_message *wm, JsonBuil
 // frees 'builder'
 // sends an asynchronous notification to all websockets connected to a session
 // session must be locked already
-static void janus_send_json_async(struct janus_session *session, JsonBuilder *builder) {
-	char *result = glib_json_print(builder);
+static void janus_send_json_async(struct janus_session *session, struct json_writer *builder) {
+	char *result = json_writer_finish(builder);
 
 	GHashTableIter iter;
 	gpointer value;
@@ -141,19 +234,19 @@ static void janus_send_json_async(struct janus_session *session, JsonBuilder *bu
 }
 
 
-// session is locked
 static void janus_send_ack(struct websocket_message *wm, const char *transaction, struct janus_session *session) {
 	// build and send an early ack
-	JsonBuilder *ack = json_builder_new();
-	json_builder_begin_object(ack); // {
-	json_builder_set_member_name(ack, "janus");
-	json_builder_add_string_value(ack, "ack");
-	json_builder_set_member_name(ack, "transaction");
-	json_builder_add_string_value(ack, transaction);
-	json_builder_set_member_name(ack, "session_id");
-	json_builder_add_int_value(ack, session->id);
-	json_builder_end_object(ack); // }
+	struct json_writer *ack = json_writer_new();
+	json_writer_begin_object(ack); // {
+	json_writer_key(ack, "janus");
+	json_writer_string(ack, "ack");
+	json_writer_key(ack, "transaction");
+	json_writer_string(ack, transaction);
+	json_writer_key(ack, "session_id");
+	json_writer_int(ack, session->id);
+	json_writer_end_object(ack); // }
 
+	LOCK(&session->lock);
 	janus_send_json_async(session, ack);
 }
 
@@ -164,90 +257,100 @@ INLINE char *janus_call_id(uint64_t room_id) {
 }
 
 
-// global janus_lock is held
+// handle is locked
 static const char *janus_videoroom_create(struct janus_session *session, struct janus_handle *handle,
-		JsonBuilder *builder, JsonReader *reader, int *retcode)
+		struct json_writer *builder, JsonReader *reader, int *retcode)
 {
 	*retcode = 436;
 	if (handle->room != 0)
 		return "User already exists in a room";
 
-	// create new videoroom
-	struct janus_room *room = g_slice_alloc0(sizeof(*room));
+	uint64_t room_id = 0;
+	if (json_reader_read_member(reader, "room")) {
+		room_id = jr_str_int(reader);
+		if (!room_id)
+			return "Invalid room ID requested";
+	}
+	json_reader_end_member(reader);
 
+	int num_publishers = 0;
 	if (json_reader_read_member(reader, "publishers"))
-		room->num_publishers = jr_str_int(reader);
+		num_publishers = jr_str_int(reader);
 	json_reader_end_member(reader);
-	if (room->num_publishers <= 0)
-		room->num_publishers = 3;
+	if (num_publishers <= 0)
+		num_publishers = 3;
+
+	// create new videoroom
+	struct janus_room *room = obj_alloc0("janus_room", sizeof(*room), __janus_room_free);
+	mutex_init(&room->lock);
+	room->num_publishers = num_publishers;
 	room->handle_id = handle->id; // controlling handle
 	// XXX optimise for 64-bit archs
 	room->publishers = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, g_free);
 	room->subscribers = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, g_free);
 	room->feeds = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, g_free);
 
-	uint64_t room_id = 0;
-	if (json_reader_read_member(reader, "room")) {
-		room_id = jr_str_int(reader);
-		if (!room_id)
-			return "Invalid room ID requested";
-	}
-	json_reader_end_member(reader);
-
-	if (room_id) {
-		*retcode = 512;
-		if (g_hash_table_lookup(janus_rooms, &room_id))
-			return "Requested room already exists";
-	}
+	bool requested = room_id != 0;
 
 	while (1) {
 		if (!room_id)
 			room_id = janus_random();
 		room->id = room_id;
-		if (g_hash_table_lookup(janus_rooms, &room->id))
-			continue;
+		g_free(room->call_id.s);
 		room->call_id.s = janus_call_id(room_id);
 		room->call_id.len = strlen(room->call_id.s);
+		// reserve the ID first so that no other thread can claim it
+		if (!janus_shard_add(janus_rooms, &room->id, &room->obj)) {
+			*retcode = 512;
+			if (requested) {
+				obj_put(room);
+				return "Requested room already exists";
+			}
+			room_id = 0;
+			continue;
+		}
 		struct call *call = call_get_or_create(&room->call_id, true);
 		if (!call) {
 			ilog(LOG_WARN, "Call with reserved Janus ID '" STR_FORMAT
 					"' already exists", STR_FMT(&room->call_id));
-			g_free(room->call_id.s);
+			struct janus_room *stolen = janus_shard_steal(janus_rooms, room_id);
+			if (stolen)
+				obj_put(stolen);
+			room_id = 0;
+			requested = false;
 			continue;
 		}
 		if (!call->created_from)
 			call->created_from = "janus";
-		g_hash_table_insert(janus_rooms, &room->id, room);
 		rwlock_unlock_w(&call->master_lock);
 		obj_put(call);
 		break;
 	}
 
+	obj_put(room); // reference now owned by janus_rooms
+
 	handle->room = room_id;
 
 	ilog(LOG_INFO, "Created new videoroom with ID %" PRIu64, room_id);
 
-	json_builder_set_member_name(builder, "videoroom");
-	json_builder_add_string_value(builder, "created");
-	json_builder_set_member_name(builder, "room");
-	json_builder_add_int_value(builder, room_id);
-	json_builder_set_member_name(builder, "permanent");
-	json_builder_add_boolean_value(builder, false);
+	json_writer_key(builder, "videoroom");
+	json_writer_string(builder, "created");
+	json_writer_key(builder, "room");
+	json_writer_int(builder, room_id);
+	json_writer_key(builder, "permanent");
+	json_writer_bool(builder, false);
 
 	return NULL;
 }
 
 
-// global janus_lock is held
 static const char *janus_videoroom_exists(struct janus_session *session,
-		JsonBuilder *builder, uint64_t room_id)
+		struct json_writer *builder, uint64_t room_id)
 {
-	struct janus_room *room = NULL;
-
 	bool exists = false;
 
-	if (room_id)
-		room = g_hash_table_lookup(janus_rooms, &room_id);
+	AUTO_CLEANUP_NULL(struct janus_room *room, janus_room_unlock_release);
+	room = janus_get_room(room_id);
 	if (room) {
 		struct call *call = call_get(&room->call_id);
 		if (call) {
@@ -257,31 +360,31 @@ static const char *janus_videoroom_exists(struct janus_session *session,
 		}
 	}
 
-	json_builder_set_member_name(builder, "videoroom");
-	json_builder_add_string_value(builder, "success");
-	json_builder_set_member_name(builder, "room");
-	json_builder_add_int_value(builder, room_id);
-	json_builder_set_member_name(builder, "exists");
-	json_builder_add_boolean_value(builder, exists);
+	json_writer_key(builder, "videoroom");
+	json_writer_string(builder, "success");
+	json_writer_key(builder, "room");
+	json_writer_int(builder, room_id);
+	json_writer_key(builder, "exists");
+	json_writer_bool(builder, exists);
 
 	return NULL;
 }
 
 
-// global janus_lock is held
 static const char *janus_videoroom_destroy(struct janus_session *session,
-		JsonBuilder *builder, int *retcode, uint64_t room_id)
+		struct json_writer *builder, int *retcode, uint64_t room_id)
 {
 	struct janus_room *room = NULL;
 
 	if (room_id)
-		g_hash_table_steal_extended(janus_rooms, &room_id, NULL, (void **) &room);
+		room = janus_shard_steal(janus_rooms, room_id);
 	*retcode = 426;
 	if (!room)
 		return "No such room";
 
 	ilog(LOG_INFO, "Destroying videoroom with ID %" PRIu64, room_id);
 
+	mutex_lock(&room->lock);
 	struct call *call = call_get(&room->call_id);
 	// XXX if call is destroyed separately, room persist -> room should be destroyed too
 	if (call) {
@@ -289,30 +392,28 @@ static const char *janus_videoroom_destroy(struct janus_session *session,
 		call_destroy(call);
 		obj_put(call);
 	}
+	mutex_unlock(&room->lock);
 
-	g_free(room->call_id.s);
-	g_hash_table_destroy(room->publishers);
-	g_hash_table_destroy(room->subscribers);
-	g_hash_table_destroy(room->feeds);
-	g_slice_free1(sizeof(*room), room);
+	// handles still pointing to this room may hold references
+	obj_put(room);
 
 	//XXX notify?
 
-	json_builder_set_member_name(builder, "videoroom");
-	json_builder_add_string_value(builder, "destroyed");
-	json_builder_set_member_name(builder, "room");
-	json_builder_add_int_value(builder, room_id);
-	json_builder_set_member_name(builder, "permanent");
-	json_builder_add_boolean_value(builder, false);
+	json_writer_key(builder, "videoroom");
+	json_writer_string(builder, "destroyed");
+	json_writer_key(builder, "room");
+	json_writer_int(builder, room_id);
+	json_writer_key(builder, "permanent");
+	json_writer_bool(builder, false);
 
 	return NULL;
 }
 
 
 // adds fields "streams": [...] and "audio_codec" etc into the builder at the current position
-static void janus_add_publisher_details(JsonBuilder *builder, struct call_monologue *ml) {
-	json_builder_set_member_name(builder, "streams");
-	json_builder_begin_array(builder);
+static void janus_add_publisher_details(struct json_writer *builder, struct call_monologue *ml) {
+	json_writer_key(builder, "streams");
+	json_writer_begin_array(builder);
 
 	const char *a_codec = NULL, *v_codec = NULL;
 
@@ -329,26 +430,26 @@ static void janus_add_publisher_details(JsonBuilder *builder, struct call_monolo
 			break;
 		}
 
-		json_builder_begin_object(builder);
+		json_writer_begin_object(builder);
 
-		json_builder_set_member_name(builder, "type");
-		json_builder_add_string_value(builder, media->type.s);
-		json_builder_set_member_name(builder, "mindex");
-		json_builder_add_int_value(builder, media->index - 1);
+		json_writer_key(builder, "type");
+		json_writer_str(builder, &media->type);
+		json_writer_key(builder, "mindex");
+		json_writer_int(builder, media->index - 1);
 
-		json_builder_set_member_name(builder, "mid");
+		json_writer_key(builder, "mid");
 		if (media->media_id.s)
-			json_builder_add_string_value(builder, media->media_id.s);
+			json_writer_str(builder, &media->media_id);
 		else
-			json_builder_add_null_value(builder);
+			json_writer_null(builder);
 
 		if (!MEDIA_ISSET2(media, SEND, RECV)) {
-			json_builder_set_member_name(builder, "disabled");
-			json_builder_add_boolean_value(builder, true);
+			json_writer_key(builder, "disabled");
+			json_writer_bool(builder, true);
 		}
 		else if (codec) {
-			json_builder_set_member_name(builder, "codec");
-			json_builder_add_string_value(builder, codec);
+			json_writer_key(builder, "codec");
+			json_writer_string(builder, codec);
 
 			if (media->type_id == MT_AUDIO && !a_codec)
 				a_codec = codec;
@@ -356,29 +457,30 @@ static void janus_add_publisher_details(JsonBuilder *builder, struct call_monolo
 				v_codec = codec;
 		}
 
-		json_builder_end_object(builder);
+		json_writer_end_object(builder);
 	}
 
-	json_builder_end_array(builder);
+	json_writer_end_array(builder);
 
 	if (a_codec) {
-		json_builder_set_member_name(builder, "audio_codec");
-		json_builder_add_string_value(builder, a_codec);
+		json_writer_key(builder, "audio_codec");
+		json_writer_string(builder, a_codec);
 	}
 
 	if (v_codec) {
-		json_builder_set_member_name(builder, "video_codec");
-		json_builder_add_string_value(builder, v_codec);
+		json_writer_key(builder, "video_codec");
+		json_writer_string(builder, v_codec);
 	}
 
 	// TODO add "display"
 }
 
 
-static void janus_publishers_list(JsonBuilder *builder, struct call *call, struct janus_room *room,
+// room is locked
+static void janus_publishers_list(struct json_writer *builder, struct call *call, struct janus_room *room,
 		uint64_t feed_id)
 {
-	json_builder_begin_array(builder); // [
+	json_writer_begin_array(builder); // [
 
 	GHashTableIter iter;
 	gpointer key, value;
@@ -395,20 +497,20 @@ static void janus_publishers_list(JsonBuilder *builder, struct call *call, struc
 		if (!ml)
 			continue;
 
-		json_builder_begin_object(builder); // {
-		json_builder_set_member_name(builder, "id");
-		json_builder_add_int_value(builder, *feed_id_ptr);
+		json_writer_begin_object(builder); // {
+		json_writer_key(builder, "id");
+		json_writer_int(builder, *feed_id_ptr);
 
 		janus_add_publisher_details(builder, ml);
 
-		json_builder_end_object(builder); // }
+		json_writer_end_object(builder); // }
 	}
 
-	json_builder_end_array(builder); // ]
+	json_writer_end_array(builder); // ]
 }
 
 
-// global janus_lock is held
+// handle and room are locked
 static const char *janus_videoroom_join_sub(struct janus_handle *handle, struct janus_room *room, int *retcode,
 		uint64_t feed_id, struct call *call, GQueue *srcs)
 {
@@ -449,10 +551,10 @@ static int g_int64_cmp(gconstpointer a, gconstpointer b) {
 }
 
 
-// global janus_lock is held
+// handle is locked
 static const char *janus_videoroom_join(struct websocket_message *wm, struct janus_session *session,
 		const char *transaction,
-		struct janus_handle *handle, JsonBuilder *builder, JsonReader *reader, const char **successp,
+		struct janus_handle *handle, struct json_writer *builder, JsonReader *reader, const char **successp,
 		int *retcode,
 		char **jsep_type_out, str *jsep_sdp_out,
 		uint64_t room_id)
@@ -485,9 +587,8 @@ static const char *janus_videoroom_join(struct websocket_message *wm, struct jan
 	else
 		return "Invalid 'ptype'";
 
-	struct janus_room *room = NULL;
-	if (room_id)
-		room = g_hash_table_lookup(janus_rooms, &room_id);
+	AUTO_CLEANUP_NULL(struct janus_room *room, janus_room_unlock_release);
+	room = janus_get_room(room_id);
 	*retcode = 426;
 	if (!room)
 		return "No such room";
@@ -663,41 +764,41 @@ static const char *janus_videoroom_join(struct websocket_message *wm, struct jan
 	*successp = "event";
 
 	if (is_pub) {
-		json_builder_set_member_name(builder, "videoroom");
-		json_builder_add_string_value(builder, "joined");
-		json_builder_set_member_name(builder, "room");
-		json_builder_add_int_value(builder, room_id);
-		json_builder_set_member_name(builder, "id");
-		json_builder_add_int_value(builder, feed_id);
-		json_builder_set_member_name(builder, "publishers");
+		json_writer_key(builder, "videoroom");
+		json_writer_string(builder, "joined");
+		json_writer_key(builder, "room");
+		json_writer_int(builder, room_id);
+		json_writer_key(builder, "id");
+		json_writer_int(builder, feed_id);
+		json_writer_key(builder, "publishers");
 		janus_publishers_list(builder, call, room, feed_id);
 	}
 	else {
 		// subscriber
-		json_builder_set_member_name(builder, "videoroom");
-		json_builder_add_string_value(builder, "attached");
-		json_builder_set_member_name(builder, "room");
-		json_builder_add_int_value(builder, room_id);
+		json_writer_key(builder, "videoroom");
+		json_writer_string(builder, "attached");
+		json_writer_key(builder, "room");
+		json_writer_int(builder, room_id);
 
 		// output format: single feed ID or multiple?
 		if (feed_id) {
-			json_builder_set_member_name(builder, "id");
-			json_builder_add_int_value(builder, feed_id);
+			json_writer_key(builder, "id");
+			json_writer_int(builder, feed_id);
 		}
 		else {
-			json_builder_set_member_name(builder, "streams");
-			json_builder_begin_array(builder);
+			json_writer_key(builder, "streams");
+			json_writer_begin_array(builder);
 			uint64_t idx = 0;
 			for (GList *l = ret_streams.head; l; l = l->next) {
 				uint64_t *fidp = l->data;
-				json_builder_begin_object(builder);
-				json_builder_set_member_name(builder, "mindex");
-				json_builder_add_int_value(builder, idx++);
-				json_builder_set_member_name(builder, "feed_id");
-				json_builder_add_int_value(builder, *fidp);
-				json_builder_end_object(builder);
+				json_writer_begin_object(builder);
+				json_writer_key(builder, "mindex");
+				json_writer_int(builder, idx++);
+				json_writer_key(builder, "feed_id");
+				json_writer_int(builder, *fidp);
+				json_writer_end_object(builder);
 			}
-			json_builder_end_array(builder);
+			json_writer_end_array(builder);
 		}
 	}
 
@@ -706,41 +807,37 @@ static const char *janus_videoroom_join(struct websocket_message *wm, struct jan
 
 
 // callback function for janus_notify_publishers()
-static void janus_notify_publishers_joined(JsonBuilder *event, void *ptr, uint64_t u64, struct janus_room *room,
+static void janus_notify_publishers_joined(struct json_writer *event, void *ptr, uint64_t u64, struct janus_room *room,
 		uint64_t publisher_feed)
 {
-	json_builder_set_member_name(event, "publishers");
+	json_writer_key(event, "publishers");
 	janus_publishers_list(event, ptr, room, publisher_feed);
 }
 
 
 // callback function for janus_notify_publishers()
-static void janus_notify_publishers_unpublished(JsonBuilder *event, void *ptr, uint64_t u64,
+static void janus_notify_publishers_unpublished(struct json_writer *event, void *ptr, uint64_t u64,
 		struct janus_room *room, uint64_t publisher_feed)
 {
-	json_builder_set_member_name(event, "unpublished");
-	json_builder_add_int_value(event, u64);
+	json_writer_key(event, "unpublished");
+	json_writer_int(event, u64);
 }
 
 
 // callback function for janus_notify_publishers()
-static void janus_notify_publishers_leaving(JsonBuilder *event, void *ptr, uint64_t u64, struct janus_room *room,
+static void janus_notify_publishers_leaving(struct json_writer *event, void *ptr, uint64_t u64, struct janus_room *room,
 		uint64_t publisher_feed)
 {
-	json_builder_set_member_name(event, "leaving");
-	json_builder_add_int_value(event, u64);
+	json_writer_key(event, "leaving");
+	json_writer_int(event, u64);
 }
 
 
-// global janus_lock is held
-static void janus_notify_publishers(uint64_t room_id, uint64_t except, void *ptr, uint64_t u64,
-		void (*callback)(JsonBuilder *event, void *ptr, uint64_t u64, struct janus_room *room,
+// room is locked
+static void janus_notify_publishers(struct janus_room *room, uint64_t except, void *ptr, uint64_t u64,
+		void (*callback)(struct json_writer *event, void *ptr, uint64_t u64, struct janus_room *room,
 			uint64_t publisher_feed))
 {
-	struct janus_room *room = g_hash_table_lookup(janus_rooms, &room_id);
-	if (!room)
-		return;
-
 	GHashTableIter iter;
 	gpointer key, value;
 	g_hash_table_iter_init(&iter, room->publishers);
@@ -750,52 +847,56 @@ static void janus_notify_publishers(uint64_t room_id, uint64_t except, void *ptr
 		if (*handle_id == except)
 			continue;
 
-		// look up the handle and determine which session it belongs to
-		struct janus_handle *handle = g_hash_table_lookup(janus_handles, handle_id);
+		// look up the handle and determine which session it belongs to. the handle's
+		// own lock isn't needed as the session never changes
+		AUTO_CLEANUP_NULL(struct janus_handle *handle, janus_handle_release);
+		handle = janus_shard_get(janus_handles, *handle_id);
 		if (!handle)
 			continue;
-		if (!handle->session)
+		struct janus_session *session = handle->session;
+		if (!session)
 			continue;
 
 		// send to the handle's session
 
 		uint64_t *feed_id = value;
 
-		JsonBuilder *event = json_builder_new();
-		json_builder_begin_object(event); // {
-		json_builder_set_member_name(event, "janus");
-		json_builder_add_string_value(event, "event");
-		json_builder_set_member_name(event, "session_id");
-		json_builder_add_int_value(event, handle->session->id);
-		json_builder_set_member_name(event, "sender");
-		json_builder_add_int_value(event, handle->id); // destination of notification
-		json_builder_set_member_name(event, "plugindata");
-		json_builder_begin_object(event); // {
-		json_builder_set_member_name(event, "plugin");
-		json_builder_add_string_value(event, "janus.plugin.videoroom");
-		json_builder_set_member_name(event, "data");
-		json_builder_begin_object(event); // {
-		json_builder_set_member_name(event, "videoroom");
-		json_builder_add_string_value(event, "event");
-		json_builder_set_member_name(event, "room");
-		json_builder_add_int_value(event, room_id);
+		struct json_writer *event = json_writer_new();
+		json_writer_begin_object(event); // {
+		json_writer_key(event, "janus");
+		json_writer_string(event, "event");
+		json_writer_key(event, "session_id");
+		json_writer_int(event, session->id);
+		json_writer_key(event, "sender");
+		json_writer_int(event, handle->id); // destination of notification
+		json_writer_key(event, "plugindata");
+		json_writer_begin_object(event); // {
+		json_writer_key(event, "plugin");
+		json_writer_string(event, "janus.plugin.videoroom");
+		json_writer_key(event, "data");
+		json_writer_begin_object(event); // {
+		json_writer_key(event, "videoroom");
+		json_writer_string(event, "event");
+		json_writer_key(event, "room");
+		json_writer_int(event, room->id);
 
 		callback(event, ptr, u64, room, *feed_id);
 
-		json_builder_end_object(event); // }
-		json_builder_end_object(event); // }
-		json_builder_end_object(event); // }
+		json_writer_end_object(event); // }
+		json_writer_end_object(event); // }
+		json_writer_end_object(event); // }
 
-		janus_send_json_async(handle->session, event);
+		LOCK(&session->lock);
+		janus_send_json_async(session, event);
 	}
 }
 
 
-// global janus_lock is held
+// handle is locked
 static const char *janus_videoroom_configure(struct websocket_message *wm, struct janus_session *session,
 		const char *jsep_type, const char *jsep_sdp,
 		const char *transaction,
-		struct janus_handle *handle, JsonBuilder *builder, JsonReader *reader, const char **successp,
+		struct janus_handle *handle, struct json_writer *builder, JsonReader *reader, const char **successp,
 		int *retcode,
 		char **jsep_type_out, str *jsep_sdp_out,
 		uint64_t room_id)
@@ -826,9 +927,10 @@ static const char *janus_videoroom_configure(struct websocket_message *wm, struc
 	if (handle->room != room_id)
 		return "Not in the room";
 
+	AUTO_CLEANUP_NULL(struct janus_room *room, janus_room_unlock_release);
 	AUTO_CLEANUP_NULL(struct call *call, call_unlock_release);
 
-	struct janus_room *room = g_hash_table_lookup(janus_rooms, &room_id);
+	room = janus_get_room(room_id);
 	*retcode = 426;
 	if (!room)
 		return "No such room";
@@ -893,12 +995,12 @@ static const char *janus_videoroom_configure(struct websocket_message *wm, struc
 	}
 
 	*successp = "event";
-	json_builder_set_member_name(builder, "videoroom");
-	json_builder_add_string_value(builder, "event");
-	json_builder_set_member_name(builder, "room");
-	json_builder_add_int_value(builder, room_id);
-	json_builder_set_member_name(builder, "configured");
-	json_builder_add_string_value(builder, "ok");
+	json_writer_key(builder, "videoroom");
+	json_writer_string(builder, "event");
+	json_writer_key(builder, "room");
+	json_writer_int(builder, room_id);
+	json_writer_key(builder, "configured");
+	json_writer_string(builder, "ok");
 
 	// apply audio/video bool flags
 	for (unsigned int i = 0; i < ml->medias->len; i++) {
@@ -922,17 +1024,17 @@ static const char *janus_videoroom_configure(struct websocket_message *wm, struc
 
 	janus_add_publisher_details(builder, ml);
 
-	janus_notify_publishers(room_id, handle->id, call, 0, janus_notify_publishers_joined);
+	janus_notify_publishers(room, handle->id, call, 0, janus_notify_publishers_joined);
 
 	return NULL;
 }
 
 
-// global janus_lock is held
+// handle is locked
 static const char *janus_videoroom_start(struct websocket_message *wm, struct janus_session *session,
 		const char *jsep_type, const char *jsep_sdp,
 		const char *transaction,
-		struct janus_handle *handle, JsonBuilder *builder, JsonReader *reader, const char **successp,
+		struct janus_handle *handle, struct json_writer *builder, JsonReader *reader, const char **successp,
 		int *retcode,
 		uint64_t room_id)
 {
@@ -962,9 +1064,10 @@ static const char *janus_videoroom_start(struct websocket_message *wm, struct ja
 	if (sdp_streams(&parsed, &streams, &flags))
 		return "Incomplete SDP specification";
 
+	AUTO_CLEANUP_NULL(struct janus_room *room, janus_room_unlock_release);
 	AUTO_CLEANUP_NULL(struct call *call, call_unlock_release);
 
-	struct janus_room *room = g_hash_table_lookup(janus_rooms, &room_id);
+	room = janus_get_room(room_id);
 	*retcode = 426;
 	if (!room)
 		return "No such room";
@@ -995,21 +1098,21 @@ static const char *janus_videoroom_start(struct websocket_message *wm, struct ja
 		return "Failed to process subscription answer";
 
 	*successp = "event";
-	json_builder_set_member_name(builder, "videoroom");
-	json_builder_add_string_value(builder, "event");
-	json_builder_set_member_name(builder, "room");
-	json_builder_add_int_value(builder, room_id);
-	json_builder_set_member_name(builder, "started");
-	json_builder_add_string_value(builder, "ok");
+	json_writer_key(builder, "videoroom");
+	json_writer_string(builder, "event");
+	json_writer_key(builder, "room");
+	json_writer_int(builder, room_id);
+	json_writer_key(builder, "started");
+	json_writer_string(builder, "ok");
 
 	return NULL;
 }
 
 
-// global janus_lock is held
+// handle is locked
 static const char *janus_videoroom_unpublish(struct websocket_message *wm, struct janus_session *session,
 		const char *transaction,
-		struct janus_handle *handle, JsonBuilder *builder, const char **successp,
+		struct janus_handle *handle, struct json_writer *builder, const char **successp,
 		int *retcode)
 {
 	janus_send_ack(wm, transaction, session);
@@ -1021,9 +1124,8 @@ static const char *janus_videoroom_unpublish(struct websocket_message *wm, struc
 	if (!room_id)
 		return "Not in any room";
 
-	struct janus_room *room = NULL;
-	if (room_id)
-		room = g_hash_table_lookup(janus_rooms, &room_id);
+	AUTO_CLEANUP_NULL(struct janus_room *room, janus_room_unlock_release);
+	room = janus_get_room(room_id);
 	*retcode = 426;
 	if (!room)
 		return "No such room";
@@ -1041,30 +1143,29 @@ static const char *janus_videoroom_unpublish(struct websocket_message *wm, struc
 	// all is ok
 
 	// notify other publishers
-	janus_notify_publishers(room_id, handle->id, NULL, *feed_id, janus_notify_publishers_unpublished);
+	janus_notify_publishers(room, handle->id, NULL, *feed_id, janus_notify_publishers_unpublished);
 
 	struct call_monologue *ml = janus_get_monologue(handle->id, call, call_get_monologue);
 	if (ml)
 		monologue_destroy(ml);
 
 	*successp = "event";
-	json_builder_set_member_name(builder, "videoroom");
-	json_builder_add_string_value(builder, "event");
-	json_builder_set_member_name(builder, "room");
-	json_builder_add_int_value(builder, room_id);
-	json_builder_set_member_name(builder, "unpublished");
-	json_builder_add_string_value(builder, "ok");
+	json_writer_key(builder, "videoroom");
+	json_writer_string(builder, "event");
+	json_writer_key(builder, "room");
+	json_writer_int(builder, room_id);
+	json_writer_key(builder, "unpublished");
+	json_writer_string(builder, "ok");
 
 	return NULL;
 }
 
 
-// global janus_lock is held
-// TODO: more granular locking
+// handle is locked
 static const char *janus_videoroom(struct websocket_message *wm, struct janus_session *session,
 		const char *jsep_type, const char *jsep_sdp,
 		const char *transaction,
-		struct janus_handle *handle, JsonBuilder *builder, JsonReader *reader, const char **successp,
+		struct janus_handle *handle, struct json_writer *builder, JsonReader *reader, const char **successp,
 		int *retcodep, char **jsep_type_out, str *jsep_sdp_out)
 {
 	uint64_t room_id = 0;
@@ -1132,7 +1233,7 @@ err:
 }
 
 
-static const char *janus_add_token(JsonReader *reader, JsonBuilder *builder, bool authorised, int *retcode) {
+static const char *janus_add_token(JsonReader *reader, struct json_writer *builder, bool authorised, int *retcode) {
 	*retcode = 403;
 	if (!authorised)
 		return "Janus 'admin_secret' key not provided or incorrect";
@@ -1148,23 +1249,23 @@ static const char *janus_add_token(JsonReader *reader, JsonBuilder *builder, boo
 
 	time_t *now = g_malloc(sizeof(*now));
 	*now = rtpe_now.tv_sec;
-	mutex_lock(&janus_lock);
+	mutex_lock(&janus_tokens_lock);
 	g_hash_table_replace(janus_tokens, g_strdup(token), now);
-	mutex_unlock(&janus_lock);
+	mutex_unlock(&janus_tokens_lock);
 
-	json_builder_set_member_name(builder, "data");
-	json_builder_begin_object(builder); // {
-	json_builder_set_member_name(builder, "plugins");
-	json_builder_begin_array(builder); // [
-	json_builder_add_string_value(builder, "janus.plugin.videoroom");
-	json_builder_end_array(builder); // ]
-	json_builder_end_object(builder); // }
+	json_writer_key(builder, "data");
+	json_writer_begin_object(builder); // {
+	json_writer_key(builder, "plugins");
+	json_writer_begin_array(builder); // [
+	json_writer_string(builder, "janus.plugin.videoroom");
+	json_writer_end_array(builder); // ]
+	json_writer_end_object(builder); // }
 
 	return NULL;
 }
 
 
-static const char *janus_create(JsonReader *reader, JsonBuilder *builder, struct websocket_message *wm) {
+static const char *janus_create(JsonReader *reader, struct json_writer *builder, struct websocket_message *wm) {
 	if (wm->method != M_WEBSOCKET)
 		return "Unsupported transport protocol";
 
@@ -1178,7 +1279,7 @@ static const char *janus_create(JsonReader *reader, JsonBuilder *builder, struct
 	mutex_lock(&session->lock); // not really necessary but Coverity complains
 	session->last_act = rtpe_now.tv_sec;
 	session->websockets = g_hash_table_new(g_direct_hash, g_direct_equal);
-	session->handles = g_hash_table_new(g_int64_hash, g_int64_equal);
+	session->handles = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
 
 	g_hash_table_insert(session->websockets, wm->wc, wm->wc);
 
@@ -1186,14 +1287,9 @@ static const char *janus_create(JsonReader *reader, JsonBuilder *builder, struct
 		while (!session_id)
 			session_id = janus_random();
 
-		mutex_lock(&janus_lock);
-		if (g_hash_table_lookup(janus_sessions, &session_id))
+		session->id = session_id;
+		if (!janus_shard_add(janus_sessions, &session->id, &session->obj))
 			session_id = 0; // pick a random one
-		else {
-			session->id = session_id;
-			g_hash_table_insert(janus_sessions, &session->id, obj_get(session));
-		}
-		mutex_unlock(&janus_lock);
 	}
 	while (!session_id);
 	mutex_unlock(&session->lock);
@@ -1202,11 +1298,11 @@ static const char *janus_create(JsonReader *reader, JsonBuilder *builder, struct
 
 	websocket_conn_add_session(wm->wc, obj_get(session));
 
-	json_builder_set_member_name(builder, "data");
-	json_builder_begin_object(builder); // {
-	json_builder_set_member_name(builder, "id");
-	json_builder_add_int_value(builder, session_id);
-	json_builder_end_object(builder); // }
+	json_writer_key(builder, "data");
+	json_writer_begin_object(builder); // {
+	json_writer_key(builder, "id");
+	json_writer_int(builder, session_id);
+	json_writer_end_object(builder); // }
 
 	return NULL;
 }
@@ -1231,15 +1327,15 @@ void janus_rtc_up(struct call_monologue *ml) {
 
 	// build json
 
-	JsonBuilder *builder = json_builder_new();
-	json_builder_begin_object(builder); // {
-	json_builder_set_member_name(builder, "janus");
-	json_builder_add_string_value(builder, "webrtcup");
-	json_builder_set_member_name(builder, "session_id");
-	json_builder_add_int_value(builder, session->id);
-	json_builder_set_member_name(builder, "sender");
-	json_builder_add_int_value(builder, handle);
-	json_builder_end_object(builder); // }
+	struct json_writer *builder = json_writer_new();
+	json_writer_begin_object(builder); // {
+	json_writer_key(builder, "janus");
+	json_writer_string(builder, "webrtcup");
+	json_writer_key(builder, "session_id");
+	json_writer_int(builder, session->id);
+	json_writer_key(builder, "sender");
+	json_writer_int(builder, handle);
+	json_writer_end_object(builder); // }
 
 	LOCK(&session->lock);
 
@@ -1264,24 +1360,24 @@ void janus_media_up(struct call_media *media) {
 
 	// build json
 
-	JsonBuilder *builder = json_builder_new();
-	json_builder_begin_object(builder); // {
-	json_builder_set_member_name(builder, "janus");
-	json_builder_add_string_value(builder, "media");
-	json_builder_set_member_name(builder, "session_id");
-	json_builder_add_int_value(builder, session->id);
-	json_builder_set_member_name(builder, "sender");
-	json_builder_add_int_value(builder, handle);
-	json_builder_set_member_name(builder, "mid");
+	struct json_writer *builder = json_writer_new();
+	json_writer_begin_object(builder); // {
+	json_writer_key(builder, "janus");
+	json_writer_string(builder, "media");
+	json_writer_key(builder, "session_id");
+	json_writer_int(builder, session->id);
+	json_writer_key(builder, "sender");
+	json_writer_int(builder, handle);
+	json_writer_key(builder, "mid");
 	if (media->media_id.s)
-		json_builder_add_string_value(builder, media->media_id.s);
+		json_writer_str(builder, &media->media_id);
 	else
-		json_builder_add_null_value(builder);
-	json_builder_set_member_name(builder, "type");
-	json_builder_add_string_value(builder, media->type.s);
-	json_builder_set_member_name(builder, "receiving");
-	json_builder_add_boolean_value(builder, true);
-	json_builder_end_object(builder); // }
+		json_writer_null(builder);
+	json_writer_key(builder, "type");
+	json_writer_str(builder, &media->type);
+	json_writer_key(builder, "receiving");
+	json_writer_bool(builder, true);
+	json_writer_end_object(builder); // }
 
 	LOCK(&session->lock);
 
@@ -1289,7 +1385,7 @@ void janus_media_up(struct call_media *media) {
 }
 
 
-static const char *janus_attach(JsonReader *reader, JsonBuilder *builder, struct janus_session *session,
+static const char *janus_attach(JsonReader *reader, struct json_writer *builder, struct janus_session *session,
 		int *retcode)
 {
 	*retcode = 458;
@@ -1307,55 +1403,54 @@ static const char *janus_attach(JsonReader *reader, JsonBuilder *builder, struct
 		return "Unsupported plugin";
 	json_reader_end_member(reader);
 
-	struct janus_handle *handle = g_slice_alloc0(sizeof(*handle));
-	mutex_lock(&janus_lock);
+	struct janus_handle *handle = obj_alloc0("janus_handle", sizeof(*handle), __janus_handle_free);
+	mutex_init(&handle->lock);
 	handle->session = obj_get(session);
 	uint64_t handle_id = 0;
-	while (1) {
+	do
 		handle_id = handle->id = janus_random();
-		if (g_hash_table_lookup(janus_handles, &handle->id))
-			continue;
-		g_hash_table_insert(janus_handles, &handle->id, handle);
-		break;
-	}
-	mutex_unlock(&janus_lock);
+	while (!janus_shard_add(janus_handles, &handle->id, &handle->obj));
+	obj_put(handle); // reference now owned by janus_handles
 
 	mutex_lock(&session->lock);
 	assert(g_hash_table_lookup(session->handles, &handle_id) == NULL);
-	g_hash_table_insert(session->handles, &handle->id, (void *) 0x1);
+	g_hash_table_insert(session->handles, uint64_dup(handle_id), (void *) 0x1);
 	mutex_unlock(&session->lock);
 
-	json_builder_set_member_name(builder, "data");
-	json_builder_begin_object(builder); // {
-	json_builder_set_member_name(builder, "id");
-	json_builder_add_int_value(builder, handle_id);
-	json_builder_end_object(builder); // }
+	json_writer_key(builder, "data");
+	json_writer_begin_object(builder); // {
+	json_writer_key(builder, "id");
+	json_writer_int(builder, handle_id);
+	json_writer_end_object(builder); // }
 
 	return NULL;
 }
 
 
+// handle must already be removed from janus_handles. releases the reference
 static void janus_destroy_handle(struct janus_handle *handle) {
-	uint64_t room_id = handle->room;
 	uint64_t handle_id = handle->id;
 
-	// destroy handle
-	if (handle->session)
-		obj_put(handle->session);
-	g_slice_free1(sizeof(*handle), handle);
+	mutex_lock(&handle->lock);
+	uint64_t room_id = handle->room;
+	handle->room = 0;
+	// a request that is already holding a reference must not re-join a room
+	handle->destroyed = true;
 
-	if (!room_id)
-		return;
+	AUTO_CLEANUP_NULL(struct janus_room *room, janus_room_unlock_release);
+	room = janus_get_room(room_id);
+
+	mutex_unlock(&handle->lock);
+	obj_put(handle);
 
-	struct janus_room *room = g_hash_table_lookup(janus_rooms, &room_id);
 	if (!room)
 		return;
 
 	uint64_t *feed = g_hash_table_lookup(room->publishers, &handle_id);
 	if (feed) {
 		// was a publisher - send notifies
-		janus_notify_publishers(room_id, handle_id, NULL, *feed, janus_notify_publishers_unpublished);
-		janus_notify_publishers(room_id, handle_id, NULL, *feed, janus_notify_publishers_leaving);
+		janus_notify_publishers(room, handle_id, NULL, *feed, janus_notify_publishers_unpublished);
+		janus_notify_publishers(room, handle_id, NULL, *feed, janus_notify_publishers_leaving);
 
 		struct call *call = call_get(&room->call_id);
 		if (call) {
@@ -1388,7 +1483,7 @@ static void janus_destroy_handle(struct janus_handle *handle) {
 }
 
 
-static const char *janus_detach(struct websocket_message *wm, JsonReader *reader, JsonBuilder *builder,
+static const char *janus_detach(struct websocket_message *wm, JsonReader *reader, struct json_writer *builder,
 		struct janus_session *session,
 		uint64_t handle_id, int *retcode)
 {
@@ -1399,8 +1494,8 @@ static const char *janus_detach(struct websocket_message *wm, JsonReader *reader
 	if (!handle_id)
 		return "Unhandled request method";
 
-	// remove handle from session first as the handle ID in the hash is owned by the
-	// janus_handle object, which is owned by janus_handles
+	// remove handle from session first, which makes us the only one to remove it
+	// from janus_handles
 	{
 		LOCK(&session->lock);
 
@@ -1411,16 +1506,14 @@ static const char *janus_detach(struct websocket_message *wm, JsonReader *reader
 			return "Could not detach handle from plugin";
 	}
 
-	LOCK(&janus_lock);
-
-	struct janus_handle *handle = NULL;
-	g_hash_table_steal_extended(janus_handles, &handle_id, NULL, (void **) &handle);
+	struct janus_handle *handle = janus_shard_steal(janus_handles, handle_id);
 
 	*retcode = 463;
 	if (!handle)
 		return "Could not detach handle from plugin";
 	if (handle->session != session) {
-		g_hash_table_insert(janus_handles, &handle->id, handle);
+		janus_shard_add(janus_handles, &handle->id, &handle->obj);
+		obj_put(handle);
 		return "Invalid session/handle association";
 	}
 
@@ -1430,15 +1523,19 @@ static const char *janus_detach(struct websocket_message *wm, JsonReader *reader
 }
 
 
-// janus_lock must be held
+// session must already be removed from janus_sessions
 static void janus_session_cleanup(struct janus_session *session) {
+	mutex_lock(&session->lock);
+	AUTO_CLEANUP_INIT(GHashTable *handles, __g_hash_table_destroy, session->handles);
+	session->handles = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, NULL);
+	mutex_unlock(&session->lock);
+
 	GHashTableIter iter;
-	g_hash_table_iter_init(&iter, session->handles);
+	g_hash_table_iter_init(&iter, handles);
 	gpointer key;
 	while (g_hash_table_iter_next(&iter, &key, NULL)) {
 		uint64_t *handle_id = key;
-		struct janus_handle *handle = NULL;
-		g_hash_table_steal_extended(janus_handles, handle_id, NULL, (void **) &handle);
+		struct janus_handle *handle = janus_shard_steal(janus_handles, *handle_id);
 		if (!handle) // bug?
 			continue;
 		janus_destroy_handle(handle);
@@ -1446,7 +1543,7 @@ static void janus_session_cleanup(struct janus_session *session) {
 }
 
 
-static const char *janus_destroy(struct websocket_message *wm, JsonReader *reader, JsonBuilder *builder,
+static const char *janus_destroy(struct websocket_message *wm, JsonReader *reader, struct json_writer *builder,
 		struct janus_session *session,
 		int *retcode)
 {
@@ -1454,12 +1551,14 @@ static const char *janus_destroy(struct websocket_message *wm, JsonReader *reade
 	if (!session)
 		return "Session ID not found";
 
-	LOCK(&janus_lock);
-
-	struct janus_session *ht_session = NULL;
-	g_hash_table_steal_extended(janus_sessions, &session->id, NULL, (void **) &ht_session);
-	if (ht_session != session)
+	struct janus_session *ht_session = janus_shard_steal(janus_sessions, session->id);
+	if (ht_session != session) {
+		if (ht_session) {
+			janus_shard_add(janus_sessions, &ht_session->id, &ht_session->obj);
+			obj_put(ht_session);
+		}
 		return "Sesssion ID not found"; // already removed/destroyed
+	}
 
 	janus_session_cleanup(session);
 	obj_put(session);
@@ -1468,7 +1567,7 @@ static const char *janus_destroy(struct websocket_message *wm, JsonReader *reade
 }
 
 
-static const char *janus_message(struct websocket_message *wm, JsonReader *reader, JsonBuilder *builder,
+static const char *janus_message(struct websocket_message *wm, JsonReader *reader, struct json_writer *builder,
 		struct janus_session *session,
 		const char *transaction,
 		uint64_t handle_id,
@@ -1499,41 +1598,47 @@ static const char *janus_message(struct websocket_message *wm, JsonReader *reade
 	if (!json_reader_read_member(reader, "body"))
 		return "JSON object does not contain 'body' key";
 
-	json_builder_set_member_name(builder, "plugindata");
-	json_builder_begin_object(builder); // {
-	json_builder_set_member_name(builder, "plugin");
-	json_builder_add_string_value(builder, "janus.plugin.videoroom");
-	json_builder_set_member_name(builder, "data");
-	json_builder_begin_object(builder); // {
+	json_writer_key(builder, "plugindata");
+	json_writer_begin_object(builder); // {
+	json_writer_key(builder, "plugin");
+	json_writer_string(builder, "janus.plugin.videoroom");
+	json_writer_key(builder, "data");
+	json_writer_begin_object(builder); // {
 
 	char *jsep_type_out = NULL;
 	str jsep_sdp_out = STR_NULL;
 
-	LOCK(&janus_lock);
-
-	struct janus_handle *handle = g_hash_table_lookup(janus_handles, &handle_id);
+	AUTO_CLEANUP_NULL(struct janus_handle *handle, janus_handle_release);
+	handle = janus_shard_get(janus_handles, handle_id);
 
 	const char *err = NULL;
 	if (!handle || handle->session != session) {
 		*retcode = 457;
 		err = "No plugin handle given or invalid handle";
 	}
-	else
-		err = janus_videoroom(wm, session, jsep_type, jsep_sdp, transaction, handle,
-				builder, reader, successp, retcode, &jsep_type_out,
-				&jsep_sdp_out);
+	else {
+		LOCK(&handle->lock);
+		if (handle->destroyed) {
+			*retcode = 457;
+			err = "No plugin handle given or invalid handle";
+		}
+		else
+			err = janus_videoroom(wm, session, jsep_type, jsep_sdp, transaction, handle,
+					builder, reader, successp, retcode, &jsep_type_out,
+					&jsep_sdp_out);
+	}
 
-	json_builder_end_object(builder); // }
-	json_builder_end_object(builder); // }
+	json_writer_end_object(builder); // }
+	json_writer_end_object(builder); // }
 
 	if (jsep_type_out && jsep_sdp_out.len) {
-		json_builder_set_member_name(builder, "jsep");
-		json_builder_begin_object(builder); // {
-		json_builder_set_member_name(builder, "type");
-		json_builder_add_string_value(builder, jsep_type_out);
-		json_builder_set_member_name(builder, "sdp");
-		json_builder_add_string_value(builder, jsep_sdp_out.s);
-		json_builder_end_object(builder); // }
+		json_writer_key(builder, "jsep");
+		json_writer_begin_object(builder); // {
+		json_writer_key(builder, "type");
+		json_writer_string(builder, jsep_type_out);
+		json_writer_key(builder, "sdp");
+		json_writer_str(builder, &jsep_sdp_out);
+		json_writer_end_object(builder); // }
 	}
 
 	str_free_dup(&jsep_sdp_out);
@@ -1595,24 +1700,28 @@ static const char *janus_trickle(JsonReader *reader, struct janus_session *sessi
 	if (!sdp_mid && sdp_m_line < 0)
 		return "Neither sdpMid nor sdpMLineIndex given";
 
-	// fetch call
+	// fetch call. the call ID is derived from the room ID, so neither the room
+	// nor the handle needs to stay locked for this
 
 	AUTO_CLEANUP_GBUF(call_id);
 	AUTO_CLEANUP_NULL(struct call *call, call_unlock_release);
 	{
-		LOCK(&janus_lock);
+		AUTO_CLEANUP_NULL(struct janus_handle *handle, janus_handle_release);
+		handle = janus_shard_get(janus_handles, handle_id);
 
-		struct janus_handle *handle = g_hash_table_lookup(janus_handles, &handle_id);
-
-		if (!handle || !handle->room || handle->session != session)
+		if (!handle || handle->session != session)
 			return "Unhandled request method";
 
-		call_id = janus_call_id(handle->room);
+		mutex_lock(&handle->lock);
+		uint64_t room_id = handle->room;
+		mutex_unlock(&handle->lock);
 
-		struct janus_room *room = g_hash_table_lookup(janus_rooms, &handle->room);
+		if (!room_id)
+			return "Unhandled request method";
 
-		if (room)
-			call = call_get(&room->call_id);
+		call_id = janus_call_id(room_id);
+		str call_id_str = STR_INIT(call_id);
+		call = call_get(&call_id_str);
 	}
 
 	// set up "streams" structures to use an trickle ICE update. these must be
@@ -1675,40 +1784,40 @@ static const char *janus_trickle(JsonReader *reader, struct janus_session *sessi
 }
 
 
-static const char *janus_server_info(JsonBuilder *builder) {
-	json_builder_set_member_name(builder, "name");
-	json_builder_add_string_value(builder, "rtpengine Janus interface");
-	json_builder_set_member_name(builder, "version_string");
-	json_builder_add_string_value(builder, RTPENGINE_VERSION);
-	json_builder_set_member_name(builder, "plugins");
-	json_builder_begin_object(builder); // {
-	json_builder_set_member_name(builder, "janus.plugin.videoroom");
-	json_builder_begin_object(builder); // {
-	json_builder_set_member_name(builder, "name");
-	json_builder_add_string_value(builder, "rtpengine Janus videoroom");
-	json_builder_end_object(builder); // }
-	json_builder_end_object(builder); // }
+static const char *janus_server_info(struct json_writer *builder) {
+	json_writer_key(builder, "name");
+	json_writer_string(builder, "rtpengine Janus interface");
+	json_writer_key(builder, "version_string");
+	json_writer_string(builder, RTPENGINE_VERSION);
+	json_writer_key(builder, "plugins");
+	json_writer_begin_object(builder); // {
+	json_writer_key(builder, "janus.plugin.videoroom");
+	json_writer_begin_object(builder); // {
+	json_writer_key(builder, "name");
+	json_writer_string(builder, "rtpengine Janus videoroom");
+	json_writer_end_object(builder); // }
+	json_writer_end_object(builder); // }
 	return "server_info";
 }
 
 
-static void janus_finish_response(JsonBuilder *builder, const char *success, const char *err, int retcode) {
-	json_builder_set_member_name(builder, "janus");
+static void janus_finish_response(struct json_writer *builder, const char *success, const char *err, int retcode) {
+	json_writer_key(builder, "janus");
 	if (err) {
-		json_builder_add_string_value(builder, "error");
+		json_writer_string(builder, "error");
 
-		json_builder_set_member_name(builder, "error");
-		json_builder_begin_object(builder); // {
-		json_builder_set_member_name(builder, "code");
-		json_builder_add_int_value(builder, retcode);
-		json_builder_set_member_name(builder, "reason");
-		json_builder_add_string_value(builder, err);
-		json_builder_end_object(builder); // }
+		json_writer_key(builder, "error");
+		json_writer_begin_object(builder); // {
+		json_writer_key(builder, "code");
+		json_writer_int(builder, retcode);
+		json_writer_key(builder, "reason");
+		json_writer_string(builder, err);
+		json_writer_end_object(builder); // }
 
 		ilog(LOG_WARN, "Janus processing returning error (code %i): %s", retcode, err);
 	}
 	else
-		json_builder_add_string_value(builder, success);
+		json_writer_string(builder, success);
 }
 
 
@@ -1726,8 +1835,8 @@ static const char *websocket_janus_process_json(struct websocket_message *wm,
 	ilog(LOG_DEBUG, "Processing Janus message: '%.*s'", (int) wm->body->len, wm->body->str);
 
 	// prepare response
-	JsonBuilder *builder = json_builder_new();
-	json_builder_begin_object(builder); // {
+	struct json_writer *builder = json_writer_new();
+	json_writer_begin_object(builder); // {
 
 	// start parsing message
 	parser = json_parser_new();
@@ -1813,18 +1922,18 @@ static const char *websocket_janus_process_json(struct websocket_message *wm,
 
 		case CSH_LOOKUP("get_status"):
 			// dummy output
-			json_builder_set_member_name(builder, "status");
-			json_builder_begin_object(builder);
-			json_builder_set_member_name(builder, "token_auth");
-			json_builder_add_boolean_value(builder, false);
-			json_builder_end_object(builder);
+			json_writer_key(builder, "status");
+			json_writer_begin_object(builder);
+			json_writer_key(builder, "token_auth");
+			json_writer_bool(builder, false);
+			json_writer_end_object(builder);
 			break;
 
 		case CSH_LOOKUP("list_sessions"):
 			// dummy output
-			json_builder_set_member_name(builder, "sessions");
-			json_builder_begin_array(builder);
-			json_builder_end_array(builder);
+			json_writer_key(builder, "sessions");
+			json_writer_begin_array(builder);
+			json_writer_end_array(builder);
 			break;
 
 		case CSH_LOOKUP("create"): // create new session
@@ -1866,18 +1975,18 @@ err:
 	janus_finish_response(builder, success, err, retcode);
 
 	if (transaction) {
-		json_builder_set_member_name(builder, "transaction");
-		json_builder_add_string_value(builder, transaction);
+		json_writer_key(builder, "transaction");
+		json_writer_string(builder, transaction);
 	}
 	if (session_id) {
-		json_builder_set_member_name(builder, "session_id");
-		json_builder_add_int_value(builder, session_id);
+		json_writer_key(builder, "session_id");
+		json_writer_int(builder, session_id);
 	}
 	if (handle_id) {
-		json_builder_set_member_name(builder, "sender");
-		json_builder_add_int_value(builder, handle_id);
+		json_writer_key(builder, "sender");
+		json_writer_int(builder, handle_id);
 	}
-	json_builder_end_object(builder); // }
+	json_writer_end_object(builder); // }
 
 	janus_send_json_sync_response(wm, builder, 200);
 
@@ -1902,8 +2011,8 @@ const char *websocket_janus_get(struct websocket_message *wm) {
 
 	ilog(LOG_DEBUG, "Processing Janus GET: '%s'", wm->uri);
 
-	JsonBuilder *builder = json_builder_new();
-	json_builder_begin_object(builder); // {
+	struct json_writer *builder = json_writer_new();
+	json_writer_begin_object(builder); // {
 
 	int retcode = 200;
 	const char *success = "success";
@@ -1922,7 +2031,7 @@ const char *websocket_janus_get(struct websocket_message *wm) {
 
 	janus_finish_response(builder, success, err, retcode);
 
-	json_builder_end_object(builder); // }
+	json_writer_end_object(builder); // }
 
 	janus_send_json_sync_response(wm, builder, 200);
 
@@ -1959,17 +2068,17 @@ done:
 
 
 void janus_init(void) {
-	mutex_init(&janus_lock);
+	mutex_init(&janus_tokens_lock);
 	janus_tokens = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
-	janus_sessions = g_hash_table_new(g_int64_hash, g_int64_equal);
-	janus_handles = g_hash_table_new(g_int64_hash, g_int64_equal);
-	janus_rooms = g_hash_table_new(g_int64_hash, g_int64_equal);
+	janus_shards_init(janus_sessions);
+	janus_shards_init(janus_handles);
+	janus_shards_init(janus_rooms);
 	// XXX timer thread to clean up orphaned sessions
 }
 void janus_free(void) {
-	mutex_destroy(&janus_lock);
+	mutex_destroy(&janus_tokens_lock);
 	g_hash_table_destroy(janus_tokens);
-	g_hash_table_destroy(janus_sessions);
-	g_hash_table_destroy(janus_handles);
-	g_hash_table_destroy(janus_rooms);
+	janus_shards_free(janus_sessions);
+	janus_shards_free(janus_handles);
+	janus_shards_free(janus_rooms);
 }
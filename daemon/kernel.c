@@ -93,6 +93,7 @@ static int kernel_open_table(unsigned int id) {
 			[REMG_GET_STATS] = sizeof(struct rtpengine_command_stats),
 			[REMG_GET_RESET_STATS] = sizeof(struct rtpengine_command_stats),
 			[REMG_SEND_RTCP] = sizeof(struct rtpengine_command_send_packet),
+			[REMG_PACKETS] = sizeof(struct rtpengine_command_packets),
 		},
 	};
 
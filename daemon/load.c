@@ -5,6 +5,8 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 #include "helpers.h"
 #include "log.h"
 #include "main.h"
@@ -12,13 +14,127 @@
 int load_average; // times 100
 int cpu_usage; // percent times 100 (0 - 9999)
 
+struct thread_load_stats thread_load_stats[__THREAD_LOAD_TYPES];
+
+const char *thread_load_type_names[__THREAD_LOAD_TYPES] = {
+	[THREAD_LOAD_POLLER] = "poller",
+	[THREAD_LOAD_TIMER] = "timer",
+	[THREAD_LOAD_CODEC] = "codec",
+};
+
+struct thread_load {
+	enum thread_load_type type;
+	clockid_t clock; // CPU time clock of the thread
+	int latency_ns; // moving average, written by the owning thread only
+	// used by the load monitor only
+	long long cpu_last;
+	long long wall_last;
+	int occupancy; // moving average, percent times 100
+};
+
 static long used_last, idle_last;
 
+static __thread struct thread_load *thread_load;
+static GPtrArray *thread_loads;
+static mutex_t thread_loads_lock = MUTEX_STATIC_INIT;
+
+
+// to be called once by each worker thread that should be considered for admission control
+void thread_load_register(enum thread_load_type type) {
+	if (thread_load)
+		return;
+
+	struct thread_load *tl = g_new0(struct thread_load, 1);
+	tl->type = type;
+	if (pthread_getcpuclockid(pthread_self(), &tl->clock)) {
+		ilog(LOG_WARN, "Failed to obtain CPU clock of %s thread", thread_load_type_names[type]);
+		g_free(tl);
+		return;
+	}
+
+	mutex_lock(&thread_loads_lock);
+	if (!thread_loads)
+		thread_loads = g_ptr_array_new_with_free_func(g_free);
+	g_ptr_array_add(thread_loads, tl);
+	mutex_unlock(&thread_loads_lock);
+
+	thread_load = tl;
+}
+
+// returns zero if no sampling is needed
+long long thread_load_start(void) {
+	if (!thread_load || !rtpe_config.thread_load_limit)
+		return 0;
+	return clock_ns(CLOCK_MONOTONIC);
+}
+
+void thread_load_done(long long start) {
+	if (!start)
+		return;
+	long long diff = clock_ns(CLOCK_MONOTONIC) - start;
+	if (diff < 0)
+		return;
+	diff = MIN(diff, 1000000000LL);
+	int latency = thread_load->latency_ns;
+	latency += (diff - latency) / 8;
+	g_atomic_int_set(&thread_load->latency_ns, latency);
+}
+
+static void thread_load_update(void) {
+	long long occupancy_sum[__THREAD_LOAD_TYPES] = {0,};
+	long long latency_sum[__THREAD_LOAD_TYPES] = {0,};
+	int occupancy_max[__THREAD_LOAD_TYPES] = {0,};
+	int threads[__THREAD_LOAD_TYPES] = {0,};
+
+	long long wall = clock_ns(CLOCK_MONOTONIC);
+
+	mutex_lock(&thread_loads_lock);
+	for (unsigned int i = 0; thread_loads && i < thread_loads->len; i++) {
+		struct thread_load *tl = g_ptr_array_index(thread_loads, i);
+
+		long long cpu = clock_ns(tl->clock);
+		if (cpu < 0)
+			continue;
+		if (tl->wall_last && wall > tl->wall_last) {
+			long long occ = (cpu - tl->cpu_last) * 10000 / (wall - tl->wall_last);
+			occ = MAX(0, MIN(10000, occ));
+			tl->occupancy += (occ - tl->occupancy) / 4;
+		}
+		tl->cpu_last = cpu;
+		tl->wall_last = wall;
+
+		threads[tl->type]++;
+		occupancy_sum[tl->type] += tl->occupancy;
+		occupancy_max[tl->type] = MAX(occupancy_max[tl->type], tl->occupancy);
+		latency_sum[tl->type] += g_atomic_int_get(&tl->latency_ns);
+	}
+	mutex_unlock(&thread_loads_lock);
+
+	for (unsigned int t = 0; t < __THREAD_LOAD_TYPES; t++) {
+		struct thread_load_stats *s = &thread_load_stats[t];
+		g_atomic_int_set(&s->threads, threads[t]);
+		g_atomic_int_set(&s->occupancy, threads[t] ? occupancy_sum[t] / threads[t] : 0);
+		g_atomic_int_set(&s->occupancy_max, occupancy_max[t]);
+		g_atomic_int_set(&s->latency_ns, threads[t] ? latency_sum[t] / threads[t] : 0);
+	}
+}
+
+void load_free(void) {
+	mutex_lock(&thread_loads_lock);
+	if (thread_loads)
+		g_ptr_array_free(thread_loads, TRUE);
+	thread_loads = NULL;
+	mutex_unlock(&thread_loads_lock);
+}
+
 enum thread_looper_action load_thread() {
 	// anything to do?
-	if (!rtpe_config.load_limit && !rtpe_config.cpu_limit)
+	if (!rtpe_config.load_limit && !rtpe_config.cpu_limit && !rtpe_config.thread_load_limit)
 		return TLA_BREAK;
 
+	if (rtpe_config.thread_load_limit)
+		thread_load_update();
+
 	if (rtpe_config.load_limit) {
 		double loadavg;
 		if (getloadavg(&loadavg, 1) >= 1)
@@ -78,6 +78,8 @@ struct rtpengine_config rtpe_config = {
 	.interfaces = G_QUEUE_INIT,
 	.homer_protocol = SOCK_DGRAM,
 	.homer_id = 2001,
+	.homer_queue = 1024,
+	.homer_sample = 1,
 	.port_min = 30000,
 	.port_max = 40000,
 	.redis_db = -1,
@@ -98,6 +100,7 @@ struct rtpengine_config rtpe_config = {
 	.mqtt_keepalive = 30,
 	.mqtt_publish_interval = 5000,
 	.dtmf_digit_delay = 2500,
+	.mysql_threads = 2,
 	.common = {
 		.log_levels = {
 			[log_level_index_internals] = -1,
@@ -470,6 +473,7 @@ static void options(int *argc, char ***argv) {
 	bool codecs = false;
 	double max_load = 0;
 	double max_cpu = 0;
+	double max_thread_load = 0;
 	AUTO_CLEANUP_GBUF(dtmf_udp_ep);
 	AUTO_CLEANUP_GBUF(endpoint_learning);
 	AUTO_CLEANUP_GBUF(dtls_sig);
@@ -553,16 +557,20 @@ static void options(int *argc, char ***argv) {
 		{ "xmlrpc-format",'x', 0, G_OPTION_ARG_INT,	&rtpe_config.fmt,	"XMLRPC timeout request format to use. 0: SEMS DI, 1: call-id only, 2: Kamailio",	"INT"	},
 		{ "num-threads",  0, 0, G_OPTION_ARG_INT,	&rtpe_config.num_threads,	"Number of worker threads to create",	"INT"	},
 		{ "media-num-threads",  0, 0, G_OPTION_ARG_INT,	&rtpe_config.media_num_threads,	"Number of worker threads for media playback",	"INT"	},
+		{ "codec-threads",  0, 0, G_OPTION_ARG_INT,	&rtpe_config.codec_threads,	"Number of worker threads for transcoding",	"INT"	},
 		{ "delete-delay",  'd', 0, G_OPTION_ARG_INT,    &rtpe_config.delete_delay,  "Delay for deleting a session from memory.",    "INT"   },
 		{ "sip-source",  0,  0, G_OPTION_ARG_NONE,	&sip_source,	"Use SIP source address by default",	NULL	},
 		{ "dtls-passive", 0, 0, G_OPTION_ARG_NONE,	&dtls_passive_def,"Always prefer DTLS passive role",	NULL	},
 		{ "max-sessions", 0, 0, G_OPTION_ARG_INT,	&rtpe_config.max_sessions,	"Limit of maximum number of sessions",	"INT"	},
 		{ "max-load",	0, 0,	G_OPTION_ARG_DOUBLE,	&max_load,	"Reject new sessions if load averages exceeds this value",	"FLOAT"	},
 		{ "max-cpu",	0, 0,	G_OPTION_ARG_DOUBLE,	&max_cpu,	"Reject new sessions if CPU usage (in percent) exceeds this value",	"FLOAT"	},
+		{ "max-thread-load",0,0,G_OPTION_ARG_DOUBLE,	&max_thread_load,"Reject new sessions if projected worker thread occupancy (in percent) exceeds this value",	"FLOAT"	},
 		{ "max-bandwidth",0, 0,	G_OPTION_ARG_INT64,	&rtpe_config.bw_limit,	"Reject new sessions if bandwidth usage (in bytes per second) exceeds this value",	"INT"	},
 		{ "homer",	0,  0, G_OPTION_ARG_STRING,	&homerp,	"Address of Homer server for RTCP stats","IP46|HOSTNAME:PORT"},
 		{ "homer-protocol",0,0,G_OPTION_ARG_STRING,	&homerproto,	"Transport protocol for Homer (default udp)",	"udp|tcp"	},
 		{ "homer-id",	0,  0, G_OPTION_ARG_INT,	&rtpe_config.homer_id,	"'Capture ID' to use within the HEP protocol", "INT"	},
+		{ "homer-queue",0,  0, G_OPTION_ARG_INT,	&rtpe_config.homer_queue,"Max number of messages waiting to be sent to Homer", "INT"	},
+		{ "homer-sample",0, 0, G_OPTION_ARG_INT,	&rtpe_config.homer_sample,"Send only one out of this many calls to Homer", "INT"	},
 		{ "recording-dir", 0, 0, G_OPTION_ARG_STRING,	&rtpe_config.spooldir,	"Directory for storing pcap and metadata files", "FILE"	},
 		{ "recording-method",0, 0, G_OPTION_ARG_STRING,	&rtpe_config.rec_method,	"Strategy for call recording",		"pcap|proc|all"	},
 		{ "recording-format",0, 0, G_OPTION_ARG_STRING,	&rtpe_config.rec_format,	"File format for stored pcap files",	"raw|eth"	},
@@ -581,6 +589,8 @@ static void options(int *argc, char ***argv) {
 		{ "mysql-user",	0,   0,	G_OPTION_ARG_STRING,	&rtpe_config.mysql_user,"MySQL connection credentials",		"USERNAME"	},
 		{ "mysql-pass",	0,   0,	G_OPTION_ARG_STRING,	&rtpe_config.mysql_pass,"MySQL connection credentials",		"PASSWORD"	},
 		{ "mysql-query",0,   0,	G_OPTION_ARG_STRING,	&rtpe_config.mysql_query,"MySQL select query",			"STRING"	},
+		{ "mysql-threads",0, 0,	G_OPTION_ARG_INT,	&rtpe_config.mysql_threads,"Number of threads loading media from MySQL","INT"	},
+		{ "mysql-prefetch",0,0,	G_OPTION_ARG_STRING_ARRAY,&rtpe_config.mysql_prefetch,"Media IDs to load from MySQL at startup","INT ..."},
 		{ "endpoint-learning",0,0,G_OPTION_ARG_STRING,	&endpoint_learning,	"RTP endpoint learning algorithm",	"delayed|immediate|off|heuristic"	},
 		{ "jitter-buffer",0, 0,	G_OPTION_ARG_INT,	&rtpe_config.jb_length,	"Size of jitter buffer",		"INT" },
 		{ "jb-clock-drift",0,0,	G_OPTION_ARG_NONE,	&rtpe_config.jb_clock_drift,"Compensate for source clock drift",NULL },
@@ -589,6 +599,7 @@ static void options(int *argc, char ***argv) {
 		{ "dtls-rsa-key-size",0, 0,	G_OPTION_ARG_INT,&rtpe_config.dtls_rsa_key_size,"Size of RSA key for DTLS",	"INT"		},
 		{ "dtls-cert-cipher",0,  0,G_OPTION_ARG_STRING,	&dcc,			"Cipher to use for the DTLS certificate","RSA"	},
 		{ "dtls-mtu",0, 0,	G_OPTION_ARG_INT,&rtpe_config.dtls_mtu,"DTLS MTU",	"INT"		},
+		{ "dtls-threads",0, 0,	G_OPTION_ARG_INT,&rtpe_config.dtls_threads,"Number of threads for DTLS handshakes",	"INT"		},
 		{ "dtls-ciphers",0,  0,	G_OPTION_ARG_STRING,	&rtpe_config.dtls_ciphers,"List of ciphers for DTLS",		"STRING"	},
 		{ "dtls-signature",0,  0,G_OPTION_ARG_STRING,	&dtls_sig,		"Signature algorithm for DTLS",		"SHA-256|SHA-1"	},
 		{ "listen-http", 0,0,	G_OPTION_ARG_STRING_ARRAY,&rtpe_config.http_ifs,"Interface for HTTP and WS",	"[IP46|HOSTNAME:]PORT"},
@@ -609,6 +620,8 @@ static void options(int *argc, char ***argv) {
 		{ "silence-detect",0,0,	G_OPTION_ARG_DOUBLE,	&silence_detect,	"Audio level threshold in percent for silence detection","FLOAT"},
 		{ "cn-payload",0,0,	G_OPTION_ARG_STRING_ARRAY,&cn_payload,		"Comfort noise parameters to replace silence with","INT INT INT ..."},
 		{ "player-cache",0,0,	G_OPTION_ARG_NONE,	&rtpe_config.player_cache,"Cache media files for playback in memory",NULL},
+		{ "player-cache-size",0,0,	G_OPTION_ARG_INT,&rtpe_config.player_cache_size,"Maximum size of media player cache in MB","INT"},
+		{ "player-cache-dir",0,0,	G_OPTION_ARG_STRING,&rtpe_config.player_cache_dir,"Directory to store encoded media files for playback","PATH"},
 		{ "audio-buffer-length",0,0,	G_OPTION_ARG_INT,&rtpe_config.audio_buffer_length,"Length in milliseconds of audio buffer","INT"},
 		{ "audio-buffer-delay",0,0,	G_OPTION_ARG_INT,&rtpe_config.audio_buffer_delay,"Initial delay in milliseconds for buffered audio","INT"},
 		{ "audio-player",0,0,	G_OPTION_ARG_STRING,	&use_audio_player,	"When to enable the internal audio player","on-demand|play-media|transcoding|always"},
@@ -629,6 +642,7 @@ static void options(int *argc, char ***argv) {
 		{ "mqtt-publish-topic",0,0,G_OPTION_ARG_STRING,	&rtpe_config.mqtt_publish_topic,"Mosquitto publish topic",	"STRING"},
 		{ "mqtt-publish-interval",0,0,G_OPTION_ARG_INT,	&rtpe_config.mqtt_publish_interval,"Publish timer interval",	"MILLISECONDS"},
 		{ "mqtt-publish-scope",0,0,G_OPTION_ARG_STRING,	&mqtt_publish_scope,	"Scope for published mosquitto messages","global|summary|call|media"},
+		{ "mqtt-publish-changed-only",0,0,G_OPTION_ARG_NONE,	&rtpe_config.mqtt_publish_changed,"Leave out streams and SSRCs without new packets",NULL},
 #endif
 		{ "mos",0,0,		G_OPTION_ARG_STRING,	&mos,		"Type of MOS calculation","CQ|LQ"},
 		{ "measure-rtp",0,0,	G_OPTION_ARG_NONE,	&rtpe_config.measure_rtp,"Enable measuring RTP statistics and VoIP metrics",NULL},
@@ -754,6 +768,10 @@ static void options(int *argc, char ***argv) {
 		else
 			die("Invalid protocol '%s' (--homer-protocol)", homerproto);
 	}
+	if (rtpe_config.homer_queue < 1)
+		die("Invalid --homer-queue (%i)", rtpe_config.homer_queue);
+	if (rtpe_config.homer_sample < 1)
+		die("Invalid --homer-sample (%i)", rtpe_config.homer_sample);
 
 	if (rtpe_config.default_tos < 0 || rtpe_config.default_tos > 255)
 		die("Invalid TOS value");
@@ -829,6 +847,9 @@ static void options(int *argc, char ***argv) {
 
 	rtpe_config.cpu_limit = max_cpu * 100;
 	rtpe_config.load_limit = max_load * 100;
+	if (max_thread_load < 0 || max_thread_load > 100)
+		die("Invalid thread load limit %.1f (--max-thread-load)", max_thread_load);
+	rtpe_config.thread_load_limit = max_thread_load * 100;
 
 	if (rtpe_config.mysql_query) {
 		// require exactly one %llu placeholder and allow no other % placeholders
@@ -845,6 +866,22 @@ static void options(int *argc, char ***argv) {
 			die("Too many '%%' placeholders (%u) present in --mysql-query='%s'",
 					count, rtpe_config.mysql_query);
 	}
+	if (rtpe_config.mysql_threads < 0)
+		die("Invalid --mysql-threads value");
+	if (rtpe_config.player_cache_size < 0)
+		die("Invalid --player-cache-size value");
+	if (rtpe_config.mysql_prefetch && rtpe_config.mysql_prefetch[0]) {
+		if (!rtpe_config.mysql_host || !rtpe_config.mysql_query)
+			die("--mysql-prefetch requires --mysql-host and --mysql-query");
+		if (!rtpe_config.mysql_threads)
+			die("--mysql-prefetch requires --mysql-threads to be non-zero");
+	}
+	for (char **id = rtpe_config.mysql_prefetch; id && *id; id++) {
+		char *endp;
+		long long db_id = strtoll(*id, &endp, 10);
+		if (db_id <= 0 || *endp)
+			die("Invalid media ID '%s' in --mysql-prefetch", *id);
+	}
 
 	enum endpoint_learning el_config = EL_DELAYED;
 	if (endpoint_learning) {
@@ -882,6 +919,12 @@ static void options(int *argc, char ***argv) {
 		However, this does not preclude link layers with an MTU smaller than this minimum MTU from conveying IP data. Internet IPv4 path MTU is 68 bytes.*/
 		die("Invalid --dtls-mtu (%i)", rtpe_config.dtls_mtu);
 
+	if (rtpe_config.dtls_threads < 0)
+		die("Invalid --dtls-threads (%i)", rtpe_config.dtls_threads);
+
+	if (rtpe_config.codec_threads < 0)
+		die("Invalid --codec-threads (%i)", rtpe_config.codec_threads);
+
 	if (rtpe_config.jb_length < 0)
 		die("Invalid negative jitter buffer size");
 
@@ -1004,6 +1047,7 @@ static void fill_initial_rtpe_cfg(struct rtpengine_config* ini_rtpe_cfg) {
 	ini_rtpe_cfg->max_sessions = rtpe_config.max_sessions;
 	ini_rtpe_cfg->cpu_limit = rtpe_config.cpu_limit;
 	ini_rtpe_cfg->load_limit = rtpe_config.load_limit;
+	ini_rtpe_cfg->thread_load_limit = rtpe_config.thread_load_limit;
 	ini_rtpe_cfg->bw_limit = rtpe_config.bw_limit;
 	ini_rtpe_cfg->timeout = rtpe_config.timeout;
 	ini_rtpe_cfg->silent_timeout = rtpe_config.silent_timeout;
@@ -1026,6 +1070,7 @@ static void fill_initial_rtpe_cfg(struct rtpengine_config* ini_rtpe_cfg) {
 	ini_rtpe_cfg->no_redis_required = rtpe_config.no_redis_required;
 	ini_rtpe_cfg->num_threads = rtpe_config.num_threads;
 	ini_rtpe_cfg->media_num_threads = rtpe_config.media_num_threads;
+	ini_rtpe_cfg->codec_threads = rtpe_config.codec_threads;
 	ini_rtpe_cfg->fmt = rtpe_config.fmt;
 	ini_rtpe_cfg->log_format = rtpe_config.log_format;
 	ini_rtpe_cfg->redis_allowed_errors = rtpe_config.redis_allowed_errors;
@@ -1102,6 +1147,8 @@ static void options_free(void) {
 	g_free(rtpe_config.mysql_user);
 	g_free(rtpe_config.mysql_pass);
 	g_free(rtpe_config.mysql_query);
+	g_strfreev(rtpe_config.mysql_prefetch);
+	g_free(rtpe_config.player_cache_dir);
 	g_free(rtpe_config.dtls_ciphers);
 	g_strfreev(rtpe_config.http_ifs);
 	g_strfreev(rtpe_config.https_ifs);
@@ -1302,6 +1349,16 @@ static void do_redis_restore(void) {
 }
 
 
+static void poller_thread(void *p) {
+	thread_load_register(THREAD_LOAD_POLLER);
+	poller_loop2(p);
+}
+
+static void poller_map_thread(void *p) {
+	thread_load_register(THREAD_LOAD_POLLER);
+	poller_loop(p);
+}
+
 int main(int argc, char **argv) {
 	int idx;
 
@@ -1360,19 +1417,23 @@ int main(int argc, char **argv) {
 
 	thread_create_detach(ice_thread_run, NULL, "ICE");
 
+	if (has_homer())
+		thread_create_detach_prio(homer_loop, NULL, rtpe_config.idle_scheduling,
+				rtpe_config.idle_priority, "homer");
+
 	websocket_start();
 
 	service_notify("READY=1\n");
 
 	for (idx = 0; idx < rtpe_config.num_threads; ++idx) {
 		if (!rtpe_config.poller_per_thread)
-			thread_create_detach_prio(poller_loop2, rtpe_poller, rtpe_config.scheduling, rtpe_config.priority, "poller");
+			thread_create_detach_prio(poller_thread, rtpe_poller, rtpe_config.scheduling, rtpe_config.priority, "poller");
 		else
-			thread_create_detach_prio(poller_loop, rtpe_poller_map, rtpe_config.scheduling, rtpe_config.priority, "poller");
+			thread_create_detach_prio(poller_map_thread, rtpe_poller_map, rtpe_config.scheduling, rtpe_config.priority, "poller");
 	}
 
 	if (rtpe_config.poller_per_thread)
-		thread_create_detach_prio(poller_loop2, rtpe_poller, rtpe_config.scheduling, rtpe_config.priority, "poller");
+		thread_create_detach_prio(poller_thread, rtpe_poller, rtpe_config.scheduling, rtpe_config.priority, "poller");
 
 	if (rtpe_config.media_num_threads < 0)
 		rtpe_config.media_num_threads = rtpe_config.num_threads;
@@ -1411,6 +1472,9 @@ int main(int argc, char **argv) {
 
 	threads_join_all(true);
 
+	codecs_stop();
+	dtls_stop();
+
 	if (!is_addr_unspecified(&rtpe_config.redis_ep.address) && initial_rtpe_config.redis_delete_async)
 		redis_async_event_base_action(rtpe_redis_write, EVENT_BASE_FREE);
 
@@ -1431,8 +1495,10 @@ int main(int argc, char **argv) {
 	call_interfaces_free();
 	ice_free();
 	dtls_cert_free();
+	homer_sender_free();
 	control_ng_cleanup();
 	codecs_cleanup();
+	load_free();
 	statistics_free();
 
 	redis_close(rtpe_redis);
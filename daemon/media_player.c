@@ -1,5 +1,8 @@
 #include "media_player.h"
 #include <glib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #ifdef WITH_TRANSCODING
 #include <mysql.h>
 #include <mysql/errmsg.h>
@@ -37,16 +40,30 @@ struct media_player_cache_index {
 	struct rtp_payload_type dst_pt;
 };
 struct media_player_cache_entry {
+	struct obj obj; // held by the cache, by each player using it, and by the decoder thread
 	bool finished;
 	// "unfinished" elements, only used while decoding is active:
 	mutex_t lock;
 	cond_t cond; // to wait for more data to be decoded
 
-	GPtrArray *packets; // read-only except for decoder thread, which uses finished flags and locks
+	GArray *packets; // read-only except for decoder thread, which uses finished flags and locks
+
+	// packet data, in chunks of at least MP_CACHE_ARENA_SIZE. only touched by the decoder thread
+	GPtrArray *arenas;
+	char *arena_next;
+	size_t arena_free; // in the last chunk
+	void *map; // data is mmap'd from disk instead
+	size_t map_len;
+
+	size_t size; // memory used
+	struct media_player_cache_index *key; // NULL once evicted
+	GList lru_link; // in media_player_cache_lru, if in the cache
 
 	struct codec_scheduler csch;
 	struct media_player_coder coder; // de/encoder data
+	struct rtp_payload_type dst_pt; // for entries that have no coder
 
+	char *disk_key; // if set, write to disk cache when done
 	char *info_str; // for logging
 };
 struct media_player_cache_packet {
@@ -57,8 +74,29 @@ struct media_player_cache_packet {
 	long long duration_ts;
 };
 
+#define MP_CACHE_ARENA_SIZE (256 * 1024)
+
 static mutex_t media_player_cache_lock;
-static GHashTable *media_player_cache; // keys and values only ever freed at shutdown
+static GHashTable *media_player_cache;
+static GQueue media_player_cache_lru = G_QUEUE_INIT; // most recently used first
+static size_t media_player_cache_size;
+
+static void media_player_cache_entry_free(void *p);
+
+// loads media from the DB in the background, each thread with its own DB connection
+static GThreadPool *media_player_db_pool;
+struct media_player_db_job {
+	struct media_player *mp; // NULL for prefetch
+	unsigned int play_gen;
+	long long id;
+	long long repeat;
+	long long start_pos;
+};
+
+// raw media as loaded from the DB by a prefetch job, by ID. only kept until there's an
+// encoded cache entry, so never more than --mysql-prefetch lists
+static mutex_t media_player_db_cache_lock;
+static GHashTable *media_player_db_cache;
 
 static bool media_player_read_packet(struct media_player *mp);
 #endif
@@ -105,6 +143,7 @@ static void media_player_shutdown(struct media_player *mp) {
 	//ilog(LOG_DEBUG, "shutting down media_player");
 	timerthread_obj_deschedule(&mp->tt_obj);
 	mp->next_run.tv_sec = 0;
+	mp->play_gen++; // invalidates pending DB loads
 
 	if (mp->sink) {
 		unsigned int num = send_timer_flush(mp->sink->send_timer, mp->coder.handler);
@@ -120,7 +159,7 @@ static void media_player_shutdown(struct media_player *mp) {
 	if (mp->cache_index.file.s)
 		g_free(mp->cache_index.file.s);
 	mp->cache_index.file = STR_NULL;// coverity[missing_lock : FALSE]
-	mp->cache_entry = NULL; // coverity[missing_lock : FALSE]
+	obj_release(mp->cache_entry); // coverity[missing_lock : FALSE]
 	mp->cache_read_idx = 0;
 }
 #endif
@@ -417,8 +456,11 @@ retry:;
 		goto retry;
 	}
 
-	// got a packet
-	struct media_player_cache_packet *pkt = entry->packets->pdata[read_idx];
+	// got a packet. the array may be reallocated by the decoder thread, so make a copy
+	struct media_player_cache_packet *pkt
+		= &g_array_index(entry->packets, struct media_player_cache_packet, read_idx);
+	struct media_player_cache_packet pkt_copy = *pkt;
+	pkt = &pkt_copy;
 	long long us_dur = pkt->duration;
 
 	mp->cache_read_idx++;
@@ -469,7 +511,8 @@ static void media_player_cached_reader_start(struct media_player *mp, const stru
 
 	// create dummy codec handler and start timer
 
-	mp->coder.handler = codec_handler_make_dummy(&entry->coder.handler->dest_pt, mp->media);
+	mp->coder.handler = codec_handler_make_dummy(entry->coder.handler ? &entry->coder.handler->dest_pt
+			: &entry->dst_pt, mp->media);
 
 	mp->run_func = media_player_read_decoded_packet;
 	mp->next_run = rtpe_now;
@@ -489,10 +532,302 @@ static void media_player_cached_reader_start(struct media_player *mp, const stru
 }
 
 
-static void cache_packet_free(void *ptr) {
-	struct media_player_cache_packet *p = ptr;
-	g_free(p->buf);
-	g_slice_free1(sizeof(*p), p);
+// called with media_player_cache_lock held
+static void media_player_cache_remove(struct media_player_cache_entry *entry) {
+	g_queue_unlink(&media_player_cache_lru, &entry->lru_link);
+	media_player_cache_size -= entry->size;
+	struct media_player_cache_index *key = entry->key;
+	entry->key = NULL;
+	// releases the key and the cache's reference to the entry
+	g_hash_table_remove(media_player_cache, key);
+}
+
+// called with media_player_cache_lock held. drops the least recently used entries until the
+// cache fits within the configured limit. entries still in use are released by their users.
+static void media_player_cache_evict(void) {
+	if (rtpe_config.player_cache_size <= 0)
+		return;
+	size_t limit = (size_t) rtpe_config.player_cache_size * 1024 * 1024;
+
+	while (media_player_cache_size > limit && media_player_cache_lru.tail) {
+		struct media_player_cache_entry *entry = media_player_cache_lru.tail->data;
+		ilog(LOG_DEBUG, "Evicting %s from media player cache (%zu bytes)", entry->info_str, entry->size);
+		media_player_cache_remove(entry);
+	}
+}
+
+static void media_player_cache_account(struct media_player_cache_entry *entry, size_t bytes) {
+	LOCK(&media_player_cache_lock);
+	entry->size += bytes;
+	if (!entry->key)
+		return; // evicted
+	media_player_cache_size += bytes;
+	media_player_cache_evict();
+}
+
+// called with media_player_cache_lock held. takes over the reference
+static void media_player_cache_insert(const struct media_player_cache_index *lookup,
+		struct media_player_cache_entry *entry)
+{
+	struct media_player_cache_index *ins_key = g_slice_alloc(sizeof(*ins_key));
+	*ins_key = *lookup;
+	str_init_dup_str(&ins_key->index.file, &lookup->index.file);
+	codec_init_payload_type(&ins_key->dst_pt, MT_UNKNOWN); // duplicate contents
+
+	entry->key = ins_key;
+	g_hash_table_insert(media_player_cache, ins_key, entry);
+	g_queue_push_head_link(&media_player_cache_lru, &entry->lru_link);
+	media_player_cache_size += entry->size;
+
+	media_player_cache_evict();
+}
+
+static struct media_player_cache_entry *media_player_cache_entry_new(const struct media_player_cache_index *lookup) {
+	struct media_player_cache_entry *entry = obj_alloc0("media_player_cache_entry", sizeof(*entry),
+			media_player_cache_entry_free);
+	mutex_init(&entry->lock);
+	cond_init(&entry->cond);
+	entry->packets = g_array_new(false, false, sizeof(struct media_player_cache_packet));
+	entry->arenas = g_ptr_array_new_with_free_func(g_free);
+	entry->lru_link.data = entry;
+	entry->dst_pt = lookup->dst_pt;
+	codec_init_payload_type(&entry->dst_pt, MT_UNKNOWN); // duplicate contents
+
+	switch (lookup->index.type) {
+		case MP_DB:
+			entry->info_str = g_strdup_printf("DB media file #%llu", lookup->index.db_id);
+			break;
+		case MP_FILE:
+			entry->info_str = g_strdup_printf("media file '" STR_FORMAT "'",
+					STR_FMT(&lookup->index.file));
+			break;
+		case MP_BLOB:
+			entry->info_str = g_strdup_printf("binary media blob");
+			break;
+		default:;
+	}
+
+	return entry;
+}
+
+// returns space for `len` bytes of packet data. only used by the decoder thread
+static char *media_player_cache_arena_alloc(struct media_player_cache_entry *entry, size_t len) {
+	len = (len + 7) & ~7;
+	if (entry->arena_free < len) {
+		size_t chunk_len = MAX(len, MP_CACHE_ARENA_SIZE);
+		char *chunk = g_malloc(chunk_len);
+		g_ptr_array_add(entry->arenas, chunk);
+		entry->arena_next = chunk;
+		entry->arena_free = chunk_len;
+		media_player_cache_account(entry, chunk_len);
+	}
+	char *ret = entry->arena_next;
+	entry->arena_next += len;
+	entry->arena_free -= len;
+	return ret;
+}
+
+
+/*
+ * On-disk cache of encoded media files, so that media doesn't need to be transcoded again after
+ * a restart, and can be shared between multiple instances. Files are named after a hash of the
+ * media file name, its modification time and size, and the output codec parameters. The files
+ * are mmap'd and used directly for playback. Layout:
+ *
+ * header, key string (padded to 8 bytes), packet table, packet data (each padded to 8 bytes)
+ */
+
+#define MP_DISK_MAGIC "RTPEMPC1"
+
+struct media_player_disk_header {
+	char magic[8];
+	uint32_t key_len;
+	uint32_t num_packets;
+	uint64_t duration;
+};
+struct media_player_disk_packet {
+	uint64_t offset; // of the buffer, from start of file
+	uint32_t hdr_len; // from start of buffer to payload
+	uint32_t len; // of payload
+	int64_t pts;
+	int64_t duration;
+	int64_t duration_ts;
+};
+
+#define MP_DISK_ALIGN(x) (((x) + 7) & ~((size_t) 7))
+
+static char *media_player_disk_key(const struct media_player_cache_index *lookup) {
+	if (!rtpe_config.player_cache_dir)
+		return NULL;
+	if (lookup->index.type != MP_FILE)
+		return NULL;
+
+	char path[PATH_MAX];
+	snprintf(path, sizeof(path), STR_FORMAT, STR_FMT(&lookup->index.file));
+	struct stat st;
+	if (stat(path, &st))
+		return NULL;
+
+	const struct rtp_payload_type *pt = &lookup->dst_pt;
+	return g_strdup_printf("%s\n%lli.%09li\n%lli\n" STR_FORMAT "\n" STR_FORMAT "\n%i\n%i\n%zu/%i",
+			path, (long long) st.st_mtim.tv_sec, (long) st.st_mtim.tv_nsec, (long long) st.st_size,
+			STR_FMT(&pt->encoding_with_full_params), STR_FMT(&pt->format_parameters),
+			pt->ptime, pt->bitrate, sizeof(struct rtp_header), RTP_BUFFER_TAIL_ROOM);
+}
+
+static char *media_player_disk_path(const char *key) {
+	AUTO_CLEANUP_GBUF(sum);
+	sum = g_compute_checksum_for_string(G_CHECKSUM_SHA256, key, -1);
+	return g_strdup_printf("%s/%s.mpc", rtpe_config.player_cache_dir, sum);
+}
+
+static struct media_player_cache_entry *media_player_disk_load(const struct media_player_cache_index *lookup,
+		const char *key)
+{
+	AUTO_CLEANUP_GBUF(path);
+	path = media_player_disk_path(key);
+
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno != ENOENT)
+			ilog(LOG_WARN, "Failed to open media cache file '%s': %s", path, strerror(errno));
+		return NULL;
+	}
+
+	const char *err = "failed to stat";
+	struct stat st;
+	void *map = MAP_FAILED;
+	if (fstat(fd, &st))
+		goto err;
+	size_t map_len = st.st_size;
+	err = "file too short";
+	if (map_len < sizeof(struct media_player_disk_header))
+		goto err;
+	err = "failed to mmap";
+	map = mmap(NULL, map_len, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto err;
+
+	// validate everything
+	const struct media_player_disk_header *hdr = map;
+	err = "invalid header";
+	if (memcmp(hdr->magic, MP_DISK_MAGIC, sizeof(hdr->magic)))
+		goto err;
+	size_t table_pos = MP_DISK_ALIGN(sizeof(*hdr) + hdr->key_len);
+	if (table_pos + (size_t) hdr->num_packets * sizeof(struct media_player_disk_packet) > map_len)
+		goto err;
+	err = "key mismatch";
+	if (hdr->key_len != strlen(key) || memcmp((const char *) map + sizeof(*hdr), key, hdr->key_len))
+		goto err;
+	const struct media_player_disk_packet *dps = (const void *) ((const char *) map + table_pos);
+	err = "invalid packet table";
+	for (unsigned int i = 0; i < hdr->num_packets; i++) {
+		if (dps[i].offset > map_len)
+			goto err;
+		if ((size_t) dps[i].hdr_len + dps[i].len + RTP_BUFFER_TAIL_ROOM > map_len - dps[i].offset)
+			goto err;
+	}
+
+	close(fd);
+
+	struct media_player_cache_entry *entry = media_player_cache_entry_new(lookup);
+	entry->map = map;
+	entry->map_len = map_len;
+	entry->size = map_len;
+	entry->finished = true;
+	entry->coder.duration = hdr->duration;
+
+	g_array_set_size(entry->packets, hdr->num_packets);
+	for (unsigned int i = 0; i < hdr->num_packets; i++) {
+		char *buf = (char *) map + dps[i].offset;
+		g_array_index(entry->packets, struct media_player_cache_packet, i)
+			= (struct media_player_cache_packet) {
+				.buf = buf,
+				.s = STR_INIT_LEN(buf + dps[i].hdr_len, dps[i].len),
+				.pts = dps[i].pts,
+				.duration = dps[i].duration,
+				.duration_ts = dps[i].duration_ts,
+			};
+	}
+
+	ilog(LOG_DEBUG, "Loaded %s from media cache file '%s' (%u packets)", entry->info_str, path,
+			hdr->num_packets);
+
+	return entry;
+
+err:
+	ilog(LOG_WARN, "Ignoring media cache file '%s': %s", path, err);
+	if (map != MAP_FAILED)
+		munmap(map, st.st_size);
+	close(fd);
+	return NULL;
+}
+
+// called from the decoder thread once the entry is finished
+static void media_player_disk_save(struct media_player_cache_entry *entry) {
+	AUTO_CLEANUP_GBUF(path);
+	AUTO_CLEANUP_GBUF(tmp_path);
+	path = media_player_disk_path(entry->disk_key);
+	tmp_path = g_strdup_printf("%s.XXXXXX", path);
+
+	int fd = g_mkstemp(tmp_path);
+	if (fd == -1) {
+		ilog(LOG_WARN, "Failed to create media cache file '%s': %s", tmp_path, strerror(errno));
+		return;
+	}
+	FILE *f = fdopen(fd, "w");
+
+	static const char zeroes[8];
+	GArray *packets = entry->packets;
+	size_t key_len = strlen(entry->disk_key);
+
+	struct media_player_disk_header hdr = {
+		.key_len = key_len,
+		.num_packets = packets->len,
+		.duration = entry->coder.duration,
+	};
+	memcpy(hdr.magic, MP_DISK_MAGIC, sizeof(hdr.magic));
+	fwrite(&hdr, sizeof(hdr), 1, f);
+	fwrite(entry->disk_key, key_len, 1, f);
+	size_t pos = sizeof(hdr) + key_len;
+	fwrite(zeroes, MP_DISK_ALIGN(pos) - pos, 1, f);
+	pos = MP_DISK_ALIGN(pos) + packets->len * sizeof(struct media_player_disk_packet);
+
+	for (unsigned int i = 0; i < packets->len; i++) {
+		struct media_player_cache_packet *pkt
+			= &g_array_index(packets, struct media_player_cache_packet, i);
+		struct media_player_disk_packet dp = {
+			.offset = pos,
+			.hdr_len = pkt->s.s - pkt->buf,
+			.len = pkt->s.len,
+			.pts = pkt->pts,
+			.duration = pkt->duration,
+			.duration_ts = pkt->duration_ts,
+		};
+		fwrite(&dp, sizeof(dp), 1, f);
+		pos += MP_DISK_ALIGN(dp.hdr_len + dp.len + RTP_BUFFER_TAIL_ROOM);
+	}
+
+	for (unsigned int i = 0; i < packets->len; i++) {
+		struct media_player_cache_packet *pkt
+			= &g_array_index(packets, struct media_player_cache_packet, i);
+		size_t len = (pkt->s.s - pkt->buf) + pkt->s.len + RTP_BUFFER_TAIL_ROOM;
+		fwrite(pkt->buf, len, 1, f);
+		fwrite(zeroes, MP_DISK_ALIGN(len) - len, 1, f);
+	}
+
+	bool ok = !ferror(f);
+	if (fclose(f))
+		ok = false;
+	if (ok && rename(tmp_path, path))
+		ok = false;
+	if (!ok) {
+		ilog(LOG_WARN, "Failed to write media cache file '%s': %s", path, strerror(errno));
+		unlink(tmp_path);
+		return;
+	}
+
+	ilog(LOG_DEBUG, "Wrote %s to media cache file '%s'", entry->info_str, path);
 }
 
 
@@ -510,49 +845,60 @@ static bool media_player_cache_get_entry(struct media_player *mp,
 	lookup.index = mp->cache_index;
 	lookup.dst_pt = *dst_pt;
 
+	char *disk_key = NULL;
+	struct media_player_cache_entry *ref = NULL;
+
 	mutex_lock(&media_player_cache_lock);
-	struct media_player_cache_entry *entry = mp->cache_entry
-		= g_hash_table_lookup(media_player_cache, &lookup);
+	struct media_player_cache_entry *entry = g_hash_table_lookup(media_player_cache, &lookup);
+
+	if (!entry && rtpe_config.player_cache_dir && lookup.index.type == MP_FILE) {
+		// try the disk cache, without holding the lock
+		mutex_unlock(&media_player_cache_lock);
+		struct media_player_cache_entry *loaded = NULL;
+		disk_key = media_player_disk_key(&lookup);
+		if (disk_key)
+			loaded = media_player_disk_load(&lookup, disk_key);
+		mutex_lock(&media_player_cache_lock);
+
+		entry = g_hash_table_lookup(media_player_cache, &lookup);
+		if (entry) {
+			// someone else was faster
+			if (loaded)
+				obj_put(loaded);
+		}
+		else if (loaded) {
+			// our own reference first, as an entry bigger than the whole cache is
+			// evicted again right away
+			ref = obj_get(loaded);
+			media_player_cache_insert(&lookup, loaded);
+			entry = loaded;
+		}
+	}
 
-	bool ret = true; // entry exists, use cached data
 	if (entry) {
+		g_free(disk_key);
+		if (entry->key) {
+			g_queue_unlink(&media_player_cache_lru, &entry->lru_link);
+			g_queue_push_head_link(&media_player_cache_lru, &entry->lru_link);
+		}
+		mp->cache_entry = ref ? ref : obj_get(entry);
+		mutex_unlock(&media_player_cache_lock);
+
+		// outside of the lock as this may wait for the decoder thread
 		media_player_cached_reader_start(mp, dst_pt, repeat);
-		goto out;
+		return true; // entry exists, use cached data
 	}
 
-	ret = false; // new entry, open decoder, then call media_player_play_start
+	// new entry, open decoder, then call media_player_play_start
 
-	// initialise object
+	entry = media_player_cache_entry_new(&lookup);
+	entry->disk_key = disk_key;
+	mp->cache_entry = obj_get(entry);
+	media_player_cache_insert(&lookup, entry);
 
-	struct media_player_cache_index *ins_key = g_slice_alloc(sizeof(*ins_key));
-	*ins_key = lookup;
-	str_init_dup_str(&ins_key->index.file, &lookup.index.file);
-	codec_init_payload_type(&ins_key->dst_pt, MT_UNKNOWN); // duplicate contents
-	entry = mp->cache_entry = g_slice_alloc0(sizeof(*entry));
-	mutex_init(&entry->lock);
-	cond_init(&entry->cond);
-	entry->packets = g_ptr_array_new_full(64, cache_packet_free);
-
-	switch (lookup.index.type) {
-		case MP_DB:
-			entry->info_str = g_strdup_printf("DB media file #%llu", lookup.index.db_id);
-			break;
-		case MP_FILE:
-			entry->info_str = g_strdup_printf("media file '" STR_FORMAT "'",
-					STR_FMT(&lookup.index.file));
-			break;
-		case MP_BLOB:
-			entry->info_str = g_strdup_printf("binary media blob");
-			break;
-		default:;
-	}
-
-	g_hash_table_insert(media_player_cache, ins_key, entry);
-
-out:
 	mutex_unlock(&media_player_cache_lock);
 
-	return ret;
+	return false;
 }
 
 static void media_player_cache_packet(struct media_player_cache_entry *entry, char *buf, size_t len,
@@ -575,6 +921,7 @@ static void media_player_cache_packet(struct media_player_cache_entry *entry, ch
 
 static void media_player_cache_entry_decoder_thread(void *p) {
 	struct media_player_cache_entry *entry = p;
+	int ret;
 
 	ilog(LOG_DEBUG, "Launching media decoder thread for %s", entry->info_str);
 
@@ -584,7 +931,7 @@ static void media_player_cache_entry_decoder_thread(void *p) {
 		pthread_testcancel();
 		thread_cancel_disable();
 
-		int ret = av_read_frame(entry->coder.fmtctx, entry->coder.pkt);
+		ret = av_read_frame(entry->coder.fmtctx, entry->coder.pkt);
 		if (ret < 0) {
 			if (ret != AVERROR_EOF)
 				ilog(LOG_ERR, "Error while reading from media stream");
@@ -601,7 +948,14 @@ static void media_player_cache_entry_decoder_thread(void *p) {
 	cond_broadcast(&entry->cond);
 	mutex_unlock(&entry->lock);
 
+	media_player_cache_account(entry, entry->packets->len * sizeof(struct media_player_cache_packet));
+
 	ilog(LOG_DEBUG, "Decoder thread for %s finished", entry->info_str);
+
+	if (ret == AVERROR_EOF && entry->disk_key && entry->packets->len)
+		media_player_disk_save(entry);
+
+	obj_put(entry);
 }
 
 static void packet_encoded_cache(AVPacket *pkt, struct codec_ssrc_handler *ch, struct media_packet *mp,
@@ -609,11 +963,16 @@ static void packet_encoded_cache(AVPacket *pkt, struct codec_ssrc_handler *ch, s
 {
 	struct media_player_cache_entry *entry = mp->cache_entry;
 
-	struct media_player_cache_packet *ep = g_slice_alloc0(sizeof(*ep));
+	// move packet into the arena
+	size_t hdr_len = s->s - buf;
+	size_t len = hdr_len + s->len + RTP_BUFFER_TAIL_ROOM;
+	char *abuf = media_player_cache_arena_alloc(entry, len);
+	memcpy(abuf, buf, len);
+	g_free(buf);
 
-	*ep = (__typeof__(*ep)) {
-		.buf = buf,
-		.s = *s,
+	struct media_player_cache_packet ep = {
+		.buf = abuf,
+		.s = STR_INIT_LEN(abuf + hdr_len, s->len),
 		.pts = pkt->pts,
 		.duration_ts = pkt->duration,
 		.duration = (long long) pkt->duration * 1000000LL
@@ -621,7 +980,7 @@ static void packet_encoded_cache(AVPacket *pkt, struct codec_ssrc_handler *ch, s
 	};
 
 	mutex_lock(&entry->lock);
-	g_ptr_array_add(entry->packets, ep);
+	g_array_append_val(entry->packets, ep);
 
 	cond_broadcast(&entry->cond);
 	mutex_unlock(&entry->lock);
@@ -658,7 +1017,7 @@ static bool media_player_cache_entry_init(struct media_player *mp, const struct
 	entry->coder.handler->packet_encoded = media_player_packet_cache;
 
 	// use low priority (10 nice)
-	thread_create_detach_prio(media_player_cache_entry_decoder_thread, entry, NULL, 10, "mp decoder");
+	thread_create_detach_prio(media_player_cache_entry_decoder_thread, obj_get(entry), NULL, 10, "mp decoder");
 
 	media_player_cached_reader_start(mp, dst_pt, repeat);
 
@@ -1050,6 +1409,9 @@ static int media_player_play_blob_id(struct media_player *mp, const str *blob, l
 			return 0;
 	}
 
+	err = "no media data";
+	if (!blob)
+		goto err;
 	mp->coder.blob = str_dup(blob);
 	err = "out of memory";
 	if (!mp->coder.blob)
@@ -1126,8 +1488,9 @@ err:
 }
 
 
-// call->master_lock held in W
-int media_player_play_db(struct media_player *mp, long long id, long long repeat, long long start_pos) {
+// loads media from the DB using this thread's connection. returns a newly allocated blob
+// (to be free'd) or NULL on error
+static str *media_player_db_load(long long id) {
 	const char *err;
 	AUTO_CLEANUP_GBUF(query);
 
@@ -1173,7 +1536,7 @@ success:;
 	}
 
 	str blob = STR_INIT_LEN(row[0], lengths[0]);
-	int ret = media_player_play_blob_id(mp, &blob, repeat, start_pos, id);
+	str *ret = str_dup(&blob);
 
 	mysql_free_result(res);
 
@@ -1181,10 +1544,160 @@ success:;
 
 err:
 	if (query)
-		ilog(LOG_ERR, "Failed to start media playback from database (used query '%s'): %s", query, err);
+		ilog(LOG_ERR, "Failed to load media from database (used query '%s'): %s", query, err);
 	else
-		ilog(LOG_ERR, "Failed to start media playback from database: %s", err);
-	return -1;
+		ilog(LOG_ERR, "Failed to load media from database: %s", err);
+	return NULL;
+}
+
+
+// returns a copy to be freed by the caller, as the cached blob may be dropped at any time
+static str *media_player_db_cache_get(long long id) {
+	if (!media_player_db_cache)
+		return NULL;
+	LOCK(&media_player_db_cache_lock);
+	str *blob = g_hash_table_lookup(media_player_db_cache, &id);
+	return blob ? str_dup(blob) : NULL;
+}
+
+static void media_player_db_cache_add(long long id, const str *blob) {
+	if (!media_player_db_cache || !blob)
+		return;
+	LOCK(&media_player_db_cache_lock);
+	if (g_hash_table_lookup(media_player_db_cache, &id))
+		return;
+	gint64 *key = g_new(gint64, 1);
+	*key = id;
+	g_hash_table_insert(media_player_db_cache, key, str_dup(blob));
+}
+
+static void media_player_db_cache_drop(long long id) {
+	if (!media_player_db_cache)
+		return;
+	LOCK(&media_player_db_cache_lock);
+	g_hash_table_remove(media_player_db_cache, &id);
+}
+
+// call->master_lock held in W
+static int media_player_play_db_blob(struct media_player *mp, const str *blob, long long repeat,
+		long long start_pos, long long id)
+{
+	int ret = media_player_play_blob_id(mp, blob, repeat, start_pos, id);
+	// the encoded cache entry takes over from the raw blob
+	if (ret == 0 && mp->cache_entry)
+		media_player_db_cache_drop(id);
+	return ret;
+}
+
+
+// lookup only, doesn't create a new entry
+static bool media_player_cache_exists(long long id, const struct rtp_payload_type *dst_pt) {
+	if (!rtpe_config.player_cache)
+		return false;
+
+	struct media_player_cache_index lookup = {
+		.index = {
+			.type = MP_DB,
+			.db_id = id,
+		},
+		.dst_pt = *dst_pt,
+	};
+
+	LOCK(&media_player_cache_lock);
+	return g_hash_table_lookup(media_player_cache, &lookup) != NULL;
+}
+
+
+// called from a loader thread once the DB query has completed
+static void media_player_db_play(struct media_player_db_job *job, str *blob) {
+	struct media_player *mp = job->mp;
+	struct call *call = mp->call;
+
+	log_info_call(call);
+	rwlock_lock_w(&call->master_lock);
+	gettimeofday(&rtpe_now, NULL);
+
+	if (mp->play_gen != job->play_gen)
+		ilog(LOG_DEBUG, "Media playback from database (ID %lli) was stopped while loading", job->id);
+	else if (!blob)
+		ilog(LOG_ERR, "Failed to start media playback from database (ID %lli)", job->id);
+	else if (media_player_play_db_blob(mp, blob, job->repeat, job->start_pos, job->id))
+		ilog(LOG_ERR, "Failed to start media playback from database (ID %lli)", job->id);
+
+	rwlock_unlock_w(&call->master_lock);
+	log_info_pop();
+}
+
+static void media_player_db_worker(void *p, void *u) {
+	struct media_player_db_job *job = p;
+
+	if (rtpe_shutdown)
+		goto out;
+
+	// may have been loaded by another job in the meantime
+	str *blob = media_player_db_cache_get(job->id);
+	if (!blob)
+		blob = media_player_db_load(job->id);
+
+	if (job->mp)
+		media_player_db_play(job, blob);
+	else if (blob) {
+		media_player_db_cache_add(job->id, blob);
+		ilog(LOG_DEBUG, "Prefetched media from database (ID %lli, %zu bytes)", job->id, blob->len);
+	}
+
+	free(blob);
+
+out:
+	media_player_put(&job->mp);
+	g_slice_free1(sizeof(*job), job);
+}
+
+static void media_player_db_queue(struct media_player *mp, long long id, long long repeat, long long start_pos) {
+	struct media_player_db_job *job = g_slice_alloc0(sizeof(*job));
+	job->mp = media_player_get(mp);
+	job->play_gen = mp ? mp->play_gen : 0;
+	job->id = id;
+	job->repeat = repeat;
+	job->start_pos = start_pos;
+	g_thread_pool_push(media_player_db_pool, job, NULL);
+}
+
+
+// call->master_lock held in W
+int media_player_play_db(struct media_player *mp, long long id, long long repeat, long long start_pos) {
+	if (!rtpe_config.mysql_host || !rtpe_config.mysql_query) {
+		ilog(LOG_ERR, "Failed to start media playback from database: missing configuration");
+		return -1;
+	}
+
+	// already loaded?
+	str *blob = media_player_db_cache_get(id);
+	if (!blob && !media_player_db_pool) {
+		// synchronous operation
+		blob = media_player_db_load(id);
+		if (!blob)
+			return -1;
+	}
+	if (blob) {
+		int ret = media_player_play_db_blob(mp, blob, repeat, start_pos, id);
+		free(blob);
+		return ret;
+	}
+
+	// stop anything currently playing and make sure we can play at all
+	const struct rtp_payload_type *dst_pt = media_player_play_init(mp);
+	if (!dst_pt)
+		return -1;
+
+	// encoded media is cached, the raw data isn't needed
+	if (media_player_cache_exists(id, dst_pt))
+		return media_player_play_db_blob(mp, NULL, repeat, start_pos, id);
+
+	// playback starts once the loader thread has the data
+	media_player_db_queue(mp, id, repeat, start_pos);
+
+	return 0;
 }
 
 
@@ -1276,12 +1789,16 @@ static void media_player_cache_index_free(void *p) {
 }
 static void media_player_cache_entry_free(void *p) {
 	struct media_player_cache_entry *e = p;
-	g_ptr_array_free(e->packets, TRUE);
+	g_array_free(e->packets, TRUE);
+	g_ptr_array_free(e->arenas, TRUE);
+	if (e->map)
+		munmap(e->map, e->map_len);
 	mutex_destroy(&e->lock);
 	g_free(e->info_str);
+	g_free(e->disk_key);
 	media_player_coder_shutdown(&e->coder);
 	av_packet_free(&e->coder.pkt);
-	g_slice_free1(sizeof(*e), e);
+	payload_type_clear(&e->dst_pt);
 }
 #endif
 
@@ -1291,10 +1808,25 @@ void media_player_init(void) {
 	if (rtpe_config.player_cache) {
 		media_player_cache = g_hash_table_new_full(media_player_cache_entry_hash,
 				media_player_cache_entry_eq, media_player_cache_index_free,
-				media_player_cache_entry_free);
+				obj_put_ptr);
 		mutex_init(&media_player_cache_lock);
 	}
 
+	if (rtpe_config.mysql_prefetch) {
+		media_player_db_cache = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free, free);
+		mutex_init(&media_player_db_cache_lock);
+	}
+
+	if (rtpe_config.mysql_host && rtpe_config.mysql_threads > 0) {
+		// not thread safe, must be done before any connection is made
+		mysql_library_init(0, NULL, NULL);
+		media_player_db_pool = g_thread_pool_new(media_player_db_worker, NULL,
+				rtpe_config.mysql_threads, TRUE, NULL);
+
+		for (char **id = rtpe_config.mysql_prefetch; id && *id; id++)
+			media_player_db_queue(NULL, strtoll(*id, NULL, 10), 0, 0);
+	}
+
 	timerthread_init(&media_player_thread, media_player_run);
 #endif
 	timerthread_init(&send_timer_thread, timerthread_queue_run);
@@ -1302,11 +1834,21 @@ void media_player_init(void) {
 
 void media_player_free(void) {
 #ifdef WITH_TRANSCODING
+	// pending jobs are discarded as we're shutting down
+	if (media_player_db_pool)
+		g_thread_pool_free(media_player_db_pool, FALSE, TRUE);
+
 	timerthread_free(&media_player_thread);
 
+	if (media_player_db_cache) {
+		mutex_destroy(&media_player_db_cache_lock);
+		g_hash_table_destroy(media_player_db_cache);
+	}
+
 	if (media_player_cache) {
 		mutex_destroy(&media_player_cache_lock);
 		g_hash_table_destroy(media_player_cache);
+		g_queue_init(&media_player_cache_lru);
 	}
 #endif
 	timerthread_free(&send_timer_thread);
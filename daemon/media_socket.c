@@ -30,6 +30,7 @@
 #include "dtmf.h"
 #include "mqtt.h"
 #include "janus.h"
+#include "load.h"
 
 
 #ifndef PORT_RANDOM_MIN
@@ -1564,7 +1565,8 @@ output:
 	// PT manipulations
 	bool silenced = CALL_ISSET(call, SILENCE_MEDIA) || ML_ISSET(media->monologue, SILENCE_MEDIA)
 			|| sink_handler->attrs.silence_media;
-	bool manipulate_pt = silenced || ML_ISSET(media->monologue, BLOCK_SHORT);
+	bool manipulate_pt = silenced || ML_ISSET(media->monologue, BLOCK_SHORT)
+			|| sink_handler->attrs.transcoding;
 	if (manipulate_pt && payload_types) {
 		int i = 0;
 		for (GList *l = *payload_types; l; l = l->next) {
@@ -1573,6 +1575,10 @@ output:
 			struct codec_handler *ch = codec_handler_get(media, rs->payload_type,
 					sink->media, sink_handler);
 
+			rpt->transcode = ch->kernel_transcode;
+			if (rpt->transcode != RTPE_PT_PASSTHROUGH)
+				rpt->pt_num = ch->dest_pt.payload_type;
+
 			str replace_pattern = STR_NULL;
 			if (silenced && ch->source_pt.codec_def)
 				replace_pattern = ch->source_pt.codec_def->silence_pattern;
@@ -3135,6 +3141,9 @@ static void stream_fd_readable(int fd, void *p, uintptr_t u) {
 		return;
 	}
 
+	// packets to be recorded through the kernel are submitted together at the end
+	recording_batch_start();
+
 restart:
 
 	for (iters = 0; ; iters++) {
@@ -3188,6 +3197,8 @@ restart:
 
 		str_init_len(&phc.s, buf + RTP_BUFFER_HEAD_ROOM, ret);
 
+		long long load_start = thread_load_start();
+
 		if (sfd->stream && sfd->stream->jb) {
 			ret = buffer_packet(&phc.mp, &phc.s);
 			if (ret == 1)
@@ -3196,6 +3207,8 @@ restart:
 		else
 			ret = stream_packet(&phc);
 
+		thread_load_done(load_start);
+
 		if (G_UNLIKELY(ret < 0))
 			ilog(LOG_WARNING | LOG_FLAG_LIMIT, "Write error on media socket: %s", strerror(-ret));
 		else if (phc.update)
@@ -3217,6 +3230,7 @@ strike:
 		redis_update_onekey(ca, rtpe_redis_write);
 	}
 done:
+	recording_batch_flush();
 	log_info_pop();
 }
 
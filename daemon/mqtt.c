@@ -6,8 +6,6 @@
 #include <string.h>
 #include <stdbool.h>
 #include <glib.h>
-#include <glib-object.h>
-#include <json-glib/json-glib.h>
 #include "main.h"
 #include "log.h"
 #include "log_funcs.h"
@@ -15,6 +13,7 @@
 #include "ssrc.h"
 #include "rtplib.h"
 #include "media_player.h"
+#include "jsonlib.h"
 
 
 
@@ -23,8 +22,23 @@ static bool is_connected = false;
 
 static struct interface_sampled_rate_stats interface_rate_stats;
 
+// the global scope message covers all calls. it's built up in MQTT_GLOBAL_SLICES steps
+// over the publishing interval from a snapshot of the call list taken in the first step,
+// and published after the last one
+static struct {
+	mutex_t lock;
+	unsigned int slice;
+	unsigned int idx;
+	GPtrArray *calls;
+	GString *buf;
+	struct json_writer json;
+} mqtt_global = {
+	.lock = MUTEX_STATIC_INIT,
+};
 
-static void mqtt_ssrc_stats(struct ssrc_ctx *ssrc, JsonBuilder *json, struct call_media *media);
+
+static void mqtt_ssrc_stats(struct ssrc_ctx *ssrc, struct json_writer *json, struct call_media *media);
+static void mqtt_global_release(void);
 
 
 
@@ -129,6 +143,8 @@ void mqtt_loop(void *dummy) {
 
 	mosquitto_destroy(mosq);
 	mosq = NULL;
+
+	mqtt_global_release();
 }
 
 
@@ -139,32 +155,32 @@ int mqtt_publish_scope(void) {
 }
 
 
-void mqtt_publish(char *s) {
-	ilog(LOG_DEBUG, "Publishing to mosquitto: %s%s%s", FMT_M(s));
+// the payload is copied by mosquitto, so the buffer can be reused afterwards
+void mqtt_publish(const GString *s) {
+	ilog(LOG_DEBUG, "Publishing to mosquitto: %s%s%s", FMT_M(s->str));
 
-	int ret = mosquitto_publish(mosq, NULL, rtpe_config.mqtt_publish_topic, strlen(s), s,
+	int ret = mosquitto_publish(mosq, NULL, rtpe_config.mqtt_publish_topic, s->len, s->str,
 			rtpe_config.mqtt_publish_qos,
 			false);
 	if (ret != MOSQ_ERR_SUCCESS)
 		ilog(LOG_WARN | LOG_FLAG_LIMIT, "Error publishing message to mosquitto: %s",
 				mosquitto_strerror(ret));
-	g_free(s);
 }
 
 
-static void mqtt_call_stats(struct call *call, JsonBuilder *json) {
-	json_builder_set_member_name(json, "call_id");
-	json_builder_add_string_value(json, call->callid.s);
+static void mqtt_call_stats(struct call *call, struct json_writer *json) {
+	json_writer_key(json, "call_id");
+	json_writer_str(json, &call->callid);
 }
 
 
-static void mqtt_monologue_stats(struct call_monologue *ml, JsonBuilder *json) {
-	json_builder_set_member_name(json, "tag");
-	json_builder_add_string_value(json, ml->tag.s);
+static void mqtt_monologue_stats(struct call_monologue *ml, struct json_writer *json) {
+	json_writer_key(json, "tag");
+	json_writer_str(json, &ml->tag);
 
 	if (ml->label.len) {
-		json_builder_set_member_name(json, "label");
-		json_builder_add_string_value(json, ml->label.s);
+		json_writer_key(json, "label");
+		json_writer_str(json, &ml->label);
 	}
 
 #ifdef WITH_TRANSCODING
@@ -172,25 +188,25 @@ static void mqtt_monologue_stats(struct call_monologue *ml, JsonBuilder *json) {
 	if (mp) {
 		mutex_lock(&mp->lock);
 
-		json_builder_set_member_name(json, "media_player");
+		json_writer_key(json, "media_player");
 
-		json_builder_begin_object(json);
+		json_writer_begin_object(json);
 
-		json_builder_set_member_name(json, "duration");
-		json_builder_add_int_value(json, mp->coder.duration);
-		json_builder_set_member_name(json, "repeat");
-		json_builder_add_int_value(json, mp->repeat);
-		json_builder_set_member_name(json, "frame_time");
-		json_builder_add_int_value(json, mp->last_frame_ts);
+		json_writer_key(json, "duration");
+		json_writer_int(json, mp->coder.duration);
+		json_writer_key(json, "repeat");
+		json_writer_int(json, mp->repeat);
+		json_writer_key(json, "frame_time");
+		json_writer_int(json, mp->last_frame_ts);
 
 		if (mp->ssrc_out && mp->media) {
-			json_builder_set_member_name(json, "SSRC");
-			json_builder_begin_object(json);
+			json_writer_key(json, "SSRC");
+			json_writer_begin_object(json);
 			mqtt_ssrc_stats(mp->ssrc_out, json, mp->media);
-			json_builder_end_object(json);
+			json_writer_end_object(json);
 		}
 
-		json_builder_end_object(json);
+		json_writer_end_object(json);
 
 		mutex_unlock(&mp->lock);
 	}
@@ -198,14 +214,14 @@ static void mqtt_monologue_stats(struct call_monologue *ml, JsonBuilder *json) {
 }
 
 
-static void mqtt_ssrc_stats(struct ssrc_ctx *ssrc, JsonBuilder *json, struct call_media *media) {
+static void mqtt_ssrc_stats(struct ssrc_ctx *ssrc, struct json_writer *json, struct call_media *media) {
 	if (!ssrc || !media)
 		return;
 
 	struct ssrc_entry_call *sc = ssrc->parent;
 
-	json_builder_set_member_name(json, "SSRC");
-	json_builder_add_int_value(json, sc->h.ssrc);
+	json_writer_key(json, "SSRC");
+	json_writer_int(json, sc->h.ssrc);
 
 	unsigned char prim_pt = 255;
 	mutex_lock(&ssrc->tracker.lock);
@@ -216,26 +232,26 @@ static void mqtt_ssrc_stats(struct ssrc_ctx *ssrc, JsonBuilder *json, struct cal
 	unsigned int clockrate = 0;
 	struct rtp_payload_type *pt = g_hash_table_lookup(media->codecs.codecs, GUINT_TO_POINTER(prim_pt));
 	if (pt) {
-		json_builder_set_member_name(json, "codec");
-		json_builder_add_string_value(json, pt->encoding.s);
+		json_writer_key(json, "codec");
+		json_writer_str(json, &pt->encoding);
 
-		json_builder_set_member_name(json, "clock_rate");
-		json_builder_add_int_value(json, pt->clock_rate);
+		json_writer_key(json, "clock_rate");
+		json_writer_int(json, pt->clock_rate);
 		clockrate = pt->clock_rate;
 
 		if (pt->encoding_parameters.s) {
-			json_builder_set_member_name(json, "codec_params");
-			json_builder_add_string_value(json, pt->encoding_parameters.s);
+			json_writer_key(json, "codec_params");
+			json_writer_str(json, &pt->encoding_parameters);
 		}
 
 		if (pt->format_parameters.s) {
-			json_builder_set_member_name(json, "codec_format");
-			json_builder_add_string_value(json, pt->format_parameters.s);
+			json_writer_key(json, "codec_format");
+			json_writer_str(json, &pt->format_parameters);
 		}
 	}
 
-	json_builder_set_member_name(json, "metrics");
-	json_builder_begin_object(json);
+	json_writer_key(json, "metrics");
+	json_writer_begin_object(json);
 
 	// copy out values
 	int64_t packets, octets, packets_lost, duplicates;
@@ -256,17 +272,17 @@ static void mqtt_ssrc_stats(struct ssrc_ctx *ssrc, JsonBuilder *json, struct cal
 	sample_packets_lost = atomic64_get_set(&ssrc->sample_packets_lost, packets_lost);
 	sample_duplicates = atomic64_get_set(&ssrc->sample_duplicates, duplicates);
 
-	json_builder_set_member_name(json, "packets");
-	json_builder_add_int_value(json, packets);
+	json_writer_key(json, "packets");
+	json_writer_int(json, packets);
 
-	json_builder_set_member_name(json, "bytes");
-	json_builder_add_int_value(json, octets);
+	json_writer_key(json, "bytes");
+	json_writer_int(json, octets);
 
-	json_builder_set_member_name(json, "lost");
-	json_builder_add_int_value(json, packets_lost);
+	json_writer_key(json, "lost");
+	json_writer_int(json, packets_lost);
 
-	json_builder_set_member_name(json, "duplicates");
-	json_builder_add_int_value(json, duplicates);
+	json_writer_key(json, "duplicates");
+	json_writer_int(json, duplicates);
 
 	if (last_sample && last_sample != cur_ts) {
 		// calc sample rates with primitive math
@@ -279,17 +295,17 @@ static void mqtt_ssrc_stats(struct ssrc_ctx *ssrc, JsonBuilder *json, struct cal
 		packets_lost -= sample_packets_lost;
 		duplicates -= sample_duplicates;
 
-		json_builder_set_member_name(json, "packets_per_second");
-		json_builder_add_double_value(json, (double) packets * 1000000.0 / usecs_diff);
+		json_writer_key(json, "packets_per_second");
+		json_writer_double(json, (double) packets * 1000000.0 / usecs_diff);
 
-		json_builder_set_member_name(json, "bytes_per_second");
-		json_builder_add_double_value(json, (double) octets * 1000000.0 / usecs_diff);
+		json_writer_key(json, "bytes_per_second");
+		json_writer_double(json, (double) octets * 1000000.0 / usecs_diff);
 
-		json_builder_set_member_name(json, "lost_per_second");
-		json_builder_add_double_value(json, (double) packets_lost * 1000000.0 / usecs_diff);
+		json_writer_key(json, "lost_per_second");
+		json_writer_double(json, (double) packets_lost * 1000000.0 / usecs_diff);
 
-		json_builder_set_member_name(json, "duplicates_per_second");
-		json_builder_add_double_value(json, (double) duplicates * 1000000.0 / usecs_diff);
+		json_writer_key(json, "duplicates_per_second");
+		json_writer_double(json, (double) duplicates * 1000000.0 / usecs_diff);
 	}
 
 	mutex_lock(&sc->h.lock);
@@ -304,169 +320,230 @@ static void mqtt_ssrc_stats(struct ssrc_ctx *ssrc, JsonBuilder *json, struct cal
 	mutex_unlock(&sc->h.lock);
 
 	if (clockrate) {
-		json_builder_set_member_name(json, "jitter");
-		json_builder_add_double_value(json, (double) jitter * 1000.0 / (double) clockrate);
+		json_writer_key(json, "jitter");
+		json_writer_double(json, (double) jitter * 1000.0 / (double) clockrate);
 	}
 
 	if (mos != -1 && mos != 0) {
-		json_builder_set_member_name(json, "MOS");
-		json_builder_add_double_value(json, (double) mos / 10.0);
+		json_writer_key(json, "MOS");
+		json_writer_double(json, (double) mos / 10.0);
 	}
 	if (rtt != -1) {
-		json_builder_set_member_name(json, "RTT");
-		json_builder_add_double_value(json, (double) rtt / 1000.0);
+		json_writer_key(json, "RTT");
+		json_writer_double(json, (double) rtt / 1000.0);
 	}
 	if (rtt_leg != -1) {
-		json_builder_set_member_name(json, "RTT_leg");
-		json_builder_add_double_value(json, (double) rtt_leg / 1000.0);
+		json_writer_key(json, "RTT_leg");
+		json_writer_double(json, (double) rtt_leg / 1000.0);
 	}
 
-	json_builder_end_object(json);
+	json_writer_end_object(json);
 }
 
 
-static void mqtt_stream_stats_dir(const struct stream_stats *s, JsonBuilder *json) {
-	json_builder_set_member_name(json, "bytes");
-	json_builder_add_int_value(json, atomic64_get(&s->bytes));
-	json_builder_set_member_name(json, "packets");
-	json_builder_add_int_value(json, atomic64_get(&s->packets));
-	json_builder_set_member_name(json, "errors");
-	json_builder_add_int_value(json, atomic64_get(&s->errors));
+// with --mqtt-publish-changed-only, SSRCs without new packets since the last time they
+// were published are left out
+static bool mqtt_ssrc_changed(struct ssrc_ctx *ssrc) {
+	if (!rtpe_config.mqtt_publish_changed)
+		return true;
+	if (!atomic64_get(&ssrc->last_sample))
+		return true;
+	return atomic64_get(&ssrc->packets) != atomic64_get(&ssrc->sample_packets);
 }
 
 
-static void mqtt_stream_stats(struct packet_stream *ps, JsonBuilder *json) {
+static void mqtt_stream_stats_dir(const struct stream_stats *s, struct json_writer *json) {
+	json_writer_key(json, "bytes");
+	json_writer_int(json, atomic64_get(&s->bytes));
+	json_writer_key(json, "packets");
+	json_writer_int(json, atomic64_get(&s->packets));
+	json_writer_key(json, "errors");
+	json_writer_int(json, atomic64_get(&s->errors));
+}
+
+
+static void mqtt_stream_stats(struct packet_stream *ps, struct json_writer *json) {
 	mutex_lock(&ps->in_lock);
 
 	struct stream_fd *sfd = ps->selected_sfd;
 	if (sfd) {
-		json_builder_set_member_name(json, "address");
-		json_builder_add_string_value(json, sockaddr_print_buf(&sfd->socket.local.address));
+		json_writer_key(json, "address");
+		json_writer_string(json, sockaddr_print_buf(&sfd->socket.local.address));
 
-		json_builder_set_member_name(json, "port");
-		json_builder_add_int_value(json, sfd->socket.local.port);
+		json_writer_key(json, "port");
+		json_writer_int(json, sfd->socket.local.port);
 	}
 
-	json_builder_set_member_name(json, "ingress");
-	json_builder_begin_object(json);
+	json_writer_key(json, "ingress");
+	json_writer_begin_object(json);
 	mqtt_stream_stats_dir(&ps->stats_in, json);
 
-	json_builder_set_member_name(json, "SSRC");
-	json_builder_begin_array(json);
+	json_writer_key(json, "SSRC");
+	json_writer_begin_array(json);
 	for (int i = 0; i < RTPE_NUM_SSRC_TRACKING; i++) {
 		if (!ps->ssrc_in[i])
 			break;
-		json_builder_begin_object(json);
+		if (!mqtt_ssrc_changed(ps->ssrc_in[i]))
+			continue;
+		json_writer_begin_object(json);
 		mqtt_ssrc_stats(ps->ssrc_in[i], json, ps->media);
-		json_builder_end_object(json);
+		json_writer_end_object(json);
 	}
-	json_builder_end_array(json);
+	json_writer_end_array(json);
 
-	json_builder_end_object(json);
+	json_writer_end_object(json);
 
 	mutex_unlock(&ps->in_lock);
 
 	mutex_lock(&ps->out_lock);
 
-	json_builder_set_member_name(json, "egress");
-	json_builder_begin_object(json);
+	json_writer_key(json, "egress");
+	json_writer_begin_object(json);
 	mqtt_stream_stats_dir(&ps->stats_out, json);
 
-	json_builder_set_member_name(json, "SSRC");
-	json_builder_begin_array(json);
+	json_writer_key(json, "SSRC");
+	json_writer_begin_array(json);
 	for (int i = 0; i < RTPE_NUM_SSRC_TRACKING; i++) {
 		if (!ps->ssrc_out[i])
 			break;
-		json_builder_begin_object(json);
+		if (!mqtt_ssrc_changed(ps->ssrc_out[i]))
+			continue;
+		json_writer_begin_object(json);
 		mqtt_ssrc_stats(ps->ssrc_out[i], json, ps->media);
-		json_builder_end_object(json);
+		json_writer_end_object(json);
 	}
-	json_builder_end_array(json);
+	json_writer_end_array(json);
 
-	json_builder_end_object(json);
+	json_writer_end_object(json);
 
 	mutex_unlock(&ps->out_lock);
 }
 
 
-static void mqtt_media_stats(struct call_media *media, JsonBuilder *json) {
+// remembers the packet count as published, and tells whether it moved since last time
+static bool mqtt_stream_changed(struct packet_stream *ps) {
+	uint64_t packets = atomic64_get(&ps->stats_in.packets) + atomic64_get(&ps->stats_out.packets);
+	uint64_t last = atomic64_get_set(&ps->mqtt_packets, packets);
+	if (!rtpe_config.mqtt_publish_changed)
+		return true;
+	return packets != last;
+}
+
+
+// returns false if nothing was written because nothing has changed
+static bool mqtt_media_stats(struct call_media *media, struct json_writer *json) {
 	media_update_stats(media);
 
-	json_builder_set_member_name(json, "media_index");
-	json_builder_add_int_value(json, media->index);
+	struct packet_stream *ps = media->streams.head ? media->streams.head->data : NULL;
+	if (ps) {
+		if (!mqtt_stream_changed(ps))
+			return false;
+	}
+	else if (rtpe_config.mqtt_publish_changed)
+		return false;
+
+	json_writer_key(json, "media_index");
+	json_writer_int(json, media->index);
 
-	json_builder_set_member_name(json, "type");
-	json_builder_add_string_value(json, media->type.s);
+	json_writer_key(json, "type");
+	json_writer_str(json, &media->type);
 
-	json_builder_set_member_name(json, "interface");
-	json_builder_add_string_value(json, media->logical_intf->name.s);
+	json_writer_key(json, "interface");
+	json_writer_str(json, &media->logical_intf->name);
 
 	if (media->protocol) {
-		json_builder_set_member_name(json, "protocol");
-		json_builder_add_string_value(json, media->protocol->name);
+		json_writer_key(json, "protocol");
+		json_writer_string(json, media->protocol->name);
 	}
 
-	json_builder_set_member_name(json, "status");
+	json_writer_key(json, "status");
 	if (MEDIA_ISSET(media, SEND)) {
 		if (MEDIA_ISSET(media, RECV))
-			json_builder_add_string_value(json, "sendrecv");
+			json_writer_string(json, "sendrecv");
 		else
-			json_builder_add_string_value(json, "sendonly");
+			json_writer_string(json, "sendonly");
 	}
 	else {
 		if (MEDIA_ISSET(media, RECV))
-			json_builder_add_string_value(json, "recvonly");
+			json_writer_string(json, "recvonly");
 		else
-			json_builder_add_string_value(json, "inactive");
+			json_writer_string(json, "inactive");
 	}
 
-	struct packet_stream *ps = media->streams.head ? media->streams.head->data : NULL;
 	if (ps)
 		mqtt_stream_stats(ps, json);
+
+	return true;
 }
 
 
-static void mqtt_full_call(struct call *call, JsonBuilder *json) {
+// returns false if the call was left out entirely, which only happens with
+// --mqtt-publish-changed-only or if the call is going away
+static bool mqtt_full_call(struct call *call, struct json_writer *json) {
+	bool ret = !rtpe_config.mqtt_publish_changed;
+
 	rwlock_lock_r(&call->master_lock);
 
+	if (call->destroyed.tv_sec) {
+		rwlock_unlock_r(&call->master_lock);
+		return false;
+	}
+
 	log_info_call(call);
 
 	mqtt_call_stats(call, json);
 
-	json_builder_set_member_name(json, "legs");
-	json_builder_begin_array(json);
+	json_writer_key(json, "legs");
+	json_writer_begin_array(json);
 
 	for (GList *l = call->monologues.head; l; l = l->next) {
 		struct call_monologue *ml = l->data;
 
-		json_builder_begin_object(json);
+		struct json_writer_mark leg_mark;
+		json_writer_mark(json, &leg_mark);
+
+		json_writer_begin_object(json);
 
 		mqtt_monologue_stats(ml, json);
 
-		json_builder_set_member_name(json, "medias");
-		json_builder_begin_array(json);
+		json_writer_key(json, "medias");
+		json_writer_begin_array(json);
 
+		bool leg_changed = false;
 		for (unsigned int k = 0; k < ml->medias->len; k++) {
 			struct call_media *media = ml->medias->pdata[k];
 			if (!media)
 				continue;
-			json_builder_begin_object(json);
-			mqtt_media_stats(media, json);
-			json_builder_end_object(json);
+			struct json_writer_mark media_mark;
+			json_writer_mark(json, &media_mark);
+			json_writer_begin_object(json);
+			if (mqtt_media_stats(media, json)) {
+				json_writer_end_object(json);
+				leg_changed = true;
+			}
+			else
+				json_writer_rollback(json, &media_mark);
 		}
 
-		json_builder_end_array(json);
-		json_builder_end_object(json);
+		json_writer_end_array(json);
+		json_writer_end_object(json);
+
+		if (leg_changed)
+			ret = true;
+		else if (rtpe_config.mqtt_publish_changed)
+			json_writer_rollback(json, &leg_mark);
 	}
 
-	json_builder_end_array(json);
+	json_writer_end_array(json);
 
 	rwlock_unlock_r(&call->master_lock);
 	log_info_pop();
+
+	return ret;
 }
 
 
-static void mqtt_global_stats(JsonBuilder *json) {
+static void mqtt_global_stats(struct json_writer *json) {
 	AUTO_CLEANUP_INIT(GQueue *metrics, statistics_free_metrics,
 			statistics_gather_metrics(&interface_rate_stats));
 
@@ -482,93 +559,152 @@ static void mqtt_global_stats(JsonBuilder *json) {
 
 
 		if (m->value_short) {
-			json_builder_set_member_name(json, m->label);
+			json_writer_key(json, m->label);
 			if (m->is_int)
-				json_builder_add_int_value(json, m->int_value);
+				json_writer_int(json, m->int_value);
 			else if (m->is_double)
-				json_builder_add_double_value(json, m->double_value);
+				json_writer_double(json, m->double_value);
 			else if (m->value_raw)
-				json_builder_add_string_value(json, m->value_raw);
+				json_writer_string(json, m->value_raw);
 			else
-				json_builder_add_string_value(json, m->value_short);
+				json_writer_string(json, m->value_short);
 		}
 		else if (m->is_bracket) {
 			if (m->is_close_bracket) {
 				if (m->is_brace)
-					json_builder_end_object(json);
+					json_writer_end_object(json);
 				else
-					json_builder_end_array(json);
+					json_writer_end_array(json);
 			}
 			else {
 				if (m->is_brace)
-					json_builder_begin_object(json);
+					json_writer_begin_object(json);
 				else
-					json_builder_begin_array(json);
+					json_writer_begin_array(json);
 			}
 		}
 		else
-			json_builder_set_member_name(json, m->label);
+			json_writer_key(json, m->label);
 	}
 }
 
 
-INLINE JsonBuilder *__mqtt_timer_intro(void) {
-	JsonBuilder *json = json_builder_new();
-
-	json_builder_begin_object(json);
-
-	json_builder_set_member_name(json, "timestamp");
-	json_builder_add_double_value(json, (double) rtpe_now.tv_sec + (double) rtpe_now.tv_usec / 1000000.0);
-
+// one-shot messages are rendered into a per-thread buffer that is kept around
+static struct json_writer *mqtt_writer(struct json_writer *json) {
+	static __thread GString *buf;
+	if (!buf)
+		buf = g_string_sized_new(4096);
+	json_writer_init(json, buf);
+	json_writer_reset(json);
 	return json;
 }
-INLINE void __mqtt_timer_outro(JsonBuilder *json) {
-	json_builder_end_object(json);
-	mqtt_publish(glib_json_print(json));
+INLINE void __mqtt_timer_intro(struct json_writer *json) {
+	json_writer_begin_object(json);
+
+	json_writer_key(json, "timestamp");
+	json_writer_double(json, (double) rtpe_now.tv_sec + (double) rtpe_now.tv_usec / 1000000.0);
+}
+INLINE void __mqtt_timer_outro(struct json_writer *json) {
+	json_writer_end_object(json);
+	mqtt_publish(json->buf);
 }
 void mqtt_timer_run_media(struct call *call, struct call_media *media) {
-	JsonBuilder *json = __mqtt_timer_intro();
+	struct json_writer json_s, *json = mqtt_writer(&json_s);
+	__mqtt_timer_intro(json);
 
 	rwlock_lock_r(&call->master_lock);
 	log_info_call(call);
 
 	mqtt_call_stats(call, json);
 	mqtt_monologue_stats(media->monologue, json);
-	mqtt_media_stats(media, json);
+	bool changed = mqtt_media_stats(media, json);
 
 	rwlock_unlock_r(&call->master_lock);
 	log_info_pop();
 
-	__mqtt_timer_outro(json);
+	if (changed)
+		__mqtt_timer_outro(json);
 }
 void mqtt_timer_run_call(struct call *call) {
-	JsonBuilder *json = __mqtt_timer_intro();
-
-	mqtt_full_call(call, json);
+	struct json_writer json_s, *json = mqtt_writer(&json_s);
+	__mqtt_timer_intro(json);
 
-	__mqtt_timer_outro(json);
+	if (mqtt_full_call(call, json))
+		__mqtt_timer_outro(json);
+}
+static void mqtt_global_release(void) {
+	mutex_lock(&mqtt_global.lock);
+	if (mqtt_global.calls) {
+		for (unsigned int i = mqtt_global.idx; i < mqtt_global.calls->len; i++)
+			obj_put((struct call *) mqtt_global.calls->pdata[i]);
+		g_ptr_array_free(mqtt_global.calls, TRUE);
+		mqtt_global.calls = NULL;
+	}
+	if (mqtt_global.buf) {
+		g_string_free(mqtt_global.buf, TRUE);
+		mqtt_global.buf = NULL;
+	}
+	mqtt_global.slice = 0;
+	mqtt_global.idx = 0;
+	mutex_unlock(&mqtt_global.lock);
 }
 void mqtt_timer_run_global(void) {
-	JsonBuilder *json = __mqtt_timer_intro();
+	// a previous slice still running means we're falling behind: skip this one
+	if (mutex_trylock(&mqtt_global.lock))
+		return;
 
-	mqtt_global_stats(json);
+	struct json_writer *json = &mqtt_global.json;
+
+	if (mqtt_global.slice == 0) {
+		if (!mqtt_global.buf) {
+			mqtt_global.buf = g_string_sized_new(65536);
+			mqtt_global.calls = g_ptr_array_new();
+		}
+		json_writer_init(json, mqtt_global.buf);
+		json_writer_reset(json);
 
-	json_builder_set_member_name(json, "calls");
+		__mqtt_timer_intro(json);
+		mqtt_global_stats(json);
 
-	json_builder_begin_array(json);
+		json_writer_key(json, "calls");
+		json_writer_begin_array(json);
 
-	ITERATE_CALL_LIST_START(CALL_ITERATOR_MQTT, call);
-		json_builder_begin_object(json);
-		mqtt_full_call(call, json);
-		json_builder_end_object(json);
-	ITERATE_CALL_LIST_NEXT_END(call);
+		ITERATE_CALL_LIST_START(CALL_ITERATOR_MQTT, call);
+			g_ptr_array_add(mqtt_global.calls, obj_get(call));
+		ITERATE_CALL_LIST_NEXT_END(call);
+	}
 
-	json_builder_end_array(json);
+	mqtt_global.slice++;
+	unsigned int end = mqtt_global.calls->len * mqtt_global.slice / MQTT_GLOBAL_SLICES;
 
-	__mqtt_timer_outro(json);
+	for (; mqtt_global.idx < end; mqtt_global.idx++) {
+		struct call *call = mqtt_global.calls->pdata[mqtt_global.idx];
+
+		struct json_writer_mark mark;
+		json_writer_mark(json, &mark);
+		json_writer_begin_object(json);
+		if (mqtt_full_call(call, json))
+			json_writer_end_object(json);
+		else
+			json_writer_rollback(json, &mark);
+
+		obj_put(call);
+	}
+
+	if (mqtt_global.slice >= MQTT_GLOBAL_SLICES) {
+		json_writer_end_array(json);
+		__mqtt_timer_outro(json);
+
+		g_ptr_array_set_size(mqtt_global.calls, 0);
+		mqtt_global.idx = 0;
+		mqtt_global.slice = 0;
+	}
+
+	mutex_unlock(&mqtt_global.lock);
 }
 void mqtt_timer_run_summary(void) {
-	JsonBuilder *json = __mqtt_timer_intro();
+	struct json_writer json_s, *json = mqtt_writer(&json_s);
+	__mqtt_timer_intro(json);
 
 	mqtt_global_stats(json);
 
@@ -576,5 +712,4 @@ void mqtt_timer_run_summary(void) {
 }
 
 
-
 #endif
@@ -64,6 +64,8 @@ static void meta_chunk_proc(struct recording *, const char *, const str *);
 static void update_flags_proc(struct call *call, bool streams);
 static void finish_proc(struct call *, bool discard);
 static void dump_packet_proc(struct media_packet *mp, const str *s);
+static void batch_start_proc(void);
+static void batch_flush_proc(void);
 static void init_stream_proc(struct packet_stream *);
 static void setup_stream_proc(struct packet_stream *);
 static void setup_media_proc(struct call_media *);
@@ -106,6 +108,8 @@ const struct recording_method methods[] = {
 		.meta_chunk = meta_chunk_proc,
 		.update_flags = update_flags_proc,
 		.dump_packet = dump_packet_proc,
+		.batch_start = batch_start_proc,
+		.batch_flush = batch_flush_proc,
 		.finish = finish_proc,
 		.init_stream_struct = init_stream_proc,
 		.setup_stream = setup_stream_proc,
@@ -124,6 +128,8 @@ const struct recording_method methods[] = {
 		.meta_chunk = meta_chunk_proc,
 		.update_flags = update_flags_proc,
 		.dump_packet = dump_packet_all,
+		.batch_start = batch_start_proc,
+		.batch_flush = batch_flush_proc,
 		.finish = finish_all,
 		.init_stream_struct = init_stream_proc,
 		.setup_stream = setup_stream_proc,
@@ -958,11 +964,76 @@ static void setup_media_proc(struct call_media *media) {
 
 
 
+// packets collected by one thread, to be submitted to the kernel in one write
+static __thread struct {
+	bool active;
+	unsigned int num;
+	size_t len;
+	unsigned char *buf; // rtpengine_command_packets plus RTPE_MAX_PACKETS_LEN
+} proc_batch;
+
+static void proc_batch_write(void) {
+	if (!proc_batch.num)
+		return;
+
+	struct rtpengine_command_packets *cmd = (void *) proc_batch.buf;
+	cmd->cmd = REMG_PACKETS;
+	cmd->packets.num = proc_batch.num;
+
+	int ret = write(kernel.fd, proc_batch.buf, proc_batch.len);
+	if (ret < 0)
+		ilog(LOG_ERR | LOG_FLAG_LIMIT, "Failed to submit %u packets to kernel intercepted streams: %s",
+				proc_batch.num, strerror(errno));
+
+	proc_batch.num = 0;
+	proc_batch.len = sizeof(*cmd);
+}
+
+// packets dumped from this thread are held back until batch_flush_proc()
+static void batch_start_proc(void) {
+	if (!proc_batch.buf) {
+		proc_batch.buf = g_malloc(sizeof(struct rtpengine_command_packets) + RTPE_MAX_PACKETS_LEN);
+		proc_batch.len = sizeof(struct rtpengine_command_packets);
+	}
+	proc_batch.active = true;
+}
+
+static void batch_flush_proc(void) {
+	proc_batch_write();
+	proc_batch.active = false;
+}
+
+// returns false if the packet doesn't fit into a batch at all
+static bool dump_packet_proc_batch(unsigned int stream_idx, struct media_packet *mp, const str *s) {
+	struct rtpengine_packets_entry *ent;
+	size_t max_len = sizeof(struct rtpengine_command_packets) + RTPE_MAX_PACKETS_LEN;
+	size_t need = sizeof(*ent) + s->len + MAX_PACKET_HEADER_LEN;
+	need = (need + RTPE_STREAM_BATCH_ALIGN - 1) & ~(RTPE_STREAM_BATCH_ALIGN - 1);
+
+	if (proc_batch.len + need > max_len)
+		proc_batch_write();
+	if (proc_batch.len + need > max_len)
+		return false;
+
+	ent = (void *) (proc_batch.buf + proc_batch.len);
+	ent->stream_idx = stream_idx;
+	ent->len = fake_ip_header(ent->data, mp, s);
+
+	proc_batch.len += (sizeof(*ent) + ent->len + RTPE_STREAM_BATCH_ALIGN - 1)
+		& ~(RTPE_STREAM_BATCH_ALIGN - 1);
+	proc_batch.num++;
+
+	return true;
+}
+
 static void dump_packet_proc(struct media_packet *mp, const str *s) {
 	struct packet_stream *stream = mp->stream;
 	if (stream->recording.proc.stream_idx == UNINIT_IDX)
 		return;
 
+	if (proc_batch.active && dump_packet_proc_batch(stream->recording.proc.stream_idx, mp, s))
+		return;
+
 	struct rtpengine_command_packet *cmd;
 	unsigned char pkt[sizeof(*cmd) + s->len + MAX_PACKET_HEADER_LEN];
 	cmd = (void *) pkt;
@@ -1617,7 +1617,7 @@ static int redis_maps(struct call *c, struct redis_list *maps) {
 		rh = &maps->rh[i];
 
 		/* from call.c:__get_endpoint_map() */
-		em = uid_slice_alloc0(em, &c->endpoint_maps);
+		em = call_uid_alloc0(c, em, &c->endpoint_maps);
 		g_queue_init(&em->intf_sfds);
 
 		em->wildcard = redis_hash_get_bool_flag(rh, "wildcard");
@@ -1847,7 +1847,7 @@ static int json_link_medias(struct call *c, struct redis_list *medias,
 			return -1;
 
 		if (med->media_id.s)
-			g_hash_table_insert(med->monologue->media_ids, &med->media_id, med);
+			lazy_str_ht_insert(&med->monologue->media_ids, &med->media_id, med);
 
 		/* find the pair media to subscribe */
 		if (!json_build_list_cb((callback_arg_t) NULL, c, "media-subscriptions", med->unique_id,
@@ -2521,7 +2521,7 @@ char* redis_encode_json(struct call *c) {
 
 			// SSRC table dump
 			rwlock_lock_r(&ml->ssrc_hash->lock);
-			k = g_hash_table_get_values(ml->ssrc_hash->ht);
+			k = g_list_copy(ml->ssrc_hash->q.head);
 			snprintf(tmp, sizeof(tmp), "ssrc_table-%u", ml->unique_id);
 			json_builder_set_member_name(builder, tmp);
 			json_builder_begin_array(builder);
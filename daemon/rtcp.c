@@ -970,6 +970,46 @@ static void str_sanitize(GString *s) {
 		g_string_truncate(s, s->len - 1);
 }
 
+// Output for syslog and Homer is rendered into these, reused for each packet, using
+// the formatting helpers below instead of printf
+static __thread GString *rtcp_log_buf;
+static __thread GString *rtcp_json_buf;
+
+static GString *rtcp_buf_reset(GString **bufp) {
+	if (!*bufp)
+		*bufp = g_string_sized_new(1024);
+	g_string_truncate(*bufp, 0);
+	return *bufp;
+}
+#define buf_lit(s, l) g_string_append_len(s, l, sizeof(l) - 1)
+static void buf_uint(GString *s, unsigned int u) {
+	char tmp[10];
+	char *p = tmp + sizeof(tmp);
+	do {
+		*--p = '0' + u % 10;
+		u /= 10;
+	} while (u);
+	g_string_append_len(s, p, tmp + sizeof(tmp) - p);
+}
+// "key=value, "
+#define log_uint(s, key, val) do { \
+		buf_lit(s, key "="); \
+		buf_uint(s, val); \
+		buf_lit(s, ", "); \
+	} while (0)
+// "key=value,"
+#define log_uint_c(s, key, val) do { \
+		buf_lit(s, key "="); \
+		buf_uint(s, val); \
+		buf_lit(s, ","); \
+	} while (0)
+// "\"key\":value" plus separator
+#define json_uint(s, key, val, sep) do { \
+		buf_lit(s, "\"" key "\":"); \
+		buf_uint(s, val); \
+		buf_lit(s, sep); \
+	} while (0)
+
 
 
 static void scratch_common(struct rtcp_process_ctx *ctx, struct rtcp_packet *common) {
@@ -1043,75 +1083,74 @@ static void scratch_xr_voip_metrics(struct rtcp_process_ctx *ctx, const struct x
 
 
 static void homer_init(struct rtcp_process_ctx *ctx) {
-	ctx->json = g_string_new("{ ");
+	ctx->json = rtcp_buf_reset(&rtcp_json_buf);
+	buf_lit(ctx->json, "{ ");
 	ctx->json_init_len = ctx->json->len;
 }
 static void homer_sr(struct rtcp_process_ctx *ctx, struct sender_report_packet *sr) {
-	g_string_append_printf(ctx->json, "\"sender_information\":{\"ntp_timestamp_sec\":%u,"
-	"\"ntp_timestamp_usec\":%u,\"octets\":%u,\"rtp_timestamp\":%u, \"packets\":%u},",
-		ctx->scratch.sr.ntp_msw,
-		ctx->scratch.sr.ntp_lsw,
-		ctx->scratch.sr.octet_count,
-		ctx->scratch.sr.timestamp,
-		ctx->scratch.sr.packet_count);
+	buf_lit(ctx->json, "\"sender_information\":{");
+	json_uint(ctx->json, "ntp_timestamp_sec", ctx->scratch.sr.ntp_msw, ",");
+	json_uint(ctx->json, "ntp_timestamp_usec", ctx->scratch.sr.ntp_lsw, ",");
+	json_uint(ctx->json, "octets", ctx->scratch.sr.octet_count, ",");
+	json_uint(ctx->json, "rtp_timestamp", ctx->scratch.sr.timestamp, ", ");
+	json_uint(ctx->json, "packets", ctx->scratch.sr.packet_count, "},");
 }
 static void homer_rr_list_start(struct rtcp_process_ctx *ctx, const struct rtcp_packet *common) {
-	g_string_append_printf(ctx->json, "\"ssrc\":%u,\"type\":%u,\"report_count\":%u,\"report_blocks\":[",
-		ctx->scratch_common_ssrc,
-		common->header.pt,
-		common->header.count);
+	json_uint(ctx->json, "ssrc", ctx->scratch_common_ssrc, ",");
+	json_uint(ctx->json, "type", common->header.pt, ",");
+	json_uint(ctx->json, "report_count", common->header.count, ",");
+	buf_lit(ctx->json, "\"report_blocks\":[");
 }
 static void homer_rr(struct rtcp_process_ctx *ctx, struct report_block *rr) {
-	g_string_append_printf(ctx->json, "{\"source_ssrc\":%u,"
-	    "\"highest_seq_no\":%u,\"fraction_lost\":%u,\"ia_jitter\":%u,"
-	    "\"packets_lost\":%u,\"lsr\":%u,\"dlsr\":%u},",
-		ctx->scratch.rr.ssrc,
-		ctx->scratch.rr.high_seq_received,
-		ctx->scratch.rr.fraction_lost,
-		ctx->scratch.rr.jitter,
-		ctx->scratch.rr.packets_lost,
-		ctx->scratch.rr.lsr,
-		ctx->scratch.rr.dlsr);
+	buf_lit(ctx->json, "{");
+	json_uint(ctx->json, "source_ssrc", ctx->scratch.rr.ssrc, ",");
+	json_uint(ctx->json, "highest_seq_no", ctx->scratch.rr.high_seq_received, ",");
+	json_uint(ctx->json, "fraction_lost", ctx->scratch.rr.fraction_lost, ",");
+	json_uint(ctx->json, "ia_jitter", ctx->scratch.rr.jitter, ",");
+	json_uint(ctx->json, "packets_lost", ctx->scratch.rr.packets_lost, ",");
+	json_uint(ctx->json, "lsr", ctx->scratch.rr.lsr, ",");
+	json_uint(ctx->json, "dlsr", ctx->scratch.rr.dlsr, "},");
 }
 static void homer_rr_list_end(struct rtcp_process_ctx *ctx) {
 	str_sanitize(ctx->json);
-	g_string_append_printf(ctx->json, "],");
+	buf_lit(ctx->json, "],");
 }
 static void homer_sdes_list_start(struct rtcp_process_ctx *ctx, const struct source_description_packet *sdes) {
-	g_string_append_printf(ctx->json, "\"sdes_report_count\":%u,\"sdes_information\": [ ",
-		sdes->header.count);
+	json_uint(ctx->json, "sdes_report_count", sdes->header.count, ",");
+	buf_lit(ctx->json, "\"sdes_information\": [ ");
 }
 static void homer_sdes_item(struct rtcp_process_ctx *ctx, const struct sdes_chunk *chunk,
 		const struct sdes_item *item, const char *data)
 {
 	int i;
 
-	g_string_append_printf(ctx->json, "{\"sdes_chunk_ssrc\":%u,\"type\":%u,\"text\":\"",
-		htonl(chunk->ssrc),
-		item->type);
+	buf_lit(ctx->json, "{");
+	json_uint(ctx->json, "sdes_chunk_ssrc", htonl(chunk->ssrc), ",");
+	json_uint(ctx->json, "type", item->type, ",");
+	buf_lit(ctx->json, "\"text\":\"");
 
 	for (i = 0; i < item->length; i++) {
 		switch (data[i]) {
 			case '"':
-				g_string_append(ctx->json, "\\\"");
+				buf_lit(ctx->json, "\\\"");
 				break;
 			case '\\':
-				g_string_append(ctx->json, "\\\\");
+				buf_lit(ctx->json, "\\\\");
 				break;
 			case '\b':
-				g_string_append(ctx->json, "\\b");
+				buf_lit(ctx->json, "\\b");
 				break;
 			case '\f':
-				g_string_append(ctx->json, "\\f");
+				buf_lit(ctx->json, "\\f");
 				break;
 			case '\n':
-				g_string_append(ctx->json, "\\n");
+				buf_lit(ctx->json, "\\n");
 				break;
 			case '\r':
-				g_string_append(ctx->json, "\\r");
+				buf_lit(ctx->json, "\\r");
 				break;
 			case '\t':
-				g_string_append(ctx->json, "\\t");
+				buf_lit(ctx->json, "\\t");
 				break;
 			default:
 				if (data[i] < ' ' || data[i] > 126)
@@ -1122,139 +1161,118 @@ static void homer_sdes_item(struct rtcp_process_ctx *ctx, const struct sdes_chun
 		}
 	}
 
-	g_string_append(ctx->json, "\"},");
+	buf_lit(ctx->json, "\"},");
 }
 static void homer_sdes_list_end(struct rtcp_process_ctx *ctx) {
 	str_sanitize(ctx->json);
-	g_string_append_printf(ctx->json, "],");
+	buf_lit(ctx->json, "],");
 }
 static void homer_finish(struct rtcp_process_ctx *ctx, struct call *c, const endpoint_t *src,
 		const endpoint_t *dst, const struct timeval *tv)
 {
 	str_sanitize(ctx->json);
-	g_string_append(ctx->json, " }");
-	if (ctx->json->len > ctx->json_init_len + 2)
-		homer_send(ctx->json, &c->callid, src, dst, tv);
-	else
-		g_string_free(ctx->json, TRUE);
-	ctx->json = NULL;
+	buf_lit(ctx->json, " }");
+	if (ctx->json->len > ctx->json_init_len + 2) {
+		str json = STR_INIT_LEN(ctx->json->str, ctx->json->len);
+		homer_send(&json, &c->callid, src, dst, tv);
+	}
+	ctx->json = NULL; // buffer is reused
 }
 
 static void logging_init(struct rtcp_process_ctx *ctx) {
-	ctx->log = g_string_new(NULL);
+	ctx->log = rtcp_buf_reset(&rtcp_log_buf);
 }
 static void logging_start(struct rtcp_process_ctx *ctx, struct call *c) {
-	g_string_append_printf(ctx->log, "["STR_FORMAT"] ", STR_FMT(&c->callid));
+	buf_lit(ctx->log, "[");
+	g_string_append_len(ctx->log, c->callid.s, c->callid.len);
+	buf_lit(ctx->log, "] ");
 	ctx->log_init_len = ctx->log->len;
 }
 static void logging_common(struct rtcp_process_ctx *ctx, struct rtcp_packet *common) {
-	g_string_append_printf(ctx->log,"version=%u, padding=%u, count=%u, payloadtype=%u, length=%u, ssrc=%u, ",
-		common->header.version,
-		common->header.p,
-		common->header.count,
-		common->header.pt,
-		ntohs(common->header.length),
-		ctx->scratch_common_ssrc);
+	log_uint(ctx->log, "version", common->header.version);
+	log_uint(ctx->log, "padding", common->header.p);
+	log_uint(ctx->log, "count", common->header.count);
+	log_uint(ctx->log, "payloadtype", common->header.pt);
+	log_uint(ctx->log, "length", ntohs(common->header.length));
+	log_uint(ctx->log, "ssrc", ctx->scratch_common_ssrc);
 }
 static void logging_sdes_list_start(struct rtcp_process_ctx *ctx, const struct source_description_packet *sdes) {
-	g_string_append_printf(ctx->log,"version=%u, padding=%u, count=%u, payloadtype=%u, length=%u, ",
-		sdes->header.version,
-		sdes->header.p,
-		sdes->header.count,
-		sdes->header.pt,
-		ntohs(sdes->header.length));
+	log_uint(ctx->log, "version", sdes->header.version);
+	log_uint(ctx->log, "padding", sdes->header.p);
+	log_uint(ctx->log, "count", sdes->header.count);
+	log_uint(ctx->log, "payloadtype", sdes->header.pt);
+	log_uint(ctx->log, "length", ntohs(sdes->header.length));
 }
 static void logging_sr(struct rtcp_process_ctx *ctx, struct sender_report_packet *sr) {
-	g_string_append_printf(ctx->log,"ntp_sec=%u, ntp_fractions=%u, rtp_ts=%u, sender_packets=%u, " \
-			"sender_bytes=%u, ",
-		ctx->scratch.sr.ntp_msw,
-		ctx->scratch.sr.ntp_lsw,
-		ctx->scratch.sr.timestamp,
-		ctx->scratch.sr.packet_count,
-		ctx->scratch.sr.octet_count);
+	log_uint(ctx->log, "ntp_sec", ctx->scratch.sr.ntp_msw);
+	log_uint(ctx->log, "ntp_fractions", ctx->scratch.sr.ntp_lsw);
+	log_uint(ctx->log, "rtp_ts", ctx->scratch.sr.timestamp);
+	log_uint(ctx->log, "sender_packets", ctx->scratch.sr.packet_count);
+	log_uint(ctx->log, "sender_bytes", ctx->scratch.sr.octet_count);
 }
 static void logging_rr(struct rtcp_process_ctx *ctx, struct report_block *rr) {
-	    g_string_append_printf(ctx->log,"ssrc=%u, fraction_lost=%u, packet_loss=%u, last_seq=%u, jitter=%u, last_sr=%u, delay_since_last_sr=%u, ",
-			ctx->scratch.rr.ssrc,
-			rr->fraction_lost,
-			ctx->scratch.rr.packets_lost,
-			ctx->scratch.rr.high_seq_received,
-			ctx->scratch.rr.jitter,
-			ctx->scratch.rr.lsr,
-			ctx->scratch.rr.dlsr);
+	log_uint(ctx->log, "ssrc", ctx->scratch.rr.ssrc);
+	log_uint(ctx->log, "fraction_lost", rr->fraction_lost);
+	log_uint(ctx->log, "packet_loss", ctx->scratch.rr.packets_lost);
+	log_uint(ctx->log, "last_seq", ctx->scratch.rr.high_seq_received);
+	log_uint(ctx->log, "jitter", ctx->scratch.rr.jitter);
+	log_uint(ctx->log, "last_sr", ctx->scratch.rr.lsr);
+	log_uint(ctx->log, "delay_since_last_sr", ctx->scratch.rr.dlsr);
 }
 //static void logging_xr(struct rtcp_process_ctx *ctx, const struct rtcp_packet *common, str *comp_s) {
 	//pjmedia_rtcp_xr_rx_rtcp_xr(ctx->log, common, comp_s);
 //}
 static void logging_xr_rb(struct rtcp_process_ctx *ctx, const struct xr_report_block *rb_header) {
-	g_string_append_printf(ctx->log, "rb_header_blocktype=%u, rb_header_blockspecdata=%u, " \
-			"rb_header_blocklength=%u, ",
-			rb_header->bt,
-			rb_header->specific,
-			ntohs(rb_header->length));
+	log_uint(ctx->log, "rb_header_blocktype", rb_header->bt);
+	log_uint(ctx->log, "rb_header_blockspecdata", rb_header->specific);
+	log_uint(ctx->log, "rb_header_blocklength", ntohs(rb_header->length));
 }
 static void logging_xr_rr_time(struct rtcp_process_ctx *ctx, const struct xr_rb_rr_time *rb_rr_time) {
-	g_string_append_printf(ctx->log, "rb_rr_time_ntp_sec=%u, rb_rr_time_ntp_frac=%u, ",
-			ntohl(ctx->scratch.xr_rr.ntp_msw),
-			ntohl(ctx->scratch.xr_rr.ntp_lsw));
+	log_uint(ctx->log, "rb_rr_time_ntp_sec", ntohl(ctx->scratch.xr_rr.ntp_msw));
+	log_uint(ctx->log, "rb_rr_time_ntp_frac", ntohl(ctx->scratch.xr_rr.ntp_lsw));
 }
 static void logging_xr_dlrr(struct rtcp_process_ctx *ctx, const struct xr_rb_dlrr *rb_dlrr) {
-	g_string_append_printf(ctx->log, "rb_dlrr_ssrc=%u, rb_dlrr_lrr=%u, rb_dlrr_dlrr=%u, ",
-			ntohl(ctx->scratch.xr_dlrr.ssrc),
-			ntohl(ctx->scratch.xr_dlrr.lrr),
-			ntohl(ctx->scratch.xr_dlrr.dlrr));
+	log_uint(ctx->log, "rb_dlrr_ssrc", ntohl(ctx->scratch.xr_dlrr.ssrc));
+	log_uint(ctx->log, "rb_dlrr_lrr", ntohl(ctx->scratch.xr_dlrr.lrr));
+	log_uint(ctx->log, "rb_dlrr_dlrr", ntohl(ctx->scratch.xr_dlrr.dlrr));
 }
 static void logging_xr_stats(struct rtcp_process_ctx *ctx, const struct xr_rb_stats *rb_stats) {
-	g_string_append_printf(ctx->log, "rb_stats_ssrc=%u, rb_stats_begin_seq=%u, rb_stats_end_seq=%u, rb_stats_lost_packets=%u, rb_stats_duplicate_packets=%u,"
-			"rb_stats_jitter_min=%u, rb_stats_jitter_max=%u, rb_stats_jitter_mean=%u, rb_stats_jitter_deviation=%u,"
-			"rb_stats_toh_min=%u, rb_stats_toh_max=%u, rb_stats_toh_mean=%u, rb_stats_toh_deviation=%u, ",
-			ntohl(rb_stats->ssrc),
-			ntohs(rb_stats->begin_seq),
-			ntohl(rb_stats->end_seq),
-			ntohl(rb_stats->lost),
-			ntohl(rb_stats->dup),
-			ntohl(rb_stats->jitter_min),
-			ntohl(rb_stats->jitter_max),
-			ntohl(rb_stats->jitter_mean),
-			ntohl(rb_stats->jitter_dev),
-			ntohl(rb_stats->toh_min),
-			ntohl(rb_stats->toh_max),
-			ntohl(rb_stats->toh_mean),
-			ntohl(rb_stats->toh_dev));
+	log_uint(ctx->log, "rb_stats_ssrc", ntohl(rb_stats->ssrc));
+	log_uint(ctx->log, "rb_stats_begin_seq", ntohs(rb_stats->begin_seq));
+	log_uint(ctx->log, "rb_stats_end_seq", ntohl(rb_stats->end_seq));
+	log_uint(ctx->log, "rb_stats_lost_packets", ntohl(rb_stats->lost));
+	log_uint_c(ctx->log, "rb_stats_duplicate_packets", ntohl(rb_stats->dup));
+	log_uint(ctx->log, "rb_stats_jitter_min", ntohl(rb_stats->jitter_min));
+	log_uint(ctx->log, "rb_stats_jitter_max", ntohl(rb_stats->jitter_max));
+	log_uint(ctx->log, "rb_stats_jitter_mean", ntohl(rb_stats->jitter_mean));
+	log_uint_c(ctx->log, "rb_stats_jitter_deviation", ntohl(rb_stats->jitter_dev));
+	log_uint(ctx->log, "rb_stats_toh_min", ntohl(rb_stats->toh_min));
+	log_uint(ctx->log, "rb_stats_toh_max", ntohl(rb_stats->toh_max));
+	log_uint(ctx->log, "rb_stats_toh_mean", ntohl(rb_stats->toh_mean));
+	log_uint(ctx->log, "rb_stats_toh_deviation", ntohl(rb_stats->toh_dev));
 }
 static void logging_xr_voip_metrics(struct rtcp_process_ctx *ctx, const struct xr_rb_voip_metrics *rb_voip_mtc) {
-	g_string_append_printf(ctx->log, "rb_voip_mtc_ssrc=%u, rb_voip_mtc_loss_rate=%u, " \
-			"rb_voip_mtc_discard_rate=%u, rb_voip_mtc_burst_den=%u, "
-			"rb_voip_mtc_gap_den=%u, rb_voip_mtc_burst_dur=%u, rb_voip_mtc_gap_dur=%u, " \
-			"rb_voip_mtc_rnd_trip_delay=%u, "
-			"rb_voip_mtc_end_sys_delay=%u, rb_voip_mtc_signal_lvl=%u, rb_voip_mtc_noise_lvl=%u, " \
-			"rb_voip_mtc_rerl=%u, "
-			"rb_voip_mtc_gmin=%u, rb_voip_mtc_r_factor=%u, rb_voip_mtc_ext_r_factor=%u, " \
-			"rb_voip_mtc_mos_lq=%u, "
-			"rb_voip_mtc_mos_cq=%u, rb_voip_mtc_rx_config=%u, rb_voip_mtc_jb_nom=%u, " \
-			"rb_voip_mtc_jb_max=%u, "
-			"rb_voip_mtc_jb_abs_max=%u, ",
-			ctx->scratch.xr_vm.ssrc,
-			ctx->scratch.xr_vm.loss_rate,
-			ctx->scratch.xr_vm.discard_rate,
-			ctx->scratch.xr_vm.burst_den,
-			ctx->scratch.xr_vm.gap_den,
-			ctx->scratch.xr_vm.burst_dur,
-			ctx->scratch.xr_vm.gap_dur,
-			ctx->scratch.xr_vm.rnd_trip_delay,
-			ctx->scratch.xr_vm.end_sys_delay,
-			ctx->scratch.xr_vm.signal_lvl,
-			ctx->scratch.xr_vm.noise_lvl,
-			ctx->scratch.xr_vm.rerl,
-			ctx->scratch.xr_vm.gmin,
-			ctx->scratch.xr_vm.r_factor,
-			ctx->scratch.xr_vm.ext_r_factor,
-			ctx->scratch.xr_vm.mos_lq,
-			ctx->scratch.xr_vm.mos_cq,
-			ctx->scratch.xr_vm.rx_config,
-			ctx->scratch.xr_vm.jb_nom,
-			ctx->scratch.xr_vm.jb_max,
-			ctx->scratch.xr_vm.jb_abs_max);
+	log_uint(ctx->log, "rb_voip_mtc_ssrc", ctx->scratch.xr_vm.ssrc);
+	log_uint(ctx->log, "rb_voip_mtc_loss_rate", ctx->scratch.xr_vm.loss_rate);
+	log_uint(ctx->log, "rb_voip_mtc_discard_rate", ctx->scratch.xr_vm.discard_rate);
+	log_uint(ctx->log, "rb_voip_mtc_burst_den", ctx->scratch.xr_vm.burst_den);
+	log_uint(ctx->log, "rb_voip_mtc_gap_den", ctx->scratch.xr_vm.gap_den);
+	log_uint(ctx->log, "rb_voip_mtc_burst_dur", ctx->scratch.xr_vm.burst_dur);
+	log_uint(ctx->log, "rb_voip_mtc_gap_dur", ctx->scratch.xr_vm.gap_dur);
+	log_uint(ctx->log, "rb_voip_mtc_rnd_trip_delay", ctx->scratch.xr_vm.rnd_trip_delay);
+	log_uint(ctx->log, "rb_voip_mtc_end_sys_delay", ctx->scratch.xr_vm.end_sys_delay);
+	log_uint(ctx->log, "rb_voip_mtc_signal_lvl", ctx->scratch.xr_vm.signal_lvl);
+	log_uint(ctx->log, "rb_voip_mtc_noise_lvl", ctx->scratch.xr_vm.noise_lvl);
+	log_uint(ctx->log, "rb_voip_mtc_rerl", ctx->scratch.xr_vm.rerl);
+	log_uint(ctx->log, "rb_voip_mtc_gmin", ctx->scratch.xr_vm.gmin);
+	log_uint(ctx->log, "rb_voip_mtc_r_factor", ctx->scratch.xr_vm.r_factor);
+	log_uint(ctx->log, "rb_voip_mtc_ext_r_factor", ctx->scratch.xr_vm.ext_r_factor);
+	log_uint(ctx->log, "rb_voip_mtc_mos_lq", ctx->scratch.xr_vm.mos_lq);
+	log_uint(ctx->log, "rb_voip_mtc_mos_cq", ctx->scratch.xr_vm.mos_cq);
+	log_uint(ctx->log, "rb_voip_mtc_rx_config", ctx->scratch.xr_vm.rx_config);
+	log_uint(ctx->log, "rb_voip_mtc_jb_nom", ctx->scratch.xr_vm.jb_nom);
+	log_uint(ctx->log, "rb_voip_mtc_jb_max", ctx->scratch.xr_vm.jb_max);
+	log_uint(ctx->log, "rb_voip_mtc_jb_abs_max", ctx->scratch.xr_vm.jb_abs_max);
 }
 static void logging_finish(struct rtcp_process_ctx *ctx, struct call *c, const endpoint_t *src,
 		const endpoint_t *dst, const struct timeval *tv)
@@ -1264,7 +1282,7 @@ static void logging_finish(struct rtcp_process_ctx *ctx, struct call *c, const e
 		rtcplog(ctx->log->str);
 }
 static void logging_destroy(struct rtcp_process_ctx *ctx) {
-	g_string_free(ctx->log, TRUE);
+	ctx->log = NULL; // buffer is reused
 }
 
 
@@ -19,7 +19,8 @@ static void init_ssrc_ctx(struct ssrc_ctx *c, struct ssrc_entry_call *parent) {
 }
 static void init_ssrc_entry(struct ssrc_entry *ent, uint32_t ssrc) {
 	ent->ssrc = ssrc;
-	ent->last_used = rtpe_now.tv_sec;
+	ent->used = 1;
+	ent->link.data = ent;
 	mutex_init(&ent->lock);
 }
 static struct ssrc_entry *create_ssrc_entry_call(void *uptr) {
@@ -32,12 +33,69 @@ static struct ssrc_entry *create_ssrc_entry_call(void *uptr) {
 	ent->lost_bits = -1;
 	return &ent->h;
 }
+
+// ht->lock held in W
+static inline void ssrc_hash_write_begin(struct ssrc_hash *ht) {
+	g_atomic_int_inc(&ht->seq);
+}
+static inline void ssrc_hash_write_end(struct ssrc_hash *ht) {
+	g_atomic_int_inc(&ht->seq);
+}
+// ht->lock held in W, or inside a seq read section
+static struct ssrc_entry **ssrc_hash_find_slot(struct ssrc_hash *ht, uint32_t ssrc) {
+	unsigned int idx = ssrc_hash_slot(ssrc);
+	for (unsigned int i = 0; i < SSRC_HASH_SLOTS; i++) {
+		struct ssrc_entry **slot = &ht->slots[(idx + i) & (SSRC_HASH_SLOTS - 1)];
+		struct ssrc_entry *ent = g_atomic_pointer_get(slot);
+		if (!ent)
+			return slot;
+		if (ent->ssrc == ssrc)
+			return slot;
+	}
+	return NULL; // can't happen as the table is never full
+}
+// ht->lock held in W
 static void add_ssrc_entry(uint32_t ssrc, struct ssrc_entry *ent, struct ssrc_hash *ht) {
 	init_ssrc_entry(ent, ssrc);
-	g_hash_table_replace(ht->ht, &ent->ssrc, ent);
-	obj_hold(ent); // HT entry
-	g_queue_push_tail(&ht->q, ent);
-	obj_hold(ent); // queue entry
+	struct ssrc_entry **slot = ssrc_hash_find_slot(ht, ssrc);
+	assert(slot != NULL && *slot == NULL);
+	ssrc_hash_write_begin(ht);
+	g_atomic_pointer_set(slot, ent);
+	ssrc_hash_write_end(ht);
+	g_queue_push_tail_link(&ht->q, &ent->link); // takes over the reference
+}
+// ht->lock held in W. Backward-shift deletion, so no tombstones are needed.
+static void remove_ssrc_entry(struct ssrc_entry *ent, struct ssrc_hash *ht) {
+	struct ssrc_entry **slot = ssrc_hash_find_slot(ht, ent->ssrc);
+	assert(slot != NULL && *slot == ent);
+	unsigned int i = slot - ht->slots;
+
+	ssrc_hash_write_begin(ht);
+	g_atomic_pointer_set(&ht->slots[i], NULL);
+	for (unsigned int j = (i + 1) & (SSRC_HASH_SLOTS - 1); ht->slots[j]; j = (j + 1) & (SSRC_HASH_SLOTS - 1)) {
+		unsigned int home = ssrc_hash_slot(ht->slots[j]->ssrc);
+		// can the entry in j be moved to the hole in i?
+		if (((j - home) & (SSRC_HASH_SLOTS - 1)) < ((j - i) & (SSRC_HASH_SLOTS - 1)))
+			continue;
+		g_atomic_pointer_set(&ht->slots[i], ht->slots[j]);
+		g_atomic_pointer_set(&ht->slots[j], NULL);
+		i = j;
+	}
+	ssrc_hash_write_end(ht);
+
+	// a concurrent lookup may still be looking at it
+	g_queue_unlink(&ht->q, &ent->link);
+	g_queue_push_tail_link(&ht->retired, &ent->link);
+}
+// ht->lock held in W
+static void ssrc_hash_release_retired(struct ssrc_hash *ht) {
+	if (!ht->retired.length)
+		return;
+	if (g_atomic_int_get(&ht->readers))
+		return; // try again next time
+	GList *l;
+	while ((l = g_queue_pop_head_link(&ht->retired)))
+		obj_put((struct ssrc_entry *) l->data);
 }
 static void free_sender_report(struct ssrc_sender_report_item *i) {
 	g_slice_free1(sizeof(*i), i);
@@ -56,10 +114,6 @@ static void __free_ssrc_entry_call(void *ep) {
 	if (e->sequencers)
 		g_hash_table_destroy(e->sequencers);
 }
-static void ssrc_entry_put(void *ep) {
-	struct ssrc_entry_call *e = ep;
-	obj_put(&e->h);
-}
 
 // returned as mos * 10 (i.e. 10 - 50 for 1.0 to 5.0)
 static void mos_calc(struct ssrc_stats_block *ssb) {
@@ -91,32 +145,46 @@ static void mos_calc(struct ssrc_stats_block *ssb) {
 }
 
 static void *find_ssrc(uint32_t ssrc, struct ssrc_hash *ht) {
-	rwlock_lock_r(&ht->lock);
-	struct ssrc_entry *ret = g_atomic_pointer_get(&ht->cache);
-	if (!ret || ret->ssrc != ssrc) {
-		ret = g_hash_table_lookup(ht->ht, &ssrc);
-		if (ret) {
-			obj_hold(ret);
-			// cache shares the reference from ht
-			g_atomic_pointer_set(&ht->cache, ret);
-			ret->last_used = rtpe_now.tv_sec;
-		}
-	}
-	else {
+	struct ssrc_entry *ret = NULL;
+	unsigned int seq;
+
+	g_atomic_int_inc(&ht->readers);
+	do {
+		seq = g_atomic_int_get(&ht->seq);
+		if (G_UNLIKELY(seq & 1))
+			continue; // write in progress
+		struct ssrc_entry **slot = ssrc_hash_find_slot(ht, ssrc);
+		ret = slot ? g_atomic_pointer_get(slot) : NULL;
+	} while (G_UNLIKELY((seq & 1) || g_atomic_int_get(&ht->seq) != seq));
+
+	if (ret) {
 		obj_hold(ret);
-		ret->last_used = rtpe_now.tv_sec;
+		if (!g_atomic_int_get(&ret->used))
+			g_atomic_int_set(&ret->used, 1);
 	}
-	rwlock_unlock_r(&ht->lock);
+	g_atomic_int_add(&ht->readers, -1);
+
 	return ret;
 }
 
-static int ssrc_time_cmp(const void *aa, const void *bb, void *pp) {
-	const struct ssrc_entry *a = aa, *b = bb;
-	if (a->last_used < b->last_used)
-		return -1;
-	if (a->last_used > b->last_used)
-		return 1;
-	return 0;
+// ht->lock held in W. Second-chance eviction: entries used since they were last looked at
+// go to the back of the queue.
+static void ssrc_hash_evict(struct ssrc_hash *ht, uint32_t new_ssrc) {
+	unsigned int passes = ht->q.length;
+	while (G_UNLIKELY(ht->q.length > SSRC_HASH_LIMIT)) {
+		struct ssrc_entry *old_ent = ht->q.head->data;
+		if (passes && g_atomic_int_get(&old_ent->used)) {
+			passes--;
+			g_atomic_int_set(&old_ent->used, 0);
+			g_queue_unlink(&ht->q, &old_ent->link);
+			g_queue_push_tail_link(&ht->q, &old_ent->link);
+			continue;
+		}
+		ilog(LOG_DEBUG, "SSRC hash table exceeded size limit (trying to add %s%x%s) - "
+				"deleting SSRC %s%x%s",
+				FMT_M(new_ssrc), FMT_M(old_ent->ssrc));
+		remove_ssrc_entry(old_ent, ht);
+	}
 }
 
 // returns a new reference
@@ -150,18 +218,9 @@ restart:
 
 	rwlock_lock_w(&ht->lock);
 
-	while (G_UNLIKELY(ht->q.length > 20)) { // arbitrary limit
-		g_queue_sort(&ht->q, ssrc_time_cmp, NULL);
-		struct ssrc_entry *old_ent = g_queue_pop_head(&ht->q);
-		ilog(LOG_DEBUG, "SSRC hash table exceeded size limit (trying to add %s%x%s) - "
-				"deleting SSRC %s%x%s",
-				FMT_M(ssrc), FMT_M(old_ent->ssrc));
-		g_atomic_pointer_set(&ht->cache, NULL);
-		g_hash_table_remove(ht->ht, &old_ent->ssrc); // does obj_put
-		obj_put(old_ent); // for the queue entry
-	}
+	ssrc_hash_evict(ht, ssrc);
 
-	if (g_hash_table_lookup(ht->ht, &ssrc)) {
+	if (*ssrc_hash_find_slot(ht, ssrc)) {
 		// preempted
 		rwlock_unlock_w(&ht->lock);
 		// return created entry if slot is still empty
@@ -170,7 +229,8 @@ restart:
 		goto restart;
 	}
 	add_ssrc_entry(ssrc, ent, ht);
-	g_atomic_pointer_set(&ht->cache, ent);
+	obj_hold(ent); // for the caller
+	ssrc_hash_release_retired(ht);
 	rwlock_unlock_w(&ht->lock);
 	if (created)
 		*created = true;
@@ -180,8 +240,11 @@ restart:
 void free_ssrc_hash(struct ssrc_hash **ht) {
 	if (!*ht)
 		return;
-	g_hash_table_destroy((*ht)->ht);
-	g_queue_clear_full(&(*ht)->q, ssrc_entry_put);
+	GList *l;
+	while ((l = g_queue_pop_head_link(&(*ht)->q)))
+		obj_put((struct ssrc_entry *) l->data);
+	while ((l = g_queue_pop_head_link(&(*ht)->retired)))
+		obj_put((struct ssrc_entry *) l->data);
 	if ((*ht)->precreat)
 		obj_put((struct ssrc_entry *) (*ht)->precreat);
 	g_slice_free1(sizeof(**ht), *ht);
@@ -205,7 +268,6 @@ void ssrc_hash_foreach(struct ssrc_hash *sh, void (*f)(void *, void *), void *pt
 struct ssrc_hash *create_ssrc_hash_full_fast(ssrc_create_func_t cfunc, void *uptr) {
 	struct ssrc_hash *ret;
 	ret = g_slice_alloc0(sizeof(*ret));
-	ret->ht = g_hash_table_new_full(uint32_hash, uint32_eq, NULL, ssrc_entry_put);
 	rwlock_init(&ret->lock);
 	ret->create_func = cfunc;
 	ret->uptr = uptr;
@@ -5,6 +5,7 @@
 #include "graphite.h"
 #include "main.h"
 #include "control_ng.h"
+#include "load.h"
 
 
 struct timeval rtpe_started;
@@ -12,6 +13,7 @@ struct timeval rtpe_started;
 
 mutex_t rtpe_codec_stats_lock;
 GHashTable *rtpe_codec_stats;
+struct codec_worker_stats *rtpe_codec_worker_stats;
 
 
 struct global_stats_gauge rtpe_stats_gauge;			// master values
@@ -323,9 +325,7 @@ GQueue *statistics_gather_metrics(struct interface_sampled_rate_stats *interface
 	HEADER("currentstatistics", "Statistics over currently running sessions:");
 	HEADER("{", "");
 
-	rwlock_lock_r(&rtpe_callhash_lock);
-	cur_sessions = g_hash_table_size(rtpe_callhash);
-	rwlock_unlock_r(&rtpe_callhash_lock);
+	cur_sessions = atomic64_get(&rtpe_stats_gauge.total_sessions);
 
 	METRIC("sessionsown", "Owned sessions", UINT64F, UINT64F, cur_sessions - atomic64_get(&rtpe_stats_gauge.foreign_sessions));
 	PROM("sessions", "gauge");
@@ -359,6 +359,8 @@ GQueue *statistics_gather_metrics(struct interface_sampled_rate_stats *interface
 	METRIC("errorrate", "Errors per second (total)", UINT64F, UINT64F,
 			atomic64_get(&rtpe_stats_rate.errors_user) +
 			atomic64_get(&rtpe_stats_rate.errors_kernel));
+	METRIC("dtlshandshakerate", "DTLS handshakes per second", UINT64F, UINT64F,
+			atomic64_get(&rtpe_stats_rate.dtls_handshakes));
 
 	METRIC("media_userspace", "Userspace-only media streams", UINT64F, UINT64F,
 			atomic64_get(&rtpe_stats_gauge.userspace_streams));
@@ -450,6 +452,21 @@ GQueue *statistics_gather_metrics(struct interface_sampled_rate_stats *interface
 	PROM("zero_packet_streams_total", "counter");
 	METRIC("onewaystreams", "Total number of 1-way streams", UINT64F, UINT64F,atomic64_get(&rtpe_stats.oneway_stream_sess));
 	PROM("one_way_sessions_total", "counter");
+	METRIC("dtlshandshakes", "Total DTLS handshakes", UINT64F, UINT64F,
+			atomic64_get(&rtpe_stats.dtls_handshakes));
+	PROM("dtls_handshakes_total", "counter");
+	METRIC("dtlshandshakefailures", "Total failed DTLS handshakes", UINT64F, UINT64F,
+			atomic64_get(&rtpe_stats.dtls_handshake_failures));
+	PROM("dtls_handshake_failures_total", "counter");
+	METRICva("dtlshandshaketime", "Total CPU time spent on DTLS handshakes", "%.6f", "%.6f seconds",
+			(double) atomic64_get(&rtpe_stats.dtls_handshake_time) / 1000000.0);
+	PROM("dtls_handshake_seconds_total", "counter");
+	METRIC("homermessages", "Total messages sent to Homer", UINT64F, UINT64F,
+			atomic64_get(&rtpe_stats.homer_messages));
+	PROM("homer_messages_total", "counter");
+	METRIC("homerdrops", "Total messages to Homer dropped", UINT64F, UINT64F,
+			atomic64_get(&rtpe_stats.homer_drops));
+	PROM("homer_drops_total", "counter");
 	METRICva("avgcallduration", "Average call duration", "%.6f", "%.6f seconds", (double) avg_us / 1000000.0);
 	PROM("call_duration_avg", "gauge");
 
@@ -908,6 +925,55 @@ GQueue *statistics_gather_metrics(struct interface_sampled_rate_stats *interface
 	g_list_free(chains);
 	HEADER("]", "");
 
+	HEADER("codecworkers", NULL);
+	HEADER("[", "");
+	for (int i = 0; rtpe_codec_worker_stats && i < rtpe_config.codec_threads; i++) {
+		struct codec_worker_stats *ws = &rtpe_codec_worker_stats[i];
+		uint64_t jobs = atomic64_get(&ws->jobs);
+		uint64_t wait_us = atomic64_get(&ws->wait_us);
+		HEADER("{", "");
+		METRICs("worker", "%i", i);
+		METRICs("queued", UINT64F, atomic64_get(&ws->queued));
+		PROM("codec_worker_queued", "gauge");
+		PROMLAB("worker=\"%i\"", i);
+		METRICs("jobs", UINT64F, jobs);
+		PROM("codec_worker_jobs_total", "counter");
+		PROMLAB("worker=\"%i\"", i);
+		METRICs("waittime", "%.6f", (double) wait_us / 1000000.0);
+		PROM("codec_worker_wait_seconds_total", "counter");
+		PROMLAB("worker=\"%i\"", i);
+		METRICs("busytime", "%.6f", (double) atomic64_get(&ws->busy_us) / 1000000.0);
+		PROM("codec_worker_busy_seconds_total", "counter");
+		PROMLAB("worker=\"%i\"", i);
+		METRICs("avgwaittime", "%.6f", jobs ? (double) wait_us / jobs / 1000000.0 : 0.0);
+		HEADER("}", "");
+	}
+	HEADER("]", "");
+
+	// only sampled when --max-thread-load is in use
+	HEADER("threadload", NULL);
+	HEADER("[", "");
+	for (int i = 0; rtpe_config.thread_load_limit && i < __THREAD_LOAD_TYPES; i++) {
+		struct thread_load_stats *ts = &thread_load_stats[i];
+		const char *type = thread_load_type_names[i];
+		HEADER("{", "");
+		METRICs("type", "%s", type);
+		METRICs("threads", "%i", g_atomic_int_get(&ts->threads));
+		PROM("thread_load_threads", "gauge");
+		PROMLAB("type=\"%s\"", type);
+		METRICs("occupancy", "%.2f", (double) g_atomic_int_get(&ts->occupancy) / 100.0);
+		PROM("thread_load_occupancy_percent", "gauge");
+		PROMLAB("type=\"%s\"", type);
+		METRICs("maxoccupancy", "%.2f", (double) g_atomic_int_get(&ts->occupancy_max) / 100.0);
+		PROM("thread_load_max_occupancy_percent", "gauge");
+		PROMLAB("type=\"%s\"", type);
+		METRICs("latency", "%.6f", (double) g_atomic_int_get(&ts->latency_ns) / 1000000000.0);
+		PROM("thread_load_latency_seconds", "gauge");
+		PROMLAB("type=\"%s\"", type);
+		HEADER("}", "");
+	}
+	HEADER("]", "");
+
 	HEADER("}", NULL);
 
 	return ret;
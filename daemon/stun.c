@@ -3,8 +3,6 @@
 #include <sys/types.h>
 #include <string.h>
 #include <sys/socket.h>
-#include <zlib.h>
-#include <openssl/hmac.h>
 #include <glib.h>
 #include <endian.h>
 
@@ -330,59 +328,19 @@ static void fingerprint(struct msghdr *mh, struct fingerprint *fp) {
 	hdr = iov->iov_base;
 	hdr->msg_len = htons(hdr->msg_len);
 
-	fp->crc = crc32(0, NULL, 0);
+	fp->crc = 0;
 	for (i = 0; i < mh->msg_iovlen - 1; i++)
-		fp->crc = crc32(fp->crc, iov[i].iov_base, iov[i].iov_len);
+		fp->crc = stun_crc32(fp->crc, iov[i].iov_base, iov[i].iov_len);
 
 	fp->crc = htonl(fp->crc ^ STUN_CRC_XOR);
 	hdr->msg_len = ntohs(hdr->msg_len);
 }
 
-static void __integrity(struct iovec *iov, int iov_cnt, str *pwd, char *digest) {
-	int i;
-
-#if OPENSSL_VERSION_NUMBER >= 0x30000000L
-	EVP_MAC_CTX *ctx;
-
-	ctx = EVP_MAC_CTX_dup(rtpe_hmac_sha1_base);
-	EVP_MAC_init(ctx, (unsigned char *) pwd->s, pwd->len, NULL);
-
-	for (i = 0; i < iov_cnt; i++)
-		EVP_MAC_update(ctx, iov[i].iov_base, iov[i].iov_len);
-
-	size_t outsize = 20;
-	EVP_MAC_final(ctx, (unsigned char *) digest, &outsize, outsize);
-	EVP_MAC_CTX_free(ctx);
-#else // <3.0
-	HMAC_CTX *ctx;
-
-#if OPENSSL_VERSION_NUMBER >= 0x10100000L
-	ctx = HMAC_CTX_new();
-#else
-	HMAC_CTX ctx_s;
-	HMAC_CTX_init(&ctx_s);
-	ctx = &ctx_s;
-#endif
-	/* do we need to SASLprep here? */
-	HMAC_Init_ex(ctx, pwd->s, pwd->len, EVP_sha1(), NULL);
-
-	for (i = 0; i < iov_cnt; i++)
-		HMAC_Update(ctx, iov[i].iov_base, iov[i].iov_len);
-
-	HMAC_Final(ctx, (void *) digest, NULL);
-#if OPENSSL_VERSION_NUMBER >= 0x10100000L
-	HMAC_CTX_free(ctx);
-#else
-	HMAC_CTX_cleanup(ctx);
-#endif
-#endif
-}
-
-static void integrity(struct msghdr *mh, struct msg_integrity *mi, str *pwd) {
+static void integrity(struct msghdr *mh, struct msg_integrity *mi, const struct hmac_sha1_key *key) {
 	struct iovec *iov;
 	struct header *hdr;
 
-	if (!pwd || !pwd->s)
+	if (!key || !key->inner)
 		return;
 
 	output_add(mh, mi, STUN_MESSAGE_INTEGRITY);
@@ -390,7 +348,7 @@ static void integrity(struct msghdr *mh, struct msg_integrity *mi, str *pwd) {
 	hdr = iov->iov_base;
 	hdr->msg_len = htons(hdr->msg_len);
 
-	__integrity(mh->msg_iov, mh->msg_iovlen - 1, pwd, mi->digest);
+	hmac_sha1_iov(key, mh->msg_iov, mh->msg_iovlen - 1, (unsigned char *) mi->digest);
 
 	hdr->msg_len = ntohs(hdr->msg_len);
 }
@@ -417,7 +375,7 @@ static void stun_error_len(struct stream_fd *sfd, const endpoint_t *sin,
 	if (attr_cont)
 		output_add_data_wr(&mh, &aa, add_attr, attr_cont, attr_len);
 
-	integrity(&mh, &mi, &sfd->stream->media->ice_agent->pwd[1]);
+	integrity(&mh, &mi, &sfd->stream->media->ice_agent->pwd_key[1]);
 	fingerprint(&mh, &fp);
 
 	output_finish_src(&mh);
@@ -438,7 +396,7 @@ static int check_fingerprint(const str *msg, struct stun_attrs *attrs) {
 	uint32_t crc;
 
 	len = attrs->fingerprint_attr - msg->s;
-	crc = crc32(0, (void *) msg->s, len);
+	crc = stun_crc32(0, msg->s, len);
 	crc ^= STUN_CRC_XOR;
 	if (crc != attrs->fingerprint)
 		return -1;
@@ -458,7 +416,7 @@ static int check_auth(const str *msg, struct stun_attrs *attrs, struct call_medi
 		return -1;
 	if (!ag->ufrag[dst].s || !ag->ufrag[dst].len)
 		return -1;
-	if (!ag->pwd[dst].s || !ag->pwd[dst].len)
+	if (!ag->pwd[dst].s || !ag->pwd[dst].len || !ag->pwd_key[dst].inner)
 		return -1;
 
 	if (attrs->username.s) {
@@ -483,7 +441,7 @@ static int check_auth(const str *msg, struct stun_attrs *attrs, struct call_medi
 	iov[2].iov_base = msg->s + G_STRUCT_OFFSET(struct header, cookie);
 	iov[2].iov_len = ntohs(lenX) + - 24 + 20 - G_STRUCT_OFFSET(struct header, cookie);
 
-	__integrity(iov, G_N_ELEMENTS(iov), &ag->pwd[dst], digest);
+	hmac_sha1_iov(&ag->pwd_key[dst], iov, G_N_ELEMENTS(iov), (unsigned char *) digest);
 
 	return memcmp(digest, attrs->msg_integrity.s, 20) ? -1 : 0;
 }
@@ -517,7 +475,7 @@ static int stun_binding_success(struct stream_fd *sfd, struct header *req, struc
 		output_add(&mh, &xma, STUN_XOR_MAPPED_ADDRESS);
 	}
 
-	integrity(&mh, &mi, &sfd->stream->media->ice_agent->pwd[1]);
+	integrity(&mh, &mi, &sfd->stream->media->ice_agent->pwd_key[1]);
 	fingerprint(&mh, &fp);
 
 	output_finish_src(&mh);
@@ -666,7 +624,7 @@ ignore:
 	return -1;
 }
 
-int stun_binding_request(const endpoint_t *dst, uint32_t transaction[3], str *pwd,
+int stun_binding_request(const endpoint_t *dst, uint32_t transaction[3], const struct hmac_sha1_key *key,
 		str ufrags[2], int controlling, uint64_t tiebreaker, uint32_t priority,
 		socket_t *sock, int to_use)
 {
@@ -701,7 +659,7 @@ int stun_binding_request(const endpoint_t *dst, uint32_t transaction[3], str *pw
 	if (to_use)
 		output_add(&mh, &uc, STUN_USE_CANDIDATE);
 
-	integrity(&mh, &mi, pwd);
+	integrity(&mh, &mi, key);
 	fingerprint(&mh, &fp);
 
 	output_finish_src(&mh);
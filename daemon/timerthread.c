@@ -1,6 +1,8 @@
 #include "timerthread.h"
 #include "helpers.h"
 #include "log_funcs.h"
+#include "recording.h"
+#include "load.h"
 
 
 static int tt_obj_cmp(const void *a, const void *b) {
@@ -34,8 +36,12 @@ void timerthread_run(void *p) {
 	struct thread_waker waker = { .lock = &tt->lock, .cond = &tt->cond };
 	thread_waker_add(&waker);
 
+	thread_load_register(THREAD_LOAD_TIMER);
+
 	mutex_lock(&tt->lock);
 
+	bool batch_open = false;
+
 	while (!rtpe_shutdown) {
 		gettimeofday(&rtpe_now, NULL);
 
@@ -50,6 +56,10 @@ void timerthread_run(void *p) {
 		if (sleeptime > 0)
 			goto sleep;
 
+		// packets to be recorded through the kernel are submitted once per tick
+		recording_batch_start();
+		batch_open = true;
+
 		// steal reference
 		g_tree_remove(tt->tree, tt_obj);
 		// pretend we're running exactly at the scheduled time
@@ -59,8 +69,10 @@ void timerthread_run(void *p) {
 		mutex_unlock(&tt->lock);
 
 		// run and release
+		long long load_start = thread_load_start();
 		tt->func(tt_obj);
 		obj_put(tt_obj);
+		thread_load_done(load_start);
 
 		log_info_reset();
 
@@ -68,6 +80,16 @@ void timerthread_run(void *p) {
 		continue;
 
 sleep:;
+		if (batch_open) {
+			// written out without the lock held, then look at the tree again, as
+			// it may have changed in the meantime
+			mutex_unlock(&tt->lock);
+			recording_batch_flush();
+			batch_open = false;
+			mutex_lock(&tt->lock);
+			continue;
+		}
+
 		/* figure out how long we should sleep */
 		sleeptime = MIN(10000000, sleeptime); /* 100 ms at the most */
 		struct timeval tv = rtpe_now;
@@ -76,6 +98,7 @@ sleep:;
 	}
 
 	mutex_unlock(&tt->lock);
+	recording_batch_flush();
 	thread_waker_del(&waker);
 }
 
@@ -33,9 +33,9 @@ struct websocket_conn {
 
 	// multithreaded message processing
 	mutex_t lock;
-	unsigned int jobs;
+	volatile int jobs; // atomic, but incremented and dropped to zero only under the lock
 	GQueue messages;
-	cond_t cond;
+	cond_t cond; // signalled when `jobs` drops to zero
 	GHashTable *janus_sessions;
 
 	// output buffer - also protected by lock
@@ -215,13 +215,35 @@ static void websocket_message_push(struct websocket_conn *wc, websocket_message_
 	wm->func = func;
 
 	g_queue_push_tail(&wc->messages, wm);
-	wc->jobs++;
+	g_atomic_int_inc(&wc->jobs);
 	g_thread_pool_push(websocket_threads, wc, NULL);
 
 	wc->wm = websocket_message_new(wc);
 }
 
 
+// Only the last outstanding job can be of interest to websocket_conn_cleanup(), so
+// the lock and the signal are skipped for all others. The final decrement must
+// happen under the lock as `wc` may be freed as soon as it's released.
+static void websocket_job_done(struct websocket_conn *wc) {
+	int old;
+	do {
+		old = g_atomic_int_get(&wc->jobs);
+		assert(old >= 1);
+		if (old == 1)
+			break;
+	} while (!g_atomic_int_compare_and_exchange(&wc->jobs, old, old - 1));
+
+	if (old != 1)
+		return;
+
+	mutex_lock(&wc->lock);
+	if (g_atomic_int_dec_and_test(&wc->jobs))
+		cond_signal(&wc->cond);
+	mutex_unlock(&wc->lock);
+}
+
+
 static void websocket_process(void *p, void *up) {
 	struct websocket_conn *wc = p;
 
@@ -238,11 +260,7 @@ static void websocket_process(void *p, void *up) {
 	// job count has been decremented
 
 	websocket_message_free(&wm);
-	mutex_lock(&wc->lock);
-	assert(wc->jobs >= 1);
-	wc->jobs--;
-	cond_signal(&wc->cond);
-	mutex_unlock(&wc->lock);
+	websocket_job_done(wc);
 
 	if (err)
 		ilogs(http, LOG_ERR, "Error while processing HTTP/WS message: %s", err);
@@ -660,7 +678,7 @@ static void websocket_conn_cleanup(struct websocket_conn *wc) {
 
 	// wait until all remaining tasks are finished
 	mutex_lock(&wc->lock);
-	while (wc->jobs)
+	while (g_atomic_int_get(&wc->jobs))
 		cond_wait(&wc->cond, &wc->lock);
 
 	// lock order constraint: janus_session lock first, websocket_conn lock second:
@@ -3,7 +3,6 @@
 
 #include <sys/uio.h>
 #include <string.h>
-#include <json-glib/json-glib.h>
 
 #include "compat.h"
 
@@ -300,8 +299,9 @@ INLINE bencode_item_t *bencode_decode_expect_str(bencode_buffer_t *buf, const st
 /* Returns the number of bytes that could successfully be decoded from 's', -1 if more bytes are needed or -2 on error */
 ssize_t bencode_valid(const char *s, size_t len);
 
-// Convert a GLib JSON document to bencode
-bencode_item_t *bencode_convert_json(bencode_buffer_t *buf, JsonParser *json);
+// Decode a JSON document into bencode objects. As with bencode_decode(), strings reference the
+// input buffer where possible. JSON null and floating point values are not supported.
+bencode_item_t *bencode_decode_json(bencode_buffer_t *buf, const char *s, size_t len);
 
 
 /*** DICTIONARY LOOKUP & EXTRACTION ***/
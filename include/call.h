@@ -408,6 +408,7 @@ struct packet_stream {
 	struct stream_stats	kernel_stats_out;
 	unsigned char		in_tos_tclass;
 	atomic64		last_packet;
+	atomic64		mqtt_packets;	/* in + out as of the last MQTT publish */
 	GHashTable		*rtp_stats;				/* LOCK: call->master_lock */
 	struct rtp_stats	*rtp_stats_cache;
 	unsigned int		stats_flags;
@@ -552,7 +553,7 @@ struct call_monologue {
 	GQueue			subscribers;		/* who is subscribed to me (sinks) */
 	GHashTable		*subscribers_ht;	/* for quick lookup */
 	GPtrArray		*medias;
-	GHashTable		*media_ids;
+	GHashTable		*media_ids;		/* created on demand */
 	struct media_player	*player;
 	unsigned long long	sdp_session_id;
 	unsigned long long	sdp_version;
@@ -664,6 +665,9 @@ struct call {
 
 	mutex_t			buffer_lock;
 	call_buffer_t		buffer;
+	char			*arena;		/* current chunk for call_obj_alloc0(), part of buffer */
+	size_t			arena_left;
+	size_t			mem_usage;	/* bytes taken from buffer, protected by buffer_lock */
 
 	/* master_lock protects the entire call and all the contained objects.
 	 * 
@@ -680,8 +684,8 @@ struct call {
 	GQueue			monologues;	/* call_monologue */
 	GQueue			medias;		/* call_media */
 	GHashTable		*tags;
-	GHashTable		*viabranches;
-	GHashTable		*labels;
+	GHashTable		*viabranches;	/* created on demand */
+	GHashTable		*labels;	/* created on demand */
 	GQueue			streams;
 	GQueue			stream_fds;	/* stream_fd */
 	GQueue			endpoint_maps;
@@ -715,12 +719,20 @@ struct call {
 
 /**
  * The main entry point into call objects for signalling events is the call-ID:
- * Therefore the main entry point is the global hash table rtpe_callhash (protected by rtpe_callhash_lock),
+ * Therefore the main entry point is the global hash table rtpe_callhash,
  * which uses call-IDs as keys and call objects as values,
  * while holding a reference to each contained call.
+ * It's split into CALLHASH_SHARDS shards by hash of the call-ID, each with its own lock,
+ * so that signalling for unrelated calls doesn't contend. The number of calls in it is
+ * kept in the total_sessions gauge.
  */
-extern rwlock_t rtpe_callhash_lock;
-extern GHashTable *rtpe_callhash;
+#define CALLHASH_SHARD_BITS 6
+#define CALLHASH_SHARDS (1 << CALLHASH_SHARD_BITS)
+struct callhash_shard {
+	rwlock_t lock;
+	GHashTable *ht;
+} __attribute__ ((aligned (64)));
+extern struct callhash_shard rtpe_callhash[CALLHASH_SHARDS];
 extern struct call_iterator_list rtpe_call_iterators[NUM_CALL_ITERATORS];
 
 
@@ -797,14 +809,52 @@ const struct rtp_payload_type *__rtp_stats_codec(struct call_media *m);
 #include "str.h"
 #include "rtp.h"
 
+void *__call_malloc(struct call *c, size_t l); // buffer_lock held
 INLINE void *call_malloc(struct call *c, size_t l) {
 	void *ret;
 	mutex_lock(&c->buffer_lock);
-	ret = call_buffer_alloc(&c->buffer, l);
+	ret = __call_malloc(c, l);
 	mutex_unlock(&c->buffer_lock);
 	return ret;
 }
 
+/* for objects owned by the call which live as long as the call itself. memory is
+ * released only when the call is freed. */
+void *call_obj_alloc0(struct call *c, size_t l);
+#define call_uid_alloc0(c, ptr, q) __call_uid_alloc0(c, sizeof(*(ptr)), q, \
+		G_STRUCT_OFFSET(__typeof__(*(ptr)), unique_id))
+INLINE void *__call_uid_alloc0(struct call *c, size_t size, GQueue *q, unsigned int offset) {
+	void *ret = call_obj_alloc0(c, size);
+	__uid_slice_alloc_fill(ret, q, offset);
+	return ret;
+}
+
+/* str-keyed lookup tables which stay empty for most calls are created on first insert */
+INLINE void *lazy_str_ht_lookup(GHashTable *ht, const str *key) {
+	if (!ht)
+		return NULL;
+	return g_hash_table_lookup(ht, key);
+}
+INLINE void lazy_str_ht_insert(GHashTable **ht, str *key, void *val) {
+	if (!*ht)
+		*ht = g_hash_table_new(str_hash, str_equal);
+	g_hash_table_insert(*ht, key, val);
+}
+INLINE void lazy_str_ht_replace(GHashTable **ht, str *key, void *val) {
+	if (!*ht)
+		*ht = g_hash_table_new(str_hash, str_equal);
+	g_hash_table_replace(*ht, key, val);
+}
+INLINE void lazy_str_ht_remove(GHashTable *ht, const str *key) {
+	if (ht)
+		g_hash_table_remove(ht, key);
+}
+INLINE void lazy_str_ht_destroy(GHashTable **ht) {
+	if (*ht)
+		g_hash_table_destroy(*ht);
+	*ht = NULL;
+}
+
 INLINE char *call_strdup_len(struct call *c, const char *s, unsigned int len) {
 	char *r;
 	if (!s)
@@ -41,6 +41,7 @@ struct codec_handler {
 	int real_dtmf_payload_type;
 	int cn_payload_type;
 	codec_handler_func *handler_func;
+	enum rtpengine_pt_transcode kernel_transcode; // simple conversion, also done by the kernel
 	unsigned int passthrough:1;
 	unsigned int kernelize:1;
 	unsigned int transcoder:1;
@@ -92,6 +93,7 @@ struct codec_scheduler {
 
 
 void codecs_init(void);
+void codecs_stop(void);
 void codecs_cleanup(void);
 void codec_timers_loop(void *);
 void rtcp_timer_stop(struct rtcp_timer **);
@@ -192,6 +194,7 @@ void codec_decoder_skip_pts(struct codec_ssrc_handler *ch, uint64_t);
 uint64_t codec_decoder_unskip_pts(struct codec_ssrc_handler *ch);
 void codec_tracker_update(struct codec_store *);
 void codec_handlers_stop(GQueue *);
+long long codec_cost_estimate(const str *codec);
 
 
 void packet_encoded_packetize(AVPacket *pkt, struct codec_ssrc_handler *ch, struct media_packet *mp,
@@ -232,6 +235,7 @@ INLINE void codec_handler_free(struct codec_handler **handler) { }
 INLINE void codec_tracker_update(struct codec_store *cs) { }
 INLINE void codec_handlers_stop(GQueue *q) { }
 INLINE void ensure_codec_def(struct rtp_payload_type *pt, struct call_media *media) { }
+INLINE long long codec_cost_estimate(const str *codec) { return 0; }
 
 #endif
 
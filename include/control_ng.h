@@ -92,6 +92,7 @@ enum load_limit_reasons {
 	LOAD_LIMIT_CPU,
 	LOAD_LIMIT_LOAD,
 	LOAD_LIMIT_BW,
+	LOAD_LIMIT_THREADS,
 
 	__LOAD_LIMIT_MAX
 };
@@ -45,10 +45,12 @@ struct dtls_cert {
 	EVP_PKEY *pkey;
 	X509 *x509;
 	time_t expires;
+	SSL_CTX *ssl_ctx[2]; // 0 = passive/server, 1 = active/client
+	mutex_t pool_lock;
+	GQueue ssl_pool[2]; // ready to use SSL objects, same index
 };
 
 struct dtls_connection {
-	SSL_CTX *ssl_ctx;
 	SSL *ssl;
 	BIO *r_bio, *w_bio;
 	void *ptr;
@@ -63,10 +65,12 @@ struct dtls_connection {
 
 int dtls_init(void);
 void dtls_timer(void);
+void dtls_pool_fill(struct dtls_cert *);
 
 int dtls_verify_cert(struct packet_stream *ps);
 const struct dtls_hash_func *dtls_find_hash_func(const str *);
 struct dtls_cert *dtls_cert(void);
+void dtls_stop(void);
 void dtls_cert_free(void);
 
 int dtls_connection_init(struct dtls_connection *, struct packet_stream *, int active, struct dtls_cert *cert);
@@ -2,12 +2,16 @@
 #define __HOMER_H__
 
 #include "socket.h"
+#include "helpers.h"
 
 
 void homer_sender_init(const endpoint_t *, int, int);
-int homer_send(GString *, const str *, const endpoint_t *, const endpoint_t *,
+void homer_sender_free(void);
+int homer_send(const str *, const str *, const endpoint_t *, const endpoint_t *,
 		const struct timeval *tv);
 int has_homer(void);
+enum thread_looper_action homer_exporter(void);
+void homer_loop(void *);
 
 
 #endif
@@ -14,6 +14,7 @@
 #include "media_socket.h"
 #include "socket.h"
 #include "timerthread.h"
+#include "ssllib.h"
 
 
 
@@ -137,6 +138,7 @@ struct ice_agent {
 
 	str			ufrag[2]; /* 0 = remote, 1 = local */
 	str			pwd[2]; /* ditto */
+	struct hmac_sha1_key	pwd_key[2]; /* for STUN message integrity, ditto */
 	volatile unsigned int	agent_flags;
 };
 
@@ -1,9 +1,32 @@
 #ifndef _LOAD_H_
 #define _LOAD_H_
 
+enum thread_load_type {
+	THREAD_LOAD_POLLER = 0,
+	THREAD_LOAD_TIMER,
+	THREAD_LOAD_CODEC,
+
+	__THREAD_LOAD_TYPES
+};
+
+// per class of worker threads, updated by the load monitor
+struct thread_load_stats {
+	int threads;
+	int occupancy; // mean across threads, percent times 100
+	int occupancy_max; // busiest thread, percent times 100
+	int latency_ns; // mean processing time per work item
+};
+
 extern int load_average; // times 100
 extern int cpu_usage; // times 100
+extern struct thread_load_stats thread_load_stats[__THREAD_LOAD_TYPES];
+extern const char *thread_load_type_names[__THREAD_LOAD_TYPES];
 
 enum thread_looper_action load_thread(void);
 
+void thread_load_register(enum thread_load_type);
+long long thread_load_start(void);
+void thread_load_done(long long start);
+void load_free(void);
+
 #endif
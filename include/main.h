@@ -67,6 +67,8 @@ struct rtpengine_config {
 	endpoint_t		homer_ep;
 	int			homer_protocol;
 	int			homer_id;
+	int			homer_queue;
+	int			homer_sample;
 	gboolean		no_fallback;
 	gboolean		reject_invalid_sdp;
 	gboolean		save_interface_ports;
@@ -86,6 +88,7 @@ struct rtpengine_config {
 	gboolean		active_switchover;
 	int			num_threads;
 	int			media_num_threads;
+	int			codec_threads;
 	char			*spooldir;
 	char			*rec_method;
 	char			*rec_format;
@@ -95,6 +98,7 @@ struct rtpengine_config {
 	char			*nftables_base_chain;
 	int			load_limit;
 	int			cpu_limit;
+	int			thread_load_limit;
 	uint64_t		bw_limit;
 	char			*scheduling;
 	int			priority;
@@ -106,6 +110,8 @@ struct rtpengine_config {
 	char			*mysql_user;
 	char			*mysql_pass;
 	char			*mysql_query;
+	int			mysql_threads;
+	char			**mysql_prefetch;
 	endpoint_t		dtmf_udp_ep;
 	gboolean		dtmf_via_ng;
 	gboolean		dtmf_no_suppress;
@@ -120,6 +126,7 @@ struct rtpengine_config {
 	}			dtls_cert_cipher;
 	int			dtls_rsa_key_size;
 	int			dtls_mtu;
+	int			dtls_threads;
 	char			*dtls_ciphers;
 	enum {
 		DSIG_SHA256 = 0,
@@ -141,6 +148,8 @@ struct rtpengine_config {
 	uint32_t		silence_detect_int;
 	str			cn_payload;
 	gboolean		player_cache;
+	int			player_cache_size;
+	char			*player_cache_dir;
 	int			audio_buffer_length;
 	int			audio_buffer_delay;
 	enum {
@@ -165,6 +174,7 @@ struct rtpengine_config {
 	int			mqtt_publish_qos;
 	char			*mqtt_publish_topic;
 	int			mqtt_publish_interval;
+	gboolean		mqtt_publish_changed;
 	enum {
 		MPS_NONE = -1,
 		MPS_GLOBAL = 0,
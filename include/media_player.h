@@ -62,6 +62,7 @@ struct media_player {
 
 	struct timeval next_run;
 	unsigned long repeat;
+	unsigned int play_gen; // incremented whenever playback is stopped or replaced
 
 	struct media_player_coder coder;
 	struct media_player_content_index cache_index;
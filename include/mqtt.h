@@ -2,11 +2,15 @@
 #define _MQTT_H_
 
 #include <stdbool.h>
+#include <glib.h>
 #include "main.h"
 
 struct call;
 struct call_media;
 
+// number of steps the global scope message is built up in
+#define MQTT_GLOBAL_SLICES 10
+
 
 #ifdef HAVE_MQTT
 
@@ -14,7 +18,7 @@ struct call_media;
 int mqtt_init(void);
 void mqtt_loop(void *);
 int mqtt_publish_scope(void);
-void mqtt_publish(char *);
+void mqtt_publish(const GString *);
 void mqtt_timer_run_media(struct call *, struct call_media *);
 void mqtt_timer_run_call(struct call *);
 void mqtt_timer_run_global(void);
@@ -26,7 +30,7 @@ void mqtt_timer_run_summary(void);
 #include "compat.h"
 
 INLINE int mqtt_init(void) { return 0; }
-INLINE void mqtt_publish(char *s) { }
+INLINE void mqtt_publish(const GString *s) { }
 INLINE int mqtt_publish_scope(void) { return MPS_NONE; };
 INLINE void mqtt_timer_run_media(struct call *c, struct call_media *m) { }
 INLINE void mqtt_timer_run_call(struct call *c) { }
@@ -76,6 +76,8 @@ struct recording_method {
 	void (*update_flags)(struct call *call, bool streams);
 
 	void (*dump_packet)(struct media_packet *, const str *s);
+	void (*batch_start)(void);
+	void (*batch_flush)(void);
 	void (*finish)(struct call *, bool discard);
 	void (*response)(struct recording *, bencode_item_t *);
 
@@ -139,5 +141,8 @@ void recording_finish(struct call *, bool discard);
 #define recording_meta_chunk(args...) _rm(meta_chunk, args)
 #define recording_response(args...) _rm(response, args)
 #define dump_packet(args...) _rm(dump_packet, args)
+// packets dumped by the current thread in between these two may be submitted together
+#define recording_batch_start() _rm(batch_start)
+#define recording_batch_flush() _rm(batch_flush)
 
 #endif
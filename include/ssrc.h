@@ -11,6 +11,9 @@
 
 
 
+#define SSRC_HASH_SLOTS 32 // power of two
+#define SSRC_HASH_LIMIT 20 // arbitrary, must be well below SSRC_HASH_SLOTS
+
 
 struct call;
 struct call_media;
@@ -26,13 +29,21 @@ struct stream_fd;
 typedef struct ssrc_entry *(*ssrc_create_func_t)(void *uptr);
 
 
+/*
+ * Open-addressing table with linear probing. Lookups don't take any lock: they retry if `seq`
+ * changed (or was odd) while the slots were being read, and are counted in `readers` so that
+ * entries removed from the table are only released once no lookup can still be looking at
+ * them. All modifications are done under the write lock, which also protects `q`.
+ */
 struct ssrc_hash {
-	GHashTable *ht;
-	GQueue q;
+	struct ssrc_entry *slots[SSRC_HASH_SLOTS];
+	unsigned int seq;
+	int readers;
+	GQueue q; // all entries, in LRU order (approximately), links embedded in the entries
+	GQueue retired; // removed entries waiting to be released
 	rwlock_t lock;
 	ssrc_create_func_t create_func;
 	void *uptr;
-	struct ssrc_entry *cache; // last used entry
 	struct ssrc_entry *precreat; // next used entry
 };
 struct payload_tracker {
@@ -94,7 +105,8 @@ struct ssrc_entry {
 	struct obj obj;
 	mutex_t lock;
 	uint32_t ssrc;
-	time_t last_used;
+	int used; // set on lookup, cleared when passed over for eviction
+	GList link; // in ssrc_hash q or retired
 };
 
 struct ssrc_entry_call {
@@ -223,6 +235,10 @@ struct ssrc_hash *create_ssrc_hash_full_fast(ssrc_create_func_t, void *uptr); //
 struct ssrc_hash *create_ssrc_hash_call(void);
 
 void *get_ssrc_full(uint32_t, struct ssrc_hash *, bool *created); // creates new entry if not found
+// preferred slot in ssrc_hash; multiplicative hashing as SSRCs may not be random
+INLINE unsigned int ssrc_hash_slot(uint32_t ssrc) {
+	return (ssrc * 0x9e3779b1u) >> (32 - __builtin_ctz(SSRC_HASH_SLOTS));
+}
 INLINE void *get_ssrc(uint32_t ssrc, struct ssrc_hash *ht) {
 	return get_ssrc_full(ssrc, ht, NULL);
 }
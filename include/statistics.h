@@ -99,6 +99,15 @@ struct codec_stats {
 	atomic64		packets_input[3];
 	atomic64		bytes_input[3];
 	atomic64		pcm_samples[3];
+	atomic64		cost_ns; // moving average of CPU time spent per packet
+};
+
+// one per --codec-threads worker
+struct codec_worker_stats {
+	atomic64		queued; // current queue depth
+	atomic64		jobs;
+	atomic64		wait_us; // total time spent in the queue
+	atomic64		busy_us; // total processing time
 };
 
 struct stats_metric {
@@ -130,6 +139,7 @@ extern struct timeval rtpe_started;
 
 extern mutex_t rtpe_codec_stats_lock;
 extern GHashTable *rtpe_codec_stats;
+extern struct codec_worker_stats *rtpe_codec_worker_stats;
 
 
 extern struct global_stats_gauge rtpe_stats_gauge;			// master values
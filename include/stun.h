@@ -5,10 +5,15 @@
 #include <string.h>
 #include <arpa/inet.h>
 #include <sys/types.h>
+#include <zlib.h>
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
 #include "compat.h"
 #include "call.h"
 #include "str.h"
 #include "socket.h"
+#include "ssllib.h"
 
 
 #define STUN_COOKIE 0x2112A442UL
@@ -31,6 +36,26 @@ struct stun_attrs {
 };
 
 
+// CRC-32 as used by FINGERPRINT, with the same semantics as zlib's crc32(). The ARMv8
+// CRC instructions implement this polynomial directly. (The SSE4.2 instruction
+// computes CRC-32C, which is a different polynomial, so x86 uses zlib.)
+INLINE uint32_t stun_crc32(uint32_t crc, const void *buf, size_t len) {
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+	const unsigned char *p = buf;
+	crc = ~crc;
+	for (; len >= 8; len -= 8, p += 8) {
+		uint64_t v;
+		memcpy(&v, p, sizeof(v));
+		crc = __crc32d(crc, v);
+	}
+	for (; len; len--, p++)
+		crc = __crc32b(crc, *p);
+	return ~crc;
+#else
+	return crc32(crc, buf, len);
+#endif
+}
+
 INLINE int is_stun(const str *s) {
 	const unsigned char *b = (const void *) s->s;
 	const uint32_t *u;
@@ -51,7 +76,7 @@ INLINE int is_stun(const str *s) {
 
 int stun(const str *, struct stream_fd *, const endpoint_t *);
 
-int stun_binding_request(const endpoint_t *dst, uint32_t transaction[3], str *pwd,
+int stun_binding_request(const endpoint_t *dst, uint32_t transaction[3], const struct hmac_sha1_key *,
 		str ufrags[2], int controlling, uint64_t tiebreaker, uint32_t priority,
 		socket_t *, int);
 
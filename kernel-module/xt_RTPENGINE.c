@@ -23,6 +23,20 @@
 #include <net/route.h>
 #include <net/ip6_route.h>
 #include <net/dst.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4,6,0) && IS_ENABLED(CONFIG_DST_CACHE)
+#include <net/dst_cache.h>
+#define RE_HAS_DST_CACHE 1
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,9,0) && IS_ENABLED(CONFIG_DEBUG_INFO_BTF_MODULES)
+#include <linux/bpf.h>
+#include <linux/btf.h>
+#include <linux/btf_ids.h>
+#include <linux/if_arp.h>
+#include <linux/etherdevice.h>
+#include <net/xdp.h>
+#include <net/neighbour.h>
+#define RE_HAS_XDP 1
+#endif
 #include <linux/proc_fs.h>
 #include <linux/spinlock.h>
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3,0,0)
@@ -42,6 +56,7 @@
 #endif
 
 #include "rtpengine_config.h"
+#include "rtpengine_g711.h"
 
 MODULE_LICENSE("GPL");
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(5,12,0)
@@ -263,6 +278,7 @@ static int proc_main_list_show(struct seq_file *, void *);
 static int proc_stream_open(struct inode *i, struct file *f);
 static int proc_stream_close(struct inode *i, struct file *f);
 static ssize_t proc_stream_read(struct file *f, char __user *b, size_t l, loff_t *o);
+static ssize_t proc_stream_write(struct file *f, const char __user *b, size_t l, loff_t *o);
 static unsigned int proc_stream_poll(struct file *f, struct poll_table_struct *p);
 
 static void table_put(struct rtpengine_table *);
@@ -287,6 +303,20 @@ static int srtp_decrypt_aes_gcm(struct re_crypto_context *, struct rtpengine_srt
 static int srtcp_decrypt_aes_gcm(struct re_crypto_context *, struct rtpengine_srtp *,
 		struct rtp_parsed *, uint64_t *);
 
+// Splitting off the payload costs about as much as one full copy, so it only pays off
+// if at least two outputs can share it. The last output gets the original packet.
+static bool output_share_payload(struct rtpengine_target *g, unsigned int start_idx,
+		unsigned int end_idx)
+{
+	unsigned int i, plain = 0;
+
+	for (i = start_idx; i + 1 < end_idx; i++) {
+		if (g->outputs[i].plain && ++plain >= 2)
+			return true;
+	}
+	return false;
+}
+
 static int send_proxy_packet_output(struct sk_buff *skb, struct rtpengine_target *g,
 		int rtp_pt_idx,
 		struct rtpengine_output *o, struct rtp_parsed *rtp, int ssrc_idx,
@@ -335,6 +365,27 @@ struct rtpengine_output {
 	struct re_crypto_context	encrypt_rtp;
 	struct re_crypto_context	encrypt_rtcp;
 	struct rtpengine_stats_a	stats_out;
+
+	// IP and UDP headers as far as they're constant for this output
+	union {
+		struct {
+			struct iphdr		ih;
+			struct udphdr		uh;
+		} v4;
+		struct {
+			struct ipv6hdr		ih;
+			struct udphdr		uh;
+		} v6;
+	} header;
+	// no encryption, authentication or MKI, so the payload goes out unchanged
+	bool				plain;
+#ifdef RE_HAS_DST_CACHE
+	// the route doesn't change for the life time of the output. the cache entry is
+	// invalidated when the route becomes obsolete (routing table changes,
+	// interface going down) and is then looked up again. an entry is only used for
+	// the network namespace it was looked up in, see output_route_net_ok()
+	struct dst_cache		dst_cache;
+#endif
 };
 struct rtpengine_target {
 	atomic_t			refcnt;
@@ -426,6 +477,7 @@ struct re_stream {
 	spinlock_t			packet_list_lock;
 	struct list_head		packet_list;
 	unsigned int			list_count;
+	unsigned int			dropped; /* since last batched read */
 	wait_queue_head_t		read_wq;
 	wait_queue_head_t		close_wq;
 	int				eof; /* protected by packet_list_lock */
@@ -616,6 +668,7 @@ static const struct seq_operations proc_main_list_seq_ops = {
 static const struct PROC_OP_STRUCT proc_stream_ops = {
 	PROC_OWNER
 	.PROC_READ		= proc_stream_read,
+	.PROC_WRITE		= proc_stream_write,
 	.PROC_POLL		= proc_stream_poll,
 	.PROC_OPEN		= proc_stream_open,
 	.PROC_RELEASE		= proc_stream_close,
@@ -953,6 +1006,9 @@ static void target_put(struct rtpengine_target *t) {
 		for (i = 0; i < t->target.num_destinations; i++) {
 			free_crypto_context(&t->outputs[i].encrypt_rtp);
 			free_crypto_context(&t->outputs[i].encrypt_rtcp);
+#ifdef RE_HAS_DST_CACHE
+			dst_cache_destroy(&t->outputs[i].dst_cache);
+#endif
 		}
 		kfree(t->outputs);
 	}
@@ -2593,6 +2649,45 @@ fail1:
 	return err;
 }
 
+// fills in everything that doesn't depend on the packet
+static void output_header_init(struct rtpengine_output *o) {
+	const struct rtpengine_output_info *oi = &o->output;
+
+	switch (oi->src_addr.family) {
+		case AF_INET:
+			o->header.v4.ih = (struct iphdr) {
+				.version	= 4,
+				.ihl		= 5,
+				.tos		= oi->tos,
+				.ttl		= 64,
+				.protocol	= IPPROTO_UDP,
+				.saddr		= oi->src_addr.u.ipv4,
+				.daddr		= oi->dst_addr.u.ipv4,
+			};
+			o->header.v4.uh = (struct udphdr) {
+				.source		= htons(oi->src_addr.port),
+				.dest		= htons(oi->dst_addr.port),
+			};
+			break;
+
+		case AF_INET6:
+			o->header.v6.ih = (struct ipv6hdr) {
+				.version	= 6,
+				.priority	= (oi->tos & 0xf0) >> 4,
+				.flow_lbl	= {(oi->tos & 0xf) << 4, 0, 0},
+				.nexthdr	= IPPROTO_UDP,
+				.hop_limit	= 64,
+			};
+			memcpy(&o->header.v6.ih.saddr, oi->src_addr.u.ipv6, sizeof(o->header.v6.ih.saddr));
+			memcpy(&o->header.v6.ih.daddr, oi->dst_addr.u.ipv6, sizeof(o->header.v6.ih.daddr));
+			o->header.v6.uh = (struct udphdr) {
+				.source		= htons(oi->src_addr.port),
+				.dest		= htons(oi->dst_addr.port),
+			};
+			break;
+	}
+}
+
 static int table_add_destination(struct rtpengine_table *t, struct rtpengine_destination_info *i) {
 	unsigned long flags;
 	int err;
@@ -2647,6 +2742,14 @@ static int table_add_destination(struct rtpengine_table *t, struct rtpengine_des
 	err = gen_rtp_session_keys(&g->outputs[i->num].encrypt_rtp, &i->output.encrypt);
 	if (!err)
 		err = gen_rtcp_session_keys(&g->outputs[i->num].encrypt_rtcp, &i->output.encrypt);
+	output_header_init(&g->outputs[i->num]);
+	g->outputs[i->num].plain = i->output.encrypt.cipher == REC_NULL
+		&& i->output.encrypt.hmac == REH_NULL
+		&& !i->output.encrypt.mki_len;
+#ifdef RE_HAS_DST_CACHE
+	if (!err)
+		err = dst_cache_init(&g->outputs[i->num].dst_cache, GFP_KERNEL);
+#endif
 
 	// re-acquire lock and finish up: decreasing outputs_unfillled to zero
 	// makes this usable
@@ -3240,8 +3343,10 @@ not_found:
 
 	_w_unlock(&streams.lock, flags);
 
-	/* proc_ functions may sleep, so this must be done outside of the lock */
-	pde = stream->file = proc_create_user(info->stream_name, S_IFREG | 0440, call->root,
+	/* proc_ functions may sleep, so this must be done outside of the lock.
+	 * writable by the owner only (proc_uid), which is how the recording daemon
+	 * switches the stream to batch mode. the group remains read-only */
+	pde = stream->file = proc_create_user(info->stream_name, S_IFREG | 0640, call->root,
 			&proc_stream_ops, (void *) (unsigned long) info->idx.stream_idx);
 	err = -ENOMEM;
 	if (!pde)
@@ -3364,20 +3469,143 @@ out:
 
 
 
+/* returns the packet's data and length, or 0 for an invalid packet */
+static unsigned int stream_packet_data(struct re_stream_packet *packet, unsigned char **data) {
+	if (packet->buflen) {
+		DBG("packet is from userspace, %u bytes\n", packet->buflen);
+		*data = packet->buf;
+		return packet->buflen;
+	}
+	if (packet->skbuf) {
+		DBG("packet is from kernel, %u bytes\n", packet->skbuf->len);
+		*data = packet->skbuf->data;
+		return packet->skbuf->len;
+	}
+	printk(KERN_WARNING "BUG in packet stream list buffer\n");
+	return 0;
+}
+
+static void stream_packet_csum(unsigned char *to_copy) {
+	struct udphdr *uh;
+	struct iphdr *ih;
+	struct ipv6hdr *ih6;
+	unsigned int udplen, version;
+
+	version = ((to_copy[0] & 0xF0) >> 4);
+	if (version == 4) {
+		ih = (struct iphdr *)to_copy;
+		ih->check = 0;
+		ih->check = ip_fast_csum((u8 *)ih, ih->ihl);
+		if (ih->check == 0){
+			ih->check = CSUM_MANGLED_0;
+		}
+
+		uh = (struct udphdr *)(to_copy + sizeof(struct iphdr));
+		udplen = ntohs(uh->len);
+		uh->check = 0;
+		uh->check = csum_tcpudp_magic(ih->saddr, ih->daddr, udplen, IPPROTO_UDP, csum_partial(uh, udplen, 0));
+		if (uh->check == 0){
+			uh->check = CSUM_MANGLED_0;
+		}
+	} else if (version == 6) {
+		ih6 = (struct ipv6hdr *)to_copy;
+
+		uh = (struct udphdr *)(to_copy + sizeof(struct ipv6hdr));
+		udplen = ntohs(uh->len);
+		uh->check = 0;
+		uh->check = csum_ipv6_magic(&ih6->saddr, &ih6->daddr, udplen, IPPROTO_UDP, csum_partial(uh, udplen, 0));
+		if (uh->check == 0){
+			uh->check = CSUM_MANGLED_0;
+		}
+	}
+}
+
+/* stream's packet list lock must be held, and is released */
+static ssize_t stream_read_batch(struct re_stream *stream, unsigned long flags, char __user *b, size_t l) {
+	struct rtpengine_stream_batch hdr = {0,};
+	struct rtpengine_stream_batch_packet phdr;
+	struct re_stream_packet *packet;
+	unsigned char *data;
+	unsigned int len;
+	size_t pos;
+	ssize_t ret;
+	LIST_HEAD(batch);
+
+	/* dequeue as many packets as fit, but at least one, which may be truncated */
+	pos = sizeof(hdr);
+	while (!list_empty(&stream->packet_list)) {
+		packet = list_first_entry(&stream->packet_list, struct re_stream_packet, list_entry);
+		len = packet->buflen ? packet->buflen : (packet->skbuf ? packet->skbuf->len : 0);
+		if (hdr.packets && pos + sizeof(phdr) + len > l)
+			break;
+		list_del(&packet->list_entry);
+		list_add_tail(&packet->list_entry, &batch);
+		stream->list_count--;
+		hdr.packets++;
+		pos += sizeof(phdr) + ALIGN(len, RTPE_STREAM_BATCH_ALIGN);
+	}
+	hdr.dropped = stream->dropped;
+	stream->dropped = 0;
+
+	spin_unlock_irqrestore(&stream->packet_list_lock, flags);
+
+	DBG("reading batch of %u packets\n", hdr.packets);
+
+	ret = 0;
+	hdr.packets = 0;
+	pos = sizeof(hdr);
+
+	while (!list_empty(&batch)) {
+		packet = list_first_entry(&batch, struct re_stream_packet, list_entry);
+		list_del(&packet->list_entry);
+
+		len = stream_packet_data(packet, &data);
+		if (!len || ret)
+			goto next;
+
+		stream_packet_csum(data);
+
+		phdr.orig_len = len;
+		if (len > l - pos - sizeof(phdr))
+			len = l - pos - sizeof(phdr);
+		phdr.len = len;
+
+		if (copy_to_user(b + pos, &phdr, sizeof(phdr))
+				|| copy_to_user(b + pos + sizeof(phdr), data, len))
+			ret = -EFAULT;
+
+		hdr.packets++;
+		pos += sizeof(phdr) + ALIGN(len, RTPE_STREAM_BATCH_ALIGN);
+next:
+		free_packet(packet);
+	}
+
+	if (ret)
+		return ret;
+
+	if (copy_to_user(b, &hdr, sizeof(hdr)))
+		return -EFAULT;
+
+	if (pos > l)
+		pos = l;
+	return pos;
+}
+
 static ssize_t proc_stream_read(struct file *f, char __user *b, size_t l, loff_t *o) {
 	unsigned int stream_idx = (unsigned int) (unsigned long) PDE_DATA(f->f_path.dentry->d_inode);
 	struct re_stream *stream;
 	unsigned long flags;
 	struct re_stream_packet *packet;
 	ssize_t ret;
-	const char *to_copy;
-	struct udphdr *uh;
-	struct iphdr *ih;
-	struct ipv6hdr *ih6;
-	unsigned int udplen, version;
+	unsigned char *to_copy;
+	int batch = ((unsigned long) f->private_data == RE_STREAM_MODE_BATCH);
 
 	DBG("entering proc_stream_read()\n");
 
+	if (batch && l < sizeof(struct rtpengine_stream_batch)
+			+ sizeof(struct rtpengine_stream_batch_packet))
+		return -EINVAL;
+
 	stream = get_stream_lock(NULL, stream_idx);
 	if (!stream)
 		return -EINVAL;
@@ -3406,6 +3634,11 @@ static ssize_t proc_stream_read(struct file *f, char __user *b, size_t l, loff_t
 		goto out;
 	}
 
+	if (batch) {
+		ret = stream_read_batch(stream, flags, b, l);
+		goto out;
+	}
+
 	DBG("removing packet from queue, reading %i bytes\n", (int) l);
 	packet = list_first_entry(&stream->packet_list, struct re_stream_packet, list_entry);
 	list_del(&packet->list_entry);
@@ -3413,18 +3646,8 @@ static ssize_t proc_stream_read(struct file *f, char __user *b, size_t l, loff_t
 
 	spin_unlock_irqrestore(&stream->packet_list_lock, flags);
 
-	if (packet->buflen) {
-		ret = packet->buflen;
-		to_copy = packet->buf;
-		DBG("packet is from userspace, %i bytes\n", (int) ret);
-	}
-	else if (packet->skbuf) {
-		ret = packet->skbuf->len;
-		to_copy = packet->skbuf->data;
-		DBG("packet is from kernel, %i bytes\n", (int) ret);
-	}
-	else {
-		printk(KERN_WARNING "BUG in packet stream list buffer\n");
+	ret = stream_packet_data(packet, &to_copy);
+	if (!ret) {
 		ret = -ENXIO;
 		goto err;
 	}
@@ -3432,33 +3655,7 @@ static ssize_t proc_stream_read(struct file *f, char __user *b, size_t l, loff_t
 	if (ret > l)
 		ret = l;
 
-	version = ((to_copy[0] & 0xF0) >> 4);
-	if (version == 4) {
-		ih = (struct iphdr *)to_copy;
-		ih->check = 0;
-		ih->check = ip_fast_csum((u8 *)ih, ih->ihl);
-		if (ih->check == 0){
-			ih->check = CSUM_MANGLED_0;
-		}
-
-		uh = (struct udphdr *)(to_copy + sizeof(struct iphdr));
-		udplen = ntohs(uh->len);
-		uh->check = 0;
-		uh->check = csum_tcpudp_magic(ih->saddr, ih->daddr, udplen, IPPROTO_UDP, csum_partial(uh, udplen, 0));
-		if (uh->check == 0){
-			uh->check = CSUM_MANGLED_0;
-		}
-	} else if (version == 6) {
-		ih6 = (struct ipv6hdr *)to_copy;
-
-		uh = (struct udphdr *)(to_copy + sizeof(struct ipv6hdr));
-		udplen = ntohs(uh->len);
-		uh->check = 0;
-		uh->check = csum_ipv6_magic(&ih6->saddr, &ih6->daddr, udplen, IPPROTO_UDP, csum_partial(uh, udplen, 0));
-		if (uh->check == 0){
-			uh->check = CSUM_MANGLED_0;
-		}
-	}
+	stream_packet_csum(to_copy);
 
 	if (copy_to_user(b, to_copy, ret))
 		ret = -EFAULT;
@@ -3470,6 +3667,23 @@ out:
 	stream_put(stream);
 	return ret;
 }
+static ssize_t proc_stream_write(struct file *f, const char __user *b, size_t l, loff_t *o) {
+	struct rtpengine_stream_mode_info info;
+
+	DBG("entering proc_stream_write()\n");
+
+	if (l != sizeof(info))
+		return -EIO;
+	if (copy_from_user(&info, b, sizeof(info)))
+		return -EFAULT;
+	if (info.mode >= __RE_STREAM_MODE_LAST)
+		return -EINVAL;
+
+	/* the mode is per open file */
+	f->private_data = (void *) (unsigned long) info.mode;
+
+	return l;
+}
 static unsigned int proc_stream_poll(struct file *f, struct poll_table_struct *p) {
 	unsigned int stream_idx = (unsigned int) (unsigned long) PDE_DATA(f->f_path.dentry->d_inode);
 	struct re_stream *stream;
@@ -3574,6 +3788,7 @@ static void add_stream_packet(struct re_stream *stream, struct re_stream_packet
 		list_del(&packet->list_entry);
 		list_add(&packet->list_entry, &delete_list);
 		stream->list_count--;
+		stream->dropped++;
 	}
 
 	spin_unlock_irqrestore(&stream->packet_list_lock, flags);
@@ -3597,44 +3812,86 @@ err:
 	return;
 }
 
+/* copies the data into a new packet and appends it to the stream */
+static int stream_add_data(struct re_stream *stream, const unsigned char *data, size_t len) {
+	struct re_stream_packet *packet;
+
+	DBG("data for stream %s\n", stream->info.stream_name);
+
+	packet = kmalloc(sizeof(*packet) + len, GFP_KERNEL);
+	if (!packet)
+		return -ENOMEM;
+	memset(packet, 0, sizeof(*packet));
+
+	memcpy(packet->buf, data, len);
+	packet->buflen = len;
+
+	add_stream_packet(stream, packet);
+
+	return 0;
+}
+
 static int stream_packet(struct rtpengine_table *t, const struct rtpengine_packet_info *info, size_t len) {
 	struct re_stream *stream;
 	int err;
-	struct re_stream_packet *packet;
-	const char *data = info->data;
 
 	if (!len) /* can't have empty packets */
 		return -EINVAL;
 
 	DBG("received %zu bytes of data from userspace\n", len);
 
-	err = -ENOENT;
 	stream = get_stream_lock(NULL, info->stream_idx);
 	if (!stream)
-		goto out;
+		return -ENOENT;
 
-	DBG("data for stream %s\n", stream->info.stream_name);
+	err = stream_add_data(stream, info->data, len);
 
-	/* alloc and copy */
+	stream_put(stream);
+	return err;
+}
 
-	err = -ENOMEM;
-	packet = kmalloc(sizeof(*packet) + len, GFP_KERNEL);
-	if (!packet)
-		goto out2;
-	memset(packet, 0, sizeof(*packet));
+static int stream_packets(struct rtpengine_table *t, const struct rtpengine_packets_info *info, size_t len) {
+	const unsigned char *p = info->data;
+	const struct rtpengine_packets_entry *ent;
+	struct re_stream *stream = NULL;
+	unsigned int i;
+	size_t rec_len;
+	int err = 0;
 
-	memcpy(packet->buf, data, len);
-	packet->buflen = len;
+	DBG("received %u packets in %zu bytes from userspace\n", info->num, len);
 
-	/* append */
-	add_stream_packet(stream, packet);
+	for (i = 0; i < info->num; i++) {
+		err = -EINVAL;
+		if (len < sizeof(*ent))
+			break;
+		ent = (const void *) p;
+		if (!ent->len || ent->len > len - sizeof(*ent))
+			break;
 
-	err = 0;
-	goto out2;
+		/* consecutive packets usually go to the same stream */
+		if (!stream || stream->info.idx.stream_idx != ent->stream_idx) {
+			if (stream)
+				stream_put(stream);
+			stream = get_stream_lock(NULL, ent->stream_idx);
+		}
+
+		/* streams may disappear while packets are in flight. skip those. */
+		err = 0;
+		if (stream)
+			err = stream_add_data(stream, ent->data, ent->len);
+		if (err)
+			break;
+
+		rec_len = sizeof(*ent) + ALIGN(ent->len, RTPE_STREAM_BATCH_ALIGN);
+		if (rec_len > len)
+			rec_len = len;
+		p += rec_len;
+		len -= rec_len;
+	}
+
+	if (stream)
+		stream_put(stream);
 
-out2:
-	stream_put(stream);
-out:
 	return err;
 }
 
@@ -3749,7 +4006,7 @@ static const size_t min_req_sizes[__REMG_LAST] = {
 	[REMG_GET_STATS]	= sizeof(struct rtpengine_command_stats),
 	[REMG_GET_RESET_STATS]	= sizeof(struct rtpengine_command_stats),
 	[REMG_SEND_RTCP]	= sizeof(struct rtpengine_command_send_packet),
-
+	[REMG_PACKETS]		= sizeof(struct rtpengine_command_packets),
 };
 static const size_t max_req_sizes[__REMG_LAST] = {
 	[REMG_NOOP]		= sizeof(struct rtpengine_command_noop),
@@ -3765,6 +4022,7 @@ static const size_t max_req_sizes[__REMG_LAST] = {
 	[REMG_GET_STATS]	= sizeof(struct rtpengine_command_stats),
 	[REMG_GET_RESET_STATS]	= sizeof(struct rtpengine_command_stats),
 	[REMG_SEND_RTCP]	= sizeof(struct rtpengine_command_send_packet) + 65535,
+	[REMG_PACKETS]		= sizeof(struct rtpengine_command_packets) + RTPE_MAX_PACKETS_LEN,
 };
 static const size_t input_req_sizes[__REMG_LAST] = {
 	[REMG_GET_STATS]	= sizeof(struct rtpengine_command_stats) - sizeof(struct rtpengine_stats_info),
@@ -3796,6 +4054,7 @@ static inline ssize_t proc_control_read_write(struct file *file, char __user *ub
 		struct rtpengine_command_add_stream *add_stream;
 		struct rtpengine_command_del_stream *del_stream;
 		struct rtpengine_command_packet *packet;
+		struct rtpengine_command_packets *packets;
 		struct rtpengine_command_stats *stats;
 		struct rtpengine_command_send_packet *send_packet;
 
@@ -3921,6 +4180,10 @@ static inline ssize_t proc_control_read_write(struct file *file, char __user *ub
 			err = stream_packet(t, &msg.packet->packet, buflen - sizeof(*msg.packet));
 			break;
 
+		case REMG_PACKETS:
+			err = stream_packets(t, &msg.packets->packets, buflen - sizeof(*msg.packets));
+			break;
+
 		case REMG_SEND_RTCP:
 			err = table_send_rtcp(t, &msg.send_packet->send_packet, buflen - sizeof(*msg.send_packet));
 			break;
@@ -3966,15 +4229,66 @@ static ssize_t proc_control_read(struct file *file, char __user *ubuf, size_t bu
 
 
 
+// the payload of outputs sharing it sits in a page fragment
+static __wsum udp_csum_partial(struct sk_buff *skb, unsigned int len) {
+	if (!skb_is_nonlinear(skb))
+		return csum_partial(skb_transport_header(skb), len, 0);
+	return skb_checksum(skb, skb_transport_offset(skb), len, 0);
+}
+
+#ifdef RE_HAS_DST_CACHE
+// the same output can be used from different network namespaces (e.g. the XDP path
+// and the iptables target). a cached route from another namespace is released and
+// replaced by a fresh lookup
+static bool output_route_net_ok(struct dst_entry *dst_entry, struct net *net) {
+	if (dst_entry->dev && net_eq(dev_net(dst_entry->dev), net))
+		return true;
+	dst_release(dst_entry);
+	return false;
+}
+#endif
+
+// returns a held reference, or NULL if there's no route
+static struct rtable *output_route4(struct rtpengine_output *o, struct net *net) {
+	const struct re_address *src = &o->output.src_addr, *dst = &o->output.dst_addr;
+	struct rtable *rt = NULL;
+
+#ifdef RE_HAS_DST_CACHE
+	{
+		__be32 saddr;
+		local_bh_disable();
+		rt = dst_cache_get_ip4(&o->dst_cache, &saddr);
+		local_bh_enable();
+		if (rt && output_route_net_ok(&rt->dst, net))
+			return rt;
+	}
+#endif
+
+	rt = ip_route_output(net, dst->u.ipv4, src->u.ipv4, o->output.tos, 0);
+	if (IS_ERR(rt))
+		return NULL;
+	if (rt->dst.error) {
+		ip_rt_put(rt);
+		return NULL;
+	}
+#ifdef RE_HAS_DST_CACHE
+	local_bh_disable();
+	dst_cache_set_ip4(&o->dst_cache, &rt->dst, src->u.ipv4);
+	local_bh_enable();
+#endif
+	return rt;
+}
+
 // par can be NULL
-static int send_proxy_packet4(struct sk_buff *skb, struct re_address *src, struct re_address *dst,
-		unsigned char tos, const struct xt_action_param *par)
+static int send_proxy_packet4(struct sk_buff *skb, struct rtpengine_output *o,
+		const struct xt_action_param *par)
 {
 	struct iphdr *ih;
 	struct udphdr *uh;
 	unsigned int datalen;
 	struct net *net;
 	struct rtable *rt;
+	const struct re_address *src = &o->output.src_addr, *dst = &o->output.dst_addr;
 
 	datalen = skb->len;
 
@@ -3986,25 +4300,14 @@ static int send_proxy_packet4(struct sk_buff *skb, struct re_address *src, struc
 	DBG("datalen=%u network_header=%p transport_header=%p\n", datalen, skb_network_header(skb), skb_transport_header(skb));
 
 	datalen += sizeof(*uh);
-	*uh = (struct udphdr) {
-		.source		= htons(src->port),
-		.dest		= htons(dst->port),
-		.len		= htons(datalen),
-	};
-	*ih = (struct iphdr) {
-		.version	= 4,
-		.ihl		= 5,
-		.tos		= tos,
-		.tot_len	= htons(sizeof(*ih) + datalen),
-		.ttl		= 64,
-		.protocol	= IPPROTO_UDP,
-		.saddr		= src->u.ipv4,
-		.daddr		= dst->u.ipv4,
-	};
+	// IP and UDP header, contiguous
+	memcpy(ih, &o->header.v4, sizeof(o->header.v4));
+	uh->len = htons(datalen);
+	ih->tot_len = htons(sizeof(*ih) + datalen);
 
 	skb->csum_start = skb_transport_header(skb) - skb->head;
 	skb->csum_offset = offsetof(struct udphdr, check);
-	uh->check = csum_tcpudp_magic(src->u.ipv4, dst->u.ipv4, datalen, IPPROTO_UDP, csum_partial(uh, datalen, 0));
+	uh->check = csum_tcpudp_magic(src->u.ipv4, dst->u.ipv4, datalen, IPPROTO_UDP, udp_csum_partial(skb, datalen));
 	if (uh->check == 0)
 		uh->check = CSUM_MANGLED_0;
 	skb->protocol = htons(ETH_P_IP);
@@ -4017,15 +4320,12 @@ static int send_proxy_packet4(struct sk_buff *skb, struct re_address *src, struc
 	if (!net)
 		goto drop;
 
-	rt = ip_route_output(net, dst->u.ipv4, src->u.ipv4, tos, 0);
-	if (IS_ERR(rt))
+	rt = output_route4(o, net);
+	if (!rt)
 		goto drop;
 	skb_dst_drop(skb);
 	skb_dst_set(skb, &rt->dst);
 
-	if (skb_dst(skb)->error)
-		goto drop;
-
 	skb->ip_summed = CHECKSUM_NONE;
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4,4,0)
@@ -4069,16 +4369,52 @@ drop:
 
 
 
+// returns a held reference, or NULL if there's no route
+static struct dst_entry *output_route6(struct rtpengine_output *o, struct net *net, uint32_t mark) {
+	const struct re_address *src = &o->output.src_addr, *dst = &o->output.dst_addr;
+	struct dst_entry *dst_entry = NULL;
+	struct flowi6 fl6;
+
+#ifdef RE_HAS_DST_CACHE
+	{
+		struct in6_addr saddr;
+		local_bh_disable();
+		dst_entry = dst_cache_get_ip6(&o->dst_cache, &saddr);
+		local_bh_enable();
+		if (dst_entry && output_route_net_ok(dst_entry, net))
+			return dst_entry;
+	}
+#endif
+
+	memset(&fl6, 0, sizeof(fl6));
+	memcpy(&fl6.saddr, src->u.ipv6, sizeof(fl6.saddr));
+	memcpy(&fl6.daddr, dst->u.ipv6, sizeof(fl6.daddr));
+	fl6.flowi6_mark = mark;
+
+	dst_entry = ip6_route_output(net, NULL, &fl6);
+	if (!dst_entry)
+		return NULL;
+	if (dst_entry->error) {
+		dst_release(dst_entry);
+		return NULL;
+	}
+#ifdef RE_HAS_DST_CACHE
+	local_bh_disable();
+	dst_cache_set_ip6(&o->dst_cache, dst_entry, &fl6.saddr);
+	local_bh_enable();
+#endif
+	return dst_entry;
+}
+
 // par can be NULL
-static int send_proxy_packet6(struct sk_buff *skb, struct re_address *src, struct re_address *dst,
-		unsigned char tos, const struct xt_action_param *par)
+static int send_proxy_packet6(struct sk_buff *skb, struct rtpengine_output *o,
+		const struct xt_action_param *par)
 {
 	struct ipv6hdr *ih;
 	struct udphdr *uh;
 	unsigned int datalen;
 	struct net *net;
 	struct dst_entry *dst_entry;
-	struct flowi6 fl6;
 
 	datalen = skb->len;
 
@@ -4090,25 +4426,14 @@ static int send_proxy_packet6(struct sk_buff *skb, struct re_address *src, struc
 	DBG("datalen=%u network_header=%p transport_header=%p\n", datalen, skb_network_header(skb), skb_transport_header(skb));
 
 	datalen += sizeof(*uh);
-	*uh = (struct udphdr) {
-		.source		= htons(src->port),
-		.dest		= htons(dst->port),
-		.len		= htons(datalen),
-	};
-	*ih = (struct ipv6hdr) {
-		.version	= 6,
-		.priority	= (tos & 0xf0) >> 4,
-		.flow_lbl	= {(tos & 0xf) << 4, 0, 0},
-		.payload_len	= htons(datalen),
-		.nexthdr	= IPPROTO_UDP,
-		.hop_limit	= 64,
-	};
-	memcpy(&ih->saddr, src->u.ipv6, sizeof(ih->saddr));
-	memcpy(&ih->daddr, dst->u.ipv6, sizeof(ih->daddr));
+	// IP and UDP header, contiguous
+	memcpy(ih, &o->header.v6, sizeof(o->header.v6));
+	uh->len = htons(datalen);
+	ih->payload_len = htons(datalen);
 
 	skb->csum_start = skb_transport_header(skb) - skb->head;
 	skb->csum_offset = offsetof(struct udphdr, check);
-	uh->check = csum_ipv6_magic(&ih->saddr, &ih->daddr, datalen, IPPROTO_UDP, csum_partial(uh, datalen, 0));
+	uh->check = csum_ipv6_magic(&ih->saddr, &ih->daddr, datalen, IPPROTO_UDP, udp_csum_partial(skb, datalen));
 	if (uh->check == 0)
 		uh->check = CSUM_MANGLED_0;
 	skb->protocol = htons(ETH_P_IPV6);
@@ -4121,18 +4446,9 @@ static int send_proxy_packet6(struct sk_buff *skb, struct re_address *src, struc
 	if (!net)
 		goto drop;
 
-	memset(&fl6, 0, sizeof(fl6));
-	memcpy(&fl6.saddr, src->u.ipv6, sizeof(fl6.saddr));
-	memcpy(&fl6.daddr, dst->u.ipv6, sizeof(fl6.daddr));
-	fl6.flowi6_mark = skb->mark;
-
-	dst_entry = ip6_route_output(net, NULL, &fl6);
+	dst_entry = output_route6(o, net, skb->mark);
 	if (!dst_entry)
 		goto drop;
-	if (dst_entry->error) {
-		dst_release(dst_entry);
-		goto drop;
-	}
 	skb_dst_drop(skb);
 	skb_dst_set(skb, dst_entry);
 
@@ -4155,21 +4471,21 @@ drop:
 
 
 
-static int send_proxy_packet(struct sk_buff *skb, struct re_address *src, struct re_address *dst,
-		unsigned char tos, const struct xt_action_param *par)
+static int send_proxy_packet(struct sk_buff *skb, struct rtpengine_output *o,
+		const struct xt_action_param *par)
 {
-	if (src->family != dst->family) {
+	if (o->output.src_addr.family != o->output.dst_addr.family) {
 		log_err("address family mismatch");
 		goto drop;
 	}
 
-	switch (src->family) {
+	switch (o->output.src_addr.family) {
 		case AF_INET:
-			return send_proxy_packet4(skb, src, dst, tos, par);
+			return send_proxy_packet4(skb, o, par);
 			break;
 
 		case AF_INET6:
-			return send_proxy_packet6(skb, src, dst, tos, par);
+			return send_proxy_packet6(skb, o, par);
 			break;
 
 		default:
@@ -4188,23 +4504,23 @@ drop:
 
 
 /* XXX shared code */
-static void parse_rtp(struct rtp_parsed *rtp, struct sk_buff *skb) {
+static void __parse_rtp(struct rtp_parsed *rtp, unsigned char *data, unsigned int len) {
 	struct rtp_extension *ext;
 	int ext_len;
 
-	if (skb->len < sizeof(*rtp->rtp_header))
+	if (len < sizeof(*rtp->rtp_header))
 		goto error;
-	rtp->rtp_header = (void *) skb->data;
+	rtp->rtp_header = (void *) data;
 	if ((rtp->rtp_header->v_p_x_cc & 0xc0) != 0x80) /* version 2 */
 		goto error;
 	rtp->header_len = sizeof(*rtp->rtp_header);
 
 	/* csrc list */
 	rtp->header_len += (rtp->rtp_header->v_p_x_cc & 0xf) * 4;
-	if (skb->len < rtp->header_len)
+	if (len < rtp->header_len)
 		goto error;
-	rtp->payload = skb->data + rtp->header_len;
-	rtp->payload_len = skb->len - rtp->header_len;
+	rtp->payload = data + rtp->header_len;
+	rtp->payload_len = len - rtp->header_len;
 
 	if ((rtp->rtp_header->v_p_x_cc & 0x10)) {
 		/* extension */
@@ -4227,6 +4543,9 @@ static void parse_rtp(struct rtp_parsed *rtp, struct sk_buff *skb) {
 error:
 	rtp->ok = 0;
 }
+static void parse_rtp(struct rtp_parsed *rtp, struct sk_buff *skb) {
+	__parse_rtp(rtp, skb->data, skb->len);
+}
 
 /* XXX shared code */
 static uint64_t rtp_packet_index(struct re_crypto_context *c,
@@ -5132,22 +5451,36 @@ static void proxy_packet_output_rtcp(struct sk_buff *skb, struct rtpengine_outpu
 	pllen = rtp->payload_len;
 	srtcp_encrypt(&o->encrypt_rtcp, &o->output.encrypt, rtp, pkt_idx);
 	srtcp_authenticate(&o->encrypt_rtcp, &o->output.encrypt, rtp, pkt_idx);
-	skb_put(skb, rtp->payload_len - pllen);
+	if (rtp->payload_len != pllen)
+		skb_put(skb, rtp->payload_len - pllen);
 }
 
-static bool proxy_packet_output_rtXp(struct sk_buff *skb, struct rtpengine_output *o,
-		int rtp_pt_idx,
+static void g711_transcode(struct rtp_parsed *rtp, const struct rtpengine_pt_output *pto) {
+	const unsigned char *table;
+	unsigned int i;
+
+	switch (pto->transcode) {
+		case RTPE_PT_ALAW_TO_ULAW:
+			table = g711_alaw_to_ulaw;
+			break;
+		case RTPE_PT_ULAW_TO_ALAW:
+			table = g711_ulaw_to_alaw;
+			break;
+		default:
+			return;
+	}
+
+	for (i = 0; i < rtp->payload_len; i++)
+		rtp->payload[i] = table[rtp->payload[i]];
+	rtp->rtp_header->m_pt = (rtp->rtp_header->m_pt & 0x80) | (pto->pt_num & 0x7f);
+}
+
+// everything done to an RTP packet before encryption. doesn't change the length
+static bool proxy_packet_rtp_rewrite(struct rtpengine_output *o, int rtp_pt_idx,
 		struct rtp_parsed *rtp, int ssrc_idx)
 {
-	unsigned int pllen;
-	uint64_t pkt_idx;
 	int i;
 
-	if (!rtp->ok) {
-		proxy_packet_output_rtcp(skb, o, rtp, ssrc_idx);
-		return true;
-	}
-
 	// pattern rewriting
 	if (rtp_pt_idx >= 0) {
 		if (o->output.pt_output[rtp_pt_idx].min_payload_len
@@ -5166,6 +5499,8 @@ static bool proxy_packet_output_rtXp(struct sk_buff *skb, struct rtpengine_outpu
 							o->output.pt_output[rtp_pt_idx].replace_pattern_len);
 			}
 		}
+
+		g711_transcode(rtp, &o->output.pt_output[rtp_pt_idx]);
 	}
 
 	// SSRC substitution and seq manipulation
@@ -5176,16 +5511,101 @@ static bool proxy_packet_output_rtXp(struct sk_buff *skb, struct rtpengine_outpu
 			rtp->rtp_header->ssrc = o->output.ssrc_out[ssrc_idx];
 	}
 
+	return true;
+}
+
+static bool proxy_packet_output_rtXp(struct sk_buff *skb, struct rtpengine_output *o,
+		int rtp_pt_idx,
+		struct rtp_parsed *rtp, int ssrc_idx)
+{
+	unsigned int pllen;
+	uint64_t pkt_idx;
+
+	if (!rtp->ok) {
+		proxy_packet_output_rtcp(skb, o, rtp, ssrc_idx);
+		return true;
+	}
+
+	if (!proxy_packet_rtp_rewrite(o, rtp_pt_idx, rtp, ssrc_idx))
+		return false;
+
 	// SRTP
 	pkt_idx = rtp_packet_index(&o->encrypt_rtp, &o->output.encrypt, rtp->rtp_header, ssrc_idx);
 	pllen = rtp->payload_len;
 	srtp_encrypt(&o->encrypt_rtp, &o->output.encrypt, rtp, pkt_idx);
 	srtp_authenticate(&o->encrypt_rtp, &o->output.encrypt, rtp, pkt_idx);
-	skb_put(skb, rtp->payload_len - pllen);
+	if (rtp->payload_len != pllen)
+		skb_put(skb, rtp->payload_len - pllen);
 
 	return true;
 }
 
+// Builds a copy of the packet with only the RTP/RTCP header in the linear data and the
+// payload in a page fragment. Copies made from it with pskb_copy() then duplicate only
+// the header, which is all that plain outputs modify, and share the payload.
+static struct sk_buff *skb_split_payload(struct sk_buff *skb, const struct rtp_parsed *rtp) {
+	unsigned int hlen, plen;
+	struct sk_buff *ret;
+	struct page *page;
+
+	if (!rtp->payload || rtp->payload < skb->data || rtp->payload > skb->data + skb->len)
+		return NULL;
+	hlen = rtp->payload - skb->data;
+	plen = skb->len - hlen;
+	if (!plen || plen > PAGE_SIZE)
+		return NULL;
+
+	ret = alloc_skb(MAX_HEADER + hlen, GFP_ATOMIC);
+	if (!ret)
+		return NULL;
+	page = alloc_page(GFP_ATOMIC);
+	if (!page) {
+		kfree_skb(ret);
+		return NULL;
+	}
+
+	skb_reserve(ret, MAX_HEADER);
+	memcpy(skb_put(ret, hlen), skb->data, hlen);
+	memcpy(page_address(page), rtp->payload, plen);
+	skb_fill_page_desc(ret, 0, page, 0, plen);
+	ret->len += plen;
+	ret->data_len += plen;
+	ret->truesize += PAGE_SIZE;
+	ret->mark = skb->mark;
+
+	return ret;
+}
+
+// Returns a header-only copy for outputs which leave the payload alone, or NULL if the
+// packet must be copied in full. `shared` holds the split packet across outputs.
+static struct sk_buff *output_header_copy(struct rtpengine_output *o, int rtp_pt_idx,
+		struct sk_buff *skb, const struct rtp_parsed *rtp, struct rtp_parsed *rtp2,
+		struct sk_buff **shared)
+{
+	struct sk_buff *ret;
+
+	if (!o->plain)
+		return NULL;
+	if (rtp->ok && rtp_pt_idx >= 0 && (o->output.pt_output[rtp_pt_idx].replace_pattern_len
+				|| o->output.pt_output[rtp_pt_idx].transcode))
+		return NULL;
+
+	if (!*shared)
+		*shared = skb_split_payload(skb, rtp);
+	if (!*shared)
+		return NULL;
+	ret = pskb_copy(*shared, GFP_ATOMIC);
+	if (!ret)
+		return NULL;
+
+	if (rtp->rtp_header)
+		rtp2->rtp_header = (void *) (ret->data + ((unsigned char *) rtp->rtp_header - skb->data));
+	// only read from here on
+	rtp2->payload = skb_frag_address(&skb_shinfo(ret)->frags[0]);
+
+	return ret;
+}
+
 static int send_proxy_packet_output(struct sk_buff *skb, struct rtpengine_target *g,
 		int rtp_pt_idx,
 		struct rtpengine_output *o, struct rtp_parsed *rtp, int ssrc_idx,
@@ -5194,7 +5614,7 @@ static int send_proxy_packet_output(struct sk_buff *skb, struct rtpengine_target
 	bool send_or_not = proxy_packet_output_rtXp(skb, o, rtp_pt_idx, rtp, ssrc_idx);
 	if (!send_or_not)
 		return 0;
-	return send_proxy_packet(skb, &o->output.src_addr, &o->output.dst_addr, o->output.tos, par);
+	return send_proxy_packet(skb, o, par);
 }
 
 
@@ -5296,7 +5716,7 @@ static unsigned int rtpengine46(struct sk_buff *skb, struct sk_buff *oskb,
 {
 	struct udphdr *uh;
 	struct rtpengine_target *g;
-	struct sk_buff *skb2;
+	struct sk_buff *skb2, *shared = NULL;
 	int err;
 	int error_nf_action = XT_CONTINUE;
 	int nf_action = NF_DROP;
@@ -5312,6 +5732,7 @@ static unsigned int rtpengine46(struct sk_buff *skb, struct sk_buff *oskb,
 	unsigned long flags;
 	unsigned int i;
 	unsigned int start_idx, end_idx;
+	bool share;
 	enum {NOT_RTCP = 0, RTCP, RTCP_FORWARD} is_rtcp;
 
 #if (RE_HAS_MEASUREDELAY)
@@ -5489,15 +5910,19 @@ static unsigned int rtpengine46(struct sk_buff *skb, struct sk_buff *oskb,
 	if (start_idx == end_idx)
 		goto out; // pass to userspace
 
+	share = output_share_payload(g, start_idx, end_idx);
+
 	for (i = start_idx; i < end_idx; i++) {
 		struct rtpengine_output *o = &g->outputs[i];
 		DBG("output src " MIPF " -> dst " MIPF "\n", MIPP(o->output.src_addr), MIPP(o->output.dst_addr));
+		rtp2 = rtp;
 		// do we need a copy?
 		if (i == (end_idx - 1)) {
 			skb2 = skb; // last iteration - use original
 			skb = NULL;
-			offset = 0;
 		}
+		else if (share && (skb2 = output_header_copy(o, rtp_pt_idx, skb, &rtp, &rtp2, &shared)))
+			; // payload shared with other outputs
 		else {
 			// make copy
 			skb2 = skb_copy_expand(skb, MAX_HEADER, MAX_SKB_TAIL_ROOM, GFP_ATOMIC);
@@ -5507,12 +5932,11 @@ static unsigned int rtpengine46(struct sk_buff *skb, struct sk_buff *oskb,
 				continue;
 			}
 			offset = skb2->data - skb->data;
+			// adjust RTP pointers
+			if (rtp.rtp_header)
+				rtp2.rtp_header = (void *) (((char *) rtp2.rtp_header) + offset);
+			rtp2.payload = (void *) (((char *) rtp2.payload) + offset);
 		}
-		// adjust RTP pointers
-		rtp2 = rtp;
-		if (rtp.rtp_header)
-			rtp2.rtp_header = (void *) (((char *) rtp2.rtp_header) + offset);
-		rtp2.payload = (void *) (((char *) rtp2.payload) + offset);
 
 		datalen_out = skb2->len;
 
@@ -5526,6 +5950,8 @@ static unsigned int rtpengine46(struct sk_buff *skb, struct sk_buff *oskb,
 			atomic64_add(datalen_out, &o->stats_out.bytes);
 		}
 	}
+	if (shared)
+		kfree_skb(shared);
 
 do_stats:
 	if (atomic64_read(&g->stats_in.packets)==0)
@@ -5674,6 +6100,247 @@ skip:
 
 
 
+#ifdef RE_HAS_XDP
+
+// Link layer rewrite for an XDP redirect. Fails if the route doesn't lead out of an
+// Ethernet device or the next hop isn't resolved yet, in which case the packet takes
+// the regular path, which also gets the neighbour resolved.
+static struct net_device *xdp_output_dev(struct dst_entry *dst_entry, const void *daddr,
+		struct ethhdr *eh)
+{
+	struct net_device *dev = dst_entry->dev;
+	struct neighbour *n;
+	bool ok = false;
+
+	if (!dev || dev->type != ARPHRD_ETHER || (dev->flags & IFF_LOOPBACK) || !(dev->flags & IFF_UP))
+		return NULL;
+
+	n = dst_neigh_lookup(dst_entry, daddr);
+	if (!n)
+		return NULL;
+	if ((READ_ONCE(n->nud_state) & NUD_VALID)) {
+		neigh_ha_snapshot(eh->h_dest, n, dev);
+		ether_addr_copy(eh->h_source, dev->dev_addr);
+		ok = true;
+	}
+	neigh_release(n);
+
+	return ok ? dev : NULL;
+}
+
+__bpf_kfunc_start_defs();
+
+// Fast path for the XDP program in xt_RTPENGINE_xdp.bpf.c. Looks up the packet in the
+// same table the netfilter target uses, and if it's plain RTP going to a single plain
+// output of the same address family, rewrites it in place. Anything that needs more
+// than that is left alone and handled by the netfilter target as usual.
+// Returns the interface index to redirect to, 0 to pass the packet on to the stack,
+// or -1 to drop it.
+__bpf_kfunc int bpf_rtpengine_xdp(struct xdp_md *ctx, u32 table_id) {
+	struct xdp_buff *xdp = (struct xdp_buff *) ctx;
+	unsigned char *data = xdp->data, *data_end = xdp->data_end;
+	struct net_device *in_dev = xdp->rxq->dev;
+	struct ethhdr *eh;
+	struct iphdr *ih4 = NULL;
+	struct ipv6hdr *ih6 = NULL;
+	struct udphdr *uh;
+	struct re_address src, dst;
+	uint8_t in_tos;
+	struct rtpengine_table *t;
+	struct rtpengine_target *g;
+	struct rtpengine_output *o;
+	struct rtp_parsed rtp;
+	struct dst_entry *dst_entry = NULL;
+	struct net_device *dev;
+	unsigned long flags;
+	unsigned int datalen;
+	int rtp_pt_idx, ssrc_idx;
+	int ret = 0;
+
+	eh = (void *) data;
+	if (data + sizeof(*eh) > data_end)
+		return 0;
+
+	memset(&src, 0, sizeof(src));
+	memset(&dst, 0, sizeof(dst));
+
+	switch (eh->h_proto) {
+		case htons(ETH_P_IP):
+			ih4 = (void *) (eh + 1);
+			uh = (void *) (ih4 + 1);
+			if ((unsigned char *) (uh + 1) > data_end)
+				return 0;
+			if (ih4->version != 4 || ih4->ihl != 5 || ih4->protocol != IPPROTO_UDP)
+				return 0;
+			if (ip_is_fragment(ih4))
+				return 0;
+			src.family = AF_INET;
+			src.u.ipv4 = ih4->saddr;
+			dst.family = AF_INET;
+			dst.u.ipv4 = ih4->daddr;
+			in_tos = ih4->tos;
+			break;
+		case htons(ETH_P_IPV6):
+			ih6 = (void *) (eh + 1);
+			uh = (void *) (ih6 + 1);
+			if ((unsigned char *) (uh + 1) > data_end)
+				return 0;
+			if (ih6->nexthdr != IPPROTO_UDP)
+				return 0;
+			src.family = AF_INET6;
+			memcpy(&src.u.ipv6, &ih6->saddr, sizeof(src.u.ipv6));
+			dst.family = AF_INET6;
+			memcpy(&dst.u.ipv6, &ih6->daddr, sizeof(dst.u.ipv6));
+			in_tos = ipv6_get_dsfield(ih6);
+			break;
+		default:
+			return 0;
+	}
+
+	datalen = ntohs(uh->len);
+	if (datalen < sizeof(*uh) || (unsigned char *) uh + datalen > data_end)
+		return 0;
+	datalen -= sizeof(*uh);
+	src.port = ntohs(uh->source);
+	dst.port = ntohs(uh->dest);
+
+	t = get_table(table_id);
+	if (!t)
+		return 0;
+	g = get_target(t, &dst);
+	if (!g)
+		goto out_table;
+
+	_r_lock(&g->outputs_lock, flags);
+	if (g->outputs_unfilled) {
+		_r_unlock(&g->outputs_lock, flags);
+		goto out;
+	}
+	_r_unlock(&g->outputs_lock, flags);
+
+	// everything that isn't plain forwarding of RTP to a single destination
+	if (!g->target.rtp || g->target.non_forwarding || g->target.do_intercept)
+		goto out;
+	if (g->target.src_mismatch != MSM_IGNORE && memcmp(&g->target.expected_src, &src, sizeof(src)))
+		goto out;
+	if (g->target.decrypt.cipher != REC_NULL || g->target.decrypt.hmac != REH_NULL)
+		goto out;
+	if (g->num_rtp_destinations != 1)
+		goto out;
+	o = &g->outputs[0];
+	if (!o->plain || o->output.src_addr.family != dst.family)
+		goto out;
+
+	// not RTP also means not STUN or DTLS
+	__parse_rtp(&rtp, (unsigned char *) (uh + 1), datalen);
+	if (!rtp.ok)
+		goto out;
+	rtp.rtcp = 0;
+	// RTCP, muxed or not, always goes the netfilter way. Forwarded RTCP must still
+	// reach the daemon as well (see RTCP_FORWARD in rtpengine46()), but XDP can only
+	// either redirect a packet or pass it on, not both. It's a few percent of the
+	// traffic at most (RFC 3550 keeps it to 5% of the session bandwidth).
+	if (g->target.rtcp) {
+		if (!g->target.rtcp_mux)
+			goto out;
+		if (rtp.rtp_header->m_pt >= 194 && rtp.rtp_header->m_pt <= 223)
+			goto out; // muxed RTCP
+	}
+
+	rtp_pt_idx = rtp_payload_type(rtp.rtp_header, &g->target, &g->last_pt);
+	ssrc_idx = target_find_ssrc(g, rtp.rtp_header->ssrc);
+	if (ssrc_idx == -2)
+		goto out; // reported as error by the netfilter target
+	if (g->target.pt_filter && rtp_pt_idx < 0)
+		goto out;
+
+	// route and link layer before anything is modified, so that the packet can still
+	// go the regular way if this fails
+	if (ih4) {
+		struct rtable *rt = output_route4(o, dev_net(in_dev));
+		if (rt)
+			dst_entry = &rt->dst;
+	}
+	else
+		dst_entry = output_route6(o, dev_net(in_dev), 0);
+	if (!dst_entry)
+		goto out;
+	dev = xdp_output_dev(dst_entry, ih4 ? (void *) &o->header.v4.ih.daddr
+			: (void *) &o->header.v6.ih.daddr, eh);
+	if (!dev)
+		goto out;
+	if (datalen + sizeof(*uh) + (ih4 ? sizeof(*ih4) : sizeof(*ih6)) > dev->mtu)
+		goto out;
+
+	// committed from here on
+
+	if (g->target.rtp_stats && ssrc_idx != -1)
+		rtp_stats(g, &rtp, ktime_to_us(ktime_get_real()), rtp_pt_idx, ssrc_idx);
+
+	if (!proxy_packet_rtp_rewrite(o, rtp_pt_idx, &rtp, ssrc_idx))
+		ret = -1;
+	else {
+		if (ih4) {
+			// IP and UDP header, contiguous
+			memcpy(ih4, &o->header.v4, sizeof(o->header.v4));
+			uh->len = htons(datalen + sizeof(*uh));
+			ih4->tot_len = htons(sizeof(*ih4) + sizeof(*uh) + datalen);
+			uh->check = csum_tcpudp_magic(ih4->saddr, ih4->daddr, datalen + sizeof(*uh),
+					IPPROTO_UDP, csum_partial(uh, datalen + sizeof(*uh), 0));
+			__ip_select_ident(dev_net(dev), ih4, 1);
+			ip_send_check(ih4);
+		}
+		else {
+			memcpy(ih6, &o->header.v6, sizeof(o->header.v6));
+			uh->len = htons(datalen + sizeof(*uh));
+			ih6->payload_len = uh->len;
+			uh->check = csum_ipv6_magic(&ih6->saddr, &ih6->daddr, datalen + sizeof(*uh),
+					IPPROTO_UDP, csum_partial(uh, datalen + sizeof(*uh), 0));
+		}
+		if (uh->check == 0)
+			uh->check = CSUM_MANGLED_0;
+
+		atomic64_inc(&o->stats_out.packets);
+		atomic64_add(datalen, &o->stats_out.bytes);
+		ret = dev->ifindex;
+	}
+
+	if (atomic64_read(&g->stats_in.packets) == 0)
+		atomic_set(&g->stats_in.tos, in_tos);
+	atomic64_inc(&g->stats_in.packets);
+	atomic64_add(datalen, &g->stats_in.bytes);
+	if (rtp_pt_idx >= 0) {
+		atomic64_inc(&g->rtp_stats[rtp_pt_idx].packets);
+		atomic64_add(datalen, &g->rtp_stats[rtp_pt_idx].bytes);
+	}
+	else
+		atomic64_inc(&g->stats_in.errors);
+
+out:
+	if (dst_entry)
+		dst_release(dst_entry);
+	target_put(g);
+out_table:
+	table_put(t);
+	return ret;
+}
+
+__bpf_kfunc_end_defs();
+
+BTF_KFUNCS_START(rtpengine_xdp_kfunc_ids)
+BTF_ID_FLAGS(func, bpf_rtpengine_xdp)
+BTF_KFUNCS_END(rtpengine_xdp_kfunc_ids)
+
+static const struct btf_kfunc_id_set rtpengine_xdp_kfunc_set = {
+	.owner		= THIS_MODULE,
+	.set		= &rtpengine_xdp_kfunc_ids,
+};
+
+#endif
+
+
+
+
 
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,35)
 #define CHECK_ERR false
@@ -5764,6 +6431,12 @@ static int __init init(void) {
 	if (ret)
 		goto fail;
 
+#ifdef RE_HAS_XDP
+	// optional, the module works without it
+	if (register_btf_kfunc_id_set(BPF_PROG_TYPE_XDP, &rtpengine_xdp_kfunc_set))
+		printk(KERN_WARNING "xt_RTPENGINE: could not register XDP function, XDP fast path unavailable\n");
+#endif
+
 	return 0;
 
 fail:
@@ -99,10 +99,17 @@ struct rtpengine_pt_input {
 	unsigned char pt_num;
 	uint32_t clock_rate;
 };
+enum rtpengine_pt_transcode {
+	RTPE_PT_PASSTHROUGH = 0,
+	RTPE_PT_ALAW_TO_ULAW,
+	RTPE_PT_ULAW_TO_ALAW,
+};
 struct rtpengine_pt_output {
 	unsigned int min_payload_len;
 	char replace_pattern[16];
 	unsigned char replace_pattern_len;
+	enum rtpengine_pt_transcode transcode;
+	unsigned char pt_num; // output payload type if transcoding
 };
 
 struct rtpengine_target_info {
@@ -176,6 +183,52 @@ struct rtpengine_packet_info {
 	unsigned char			data[];
 };
 
+/*
+ * Intercepted packets are read from the stream's proc file, by default one packet per
+ * read(). Writing a `struct rtpengine_stream_mode_info` with RE_STREAM_MODE_BATCH switches
+ * the open file into batched mode, in which each read() returns as many queued packets as
+ * fit into the given buffer: a `struct rtpengine_stream_batch` header followed by
+ * `packets` records, each consisting of a `struct rtpengine_stream_batch_packet` plus
+ * packet data, padded to RTPE_STREAM_BATCH_ALIGN bytes. The last record may lack its
+ * padding.
+ */
+enum rtpengine_stream_mode {
+	RE_STREAM_MODE_SINGLE = 0,
+	RE_STREAM_MODE_BATCH,
+
+	__RE_STREAM_MODE_LAST
+};
+
+struct rtpengine_stream_mode_info {
+	uint32_t			mode;
+};
+
+#define RTPE_STREAM_BATCH_ALIGN 8
+
+struct rtpengine_stream_batch {
+	uint32_t			packets;
+	uint32_t			dropped;	// discarded from the full queue since the last batch
+};
+
+struct rtpengine_stream_batch_packet {
+	uint32_t			len;		// bytes of data in this record
+	uint32_t			orig_len;	// length of the packet, if it had to be truncated
+};
+
+// multiple packets for intercepted streams in one message
+struct rtpengine_packets_info {
+	unsigned int			num;
+	unsigned char			data[];		// `num` records, each padded to RTPE_STREAM_BATCH_ALIGN
+};
+
+struct rtpengine_packets_entry {
+	unsigned int			stream_idx;
+	uint32_t			len;
+	unsigned char			data[];
+};
+
+#define RTPE_MAX_PACKETS_LEN 65536
+
 struct rtpengine_stats_info {
 	uint32_t			ssrc[RTPE_NUM_SSRC_TRACKING];
 	struct rtpengine_ssrc_stats	ssrc_stats[RTPE_NUM_SSRC_TRACKING];
@@ -196,6 +249,7 @@ enum rtpengine_command {
 	REMG_GET_RESET_STATS,
 	REMG_DEL_TARGET_STATS,
 	REMG_SEND_RTCP,
+	REMG_PACKETS,
 
 	__REMG_LAST
 };
@@ -264,6 +318,11 @@ struct rtpengine_command_packet {
 	struct rtpengine_packet_info	packet;
 };
 
+struct rtpengine_command_packets {
+	enum rtpengine_command		cmd;
+	struct rtpengine_packets_info	packets;
+};
+
 struct rtpengine_command_stats {
 	enum rtpengine_command		cmd;
 	struct re_address		local;		// input
@@ -0,0 +1,27 @@
+// XDP front end for the xt_RTPENGINE module. All the work is done by the module
+// itself, using the forwarding tables programmed by the daemon. Packets it doesn't
+// handle continue up the stack and reach the RTPENGINE iptables target as usual.
+//
+// Build with `make xdp`, attach with e.g.:
+//   ip link set dev eth0 xdpdrv obj xt_RTPENGINE_xdp.bpf.o sec xdp
+
+#include <linux/bpf.h>
+#include <bpf/bpf_helpers.h>
+
+extern int bpf_rtpengine_xdp(struct xdp_md *ctx, __u32 table_id) __ksym;
+
+// forwarding table to use, same as the --id of the iptables rule
+const volatile __u32 rtpengine_table = 0;
+
+SEC("xdp")
+int rtpengine_xdp(struct xdp_md *ctx) {
+	int ret = bpf_rtpengine_xdp(ctx, rtpengine_table);
+
+	if (ret > 0)
+		return bpf_redirect(ret, 0);
+	if (ret < 0)
+		return XDP_DROP;
+	return XDP_PASS;
+}
+
+char _license[] SEC("license") = "GPL";
@@ -11,6 +11,7 @@
 #include <sys/resource.h>
 #include <unistd.h>
 #include <sys/syscall.h>
+#include <time.h>
 
 
 #define THREAD_BUF_SIZE		64
@@ -300,6 +301,13 @@ INLINE void timeval_add(struct timeval *result, const struct timeval *a, const s
 INLINE void timeval_add_usec(struct timeval *tv, long usec) {
 	timeval_from_us(tv, timeval_us(tv) + usec);
 }
+// any clock, including per-thread CPU time clocks. -1 on error
+INLINE long long clock_ns(clockid_t clock) {
+	struct timespec ts;
+	if (clock_gettime(clock, &ts))
+		return -1;
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 INLINE int long_cmp(long long a, long long b) {
 	if (a == b)
 		return 0;
@@ -3490,6 +3490,130 @@ void frame_fill_dtmf_samples(enum AVSampleFormat fmt, void *samples, unsigned in
 
 
 
+void silence_ring_init(struct silence_ring *r, unsigned int size) {
+	*r = (struct silence_ring) { .size = size };
+	r->runs = g_new(struct silence_run, size);
+}
+void silence_ring_free(struct silence_ring *r) {
+	g_free(r->runs);
+	r->runs = NULL;
+	r->len = 0;
+}
+// consumers have fallen behind: double the size, unwrapping the contents
+void silence_ring_grow(struct silence_ring *r) {
+	struct silence_run *runs = g_new(struct silence_run, r->size * 2);
+	for (unsigned int i = 0; i < r->len; i++)
+		runs[i] = r->runs[(r->head + i) & (r->size - 1)];
+	g_free(r->runs);
+	r->runs = runs;
+	r->head = 0;
+	r->size *= 2;
+}
+
+
+// Silence runs in one pass. Samples are taken in chunks of one 16-byte GCC vector,
+// which maps onto a single SSE2 or NEON register. Silence runs are tracked per chunk
+// and only chunks that mix silent and non-silent samples are looked at one by one.
+
+#define FRAME_ANALYSIS_VEC 16
+#define FRAME_ANALYSIS_BLOCK 64 // chunks per vector pass
+
+enum {
+	FRAME_CHUNK_LOUD = 0,
+	FRAME_CHUNK_SILENT,
+	FRAME_CHUNK_MIXED,
+};
+
+#define frame_analyse_sample(cond, idx) \
+	if (cond) { \
+		if (!run) /* new run */ \
+			run = silence_ring_push(ring, pts + (idx)); \
+	} \
+	else if (run) { \
+		/* close off run */ \
+		run->end = pts + (idx); \
+		run = NULL; \
+	}
+
+#define frame_analyse_x(type, mtype) \
+typedef type frame_vec_ ## type __attribute__ ((vector_size (FRAME_ANALYSIS_VEC))); \
+typedef mtype frame_mask_ ## type __attribute__ ((vector_size (FRAME_ANALYSIS_VEC))); \
+static void frame_analyse_ ## type(struct silence_ring *ring, const type *s, unsigned int num, uint64_t pts, \
+		type thres) \
+{ \
+	enum { lanes = FRAME_ANALYSIS_VEC / sizeof(type) }; \
+	struct silence_run *run = silence_ring_tail(ring); \
+	if (run && run->end) /* last run finished? */ \
+		run = NULL; \
+\
+	type lo = -thres; \
+	unsigned int i = 0; \
+\
+	while (i + lanes <= num) { \
+		/* vector pass over a block of chunks, classifying each chunk */ \
+		uint8_t cls[FRAME_ANALYSIS_BLOCK]; \
+		unsigned int chunks = MIN((num - i) / lanes, FRAME_ANALYSIS_BLOCK); \
+		for (unsigned int c = 0; c < chunks; c++) { \
+			frame_vec_ ## type v; \
+			memcpy(&v, s + i + c * lanes, sizeof(v)); \
+			frame_mask_ ## type m = (v <= thres) & (v >= lo); \
+			uint64_t w[2]; \
+			memcpy(w, &m, sizeof(m)); \
+			cls[c] = !(w[0] | w[1]) ? FRAME_CHUNK_LOUD : (w[0] & w[1]) == ~0ULL ? FRAME_CHUNK_SILENT \
+				: FRAME_CHUNK_MIXED; \
+		} \
+\
+		/* silence runs from the classification, outside of the hot loop */ \
+		for (unsigned int c = 0; c < chunks; c++, i += lanes) { \
+			switch (cls[c]) { \
+				case FRAME_CHUNK_LOUD: \
+					frame_analyse_sample(false, i); \
+					break; \
+				case FRAME_CHUNK_SILENT: \
+					frame_analyse_sample(true, i); \
+					break; \
+				default: \
+					for (unsigned int j = i; j < i + lanes; j++) { \
+						frame_analyse_sample(s[j] <= thres && s[j] >= lo, j); \
+					} \
+			} \
+		} \
+	} \
+\
+	for (; i < num; i++) { \
+		frame_analyse_sample(s[i] <= thres && s[i] >= lo, i); \
+	} \
+}
+
+frame_analyse_x(double, int64_t)
+frame_analyse_x(float, int32_t)
+frame_analyse_x(int32_t, int32_t)
+frame_analyse_x(int16_t, int16_t)
+
+bool frame_analyse(struct silence_ring *ring, enum AVSampleFormat fmt, const void *samples,
+		unsigned int num, uint64_t pts, uint32_t thres_int, double thres_double)
+{
+	switch (fmt) {
+		case AV_SAMPLE_FMT_DBL:
+			frame_analyse_double(ring, samples, num, pts, thres_double);
+			break;
+		case AV_SAMPLE_FMT_FLT:
+			frame_analyse_float(ring, samples, num, pts, thres_double);
+			break;
+		case AV_SAMPLE_FMT_S32:
+			frame_analyse_int32_t(ring, samples, num, pts, thres_int);
+			break;
+		case AV_SAMPLE_FMT_S16:
+			frame_analyse_int16_t(ring, samples, num, pts, thres_int >> 16);
+			break;
+		default:
+			return false;
+	}
+	return true;
+}
+
+
+
 
 // lamely parse out decimal numbers without using floating point
 static unsigned int str_to_i_k(str *s) {
@@ -425,6 +425,26 @@ void frame_fill_dtmf_samples(enum AVSampleFormat fmt, void *samples, unsigned in
 		unsigned int event, unsigned int volume, unsigned int sample_rate, unsigned int channels);
 
 
+struct silence_run {
+	uint64_t start;
+	uint64_t end; // zero while ongoing
+};
+// ring of silence runs in PTS order, preallocated and only grown when consumers fall behind
+struct silence_ring {
+	struct silence_run *runs;
+	unsigned int size; // power of two
+	unsigned int head;
+	unsigned int len;
+};
+// appends the silence runs found in a decoded frame
+bool frame_analyse(struct silence_ring *, enum AVSampleFormat fmt, const void *samples,
+		unsigned int num, uint64_t pts, uint32_t thres_int, double thres_double);
+
+void silence_ring_init(struct silence_ring *, unsigned int size);
+void silence_ring_free(struct silence_ring *);
+void silence_ring_grow(struct silence_ring *);
+
+
 codec_chain_t *codec_chain_new(codec_def_t *src, format_t *src_format, codec_def_t *dst,
 		format_t *dst_format, int bitrate, int ptime);
 AVPacket *codec_chain_input_data(codec_chain_t *c, const str *data, unsigned long ts);
@@ -453,6 +473,29 @@ INLINE void format_init(format_t *f) {
 	f->channels = -1;
 	f->format = -1;
 }
+INLINE struct silence_run *silence_ring_head(struct silence_ring *r) {
+	if (!r->len)
+		return NULL;
+	return &r->runs[r->head];
+}
+INLINE struct silence_run *silence_ring_tail(struct silence_ring *r) {
+	if (!r->len)
+		return NULL;
+	return &r->runs[(r->head + r->len - 1) & (r->size - 1)];
+}
+INLINE void silence_ring_pop(struct silence_ring *r) {
+	r->head = (r->head + 1) & (r->size - 1);
+	r->len--;
+}
+INLINE struct silence_run *silence_ring_push(struct silence_ring *r, uint64_t start) {
+	if (G_UNLIKELY(r->len == r->size))
+		silence_ring_grow(r);
+	r->len++;
+	struct silence_run *run = silence_ring_tail(r);
+	*run = (struct silence_run) { .start = start };
+	return run;
+}
+
 INLINE char *av_error(int no) {
 	char *buf = get_thread_buf();
 	av_strerror(no, buf, THREAD_BUF_SIZE);
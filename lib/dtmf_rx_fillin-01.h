@@ -1,8 +0,0 @@
-#include <sys/types.h>
-#include <inttypes.h>
-#include <stdbool.h>
-#include <stdio.h>
-#include <spandsp/telephony.h>
-#include <spandsp/super_tone_rx.h>
-#include <spandsp/logging.h>
-#include <spandsp/dtmf.h>
@@ -1,13 +0,0 @@
-#include <sys/types.h>
-#include <inttypes.h>
-#include <stdbool.h>
-#include <stdio.h>
-#include <spandsp/telephony.h>
-#include <spandsp/super_tone_rx.h>
-#include <spandsp/logging.h>
-#include <spandsp/dtmf.h>
-#include "compat.h"
-
-INLINE void dtmf_rx_fillin(dtmf_rx_state_t *dsp, int n) {
-	// stub
-}
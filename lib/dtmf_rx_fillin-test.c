@@ -1,6 +0,0 @@
-#include "dtmf_rx_fillin.h"
-int main(void) {
-	dtmf_rx_state_t *dsp = NULL;
-	dtmf_rx_fillin(dsp, 0);
-	return 0;
-}
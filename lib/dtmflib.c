@@ -1,5 +1,7 @@
 #include "dtmflib.h"
 #include <math.h>
+#include <string.h>
+#include <limits.h>
 #include "compat.h"
 #include "log.h"
 
@@ -253,3 +255,145 @@ void dtmf_samples_int16_t_mono(void *buf, unsigned long offset, unsigned long nu
 {
 	dtmf_samples_int16_t(buf, offset, num, event, volume, sample_rate, 1);
 }
+
+
+
+/* Detector parameters, identical to spandsp's dtmf_rx() defaults */
+#define DTMF_DETECT_THRESHOLD		8.0e7f
+#define DTMF_DETECT_NORMAL_TWIST	6.309f		/* 8 dB */
+#define DTMF_DETECT_REVERSE_TWIST	2.512f		/* 4 dB */
+#define DTMF_DETECT_RELATIVE_PEAK	6.309f		/* 8 dB */
+#define DTMF_DETECT_TO_TOTAL_ENERGY	42.0f
+#define DTMF_DETECT_POWER_OFFSET	110.395f	/* 10*log(32768.0*32768.0*DTMF_DETECT_BLOCK) */
+#define DTMF_DETECT_DBM0_MAX_POWER	(3.14f + 3.02f)
+
+/* Filter bank: four row tones followed by four column tones */
+static const float dtmf_detect_freqs[8] = { 697.0f, 770.0f, 852.0f, 941.0f, 1209.0f, 1336.0f, 1477.0f, 1633.0f };
+static const char dtmf_detect_positions[] = "123A" "456B" "789C" "*0#D";
+
+/* All eight Goertzel filters run side by side in one vector: two SSE registers
+ * on baseline x86-64, one AVX register where available */
+typedef float goertzel_vec_t __attribute__ ((vector_size (8 * sizeof(float))));
+
+#if defined(__x86_64__) && !defined(ASAN_BUILD) && HAS_ATTR(target_clones)
+#define DTMF_DETECT_CLONES __attribute__ ((target_clones ("avx", "default")))
+#else
+#define DTMF_DETECT_CLONES
+#endif
+
+void dtmf_detect_init(struct dtmf_detect *d, dtmf_detect_func *func, void *ptr) {
+	*d = (struct dtmf_detect) { .func = func, .ptr = ptr };
+	for (unsigned int i = 0; i < G_N_ELEMENTS(dtmf_detect_freqs); i++)
+		d->fac[i] = 2.0f * cosf(2.0f * 3.14159265358979323846264338327950288f * dtmf_detect_freqs[i]
+				/ 8000.0f);
+}
+
+// runs the filter bank over one full block and returns the eight filter energies
+DTMF_DETECT_CLONES
+static void dtmf_detect_goertzel(const struct dtmf_detect *d, float out[8]) {
+	goertzel_vec_t fac, v1, v2 = {0,}, v3 = {0,};
+	memcpy(&fac, d->fac, sizeof(fac));
+
+	for (unsigned int i = 0; i < DTMF_DETECT_BLOCK; i++) {
+		float famp = d->block[i];
+		v1 = v2;
+		v2 = v3;
+		v3 = fac * v2 - v1 + famp;
+	}
+
+	// push a zero through the filters, then the non-recursive part
+	v1 = v2;
+	v2 = v3;
+	v3 = fac * v2 - v1;
+	v1 = v3 * v3 + v2 * v2 - v2 * v3 * fac;
+
+	memcpy(out, &v1, sizeof(v1));
+}
+
+static void dtmf_detect_block(struct dtmf_detect *d) {
+	// total energy first: serves both as the gate and for the energy ratio test
+	float energy = 0.0f;
+	for (unsigned int i = 0; i < DTMF_DETECT_BLOCK; i++) {
+		float famp = d->block[i];
+		energy += famp * famp;
+	}
+
+	if (d->duration < INT_MAX - DTMF_DETECT_BLOCK)
+		d->duration += DTMF_DETECT_BLOCK;
+	d->block_fill = 0;
+
+	char hit = 0;
+
+	// No single tone can carry more than N times the total energy of the block. If even
+	// that stays below the threshold, nothing can be detected and the filter bank is
+	// skipped. The factor of two leaves room for rounding.
+	if (energy * (2.0f * DTMF_DETECT_BLOCK) >= DTMF_DETECT_THRESHOLD) {
+		float e[8];
+		dtmf_detect_goertzel(d, e);
+		const float *row = &e[0], *col = &e[4];
+
+		unsigned int best_row = 0, best_col = 0;
+		for (unsigned int i = 1; i < 4; i++) {
+			if (row[i] > row[best_row])
+				best_row = i;
+			if (col[i] > col[best_col])
+				best_col = i;
+		}
+
+		// basic signal level test and the twist test
+		if (row[best_row] >= DTMF_DETECT_THRESHOLD && col[best_col] >= DTMF_DETECT_THRESHOLD
+				&& col[best_col] < row[best_row] * DTMF_DETECT_REVERSE_TWIST
+				&& col[best_col] * DTMF_DETECT_NORMAL_TWIST > row[best_row])
+		{
+			// relative peak test ...
+			unsigned int i;
+			for (i = 0; i < 4; i++) {
+				if ((i != best_col && col[i] * DTMF_DETECT_RELATIVE_PEAK > col[best_col])
+						|| (i != best_row && row[i] * DTMF_DETECT_RELATIVE_PEAK > row[best_row]))
+					break;
+			}
+			// ... and fraction of total energy test
+			if (i >= 4 && (row[best_row] + col[best_col]) > DTMF_DETECT_TO_TOTAL_ENERGY * energy)
+				hit = dtmf_detect_positions[(best_row << 2) + best_col];
+		}
+	}
+
+	// two successive indications that something has changed are needed. A digit
+	// starts only if both agree, otherwise it's the end of a tone.
+	if (hit != d->in_digit && d->last_hit != d->in_digit) {
+		hit = (hit && hit == d->last_hit) ? hit : 0;
+		// avoid reporting multiple no-digit conditions on flaky hits
+		if (d->in_digit || hit) {
+			int level = -99;
+			if (hit)
+				level = lrintf(log10f(energy) * 10.0f - DTMF_DETECT_POWER_OFFSET
+						+ DTMF_DETECT_DBM0_MAX_POWER);
+			if (d->func)
+				d->func(d->ptr, hit, level, d->duration);
+			d->duration = 0;
+		}
+		d->in_digit = hit;
+	}
+	d->last_hit = hit;
+}
+
+void dtmf_detect_samples(struct dtmf_detect *d, const int16_t *samples, unsigned int num) {
+	while (num) {
+		unsigned int len = MIN(num, DTMF_DETECT_BLOCK - d->block_fill);
+		memcpy(d->block + d->block_fill, samples, len * sizeof(*samples));
+		d->block_fill += len;
+		samples += len;
+		num -= len;
+		if (d->block_fill == DTMF_DETECT_BLOCK)
+			dtmf_detect_block(d);
+	}
+}
+
+// Restarts the block in progress after a gap, leaving the hit detection alone, just like
+// dtmf_rx_fillin(). The samples of the discarded partial block still count towards the
+// reported duration.
+void dtmf_detect_fillin(struct dtmf_detect *d, unsigned int num) {
+	if (d->duration < INT_MAX - DTMF_DETECT_BLOCK)
+		d->duration += d->block_fill;
+	d->block_fill = 0;
+}
@@ -22,6 +22,29 @@ struct telephone_event_payload {
 } __attribute__ ((packed));
 
 
+#define DTMF_DETECT_BLOCK	102	/* samples per Goertzel block at 8 kHz */
+
+typedef void dtmf_detect_func(void *ptr, int code, int level, int delay);
+
+// In-band DTMF detector for 8 kHz mono S16 audio. Detection semantics and the
+// realtime callback arguments (code, level in dBm0, delay in samples) follow
+// spandsp's dtmf_rx(), so the two can be used interchangeably.
+struct dtmf_detect {
+	dtmf_detect_func *func;
+	void *ptr;
+	float fac[8];
+	int16_t block[DTMF_DETECT_BLOCK];
+	unsigned int block_fill;
+	int duration;
+	char in_digit;
+	char last_hit;
+};
+
+void dtmf_detect_init(struct dtmf_detect *, dtmf_detect_func *, void *ptr);
+void dtmf_detect_samples(struct dtmf_detect *, const int16_t *samples, unsigned int num);
+void dtmf_detect_fillin(struct dtmf_detect *, unsigned int num);
+
+
 void dtmf_samples_int16_t_mono(void *buf, unsigned long offset, unsigned long num, unsigned int event,
 		unsigned int volume, unsigned int sample_rate);
 
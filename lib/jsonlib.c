@@ -0,0 +1,607 @@
+#include "jsonlib.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <math.h>
+#include <assert.h>
+
+
+static const char json_hex[] = "0123456789abcdef";
+
+
+
+struct json_writer *json_writer_new(void) {
+	struct json_writer *w = g_slice_alloc(sizeof(*w));
+	json_writer_init(w, g_string_sized_new(256));
+	w->owned = true;
+	return w;
+}
+
+void json_writer_init(struct json_writer *w, GString *buf) {
+	w->buf = buf;
+	w->depth = 0;
+	w->key_pending = false;
+	w->owned = false;
+	w->nonempty = 0;
+}
+
+void json_writer_reset(struct json_writer *w) {
+	g_string_truncate(w->buf, 0);
+	w->depth = 0;
+	w->key_pending = false;
+	w->nonempty = 0;
+}
+
+char *json_writer_finish(struct json_writer *w) {
+	assert(w->owned);
+	char *ret = g_string_free(w->buf, FALSE);
+	g_slice_free1(sizeof(*w), w);
+	return ret;
+}
+
+void json_writer_free(struct json_writer *w) {
+	if (!w)
+		return;
+	assert(w->owned);
+	g_string_free(w->buf, TRUE);
+	g_slice_free1(sizeof(*w), w);
+}
+
+
+// emits a separator if required, and marks the current level as non-empty
+static inline void json_writer_sep(struct json_writer *w) {
+	if (w->key_pending) {
+		w->key_pending = false;
+		return;
+	}
+	uint64_t bit = 1ULL << w->depth;
+	if ((w->nonempty & bit))
+		g_string_append_c(w->buf, ',');
+	else
+		w->nonempty |= bit;
+}
+
+static void json_escape(GString *b, const char *s, size_t len) {
+	const char *end = s + len;
+	const char *start = s;
+
+	g_string_append_c(b, '"');
+
+	for (; s < end; s++) {
+		unsigned char c = *s;
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+
+		if (s > start)
+			g_string_append_len(b, start, s - start);
+		start = s + 1;
+
+		switch (c) {
+			case '"':
+				g_string_append_len(b, "\\\"", 2);
+				break;
+			case '\\':
+				g_string_append_len(b, "\\\\", 2);
+				break;
+			case '\b':
+				g_string_append_len(b, "\\b", 2);
+				break;
+			case '\f':
+				g_string_append_len(b, "\\f", 2);
+				break;
+			case '\n':
+				g_string_append_len(b, "\\n", 2);
+				break;
+			case '\r':
+				g_string_append_len(b, "\\r", 2);
+				break;
+			case '\t':
+				g_string_append_len(b, "\\t", 2);
+				break;
+			default:;
+				char u[6] = { '\\', 'u', '0', '0', json_hex[c >> 4], json_hex[c & 0xf] };
+				g_string_append_len(b, u, sizeof(u));
+				break;
+		}
+	}
+
+	if (s > start)
+		g_string_append_len(b, start, s - start);
+
+	g_string_append_c(b, '"');
+}
+
+
+static void json_writer_open(struct json_writer *w, char c) {
+	json_writer_sep(w);
+	g_string_append_c(w->buf, c);
+	w->depth++;
+	assert(w->depth < JSON_MAX_DEPTH);
+	w->nonempty &= ~(1ULL << w->depth);
+}
+
+static void json_writer_close(struct json_writer *w, char c) {
+	if (w->key_pending) // member without a value, keep the document valid
+		json_writer_null(w);
+	if (!w->depth)
+		return;
+	w->depth--;
+	g_string_append_c(w->buf, c);
+}
+
+void json_writer_begin_object(struct json_writer *w) {
+	json_writer_open(w, '{');
+}
+void json_writer_end_object(struct json_writer *w) {
+	json_writer_close(w, '}');
+}
+void json_writer_begin_array(struct json_writer *w) {
+	json_writer_open(w, '[');
+}
+void json_writer_end_array(struct json_writer *w) {
+	json_writer_close(w, ']');
+}
+
+void json_writer_key_len(struct json_writer *w, const char *k, size_t len) {
+	assert(!w->key_pending);
+	json_writer_sep(w);
+	json_escape(w->buf, k, len);
+	g_string_append_c(w->buf, ':');
+	w->key_pending = true;
+}
+
+void json_writer_string_len(struct json_writer *w, const char *s, size_t len) {
+	json_writer_sep(w);
+	if (!s)
+		g_string_append_len(w->buf, "null", 4);
+	else
+		json_escape(w->buf, s, len);
+}
+
+void json_writer_printf(struct json_writer *w, const char *fmt, ...) {
+	char buf[128];
+	va_list ap;
+
+	va_start(ap, fmt);
+	int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	if (len < 0)
+		len = 0;
+	if (len < sizeof(buf)) {
+		json_writer_string_len(w, buf, len);
+		return;
+	}
+
+	va_start(ap, fmt);
+	char *s = g_strdup_vprintf(fmt, ap);
+	va_end(ap);
+	json_writer_string_len(w, s, len);
+	g_free(s);
+}
+
+void json_writer_int(struct json_writer *w, int64_t i) {
+	json_writer_sep(w);
+	g_string_append_printf(w->buf, "%" PRId64, i);
+}
+
+void json_writer_uint(struct json_writer *w, uint64_t i) {
+	json_writer_sep(w);
+	g_string_append_printf(w->buf, "%" PRIu64, i);
+}
+
+void json_writer_double(struct json_writer *w, double d) {
+	json_writer_sep(w);
+	if (!isfinite(d)) {
+		g_string_append_len(w->buf, "null", 4);
+		return;
+	}
+	// same formatting as json-glib: shortest representation, always with a decimal point
+	char buf[G_ASCII_DTOSTR_BUF_SIZE];
+	g_ascii_dtostr(buf, sizeof(buf), d);
+	g_string_append(w->buf, buf);
+	if (!strpbrk(buf, ".eE"))
+		g_string_append_len(w->buf, ".0", 2);
+}
+
+void json_writer_bool(struct json_writer *w, bool b) {
+	json_writer_sep(w);
+	if (b)
+		g_string_append_len(w->buf, "true", 4);
+	else
+		g_string_append_len(w->buf, "false", 5);
+}
+
+void json_writer_null(struct json_writer *w) {
+	json_writer_sep(w);
+	g_string_append_len(w->buf, "null", 4);
+}
+
+void json_writer_raw(struct json_writer *w, const char *s, size_t len) {
+	json_writer_sep(w);
+	g_string_append_len(w->buf, s, len);
+}
+
+
+
+enum {
+	JSON_ST_VALUE = 0,
+	JSON_ST_VALUE_OR_CLOSE,
+	JSON_ST_KEY,
+	JSON_ST_KEY_OR_CLOSE,
+	JSON_ST_NEXT,
+	JSON_ST_DONE,
+	JSON_ST_ERROR,
+};
+
+
+void json_tokenizer_init(struct json_tokenizer *t, const char *s, size_t len) {
+	t->p = s;
+	t->end = s + len;
+	t->depth = 0;
+	t->state = JSON_ST_VALUE;
+	t->in_array = 0;
+}
+
+static inline void json_skip_ws(struct json_tokenizer *t) {
+	while (t->p < t->end) {
+		switch (*t->p) {
+			case ' ':
+			case '\t':
+			case '\n':
+			case '\r':
+				t->p++;
+				continue;
+		}
+		break;
+	}
+}
+
+static inline bool json_is_hex(char c) {
+	return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+}
+
+// expects t->p to point past the opening quote
+static bool json_scan_string(struct json_tokenizer *t, struct json_token *tok) {
+	const char *start = t->p;
+	tok->escaped = false;
+
+	while (t->p < t->end) {
+		unsigned char c = *t->p;
+		if (c == '"') {
+			tok->s = STR_INIT_LEN((char *) start, t->p - start);
+			t->p++;
+			return true;
+		}
+		if (c < 0x20)
+			return false;
+		if (c != '\\') {
+			t->p++;
+			continue;
+		}
+
+		tok->escaped = true;
+		t->p++;
+		if (t->p >= t->end)
+			return false;
+		switch (*t->p) {
+			case '"':
+			case '\\':
+			case '/':
+			case 'b':
+			case 'f':
+			case 'n':
+			case 'r':
+			case 't':
+				t->p++;
+				break;
+			case 'u':
+				if (t->end - t->p < 5)
+					return false;
+				for (int i = 1; i <= 4; i++) {
+					if (!json_is_hex(t->p[i]))
+						return false;
+				}
+				t->p += 5;
+				break;
+			default:
+				return false;
+		}
+	}
+	return false;
+}
+
+static bool json_scan_number(struct json_tokenizer *t, struct json_token *tok) {
+	const char *start = t->p;
+	bool neg = false, is_int = true;
+	uint64_t val = 0;
+
+	if (*t->p == '-') {
+		neg = true;
+		t->p++;
+	}
+	if (t->p >= t->end)
+		return false;
+
+	if (*t->p == '0')
+		t->p++;
+	else if (*t->p >= '1' && *t->p <= '9') {
+		while (t->p < t->end && *t->p >= '0' && *t->p <= '9') {
+			unsigned int d = *t->p - '0';
+			if (val > (UINT64_MAX - d) / 10)
+				is_int = false; // keep scanning, will be a double
+			else
+				val = val * 10 + d;
+			t->p++;
+		}
+	}
+	else
+		return false;
+
+	if (t->p < t->end && *t->p == '.') {
+		is_int = false;
+		t->p++;
+		if (t->p >= t->end || *t->p < '0' || *t->p > '9')
+			return false;
+		while (t->p < t->end && *t->p >= '0' && *t->p <= '9')
+			t->p++;
+	}
+	if (t->p < t->end && (*t->p == 'e' || *t->p == 'E')) {
+		is_int = false;
+		t->p++;
+		if (t->p < t->end && (*t->p == '+' || *t->p == '-'))
+			t->p++;
+		if (t->p >= t->end || *t->p < '0' || *t->p > '9')
+			return false;
+		while (t->p < t->end && *t->p >= '0' && *t->p <= '9')
+			t->p++;
+	}
+
+	tok->s = STR_INIT_LEN((char *) start, t->p - start);
+
+	if (is_int) {
+		if (!neg && val <= INT64_MAX) {
+			tok->type = JSON_TOK_INT;
+			tok->i = val;
+			return true;
+		}
+		if (neg && val <= (uint64_t) INT64_MAX + 1) {
+			tok->type = JSON_TOK_INT;
+			tok->i = (int64_t) (0 - val);
+			return true;
+		}
+	}
+
+	char buf[64];
+	if (tok->s.len >= sizeof(buf))
+		return false;
+	memcpy(buf, tok->s.s, tok->s.len);
+	buf[tok->s.len] = '\0';
+	tok->type = JSON_TOK_DOUBLE;
+	tok->d = g_ascii_strtod(buf, NULL);
+	return true;
+}
+
+static bool json_scan_literal(struct json_tokenizer *t, const char *lit, size_t len) {
+	if (t->end - t->p < len)
+		return false;
+	if (memcmp(t->p, lit, len))
+		return false;
+	t->p += len;
+	return true;
+}
+
+static enum json_token_type json_tokenizer_close(struct json_tokenizer *t, struct json_token *tok,
+		bool array)
+{
+	t->p++;
+	t->depth--;
+	t->state = t->depth ? JSON_ST_NEXT : JSON_ST_DONE;
+	return (tok->type = array ? JSON_TOK_ARRAY_END : JSON_TOK_OBJECT_END);
+}
+
+static enum json_token_type json_tokenizer_open(struct json_tokenizer *t, struct json_token *tok,
+		bool array)
+{
+	t->p++;
+	if (t->depth >= JSON_MAX_DEPTH - 1)
+		goto err;
+	t->depth++;
+	if (array) {
+		t->in_array |= 1ULL << t->depth;
+		t->state = JSON_ST_VALUE_OR_CLOSE;
+		return (tok->type = JSON_TOK_ARRAY_BEGIN);
+	}
+	t->in_array &= ~(1ULL << t->depth);
+	t->state = JSON_ST_KEY_OR_CLOSE;
+	return (tok->type = JSON_TOK_OBJECT_BEGIN);
+
+err:
+	t->state = JSON_ST_ERROR;
+	return (tok->type = JSON_TOK_ERROR);
+}
+
+enum json_token_type json_tokenizer_next(struct json_tokenizer *t, struct json_token *tok) {
+	tok->escaped = false;
+	json_skip_ws(t);
+
+	switch (t->state) {
+		case JSON_ST_DONE:
+			if (t->p != t->end)
+				goto err;
+			return (tok->type = JSON_TOK_END);
+
+		case JSON_ST_NEXT:
+			if (t->p >= t->end)
+				goto err;
+			bool array = (t->in_array & (1ULL << t->depth)) ? true : false;
+			if (*t->p == ',') {
+				t->p++;
+				json_skip_ws(t);
+				t->state = array ? JSON_ST_VALUE : JSON_ST_KEY;
+				break;
+			}
+			if (*t->p == (array ? ']' : '}'))
+				return json_tokenizer_close(t, tok, array);
+			goto err;
+
+		case JSON_ST_KEY_OR_CLOSE:
+			if (t->p < t->end && *t->p == '}')
+				return json_tokenizer_close(t, tok, false);
+			break;
+
+		case JSON_ST_VALUE_OR_CLOSE:
+			if (t->p < t->end && *t->p == ']')
+				return json_tokenizer_close(t, tok, true);
+			break;
+
+		case JSON_ST_KEY:
+		case JSON_ST_VALUE:
+			break;
+
+		default:
+			goto err;
+	}
+
+	if (t->p >= t->end)
+		goto err;
+
+	if (t->state == JSON_ST_KEY || t->state == JSON_ST_KEY_OR_CLOSE) {
+		if (*t->p != '"')
+			goto err;
+		t->p++;
+		if (!json_scan_string(t, tok))
+			goto err;
+		json_skip_ws(t);
+		if (t->p >= t->end || *t->p != ':')
+			goto err;
+		t->p++;
+		t->state = JSON_ST_VALUE;
+		return (tok->type = JSON_TOK_KEY);
+	}
+
+	switch (*t->p) {
+		case '{':
+			return json_tokenizer_open(t, tok, false);
+		case '[':
+			return json_tokenizer_open(t, tok, true);
+		case '"':
+			t->p++;
+			if (!json_scan_string(t, tok))
+				goto err;
+			tok->type = JSON_TOK_STRING;
+			break;
+		case 't':
+			if (!json_scan_literal(t, "true", 4))
+				goto err;
+			tok->type = JSON_TOK_BOOL;
+			tok->i = 1;
+			break;
+		case 'f':
+			if (!json_scan_literal(t, "false", 5))
+				goto err;
+			tok->type = JSON_TOK_BOOL;
+			tok->i = 0;
+			break;
+		case 'n':
+			if (!json_scan_literal(t, "null", 4))
+				goto err;
+			tok->type = JSON_TOK_NULL;
+			break;
+		default:
+			if (!json_scan_number(t, tok))
+				goto err;
+			break;
+	}
+
+	t->state = t->depth ? JSON_ST_NEXT : JSON_ST_DONE;
+	return tok->type;
+
+err:
+	t->state = JSON_ST_ERROR;
+	return (tok->type = JSON_TOK_ERROR);
+}
+
+
+static unsigned int json_parse_hex4(const char *s) {
+	unsigned int ret = 0;
+	for (int i = 0; i < 4; i++) {
+		char c = s[i];
+		ret <<= 4;
+		if (c >= '0' && c <= '9')
+			ret |= c - '0';
+		else if (c >= 'a' && c <= 'f')
+			ret |= c - 'a' + 10;
+		else
+			ret |= c - 'A' + 10;
+	}
+	return ret;
+}
+
+size_t json_token_unescape(const struct json_token *tok, char *out) {
+	const char *s = tok->s.s;
+	const char *end = s + tok->s.len;
+	char *o = out;
+
+	if (!tok->escaped) {
+		memcpy(out, s, tok->s.len);
+		return tok->s.len;
+	}
+
+	// escape sequences have been validated by the tokenizer
+	while (s < end) {
+		const char *bs = memchr(s, '\\', end - s);
+		if (!bs)
+			bs = end;
+		memcpy(o, s, bs - s);
+		o += bs - s;
+		s = bs;
+		if (s >= end)
+			break;
+
+		s++;
+		switch (*s++) {
+			case 'b':
+				*o++ = '\b';
+				break;
+			case 'f':
+				*o++ = '\f';
+				break;
+			case 'n':
+				*o++ = '\n';
+				break;
+			case 'r':
+				*o++ = '\r';
+				break;
+			case 't':
+				*o++ = '\t';
+				break;
+			case 'u':;
+				gunichar c = json_parse_hex4(s);
+				s += 4;
+				if (c >= 0xd800 && c <= 0xdbff) {
+					// surrogate pair?
+					if (end - s >= 6 && s[0] == '\\' && s[1] == 'u') {
+						unsigned int lo = json_parse_hex4(s + 2);
+						if (lo >= 0xdc00 && lo <= 0xdfff) {
+							c = 0x10000 + ((c - 0xd800) << 10) + (lo - 0xdc00);
+							s += 6;
+						}
+						else
+							c = 0xfffd;
+					}
+					else
+						c = 0xfffd;
+				}
+				else if (c >= 0xdc00 && c <= 0xdfff)
+					c = 0xfffd;
+				o += g_unichar_to_utf8(c, o);
+				break;
+			default: // quote, backslash, slash
+				*o++ = s[-1];
+				break;
+		}
+	}
+
+	return o - out;
+}
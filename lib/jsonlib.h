@@ -0,0 +1,159 @@
+#ifndef _JSONLIB_H_
+#define _JSONLIB_H_
+
+#include <glib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+#include "str.h"
+
+
+/*
+ * Lightweight JSON producer and consumer, for the hot signalling paths (NG JSON, Janus,
+ * MQTT) where building and walking a JsonNode tree for every message is too costly.
+ *
+ * The writer appends directly to a GString, taking care of separators and string
+ * escaping. Calls are made in the same order as with a JsonBuilder, so the output of
+ * both is identical in member order. The output is always compact (no pretty printing).
+ *
+ * The tokenizer walks a JSON document held in memory without allocating anything and
+ * returns one token at a time. String tokens point into the input document. Only if
+ * they contain escape sequences (`escaped` set) must they be run through
+ * json_token_unescape().
+ */
+
+#define JSON_MAX_DEPTH 64
+
+
+struct json_writer {
+	GString *buf;
+	unsigned int depth;
+	bool key_pending;
+	bool owned;
+	uint64_t nonempty; // one bit per nesting level
+};
+
+// a position in the output that the writer can be rolled back to
+struct json_writer_mark {
+	size_t len;
+	unsigned int depth;
+	bool key_pending;
+	uint64_t nonempty;
+};
+
+
+enum json_token_type {
+	JSON_TOK_ERROR = -1,
+	JSON_TOK_END = 0,
+	JSON_TOK_OBJECT_BEGIN,
+	JSON_TOK_OBJECT_END,
+	JSON_TOK_ARRAY_BEGIN,
+	JSON_TOK_ARRAY_END,
+	JSON_TOK_KEY,
+	JSON_TOK_STRING,
+	JSON_TOK_INT,
+	JSON_TOK_DOUBLE,
+	JSON_TOK_BOOL,
+	JSON_TOK_NULL,
+};
+
+struct json_token {
+	enum json_token_type type;
+	str s; // KEY and STRING: contents without quotes. INT and DOUBLE: the literal
+	bool escaped; // KEY and STRING contain escape sequences
+	int64_t i; // INT and BOOL
+	double d; // DOUBLE
+};
+
+struct json_tokenizer {
+	const char *p, *end;
+	unsigned int depth;
+	unsigned int state;
+	uint64_t in_array; // one bit per nesting level
+};
+
+
+// heap allocated writer with its own buffer, to be released through json_writer_finish()
+// or json_writer_free()
+struct json_writer *json_writer_new(void);
+// returns the document as a NUL-terminated string (to be g_free'd) and releases the writer
+char *json_writer_finish(struct json_writer *);
+void json_writer_free(struct json_writer *);
+
+// writer appending to an existing buffer. Nothing needs to be released.
+void json_writer_init(struct json_writer *, GString *);
+// starts a new document. The buffer is truncated.
+void json_writer_reset(struct json_writer *);
+
+void json_writer_begin_object(struct json_writer *);
+void json_writer_end_object(struct json_writer *);
+void json_writer_begin_array(struct json_writer *);
+void json_writer_end_array(struct json_writer *);
+
+void json_writer_key_len(struct json_writer *, const char *, size_t);
+INLINE void json_writer_key(struct json_writer *, const char *);
+INLINE void json_writer_key_str(struct json_writer *, const str *);
+
+// a NULL string is written as `null`
+void json_writer_string_len(struct json_writer *, const char *, size_t);
+INLINE void json_writer_string(struct json_writer *, const char *);
+INLINE void json_writer_str(struct json_writer *, const str *);
+__attribute__ ((format (printf, 2, 3)))
+void json_writer_printf(struct json_writer *, const char *fmt, ...);
+
+void json_writer_int(struct json_writer *, int64_t);
+void json_writer_uint(struct json_writer *, uint64_t);
+void json_writer_double(struct json_writer *, double);
+void json_writer_bool(struct json_writer *, bool);
+void json_writer_null(struct json_writer *);
+
+// appends a value that is already JSON encoded
+void json_writer_raw(struct json_writer *, const char *, size_t);
+
+// to discard a member or array element after it has been (partly) written: take the mark
+// before its key or value is written, and roll back to it
+INLINE void json_writer_mark(struct json_writer *, struct json_writer_mark *);
+INLINE void json_writer_rollback(struct json_writer *, const struct json_writer_mark *);
+
+
+void json_tokenizer_init(struct json_tokenizer *, const char *, size_t);
+// returns the type of the token, also stored in the token. END is returned once after the
+// top-level value has been completed. Any syntax error results in ERROR.
+enum json_token_type json_tokenizer_next(struct json_tokenizer *, struct json_token *);
+
+// writes the decoded contents of a KEY or STRING token into `out`, which must have room for
+// at least `tok->s.len` bytes. Returns the decoded length. No NUL termination.
+size_t json_token_unescape(const struct json_token *tok, char *out);
+
+
+
+INLINE void json_writer_key(struct json_writer *w, const char *k) {
+	json_writer_key_len(w, k, strlen(k));
+}
+INLINE void json_writer_key_str(struct json_writer *w, const str *k) {
+	json_writer_key_len(w, k->s, k->len);
+}
+INLINE void json_writer_string(struct json_writer *w, const char *s) {
+	json_writer_string_len(w, s, s ? strlen(s) : 0);
+}
+INLINE void json_writer_str(struct json_writer *w, const str *s) {
+	json_writer_string_len(w, s ? s->s : NULL, s ? s->len : 0);
+}
+INLINE void json_writer_mark(struct json_writer *w, struct json_writer_mark *m) {
+	*m = (struct json_writer_mark) {
+		.len = w->buf->len,
+		.depth = w->depth,
+		.key_pending = w->key_pending,
+		.nonempty = w->nonempty,
+	};
+}
+INLINE void json_writer_rollback(struct json_writer *w, const struct json_writer_mark *m) {
+	g_string_truncate(w->buf, m->len);
+	w->depth = m->depth;
+	w->key_pending = m->key_pending;
+	w->nonempty = m->nonempty;
+}
+
+
+#endif
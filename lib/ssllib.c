@@ -1,5 +1,7 @@
 #include "ssllib.h"
 #include <openssl/ssl.h>
+#include <openssl/sha.h>
+#include <string.h>
 #include <time.h>
 #include "auxlib.h"
 
@@ -64,3 +66,81 @@ void rtpe_ssl_init(void) {
 	EVP_MAC_CTX_set_params(rtpe_hmac_sha1_base, params);
 #endif
 }
+
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+#define EVP_MD_CTX_new EVP_MD_CTX_create
+#define EVP_MD_CTX_free EVP_MD_CTX_destroy
+#endif
+
+void hmac_sha1_key_init(struct hmac_sha1_key *k, const void *key, size_t len) {
+	unsigned char block[SHA_CBLOCK];
+	unsigned char pad[SHA_CBLOCK];
+
+	hmac_sha1_key_clear(k);
+
+	memset(block, 0, sizeof(block));
+	if (len > sizeof(block))
+		EVP_Digest(key, len, block, NULL, EVP_sha1(), NULL);
+	else
+		memcpy(block, key, len);
+
+	k->inner = EVP_MD_CTX_new();
+	k->outer = EVP_MD_CTX_new();
+
+	for (unsigned int i = 0; i < sizeof(pad); i++)
+		pad[i] = block[i] ^ 0x36;
+	EVP_DigestInit_ex(k->inner, EVP_sha1(), NULL);
+	EVP_DigestUpdate(k->inner, pad, sizeof(pad));
+
+	for (unsigned int i = 0; i < sizeof(pad); i++)
+		pad[i] = block[i] ^ 0x5c;
+	EVP_DigestInit_ex(k->outer, EVP_sha1(), NULL);
+	EVP_DigestUpdate(k->outer, pad, sizeof(pad));
+
+	OPENSSL_cleanse(block, sizeof(block));
+	OPENSSL_cleanse(pad, sizeof(pad));
+}
+
+void hmac_sha1_key_clear(struct hmac_sha1_key *k) {
+	if (k->inner)
+		EVP_MD_CTX_free(k->inner);
+	if (k->outer)
+		EVP_MD_CTX_free(k->outer);
+	k->inner = k->outer = NULL;
+}
+
+static void hmac_sha1_ctx_free(void *p) {
+	EVP_MD_CTX_free(p);
+}
+
+// working context for hmac_sha1_iov, one per thread, released on thread exit
+static GPrivate hmac_sha1_ctx = G_PRIVATE_INIT(hmac_sha1_ctx_free);
+
+// produces 20 bytes of output
+bool hmac_sha1_iov(const struct hmac_sha1_key *k, const struct iovec *iov, int iov_cnt,
+		unsigned char *digest)
+{
+	if (!k->inner)
+		return false;
+
+	EVP_MD_CTX *ctx = g_private_get(&hmac_sha1_ctx);
+	if (!ctx) {
+		ctx = EVP_MD_CTX_new();
+		g_private_set(&hmac_sha1_ctx, ctx);
+	}
+	unsigned char inner[SHA_DIGEST_LENGTH];
+
+	// copying the precomputed key states resets the context
+
+	EVP_MD_CTX_copy_ex(ctx, k->inner);
+	for (int i = 0; i < iov_cnt; i++)
+		EVP_DigestUpdate(ctx, iov[i].iov_base, iov[i].iov_len);
+	EVP_DigestFinal_ex(ctx, inner, NULL);
+
+	EVP_MD_CTX_copy_ex(ctx, k->outer);
+	EVP_DigestUpdate(ctx, inner, sizeof(inner));
+	EVP_DigestFinal_ex(ctx, digest, NULL);
+
+	return true;
+}
@@ -3,6 +3,8 @@
 
 
 #include <openssl/ssl.h>
+#include <stdbool.h>
+#include <sys/uio.h>
 
 
 
@@ -12,7 +14,20 @@ extern EVP_MAC_CTX *rtpe_hmac_sha1_base;
 
 
 
+// HMAC-SHA1 with the key schedule done up front: SHA-1 states after absorbing
+// the padded key XOR ipad and XOR opad respectively. Read-only once set up, so
+// can be used from multiple threads at once.
+struct hmac_sha1_key {
+	EVP_MD_CTX		*inner;
+	EVP_MD_CTX		*outer;
+};
+
+
 void rtpe_ssl_init(void);
 
+void hmac_sha1_key_init(struct hmac_sha1_key *, const void *key, size_t len);
+void hmac_sha1_key_clear(struct hmac_sha1_key *);
+bool hmac_sha1_iov(const struct hmac_sha1_key *, const struct iovec *, int iov_cnt, unsigned char *digest);
+
 
 #endif
@@ -22,7 +22,7 @@ BEGIN {
 	@ISA = qw(Exporter);
 	our @EXPORT = qw(autotest_start new_call offer answer ft tt cid snd srtp_snd rtp rcv srtp_rcv rcv_no
 		srtp_dec escape rtpm rtpmre reverse_tags new_ft new_tt crlf sdp_split rtpe_req offer_answer
-		autotest_init subscribe_request subscribe_answer publish use_json);
+		autotest_init autotest_stop subscribe_request subscribe_answer publish use_json);
 };
 
 
@@ -36,6 +36,9 @@ my ($cid, $ft, $tt, @sockets, $tag_iter, $tag_suffix);
 sub autotest_start {
 	my (@cmdline) = @_;
 
+	# to run an existing test script against a different daemon configuration
+	push(@cmdline, split(' ', $ENV{RTPE_TEST_EXTRA_ARGS})) if $ENV{RTPE_TEST_EXTRA_ARGS};
+
 	like $ENV{LD_PRELOAD}, qr/tests-preload/, 'LD_PRELOAD present';
 	is $ENV{RTPE_PRELOAD_TEST_ACTIVE}, '1', 'preload library is active';
 	SKIP: {
@@ -115,7 +118,7 @@ sub sdp_split {
 	return split(/--------*\n/, $s);
 }
 sub rtpe_req {
-	my ($cmd, $name, $req) = @_;
+	my ($cmd, $name, $req, $exp_result) = @_;
 	$req->{command} = $cmd;
 	$req->{'call-id'} = $cid;
 	my $resp;
@@ -125,7 +128,7 @@ sub rtpe_req {
 		alarm(0);
 	};
 	terminate("'$cmd' request failed ($@)") if $@;
-	is $resp->{result}, 'ok', "$name - '$cmd' status";
+	is $resp->{result}, $exp_result // 'ok', "$name - '$cmd' status";
 	return $resp;
 }
 sub sdp_match {
@@ -317,7 +320,7 @@ sub use_json {
 }
 
 
-END {
+sub autotest_stop {
 	if ($rtpe_pid) {
 		kill('INT', $rtpe_pid) or terminate("cannot interrupt rtpe");
 		# wait for daemon to terminate
@@ -330,9 +333,14 @@ END {
 		kill('KILL', $rtpe_pid) if $status == 0;
 		$status == $rtpe_pid or terminate("cannot wait for process $rtpe_pid: $status: $!");
 		$? == 0 or terminate("process exited with $?");
+		$rtpe_pid = undef;
 	}
 }
 
+END {
+	autotest_stop();
+}
+
 
 
 1;
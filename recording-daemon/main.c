@@ -30,6 +30,7 @@
 #include "socket.h"
 #include "ssllib.h"
 #include "notify.h"
+#include "writer.h"
 
 
 
@@ -49,6 +50,12 @@ mode_t output_chmod_dir;
 uid_t output_chown = -1;
 gid_t output_chgrp = -1;
 char *output_pattern = NULL;
+int output_writer_threads = 0;
+int output_buffer_size = 64; // KiB
+int output_queue_limit = 64; // MiB
+gboolean output_direct_io;
+int output_stats_interval = 60;
+char *output_stats_file;
 gboolean decoding_enabled;
 char *c_mysql_host,
       *c_mysql_user,
@@ -102,6 +109,7 @@ static void setup(void) {
 	mysql_library_init(0, NULL, NULL);
 	signals();
 	metafile_setup();
+	writer_setup();
 	epoll_setup();
 	inotify_setup();
 
@@ -165,6 +173,7 @@ static void cleanup(void) {
 	notify_cleanup();
 	garbage_collect_all();
 	metafile_cleanup();
+	writer_cleanup();
 	inotify_cleanup();
 	epoll_cleanup();
 	mysql_library_end();
@@ -208,6 +217,12 @@ static void options(int *argc, char ***argv) {
 		{ "output-chmod-dir",	0,   0, G_OPTION_ARG_STRING,	&chmod_dir_mode,"Directory mode for recordings",	"OCTAL"		},
 		{ "output-chown",	0,   0, G_OPTION_ARG_STRING,	&user_uid,	"File owner for recordings",		"USER|UID"	},
 		{ "output-chgrp",	0,   0, G_OPTION_ARG_STRING,	&group_gid,	"File group for recordings",		"GROUP|GID"	},
+		{ "output-writer-threads",0, 0, G_OPTION_ARG_INT,	&output_writer_threads,"Number of threads writing output files","INT"	},
+		{ "output-buffer",	0,   0, G_OPTION_ARG_INT,	&output_buffer_size,"Write-behind buffer size per output file","KiB"	},
+		{ "output-queue-limit",	0,   0, G_OPTION_ARG_INT,	&output_queue_limit,"Maximum amount of queued output data","MiB"	},
+		{ "output-direct-io",	0,   0, G_OPTION_ARG_NONE,	&output_direct_io,"Use O_DIRECT for writing output files",NULL		},
+		{ "output-stats-interval",0, 0, G_OPTION_ARG_INT,	&output_stats_interval,"How often to log output writer stats","SECONDS"},
+		{ "output-stats-file",	0,   0, G_OPTION_ARG_FILENAME,	&output_stats_file,"File to write output writer metrics to","PATH"	},
 		{ "mysql-host",		0,   0,	G_OPTION_ARG_STRING,	&c_mysql_host,	"MySQL host for storage of call metadata","HOST|IP"	},
 		{ "mysql-port",		0,   0,	G_OPTION_ARG_INT,	&c_mysql_port,	"MySQL port"				,"INT"		},
 		{ "mysql-user",		0,   0,	G_OPTION_ARG_STRING,	&c_mysql_user,	"MySQL connection credentials",		"USERNAME"	},
@@ -316,6 +331,11 @@ static void options(int *argc, char ***argv) {
 	if (num_threads <= 0)
 		num_threads = num_cpu_cores(8);
 
+	if (output_buffer_size <= 0)
+		die("Invalid 'output-buffer' option");
+	if (output_queue_limit <= 0)
+		die("Invalid 'output-queue-limit' option");
+
 	if (!output_pattern)
 		output_pattern = g_strdup("%c-%t");
 	if (!strstr(output_pattern, "%c"))
@@ -329,6 +349,7 @@ static void options_free(void) {
 	g_free(spool_dir);
 	g_free(output_dir);
 	g_free(output_format);
+	g_free(output_stats_file);
 	g_free(c_mysql_host);
 	g_free(c_mysql_user);
 	g_free(c_mysql_pass);
@@ -32,6 +32,12 @@ extern mode_t output_chmod_dir;
 extern uid_t output_chown;
 extern gid_t output_chgrp;
 extern char *output_pattern;
+extern int output_writer_threads;
+extern int output_buffer_size;
+extern int output_queue_limit;
+extern gboolean output_direct_io;
+extern int output_stats_interval;
+extern char *output_stats_file;
 extern gboolean decoding_enabled;
 extern char *c_mysql_host,
       *c_mysql_user,
@@ -32,6 +32,14 @@ static size_t dummy_read(char *ptr, size_t size, size_t nmemb, void *userdata) {
 	return 0;
 }
 
+static void notify_req_free(struct notif_req *req) {
+	curl_slist_free_all(req->headers);
+	g_free(req->name);
+	g_free(req->full_filename_path);
+	g_slice_free1(sizeof(*req), req);
+}
+
+
 static void do_notify(void *p, void *u) {
 	struct notif_req *req = p;
 	const char *err = NULL;
@@ -186,10 +194,7 @@ cleanup:
 		curl_mime_free(mime);
 #endif
 
-	curl_slist_free_all(req->headers);
-	g_free(req->name);
-	g_free(req->full_filename_path);
-	g_slice_free1(sizeof(*req), req);
+	notify_req_free(req);
 }
 
 
@@ -263,6 +268,7 @@ void notify_setup(void) {
 void notify_cleanup(void) {
 	if (notify_threadpool)
 		g_thread_pool_free(notify_threadpool, true, false);
+	notify_threadpool = NULL;
 	if (notify_waiter && notify_timers) {
 		// get lock, free GTree, signal thread to shut down
 		pthread_mutex_lock(&timer_lock);
@@ -283,9 +289,10 @@ static void notify_add_header(struct notif_req *req, const char *fmt, ...) {
 	va_end(ap);
 }
 
-void notify_push_output(output_t *o, metafile_t *mf, tag_t *tag) {
+// returns NULL if notifications are disabled
+struct notif_req *notify_output_req(output_t *o, metafile_t *mf, tag_t *tag) {
 	if (!notify_threadpool)
-		return;
+		return NULL;
 
 	struct notif_req *req = g_slice_alloc0(sizeof(*req));
 
@@ -322,5 +329,20 @@ void notify_push_output(output_t *o, metafile_t *mf, tag_t *tag) {
 
 	req->falloff = 5; // initial retry time
 
+	return req;
+}
+
+void notify_push_req(struct notif_req *req) {
+	if (!req)
+		return;
+	if (!notify_threadpool) {
+		// shutting down
+		notify_req_free(req);
+		return;
+	}
 	g_thread_pool_push(notify_threadpool, req, NULL);
 }
+
+void notify_push_output(output_t *o, metafile_t *mf, tag_t *tag) {
+	notify_push_req(notify_output_req(o, mf, tag));
+}
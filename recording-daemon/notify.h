@@ -4,10 +4,15 @@
 #include <glib.h>
 #include "types.h"
 
+struct notif_req;
+
 void notify_setup(void);
 void notify_cleanup(void);
 
 void notify_push_output(output_t *, metafile_t *, tag_t *);
+// for notifications to be sent later, e.g. once the output file has been completely written
+struct notif_req *notify_output_req(output_t *, metafile_t *, tag_t *);
+void notify_push_req(struct notif_req *);
 void notify_push_call(metafile_t *);
 
 #endif
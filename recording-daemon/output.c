@@ -12,6 +12,7 @@
 #include "main.h"
 #include "recaux.h"
 #include "notify.h"
+#include "writer.h"
 
 
 //static int output_codec_id;
@@ -22,7 +23,7 @@ int mp3_bitrate;
 
 
 
-static bool output_shutdown(output_t *output);
+static bool output_shutdown(output_t *output, writer_done_f *done);
 
 
 
@@ -236,7 +237,7 @@ int output_config(output_t *output, const format_t *requested_format, format_t *
 	if (G_LIKELY(format_eq(&req_fmt, &output->requested_format)))
 		goto done;
 
-	output_shutdown(output);
+	output_shutdown(output, NULL);
 
 	err = "failed to alloc format context";
 	output->fmtctx = avformat_alloc_context();
@@ -301,9 +302,18 @@ int output_config(output_t *output, const format_t *requested_format, format_t *
 got_fn:
 	output->filename = full_fn;
 	err = "failed to open avio";
-	av_ret = avio_open(&output->fmtctx->pb, full_fn, AVIO_FLAG_WRITE);
-	if (av_ret < 0)
-		goto err;
+	if (writer_enabled()) {
+		output->writer = writer_open(full_fn, &output->fmtctx->pb);
+		if (!output->writer) {
+			av_ret = AVERROR(errno);
+			goto err;
+		}
+	}
+	else {
+		av_ret = avio_open(&output->fmtctx->pb, full_fn, AVIO_FLAG_WRITE);
+		if (av_ret < 0)
+			goto err;
+	}
 	err = "failed to write header";
 	av_ret = avformat_write_header(output->fmtctx, NULL);
 	if (av_ret)
@@ -317,7 +327,7 @@ done:
 	return 0;
 
 err:
-	output_shutdown(output);
+	output_shutdown(output, NULL);
 	ilog(LOG_ERR, "Error configuring media output: %s", err);
 	if (av_ret)
 		ilog(LOG_ERR, "Error returned from libav: %s", av_error(av_ret));
@@ -325,7 +335,8 @@ err:
 }
 
 
-static bool output_shutdown(output_t *output) {
+// with a writer thread, `done` is called from that thread once the file has been closed
+static bool output_shutdown(output_t *output, writer_done_f *done) {
 	if (!output)
 		return false;
 	if (!output->fmtctx)
@@ -334,9 +345,16 @@ static bool output_shutdown(output_t *output) {
 	ilog(LOG_INFO, "Closing output media file '%s'", output->filename);
 
 	bool ret = false;
+	AVIOContext *pb = NULL;
 	if (output->fmtctx->pb) {
 		av_write_trailer(output->fmtctx);
-		avio_closep(&output->fmtctx->pb);
+		if (output->writer) {
+			// handed over to the writer below
+			pb = output->fmtctx->pb;
+			output->fmtctx->pb = NULL;
+		}
+		else
+			avio_closep(&output->fmtctx->pb);
 		ret = true;
 		if (output_chmod)
 			if (chmod(output->filename, output_chmod))
@@ -359,15 +377,55 @@ static bool output_shutdown(output_t *output) {
 	output->fmtctx = NULL;
 	output->avst = NULL;
 
+	if (output->writer) {
+		// this must come last: `done` may run and release the output as soon as the
+		// close is queued, and then also reports the final result
+		if (done)
+			writer_close(&output->writer, &pb, done, output);
+		else if (!writer_close(&output->writer, &pb, NULL, NULL))
+			ilog(LOG_WARN, "Output file '%s%s%s' is incomplete, data was dropped as storage "
+					"couldn't keep up", FMT_M(output->filename));
+	}
+
 	return ret;
 }
 
 
+static void output_free(output_t *output) {
+	encoder_free(output->encoder);
+	g_clear_pointer(&output->full_filename, g_free);
+	g_clear_pointer(&output->file_path, g_free);
+	g_clear_pointer(&output->file_name, g_free);
+	g_clear_pointer(&output->filename, g_free);
+	g_slice_free1(sizeof(*output), output);
+}
+
+
+// called from the writer thread once an output file is complete
+static void output_written(void *p, bool ok) {
+	output_t *output = p;
+
+	if (!ok)
+		ilog(LOG_WARN, "Output file '%s%s%s' has not been written completely",
+				FMT_M(output->filename));
+
+	db_close_stream(output);
+	notify_push_req(output->notify);
+	output_free(output);
+}
+
+
 void output_close(metafile_t *mf, output_t *output, tag_t *tag, bool discard) {
 	if (!output)
 		return;
 	if (!discard) {
-		if (output_shutdown(output)) {
+		if (output->writer) {
+			// the database and notifications are updated once the file is complete
+			output->notify = notify_output_req(output, mf, tag);
+			output_shutdown(output, output_written);
+			return;
+		}
+		if (output_shutdown(output, NULL)) {
 			db_close_stream(output);
 			notify_push_output(output, mf, tag);
 		}
@@ -375,18 +433,13 @@ void output_close(metafile_t *mf, output_t *output, tag_t *tag, bool discard) {
 			db_delete_stream(mf, output);
 	}
 	else {
-		output_shutdown(output);
+		output_shutdown(output, NULL);
 		if (unlink(output->filename))
 			ilog(LOG_WARN, "Failed to unlink '%s%s%s': %s",
 					FMT_M(output->filename), strerror(errno));
 		db_delete_stream(mf, output);
 	}
-	encoder_free(output->encoder);
-	g_clear_pointer(&output->full_filename, g_free);
-	g_clear_pointer(&output->file_path, g_free);
-	g_clear_pointer(&output->file_name, g_free);
-	g_clear_pointer(&output->filename, g_free);
-	g_slice_free1(sizeof(*output), output);
+	output_free(output);
 }
 
 
@@ -12,6 +12,7 @@
 #include "packet.h"
 #include "forward.h"
 #include "recaux.h"
+#include "xt_RTPENGINE.h"
 
 
 #define MAXBUFLEN 65535
@@ -21,7 +22,12 @@
 #ifndef FF_INPUT_BUFFER_PADDING_SIZE
 #define FF_INPUT_BUFFER_PADDING_SIZE 0
 #endif
-#define ALLOCLEN (MAXBUFLEN + AV_INPUT_BUFFER_PADDING_SIZE + FF_INPUT_BUFFER_PADDING_SIZE)
+#define PADDING (AV_INPUT_BUFFER_PADDING_SIZE + FF_INPUT_BUFFER_PADDING_SIZE)
+#define ALLOCLEN (MAXBUFLEN + PADDING)
+#define BATCHBUFLEN (256 * 1024)
+
+
+static __thread unsigned char *batch_buf; // allocated on first use, freed by stream_thread_end()
 
 
 // stream is locked
@@ -37,6 +43,62 @@ void stream_free(stream_t *stream) {
 	g_slice_free1(sizeof(*stream), stream);
 }
 
+// to be called by each thread handling stream reads before it exits
+void stream_thread_end(void) {
+	free(batch_buf);
+	batch_buf = NULL;
+}
+
+
+static void stream_packet(stream_t *stream, unsigned char *buf, int len) {
+	if (forward_to){
+		if (forward_packet(stream->metafile,buf,len)) // leaves buf intact
+			g_atomic_int_inc(&stream->metafile->forward_failed);
+		else
+			g_atomic_int_inc(&stream->metafile->forward_count);
+	}
+	if (decoding_enabled)
+		packet_process(stream, buf, len); // consumes buf
+	else
+		free(buf);
+}
+
+
+// splits up one batch read from the kernel. called unlocked.
+static void stream_batch(stream_t *stream, const unsigned char *buf, size_t len) {
+	struct rtpengine_stream_batch hdr;
+	if (len < sizeof(hdr))
+		return;
+	memcpy(&hdr, buf, sizeof(hdr));
+
+	if (hdr.dropped)
+		ilog(LOG_WARN | LOG_FLAG_LIMIT, "Kernel discarded %u packets from full queue of stream %s",
+				hdr.dropped, stream->name);
+
+	size_t pos = sizeof(hdr);
+	for (unsigned int i = 0; i < hdr.packets; i++) {
+		struct rtpengine_stream_batch_packet phdr;
+		if (len - pos < sizeof(phdr))
+			break;
+		memcpy(&phdr, buf + pos, sizeof(phdr));
+		pos += sizeof(phdr);
+		if (phdr.len > len - pos)
+			break;
+		if (phdr.len < phdr.orig_len)
+			ilog(LOG_WARN | LOG_FLAG_LIMIT, "Truncated packet from kernel (%u of %u bytes)",
+					phdr.len, phdr.orig_len);
+
+		unsigned char *pbuf = malloc(phdr.len + PADDING);
+		memcpy(pbuf, buf + pos, phdr.len);
+		memset(pbuf + phdr.len, 0, PADDING);
+		stream_packet(stream, pbuf, phdr.len);
+
+		pos += (phdr.len + RTPE_STREAM_BATCH_ALIGN - 1) & ~(RTPE_STREAM_BATCH_ALIGN - 1);
+		if (pos > len)
+			break;
+	}
+}
+
 
 static void stream_handler(handler_t *handler) {
 	stream_t *stream = handler->ptr;
@@ -53,8 +115,16 @@ static void stream_handler(handler_t *handler) {
 		if (stream->fd == -1)
 			break;
 
-		buf = malloc(ALLOCLEN);
-		int ret = read(stream->fd, buf, MAXBUFLEN);
+		int ret;
+		if (stream->batch) {
+			if (!batch_buf)
+				batch_buf = malloc(BATCHBUFLEN);
+			ret = read(stream->fd, batch_buf, BATCHBUFLEN);
+		}
+		else {
+			buf = malloc(ALLOCLEN);
+			ret = read(stream->fd, buf, MAXBUFLEN);
+		}
 		if (ret == 0) {
 			ilog(LOG_INFO, "EOF on stream %s", stream->name);
 			stream_close(stream);
@@ -68,19 +138,13 @@ static void stream_handler(handler_t *handler) {
 			break;
 		}
 
-		// got a packet
+		// got a packet, or a batch of packets
 		pthread_mutex_unlock(&stream->lock);
 
-		if (forward_to){
-			if (forward_packet(stream->metafile,buf,ret)) // leaves buf intact
-				g_atomic_int_inc(&stream->metafile->forward_failed);
-			else
-				g_atomic_int_inc(&stream->metafile->forward_count);
-		}
-		if (decoding_enabled)
-			packet_process(stream, buf, ret); // consumes buf
+		if (stream->batch)
+			stream_batch(stream, batch_buf, ret);
 		else
-			free(buf);
+			stream_packet(stream, buf, ret);
 
 		buf = NULL;
 	}
@@ -126,7 +190,19 @@ void stream_open(metafile_t *mf, unsigned long id, char *name) {
 	char fnbuf[PATH_MAX];
 	snprintf(fnbuf, sizeof(fnbuf), "/proc/rtpengine/%u/calls/%s/%s", ktable, mf->parent, name);
 
-	stream->fd = open(fnbuf, O_RDONLY | O_NONBLOCK);
+	// opened read-write to be able to switch to batched reads, which older kernel
+	// modules don't support
+	stream->batch = 0;
+	stream->fd = open(fnbuf, O_RDWR | O_NONBLOCK);
+	if (stream->fd != -1) {
+		struct rtpengine_stream_mode_info mode = { .mode = RE_STREAM_MODE_BATCH };
+		if (write(stream->fd, &mode, sizeof(mode)) == sizeof(mode))
+			stream->batch = 1;
+		else
+			dbg("Kernel stream %s doesn't support batched reads: %s", fnbuf, strerror(errno));
+	}
+	else
+		stream->fd = open(fnbuf, O_RDONLY | O_NONBLOCK);
 	if (stream->fd == -1) {
 		ilog(LOG_ERR, "Failed to open kernel stream %s: %s", fnbuf, strerror(errno));
 		return;
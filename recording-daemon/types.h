@@ -31,6 +31,8 @@ struct metafile_s;
 typedef struct metafile_s metafile_t;
 struct output_s;
 typedef struct output_s output_t;
+struct writer_file_s;
+typedef struct writer_file_s writer_file_t;
 struct mix_s;
 typedef struct mix_s mix_t;
 struct decode_s;
@@ -55,6 +57,7 @@ struct stream_s {
 	int fd;
 	handler_t handler;
 	unsigned int forwarding_on:1;
+	unsigned int batch:1; // kernel delivers packets in batches
 	double start_time;
 };
 typedef struct stream_s stream_t;
@@ -161,6 +164,8 @@ struct output_s {
 
 	AVFormatContext *fmtctx;
 	AVStream *avst;
+	writer_file_t *writer;
+	struct notif_req *notify; // sent once the writer thread has finished the file
 	encoder_t *encoder;
 	format_t requested_format,
 		 actual_format;
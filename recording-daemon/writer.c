@@ -0,0 +1,564 @@
+#include "writer.h"
+#include <stdlib.h>
+#include <inttypes.h>
+#include <time.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <glib.h>
+#include <libavutil/mem.h>
+#include <mysql.h>
+#include "main.h"
+#include "log.h"
+#include "db.h"
+
+
+// Output files are written through a pool of writer threads, so that slow storage doesn't
+// stall the poller threads doing the decoding and mixing. libavformat writes into a
+// per-file AVIOContext buffer, and each full buffer (or each flush or seek) is handed to
+// the writer thread that owns the file as one chunk, to be written with pwrite(). All
+// chunks of one file go to the same thread, so they're written in order. The total
+// amount of queued data is bounded: once the limit is reached, further chunks are dropped
+// and counted instead of holding up the submitting thread. Closing a file is queued the
+// same way, and the writer thread finishes it once everything before it has been written.
+
+
+#define DIRECT_IO_ALIGN 4096
+
+
+struct writer_chunk {
+	writer_file_t *file;
+	int64_t offset;
+	size_t len;
+	gint64 queued; // monotonic us
+	char *buf;
+	bool close; // no data, close the file
+};
+
+struct writer_file_s {
+	char *filename;
+	int fd;
+	bool direct; // fd currently has O_DIRECT set
+	bool direct_ok; // O_DIRECT is supported for this file
+	unsigned int idx; // writer thread
+
+	// only accessed by the writer thread
+	int error;
+
+	// only accessed by the thread owning the output
+	int64_t pos;
+	int64_t size;
+	unsigned int dropped; // chunks
+
+	// set when the close is queued
+	writer_done_f *done;
+	void *done_data;
+};
+
+struct writer_thread {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond; // new chunks
+	GQueue chunks;
+	bool shutdown;
+};
+
+struct writer_stats {
+	uint64_t chunks;
+	uint64_t bytes;
+	uint64_t queue_time; // us
+	uint64_t queue_time_max;
+	uint64_t io_time; // us
+	uint64_t io_time_max;
+	uint64_t drops;
+	uint64_t errors;
+	size_t queued_max;
+};
+
+// never reset, for the metrics file
+struct writer_totals {
+	uint64_t chunks;
+	uint64_t bytes;
+	uint64_t queue_time; // us
+	uint64_t io_time; // us
+	uint64_t drops;
+	uint64_t dropped_bytes;
+	uint64_t errors;
+};
+
+
+static struct writer_thread *writer_threads;
+static unsigned int writer_thread_idx;
+
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static size_t queued_bytes;
+static size_t queue_limit;
+static size_t buffer_size;
+
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct writer_stats stats;
+static struct writer_totals totals;
+static gint64 stats_next;
+
+
+
+bool writer_enabled(void) {
+	return writer_threads != NULL;
+}
+
+
+// Prometheus text format, for the node exporter's textfile collector or similar. Replaced
+// atomically so that readers never see a partial file.
+static void writer_metrics_write(const struct writer_totals *t, size_t queued) {
+	AUTO_CLEANUP_GBUF(tmp);
+	tmp = g_strdup_printf("%s.tmp", output_stats_file);
+	FILE *fp = fopen(tmp, "w");
+	if (!fp) {
+		ilog(LOG_WARN | LOG_FLAG_LIMIT, "Failed to open metrics file '%s%s%s': %s",
+				FMT_M(tmp), strerror(errno));
+		return;
+	}
+
+#define METRIC(name, type, fmt, val) \
+	fprintf(fp, "# TYPE rtpengine_recording_writer_" name " " type "\n" \
+			"rtpengine_recording_writer_" name " " fmt "\n", val)
+
+	METRIC("queued_bytes", "gauge", "%zu", queued);
+	METRIC("queue_limit_bytes", "gauge", "%zu", queue_limit);
+	METRIC("writes_total", "counter", "%" PRIu64, t->chunks);
+	METRIC("written_bytes_total", "counter", "%" PRIu64, t->bytes);
+	METRIC("queue_seconds_total", "counter", "%.6f", (double) t->queue_time / 1000000.0);
+	METRIC("io_seconds_total", "counter", "%.6f", (double) t->io_time / 1000000.0);
+	METRIC("drops_total", "counter", "%" PRIu64, t->drops);
+	METRIC("dropped_bytes_total", "counter", "%" PRIu64, t->dropped_bytes);
+	METRIC("errors_total", "counter", "%" PRIu64, t->errors);
+
+#undef METRIC
+
+	if (fclose(fp) || rename(tmp, output_stats_file)) {
+		ilog(LOG_WARN | LOG_FLAG_LIMIT, "Failed to write metrics file '%s%s%s': %s",
+				FMT_M(output_stats_file), strerror(errno));
+		unlink(tmp);
+	}
+}
+
+
+static void writer_stats_report(void) {
+	gint64 now = g_get_monotonic_time();
+
+	pthread_mutex_lock(&stats_lock);
+	if (now < stats_next) {
+		pthread_mutex_unlock(&stats_lock);
+		return;
+	}
+	stats_next = now + output_stats_interval * 1000000LL;
+	struct writer_stats s = stats;
+	struct writer_totals t = totals;
+	memset(&stats, 0, sizeof(stats));
+	pthread_mutex_unlock(&stats_lock);
+
+	pthread_mutex_lock(&queue_lock);
+	size_t cur = queued_bytes;
+	pthread_mutex_unlock(&queue_lock);
+
+	if (output_stats_file)
+		writer_metrics_write(&t, cur);
+
+	if (!s.chunks && !s.drops && !s.errors)
+		return;
+
+	ilog(LOG_INFO, "Output writer stats: %" PRIu64 " writes, %" PRIu64 " bytes, "
+			"queue time avg %" PRIu64 " max %" PRIu64 " us, "
+			"I/O time avg %" PRIu64 " max %" PRIu64 " us, "
+			"queued %zu bytes (max %zu), %" PRIu64 " drops, %" PRIu64 " errors",
+			s.chunks, s.bytes,
+			s.chunks ? s.queue_time / s.chunks : 0, s.queue_time_max,
+			s.chunks ? s.io_time / s.chunks : 0, s.io_time_max,
+			cur, s.queued_max, s.drops, s.errors);
+}
+
+
+static void writer_set_direct(writer_file_t *f, bool direct) {
+	if (f->direct == direct)
+		return;
+	int flags = fcntl(f->fd, F_GETFL);
+	if (flags == -1)
+		return;
+	if (direct)
+		flags |= O_DIRECT;
+	else
+		flags &= ~O_DIRECT;
+	if (fcntl(f->fd, F_SETFL, flags)) {
+		f->direct_ok = false;
+		return;
+	}
+	f->direct = direct;
+}
+
+
+static int writer_do_write(struct writer_chunk *c) {
+	writer_file_t *f = c->file;
+
+	if (f->direct_ok) {
+		// O_DIRECT only for fully aligned chunks, everything else through the page cache
+		bool aligned = (c->offset % DIRECT_IO_ALIGN) == 0 && (c->len % DIRECT_IO_ALIGN) == 0;
+		writer_set_direct(f, aligned);
+	}
+
+	size_t done = 0;
+	while (done < c->len) {
+		ssize_t ret = pwrite(f->fd, c->buf + done, c->len - done, c->offset + done);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EINVAL && f->direct) {
+				// filesystem doesn't support it after all
+				f->direct_ok = false;
+				writer_set_direct(f, false);
+				continue;
+			}
+			return errno;
+		}
+		done += ret;
+	}
+	return 0;
+}
+
+
+static void writer_chunk_free(struct writer_chunk *c) {
+	pthread_mutex_lock(&queue_lock);
+	queued_bytes -= c->len;
+	pthread_mutex_unlock(&queue_lock);
+
+	free(c->buf);
+	g_slice_free1(sizeof(*c), c);
+}
+
+
+// all data before the close has been written
+static void writer_finish(writer_file_t *f) {
+	int err = f->error;
+	if (close(f->fd) && !err)
+		err = errno;
+	if (err)
+		ilog(LOG_ERR, "Error writing output file '%s%s%s': %s", FMT_M(f->filename), strerror(err));
+	if (f->dropped)
+		ilog(LOG_ERR, "Output file '%s%s%s' is incomplete: %u chunks were dropped as the "
+				"write queue was full", FMT_M(f->filename), f->dropped);
+
+	if (f->done)
+		f->done(f->done_data, err == 0 && f->dropped == 0);
+
+	g_free(f->filename);
+	g_slice_free1(sizeof(*f), f);
+}
+
+
+static void writer_thread_end(void) {
+	mysql_thread_end();
+	db_thread_end();
+}
+
+
+static void *writer_thread(void *p) {
+	struct writer_thread *wt = p;
+
+	// closing a file may involve database updates
+	mysql_thread_init();
+
+	pthread_mutex_lock(&wt->lock);
+
+	while (1) {
+		struct writer_chunk *c = g_queue_pop_head(&wt->chunks);
+		if (!c) {
+			if (wt->shutdown)
+				break;
+			if (wt == &writer_threads[0] && output_stats_interval > 0) {
+				struct timespec ts;
+				clock_gettime(CLOCK_REALTIME, &ts);
+				ts.tv_sec += 1;
+				pthread_cond_timedwait(&wt->cond, &wt->lock, &ts);
+				pthread_mutex_unlock(&wt->lock);
+				writer_stats_report();
+				pthread_mutex_lock(&wt->lock);
+			}
+			else
+				pthread_cond_wait(&wt->cond, &wt->lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&wt->lock);
+
+		if (c->close) {
+			writer_finish(c->file);
+			writer_chunk_free(c);
+			pthread_mutex_lock(&wt->lock);
+			continue;
+		}
+
+		gint64 start = g_get_monotonic_time();
+		int err = writer_do_write(c);
+		gint64 end = g_get_monotonic_time();
+
+		if (err) {
+			ilog(LOG_ERR | LOG_FLAG_LIMIT, "Failed to write to output file '%s%s%s': %s",
+					FMT_M(c->file->filename), strerror(err));
+			if (!c->file->error)
+				c->file->error = err;
+		}
+
+		pthread_mutex_lock(&stats_lock);
+		stats.chunks++;
+		stats.bytes += c->len;
+		uint64_t qt = start - c->queued;
+		uint64_t iot = end - start;
+		stats.queue_time += qt;
+		if (qt > stats.queue_time_max)
+			stats.queue_time_max = qt;
+		stats.io_time += iot;
+		if (iot > stats.io_time_max)
+			stats.io_time_max = iot;
+		if (err)
+			stats.errors++;
+		totals.chunks++;
+		totals.bytes += c->len;
+		totals.queue_time += qt;
+		totals.io_time += iot;
+		if (err)
+			totals.errors++;
+		pthread_mutex_unlock(&stats_lock);
+
+		writer_chunk_free(c);
+
+		if (wt == &writer_threads[0] && output_stats_interval > 0)
+			writer_stats_report();
+
+		pthread_mutex_lock(&wt->lock);
+	}
+
+	pthread_mutex_unlock(&wt->lock);
+
+	writer_thread_end();
+	return NULL;
+}
+
+
+static void writer_queue(writer_file_t *f, struct writer_chunk *c) {
+	struct writer_thread *wt = &writer_threads[f->idx];
+	c->queued = g_get_monotonic_time();
+	pthread_mutex_lock(&wt->lock);
+	g_queue_push_tail(&wt->chunks, c);
+	pthread_cond_broadcast(&wt->cond);
+	pthread_mutex_unlock(&wt->lock);
+}
+
+
+static void writer_submit(writer_file_t *f, const uint8_t *buf, int len) {
+	// bounded queue: if the writers can't keep up, drop the data instead of stalling the
+	// packet processing. the position still advances, so that the rest of the file stays
+	// where it belongs
+	pthread_mutex_lock(&queue_lock);
+	if (queued_bytes && queued_bytes + len > queue_limit) {
+		size_t q = queued_bytes;
+		pthread_mutex_unlock(&queue_lock);
+
+		ilog(LOG_WARN | LOG_FLAG_LIMIT, "Output write queue is full (%zu bytes), "
+				"storage can't keep up, dropping data for '%s%s%s'", q, FMT_M(f->filename));
+		pthread_mutex_lock(&stats_lock);
+		stats.drops++;
+		totals.drops++;
+		totals.dropped_bytes += len;
+		pthread_mutex_unlock(&stats_lock);
+
+		f->dropped++;
+		goto advance;
+	}
+	queued_bytes += len;
+	size_t q = queued_bytes;
+	pthread_mutex_unlock(&queue_lock);
+
+	pthread_mutex_lock(&stats_lock);
+	if (q > stats.queued_max)
+		stats.queued_max = q;
+	pthread_mutex_unlock(&stats_lock);
+
+	struct writer_chunk *c = g_slice_alloc0(sizeof(*c));
+	c->file = f;
+	c->offset = f->pos;
+	c->len = len;
+
+	if (output_direct_io) {
+		if (posix_memalign((void **) &c->buf, DIRECT_IO_ALIGN, len ? len : 1))
+			abort();
+	}
+	else {
+		c->buf = malloc(len ? len : 1);
+		if (!c->buf)
+			abort();
+	}
+	memcpy(c->buf, buf, len);
+
+	writer_queue(f, c);
+
+advance:
+	f->pos += len;
+	if (f->pos > f->size)
+		f->size = f->pos;
+}
+
+
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(61, 0, 0)
+static int writer_avio_write(void *opaque, const uint8_t *buf, int len) {
+#else
+static int writer_avio_write(void *opaque, uint8_t *buf, int len) {
+#endif
+	writer_file_t *f = opaque;
+	if (len > 0)
+		writer_submit(f, buf, len);
+	return len;
+}
+
+static int64_t writer_avio_seek(void *opaque, int64_t offset, int whence) {
+	writer_file_t *f = opaque;
+
+	if ((whence & AVSEEK_SIZE))
+		return f->size;
+
+	switch (whence & ~AVSEEK_FORCE) {
+		case SEEK_SET:
+			break;
+		case SEEK_CUR:
+			offset += f->pos;
+			break;
+		case SEEK_END:
+			offset += f->size;
+			break;
+		default:
+			return AVERROR(EINVAL);
+	}
+	if (offset < 0)
+		return AVERROR(EINVAL);
+	f->pos = offset;
+	return offset;
+}
+
+
+writer_file_t *writer_open(const char *filename, AVIOContext **pb) {
+	int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+	bool direct = output_direct_io;
+
+	int fd = open(filename, flags | (direct ? O_DIRECT : 0), 0666);
+	if (fd == -1 && direct && errno == EINVAL) {
+		ilog(LOG_WARN | LOG_FLAG_LIMIT, "Direct I/O not supported for '%s%s%s', using buffered I/O",
+				FMT_M(filename));
+		direct = false;
+		fd = open(filename, flags, 0666);
+	}
+	if (fd == -1)
+		return NULL;
+
+	writer_file_t *f = g_slice_alloc0(sizeof(*f));
+	f->filename = g_strdup(filename);
+	f->fd = fd;
+	f->direct = f->direct_ok = direct;
+	f->idx = g_atomic_int_add(&writer_thread_idx, 1) % output_writer_threads;
+
+	unsigned char *buf = av_malloc(buffer_size);
+	if (!buf)
+		goto err;
+	*pb = avio_alloc_context(buf, buffer_size, 1, f, NULL, writer_avio_write, writer_avio_seek);
+	if (!*pb) {
+		av_free(buf);
+		goto err;
+	}
+
+	return f;
+
+err:
+	close(fd);
+	g_free(f->filename);
+	g_slice_free1(sizeof(*f), f);
+	errno = ENOMEM;
+	return NULL;
+}
+
+
+bool writer_close(writer_file_t **fp, AVIOContext **pb, writer_done_f *done, void *data) {
+	writer_file_t *f = *fp;
+	if (!f)
+		return true;
+
+	if (*pb) {
+		avio_flush(*pb);
+		av_freep(&(*pb)->buffer);
+#if LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(57, 80, 0)
+		avio_context_free(pb);
+#else
+		av_freep(pb);
+#endif
+	}
+
+	bool ok = f->dropped == 0;
+
+	// the writer thread takes over the file from here
+	f->done = done;
+	f->done_data = data;
+	struct writer_chunk *c = g_slice_alloc0(sizeof(*c));
+	c->file = f;
+	c->close = true;
+	*fp = NULL; // before queueing, as `done` may release the owner of `fp`
+	writer_queue(f, c);
+
+	return ok;
+}
+
+
+void writer_setup(void) {
+	if (!output_enabled || output_writer_threads <= 0)
+		return;
+
+	buffer_size = (size_t) output_buffer_size * 1024;
+	if (output_direct_io)
+		buffer_size = (buffer_size + DIRECT_IO_ALIGN - 1) / DIRECT_IO_ALIGN * DIRECT_IO_ALIGN;
+	queue_limit = (size_t) output_queue_limit * 1024 * 1024;
+	if (queue_limit < buffer_size)
+		queue_limit = buffer_size;
+
+	stats_next = g_get_monotonic_time() + output_stats_interval * 1000000LL;
+
+	writer_threads = g_new0(struct writer_thread, output_writer_threads);
+	for (int i = 0; i < output_writer_threads; i++) {
+		struct writer_thread *wt = &writer_threads[i];
+		pthread_mutex_init(&wt->lock, NULL);
+		pthread_cond_init(&wt->cond, NULL);
+		g_queue_init(&wt->chunks);
+		if (pthread_create(&wt->thread, NULL, writer_thread, wt))
+			die_errno("pthread_create failed");
+	}
+}
+
+
+void writer_cleanup(void) {
+	if (!writer_threads)
+		return;
+
+	// writer threads drain their queues before exiting
+	for (int i = 0; i < output_writer_threads; i++) {
+		struct writer_thread *wt = &writer_threads[i];
+		pthread_mutex_lock(&wt->lock);
+		wt->shutdown = true;
+		pthread_cond_broadcast(&wt->cond);
+		pthread_mutex_unlock(&wt->lock);
+	}
+	for (int i = 0; i < output_writer_threads; i++) {
+		struct writer_thread *wt = &writer_threads[i];
+		pthread_join(wt->thread, NULL);
+		pthread_mutex_destroy(&wt->lock);
+		pthread_cond_destroy(&wt->cond);
+	}
+
+	g_free(writer_threads);
+	writer_threads = NULL;
+}
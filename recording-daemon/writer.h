@@ -0,0 +1,26 @@
+#ifndef _WRITER_H_
+#define _WRITER_H_
+
+#include <stdbool.h>
+#include <libavformat/avio.h>
+#include "types.h"
+
+
+void writer_setup(void);
+void writer_cleanup(void);
+
+bool writer_enabled(void);
+
+// Opens `filename` for writing and returns an AVIOContext that hands all written data to
+// the writer threads. NULL on error, with errno set.
+writer_file_t *writer_open(const char *filename, AVIOContext **pb);
+typedef void writer_done_f(void *, bool ok);
+
+// Flushes and frees the AVIOContext and hands the file over to its writer thread, which
+// closes it once all pending data has been written and then calls `done` (if given) from
+// the writer thread. `ok` is false if any data was dropped or any write failed. Returns
+// false if data has already been dropped at this point.
+bool writer_close(writer_file_t **, AVIOContext **pb, writer_done_f *done, void *);
+
+
+#endif
@@ -8,6 +8,8 @@ use NGCP::Rtpengine::AutoTest;
 use Test::More;
 use NGCP::Rtpclient::ICE;
 use POSIX;
+use File::Temp;
+use Time::HiRes;
 
 
 $ENV{RTPENGINE_EXTENDED_TESTS} or exit(); # timing sensitive tests
@@ -618,5 +620,142 @@ rcv($sock_b, -1, rtpm(8, $seq + 4, $ts + 160 * 4, $ssrc, $pcma_5));
 
 
 
+# size limit and disk cache, using media files. restarts the daemon
+
+my $media_dir = File::Temp::tempdir(CLEANUP => 1);
+my $cache_dir = File::Temp::tempdir(CLEANUP => 1);
+
+# same length as the sine wave, so that only the mtime tells the files apart
+my $silence_file = substr($wav_file, 0, 44) . ("\0" x 1600);
+my $silence = "\xd5" x 160;
+my $mtime = time() - 100;
+my %duration; # ms, 100 unless listed
+
+sub write_media {
+	my ($name, $content, $t) = @_;
+	$t //= $mtime;
+	my $path = "$media_dir/$name";
+	open(my $fh, '>', $path) or die;
+	binmode($fh);
+	print $fh $content;
+	close($fh) or die;
+	utime($t, $t, $path);
+	return $path;
+}
+
+# the disk cache file is found through the media file name stored in it
+sub cache_file_for {
+	my ($media) = @_;
+	for my $f (glob("$cache_dir/*.mpc")) {
+		open(my $fh, '<', $f) or die;
+		binmode($fh);
+		local $/;
+		my $c = <$fh>;
+		close($fh);
+		return $f if index($c, "$media\n") == 24;
+	}
+	return;
+}
+
+sub play_file {
+	my ($name, $file, @pcma) = @_;
+
+	my ($sock) = new_call([qw(198.51.100.1 2020)]);
+
+	offer($name, { ICE => 'remove', replace => ['origin'] }, <<SDP);
+v=0
+o=- 1545997027 1 IN IP4 198.51.100.1
+s=tester
+t=0 0
+m=audio 2020 RTP/AVP 8
+c=IN IP4 198.51.100.1
+a=sendrecv
+----------------------------------
+v=0
+o=- 1545997027 1 IN IP4 203.0.113.1
+s=tester
+t=0 0
+m=audio PORT RTP/AVP 8
+c=IN IP4 203.0.113.1
+a=rtpmap:8 PCMA/8000
+a=sendrecv
+a=rtcp:PORT
+SDP
+
+	my $resp = rtpe_req('play media', $name, { 'from-tag' => ft(), file => $file });
+	is $resp->{duration}, $duration{$file} // 100, "$name - media duration";
+
+	my (undef, $seq, $ts, $ssrc) = rcv($sock, -1, rtpm(8 | 0x80, -1, -1, -1, $pcma[0]));
+	for my $i (1 .. 4) {
+		rcv($sock, -1, rtpm(8, $seq + $i, $ts + 160 * $i, $ssrc, $pcma[$i]));
+	}
+}
+
+my @sine = ($pcma_1, $pcma_2, $pcma_3, $pcma_4, $pcma_5);
+my @silence = ($silence) x 5;
+my @media = map { write_media("media-$_.wav", $wav_file) } (1 .. 5);
+
+# 150 seconds of the sine wave, which makes a disk cache file bigger than the 1 MB cache
+my $big_data = substr($wav_file, 44) x 1500;
+my $big_file = write_media('media-big.wav', 'RIFF' . pack('V', 36 + length($big_data))
+	. substr($wav_file, 8, 32) . pack('V', length($big_data)) . $big_data);
+$duration{$big_file} = 150000;
+
+my @cache_opts = ('--player-cache-size=1', "--player-cache-dir=$cache_dir");
+
+autotest_stop();
+autotest_start(qw(--config-file=none -t -1 -i 203.0.113.1 -i 2001:db8:4321::1
+			-n 2223 -c 12345 -f -L 7 -E -u 2222 --player-cache), @cache_opts)
+		or die;
+
+play_file('cache size limit, first use', $media[0], @sine);
+
+# served from memory, even though the file has changed
+write_media('media-1.wav', $silence_file, $mtime + 1);
+play_file('cache size limit, cached', $media[0], @sine);
+
+# each entry takes one 256 kB arena, so the fifth one evicts the least recently used
+play_file("cache size limit, file $_", $media[$_ - 1], @sine) for (2 .. 5);
+
+# evicted, so the changed file is read again
+play_file('cache size limit, evicted', $media[0], @silence);
+
+# bigger than the whole cache, so it's evicted while still being decoded
+play_file('bigger than the cache', $big_file, @sine);
+
+Time::HiRes::sleep(1); # let the decoder threads finish writing the cache files
+
+# replace the media files with different content but the same size and mtime, so
+# that only a valid disk cache file can produce the original content
+
+write_media("media-$_.wav", $silence_file) for (2 .. 4);
+
+my $truncated = cache_file_for($media[2]);
+ok $truncated, 'disk cache file exists';
+truncate($truncated, 100) or die;
+
+my $corrupted = cache_file_for($media[3]);
+ok $corrupted, 'disk cache file exists';
+open(my $fh, '+<', $corrupted) or die;
+print $fh 'XXXXXXXX';
+close($fh) or die;
+
+autotest_stop();
+autotest_start(qw(--config-file=none -t -1 -i 203.0.113.1 -i 2001:db8:4321::1
+			-n 2223 -c 12345 -f -L 7 -E -u 2222 --player-cache), @cache_opts)
+		or die;
+
+play_file('disk cache reused after restart', $media[1], @sine);
+play_file('truncated disk cache file', $media[2], @silence);
+play_file('corrupted disk cache file', $media[3], @silence);
+
+# loaded from disk and evicted again as soon as it's inserted, twice
+ok -s cache_file_for($big_file) > 1024 * 1024, 'disk cache file bigger than the cache';
+play_file('disk cache file bigger than the cache', $big_file, @sine);
+play_file('disk cache file bigger than the cache, again', $big_file, @sine);
+
+
+
+
 #done_testing;NGCP::Rtpengine::AutoTest::terminate('f00');exit;
 done_testing();
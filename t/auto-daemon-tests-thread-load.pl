@@ -0,0 +1,92 @@
+#!/usr/bin/perl
+
+use strict;
+use warnings;
+use NGCP::Rtpengine::Test;
+use NGCP::Rtpengine::AutoTest;
+use Test::More;
+
+
+# one codec worker and a 1% limit: an idle daemon stays well below it, and the built-in
+# estimate for a G.711 transcoding call (2 us per packet at 100 packets/s) does too,
+# but the one for opus (150 us per packet) takes the codec worker to 1.5%
+
+autotest_start(qw(--config-file=none -t -1 -i 203.0.113.1 -i 2001:db8:4321::1
+			-n 2223 -c 12345 -f -L 7 -E -u 2222 --codec-threads=1 --max-thread-load=1))
+		or die;
+
+
+my $resp;
+
+
+
+new_call();
+
+offer('no transcoding', { }, <<SDP);
+v=0
+o=- 1545997027 1 IN IP4 172.17.0.2
+s=tester
+c=IN IP4 198.51.100.43
+t=0 0
+m=audio 6000 RTP/AVP 8
+----------------------------------
+v=0
+o=- 1545997027 1 IN IP4 172.17.0.2
+s=tester
+c=IN IP4 203.0.113.1
+t=0 0
+m=audio PORT RTP/AVP 8
+a=rtpmap:8 PCMA/8000
+a=sendrecv
+a=rtcp:PORT
+SDP
+
+rtpe_req('delete', 'no transcoding', { 'from-tag' => ft() });
+
+
+
+new_call();
+
+offer('cheap transcoding', { codec => { transcode => ['PCMU'] } }, <<SDP);
+v=0
+o=- 1545997027 1 IN IP4 172.17.0.2
+s=tester
+c=IN IP4 198.51.100.43
+t=0 0
+m=audio 6000 RTP/AVP 8
+----------------------------------
+v=0
+o=- 1545997027 1 IN IP4 172.17.0.2
+s=tester
+c=IN IP4 203.0.113.1
+t=0 0
+m=audio PORT RTP/AVP 8 0
+a=rtpmap:8 PCMA/8000
+a=rtpmap:0 PCMU/8000
+a=sendrecv
+a=rtcp:PORT
+SDP
+
+rtpe_req('delete', 'cheap transcoding', { 'from-tag' => ft() });
+
+
+
+new_call();
+
+$resp = rtpe_req('offer', 'expensive transcoding', {
+	'from-tag' => ft(),
+	codec => { transcode => ['opus'] },
+	sdp => <<SDP,
+v=0
+o=- 1545997027 1 IN IP4 172.17.0.2
+s=tester
+c=IN IP4 198.51.100.43
+t=0 0
+m=audio 6000 RTP/AVP 8
+SDP
+	}, 'load limit');
+is $resp->{message}, 'Thread occupancy limit exceeded', 'expensive transcoding - reason';
+
+
+
+done_testing();
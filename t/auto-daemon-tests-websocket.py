@@ -128,7 +128,8 @@ class TestWSCli(unittest.TestCase):
             + b"Current transcoded media: 0\n"
             + b"Current sessions ipv4 only media: 0\n"
             + b"Current sessions ipv6 only media: 0\n"
-            + b"Current sessions ip mixed  media: 0\n",
+            + b"Current sessions ip mixed  media: 0\n"
+            + b"Current call memory: 0 bytes\n",
         )
 
 
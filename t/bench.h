@@ -0,0 +1,20 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+
+// timing loops in the unit tests only run with RTPE_BENCH set (see `make unit-benchmarks`),
+// so that `make check` stays fast and doesn't depend on the load of the build machine
+static inline bool bench_enabled(void) {
+	return getenv("RTPE_BENCH") != NULL;
+}
+
+static inline double bench_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#endif
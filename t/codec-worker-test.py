@@ -0,0 +1,373 @@
+import os
+import re
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+import traceback
+
+
+# Runs a number of transcoding calls (PCMU to Opus) through a local rtpengine while an
+# unrelated plain RTP call is being forwarded, and reports the forwarding latency of
+# that call before and during the transcoding load. This is done once for each value
+# of --codec-threads given in CODEC_WORKER_THREADS, zero being the old inline
+# processing. Sizes can be tuned through the environment.
+
+CALLS = int(os.environ.get("CODEC_WORKER_CALLS", "100"))
+CODEC_THREADS = os.environ.get("CODEC_WORKER_THREADS", "0 2").split()
+MEDIA_THREADS = os.environ.get("CODEC_WORKER_MEDIA_THREADS", "2")
+DURATION = float(os.environ.get("CODEC_WORKER_DURATION", "5"))
+PROBE_INTERVAL = 0.002
+BASELINE = 2.0
+NG = ("127.0.0.1", 2223)
+
+
+def bencode(v):
+    if isinstance(v, int):
+        return b"i%ie" % v
+    if isinstance(v, str):
+        v = v.encode()
+    if isinstance(v, bytes):
+        return b"%u:%s" % (len(v), v)
+    if isinstance(v, list):
+        return b"l" + b"".join(bencode(x) for x in v) + b"e"
+    if isinstance(v, dict):
+        return b"d" + b"".join(bencode(k) + bencode(v[k]) for k in sorted(v)) + b"e"
+    raise TypeError(v)
+
+
+def bdecode(s, i=0):
+    c = s[i : i + 1]
+    if c == b"i":
+        e = s.index(b"e", i)
+        return (int(s[i + 1 : e]), e + 1)
+    if c == b"l" or c == b"d":
+        i += 1
+        items = []
+        while s[i : i + 1] != b"e":
+            (x, i) = bdecode(s, i)
+            items.append(x)
+        if c == b"l":
+            return (items, i + 1)
+        return (dict(zip(items[0::2], items[1::2])), i + 1)
+    colon = s.index(b":", i)
+    n = int(s[i:colon])
+    return (s[colon + 1 : colon + 1 + n].decode(), colon + 1 + n)
+
+
+class Control:
+    def __init__(self):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.settimeout(5)
+        self.cookie = 0
+
+    def request(self, msg):
+        self.cookie += 1
+        cookie = b"%u" % self.cookie
+        self.sock.sendto(cookie + b" " + bencode(msg), NG)
+        while True:
+            res = self.sock.recv(65536)
+            (c, _, body) = res.partition(b" ")
+            if c == cookie:
+                break
+        res = bdecode(body)[0]
+        if res.get("result") not in ("ok", "pong"):
+            raise RuntimeError("%s failed: %s" % (msg["command"], res))
+        return res
+
+    def wait(self):
+        for _ in range(1, 300):
+            try:
+                self.request({"command": "ping"})
+                return
+            except (socket.timeout, ConnectionRefusedError):
+                time.sleep(0.1)
+        raise RuntimeError("rtpengine did not start")
+
+
+def sdp(port, pt=0, extra=""):
+    return (
+        "v=0\r\n"
+        "o=- 1 1 IN IP4 127.0.0.1\r\n"
+        "s=-\r\n"
+        "c=IN IP4 127.0.0.1\r\n"
+        "t=0 0\r\n"
+        "m=audio %u RTP/AVP %u\r\n" % (port, pt)
+    ) + extra
+
+
+def sdp_port(s):
+    return int(re.search(r"m=audio (\d+) ", s).group(1))
+
+
+# local ports are assigned here instead of by the kernel, as under auto-test-helper every
+# address and port maps to a fixed unix socket path. below rtpengine's default port range
+CLIENT_PORTS = iter(range(20000, 30000, 2))
+
+
+def udp_socket():
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    s.bind(("127.0.0.1", next(CLIENT_PORTS)))
+    return s
+
+
+class Probe:
+    """Plain RTP call A -> B with the send time embedded in the payload."""
+
+    def __init__(self, ctl):
+        self.a = udp_socket()
+        self.b = udp_socket()
+        self.b.settimeout(0.1)
+        ctl.request(
+            {
+                "command": "offer",
+                "call-id": "probe",
+                "from-tag": "a",
+                "sdp": sdp(self.a.getsockname()[1]),
+            }
+        )
+        res = ctl.request(
+            {
+                "command": "answer",
+                "call-id": "probe",
+                "from-tag": "a",
+                "to-tag": "b",
+                "sdp": sdp(self.b.getsockname()[1]),
+            }
+        )
+        self.dst = ("127.0.0.1", sdp_port(res["sdp"]))
+        self.samples = []  # (send time, latency)
+        self.sent = 0
+        self.running = True
+        self.threads = [
+            threading.Thread(target=self.send_loop),
+            threading.Thread(target=self.recv_loop),
+        ]
+        for t in self.threads:
+            t.start()
+
+    def send_loop(self):
+        seq = 0
+        while self.running:
+            hdr = struct.pack("!BBHII", 0x80, 0, seq & 0xFFFF, seq * 160, 0x12345678)
+            self.a.sendto(hdr + struct.pack("!d", time.monotonic()) + b"\xff" * 152, self.dst)
+            self.sent += 1
+            seq += 1
+            time.sleep(PROBE_INTERVAL)
+
+    def recv_loop(self):
+        while self.running:
+            try:
+                pkt = self.b.recv(2048)
+            except socket.timeout:
+                continue
+            if len(pkt) < 20:
+                continue
+            sent = struct.unpack("!d", pkt[12:20])[0]
+            self.samples.append((sent, time.monotonic() - sent))
+
+    def stop(self):
+        self.running = False
+        for t in self.threads:
+            t.join()
+
+    def stats(self, start, end):
+        lat = sorted(l for (t, l) in self.samples if start <= t < end)
+        if not lat:
+            return None
+        return (
+            len(lat),
+            lat[len(lat) // 2] * 1000,
+            lat[min(len(lat) - 1, int(len(lat) * 0.99))] * 1000,
+            lat[-1] * 1000,
+        )
+
+
+def transcode_call(ctl, idx):
+    cid = "transcode-%u" % idx
+    a = udp_socket()
+    b = udp_socket()
+    ctl.request(
+        {
+            "command": "offer",
+            "call-id": cid,
+            "from-tag": "a",
+            "codec": {"transcode": ["opus"]},
+            "sdp": sdp(a.getsockname()[1]),
+        }
+    )
+    res = ctl.request(
+        {
+            "command": "answer",
+            "call-id": cid,
+            "from-tag": "a",
+            "to-tag": "b",
+            "sdp": sdp(b.getsockname()[1], 96, "a=rtpmap:96 opus/48000/2\r\n"),
+        }
+    )
+    return (a, b, ("127.0.0.1", sdp_port(res["sdp"])))
+
+
+class Load:
+    """20 ms PCMU packets into each transcoding call; the Opus output is discarded."""
+
+    def __init__(self, calls):
+        self.calls = calls
+        self.running = True
+        self.sent = 0
+        self.received = 0
+        self.threads = [
+            threading.Thread(target=self.send_loop),
+            threading.Thread(target=self.recv_loop),
+        ]
+        for t in self.threads:
+            t.start()
+
+    def send_loop(self):
+        seq = 0
+        payload = bytes((i * 37) & 0xFF for i in range(160))
+        next_time = time.monotonic()
+        while self.running:
+            for (idx, (a, b, dst)) in enumerate(self.calls):
+                hdr = struct.pack("!BBHII", 0x80, 0, seq & 0xFFFF, seq * 160, 0x1000 + idx)
+                a.sendto(hdr + payload, dst)
+                self.sent += 1
+            seq += 1
+            next_time += 0.02
+            delay = next_time - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+
+    def recv_loop(self):
+        for (a, b, dst) in self.calls:
+            b.setblocking(False)
+        while self.running:
+            got = False
+            for (a, b, dst) in self.calls:
+                try:
+                    while True:
+                        b.recv(2048)
+                        self.received += 1
+                        got = True
+                except BlockingIOError:
+                    pass
+            if not got:
+                time.sleep(0.005)
+
+    def stop(self):
+        self.running = False
+        for t in self.threads:
+            t.join()
+
+
+def find_workers(stats):
+    if isinstance(stats, dict):
+        if "codecworkers" in stats:
+            return stats["codecworkers"]
+        for v in stats.values():
+            w = find_workers(v)
+            if w is not None:
+                return w
+    return None
+
+
+def run(threads):
+    so = tempfile.NamedTemporaryFile(mode="wb", delete=False)
+    se = tempfile.NamedTemporaryFile(mode="wb", delete=False)
+    proc = subprocess.Popen(
+        [
+            os.environ.get("RTPE_BIN"),
+            "--config-file=none",
+            "-t",
+            "-1",
+            "-i",
+            "127.0.0.1",
+            "-f",
+            "-L",
+            "4",
+            "-E",
+            "--listen-ng=%s:%u" % NG,
+            "--num-threads=" + MEDIA_THREADS,
+            "--codec-threads=" + threads,
+        ],
+        stdout=so,
+        stderr=se,
+    )
+
+    ok = False
+    probe = None
+    load = None
+    try:
+        ctl = Control()
+        ctl.wait()
+        calls = [transcode_call(ctl, i) for i in range(CALLS)]
+
+        probe = Probe(ctl)
+        time.sleep(BASELINE)
+
+        start = time.monotonic()
+        load = Load(calls)
+        time.sleep(DURATION)
+        load.stop()
+        end = time.monotonic()
+
+        time.sleep(0.1)
+        probe.stop()
+
+        base = probe.stats(start - BASELINE, start)
+        during = probe.stats(start, end)
+        print(
+            "codec-threads %s: %u transcoding calls, %u packets in, %u packets out in %.2f s"
+            % (threads, CALLS, load.sent, load.received, end - start)
+        )
+        for (name, s) in (("baseline", base), ("load", during)):
+            if s:
+                print(
+                    "  RTP latency %-8s %6u packets   p50 %7.2f ms   p99 %7.2f ms   max %7.2f ms"
+                    % ((name,) + s)
+                )
+            else:
+                print("  RTP latency %-8s no packets received" % name)
+        workers = find_workers(ctl.request({"command": "statistics"})) or []
+        for w in workers:
+            print(
+                "  worker %s: %s jobs, %s queued, avg wait %.2f ms, busy %.2f s"
+                % (
+                    w["worker"],
+                    w["jobs"],
+                    w["queued"],
+                    float(w["avgwaittime"]) * 1000,
+                    float(w["busytime"]),
+                )
+            )
+        ok = base is not None and during is not None and load.received > 0
+    except:
+        traceback.print_exc()
+        if load:
+            load.stop()
+        if probe:
+            probe.stop()
+
+    proc.terminate()
+    proc.wait()
+
+    so.close()
+    se.close()
+
+    if ok and not os.environ.get("RETAIN_LOGS"):
+        os.unlink(so.name)
+        os.unlink(se.name)
+    else:
+        print("HINT: Stdout and stderr are {} and {}".format(so.name, se.name))
+    return ok
+
+
+if __name__ == "__main__":
+    code = 0
+    for threads in CODEC_THREADS:
+        if not run(threads):
+            code = 1
+    sys.exit(code)
@@ -0,0 +1,376 @@
+import asyncio
+import os
+import re
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+import traceback
+
+
+# Floods a local rtpengine with concurrent DTLS handshakes (using `openssl s_client`)
+# while an unrelated plain RTP call is being forwarded, and reports the forwarding
+# latency of that call before and during the flood. This is done once for each
+# value of --dtls-threads given in DTLS_FLOOD_THREADS, zero being the old inline
+# processing. Sizes can be tuned through the environment.
+
+CALLS = int(os.environ.get("DTLS_FLOOD_CALLS", "200"))
+CONCURRENCY = int(os.environ.get("DTLS_FLOOD_CONCURRENCY", "50"))
+DTLS_THREADS = os.environ.get("DTLS_FLOOD_THREADS", "0 4").split()
+MEDIA_THREADS = os.environ.get("DTLS_FLOOD_MEDIA_THREADS", "2")
+PROBE_INTERVAL = 0.002
+BASELINE = 2.0
+NG = ("127.0.0.1", 2223)
+
+
+def bencode(v):
+    if isinstance(v, int):
+        return b"i%ie" % v
+    if isinstance(v, str):
+        v = v.encode()
+    if isinstance(v, bytes):
+        return b"%u:%s" % (len(v), v)
+    if isinstance(v, list):
+        return b"l" + b"".join(bencode(x) for x in v) + b"e"
+    if isinstance(v, dict):
+        return b"d" + b"".join(bencode(k) + bencode(v[k]) for k in sorted(v)) + b"e"
+    raise TypeError(v)
+
+
+def bdecode(s, i=0):
+    c = s[i : i + 1]
+    if c == b"i":
+        e = s.index(b"e", i)
+        return (int(s[i + 1 : e]), e + 1)
+    if c == b"l" or c == b"d":
+        i += 1
+        items = []
+        while s[i : i + 1] != b"e":
+            (x, i) = bdecode(s, i)
+            items.append(x)
+        if c == b"l":
+            return (items, i + 1)
+        return (dict(zip(items[0::2], items[1::2])), i + 1)
+    colon = s.index(b":", i)
+    n = int(s[i:colon])
+    return (s[colon + 1 : colon + 1 + n].decode(), colon + 1 + n)
+
+
+class Control:
+    def __init__(self):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.settimeout(5)
+        self.cookie = 0
+
+    def request(self, msg):
+        self.cookie += 1
+        cookie = b"%u" % self.cookie
+        self.sock.sendto(cookie + b" " + bencode(msg), NG)
+        while True:
+            res = self.sock.recv(65536)
+            (c, _, body) = res.partition(b" ")
+            if c == cookie:
+                break
+        res = bdecode(body)[0]
+        if res.get("result") not in ("ok", "pong"):
+            raise RuntimeError("%s failed: %s" % (msg["command"], res))
+        return res
+
+    def wait(self):
+        for _ in range(1, 300):
+            try:
+                self.request({"command": "ping"})
+                return
+            except (socket.timeout, ConnectionRefusedError):
+                time.sleep(0.1)
+        raise RuntimeError("rtpengine did not start")
+
+
+def sdp(port, extra=""):
+    return (
+        "v=0\r\n"
+        "o=- 1 1 IN IP4 127.0.0.1\r\n"
+        "s=-\r\n"
+        "c=IN IP4 127.0.0.1\r\n"
+        "t=0 0\r\n"
+        "m=audio %u %s 0\r\n" % (port, "UDP/TLS/RTP/SAVP" if extra else "RTP/AVP")
+    ) + extra
+
+
+def sdp_port(s):
+    return int(re.search(r"m=audio (\d+) ", s).group(1))
+
+
+# local ports are assigned here instead of by the kernel, as under auto-test-helper every
+# address and port maps to a fixed unix socket path. below rtpengine's default port range
+CLIENT_PORTS = iter(range(20000, 30000, 2))
+
+
+def udp_socket():
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    s.bind(("127.0.0.1", next(CLIENT_PORTS)))
+    return s
+
+
+class Probe:
+    """Plain RTP call A -> B with the send time embedded in the payload."""
+
+    def __init__(self, ctl):
+        self.a = udp_socket()
+        self.b = udp_socket()
+        self.b.settimeout(0.1)
+        ctl.request(
+            {
+                "command": "offer",
+                "call-id": "probe",
+                "from-tag": "a",
+                "sdp": sdp(self.a.getsockname()[1]),
+            }
+        )
+        res = ctl.request(
+            {
+                "command": "answer",
+                "call-id": "probe",
+                "from-tag": "a",
+                "to-tag": "b",
+                "sdp": sdp(self.b.getsockname()[1]),
+            }
+        )
+        self.dst = ("127.0.0.1", sdp_port(res["sdp"]))
+        self.samples = []  # (send time, latency)
+        self.sent = 0
+        self.running = True
+        self.threads = [
+            threading.Thread(target=self.send_loop),
+            threading.Thread(target=self.recv_loop),
+        ]
+        for t in self.threads:
+            t.start()
+
+    def send_loop(self):
+        seq = 0
+        while self.running:
+            hdr = struct.pack("!BBHII", 0x80, 0, seq & 0xFFFF, seq * 160, 0x12345678)
+            self.a.sendto(hdr + struct.pack("!d", time.monotonic()) + b"\xff" * 152, self.dst)
+            self.sent += 1
+            seq += 1
+            time.sleep(PROBE_INTERVAL)
+
+    def recv_loop(self):
+        while self.running:
+            try:
+                pkt = self.b.recv(2048)
+            except socket.timeout:
+                continue
+            if len(pkt) < 20:
+                continue
+            sent = struct.unpack("!d", pkt[12:20])[0]
+            self.samples.append((sent, time.monotonic() - sent))
+
+    def stop(self):
+        self.running = False
+        for t in self.threads:
+            t.join()
+
+    def stats(self, start, end):
+        lat = sorted(l for (t, l) in self.samples if start <= t < end)
+        if not lat:
+            return None
+        return (
+            len(lat),
+            lat[len(lat) // 2] * 1000,
+            lat[min(len(lat) - 1, int(len(lat) * 0.99))] * 1000,
+            lat[-1] * 1000,
+        )
+
+
+def dtls_call(ctl, idx, fingerprint):
+    cid = "dtls-%u" % idx
+    res = ctl.request(
+        {
+            "command": "offer",
+            "call-id": cid,
+            "from-tag": "a",
+            "transport-protocol": "UDP/TLS/RTP/SAVP",
+            "sdp": sdp(9),
+        }
+    )
+    remote = sdp_port(res["sdp"])
+    # we bind s_client to a known port so that the SDP is accurate
+    port = next(CLIENT_PORTS)
+    ctl.request(
+        {
+            "command": "answer",
+            "call-id": cid,
+            "from-tag": "a",
+            "to-tag": "b",
+            "sdp": sdp(
+                port,
+                "a=setup:active\r\na=fingerprint:sha-256 %s\r\n" % fingerprint,
+            ),
+        }
+    )
+    return (port, remote)
+
+
+async def handshake(sem, certdir, local, remote, results):
+    async with sem:
+        start = time.monotonic()
+        proc = await asyncio.create_subprocess_exec(
+            "openssl",
+            "s_client",
+            "-dtls",
+            "-4",
+            "-bind",
+            "127.0.0.1:%u" % local,
+            "-connect",
+            "127.0.0.1:%u" % remote,
+            "-cert",
+            certdir + "/cert.pem",
+            "-key",
+            certdir + "/key.pem",
+            "-use_srtp",
+            "SRTP_AES128_CM_SHA1_80",
+            "-timeout",
+            stdin=subprocess.DEVNULL,
+            stdout=subprocess.PIPE,
+            stderr=subprocess.STDOUT,
+        )
+        try:
+            out = (await asyncio.wait_for(proc.communicate(), timeout=30))[0]
+        except asyncio.TimeoutError:
+            proc.kill()
+            await proc.wait()
+            out = b""
+        results.append((b"SRTP Extension negotiated" in out, time.monotonic() - start))
+
+
+async def flood(certdir, ports):
+    sem = asyncio.Semaphore(CONCURRENCY)
+    results = []
+    await asyncio.gather(
+        *[handshake(sem, certdir, local, remote, results) for (local, remote) in ports]
+    )
+    return results
+
+
+def make_cert(certdir):
+    subprocess.run(
+        [
+            "openssl",
+            "req",
+            "-x509",
+            "-newkey",
+            "ec",
+            "-pkeyopt",
+            "ec_paramgen_curve:prime256v1",
+            "-nodes",
+            "-keyout",
+            certdir + "/key.pem",
+            "-out",
+            certdir + "/cert.pem",
+            "-days",
+            "1",
+            "-subj",
+            "/CN=dtls-flood-test",
+        ],
+        check=True,
+        capture_output=True,
+    )
+    out = subprocess.run(
+        ["openssl", "x509", "-in", certdir + "/cert.pem", "-noout", "-fingerprint", "-sha256"],
+        check=True,
+        capture_output=True,
+    ).stdout.decode()
+    return out.strip().split("=", 1)[1]
+
+
+def run(threads, certdir, fingerprint):
+    so = tempfile.NamedTemporaryFile(mode="wb", delete=False)
+    se = tempfile.NamedTemporaryFile(mode="wb", delete=False)
+    proc = subprocess.Popen(
+        [
+            os.environ.get("RTPE_BIN"),
+            "--config-file=none",
+            "-t",
+            "-1",
+            "-i",
+            "127.0.0.1",
+            "-f",
+            "-L",
+            "4",
+            "-E",
+            "--listen-ng=%s:%u" % NG,
+            "--num-threads=" + MEDIA_THREADS,
+            "--dtls-threads=" + threads,
+        ],
+        stdout=so,
+        stderr=se,
+    )
+
+    ok = False
+    probe = None
+    try:
+        ctl = Control()
+        ctl.wait()
+        ports = [dtls_call(ctl, i, fingerprint) for i in range(CALLS)]
+
+        probe = Probe(ctl)
+        time.sleep(BASELINE)
+
+        start = time.monotonic()
+        eventloop = asyncio.new_event_loop()
+        results = eventloop.run_until_complete(flood(certdir, ports))
+        eventloop.close()
+        end = time.monotonic()
+
+        time.sleep(0.1)
+        probe.stop()
+
+        failed = len([r for r in results if not r[0]])
+        hs = sorted(r[1] for r in results)
+        base = probe.stats(start - BASELINE, start)
+        during = probe.stats(start, end)
+        print(
+            "dtls-threads %s: %u handshakes (%u failed) in %.2f s, handshake p50 %.1f ms, max %.1f ms"
+            % (threads, len(results), failed, end - start, hs[len(hs) // 2] * 1000, hs[-1] * 1000)
+        )
+        for (name, s) in (("baseline", base), ("flood", during)):
+            if s:
+                print(
+                    "  RTP latency %-8s %6u packets   p50 %7.2f ms   p99 %7.2f ms   max %7.2f ms"
+                    % ((name,) + s)
+                )
+            else:
+                print("  RTP latency %-8s no packets received" % name)
+        ok = failed == 0 and base is not None and during is not None
+    except:
+        traceback.print_exc()
+        if probe:
+            probe.stop()
+
+    proc.terminate()
+    proc.wait()
+
+    so.close()
+    se.close()
+
+    if ok and not os.environ.get("RETAIN_LOGS"):
+        os.unlink(so.name)
+        os.unlink(se.name)
+    else:
+        print("HINT: Stdout and stderr are {} and {}".format(so.name, se.name))
+    return ok
+
+
+if __name__ == "__main__":
+    code = 0
+    with tempfile.TemporaryDirectory() as certdir:
+        fingerprint = make_cert(certdir)
+        for threads in DTLS_THREADS:
+            if not run(threads, certdir, fingerprint):
+                code = 1
+    sys.exit(code)
@@ -0,0 +1,308 @@
+import asyncio
+import json
+import os
+import subprocess
+import sys
+import tempfile
+import time
+import traceback
+import uuid
+
+from websockets import connect
+
+
+# Drives a local rtpengine through the Janus create/attach/join/configure/trickle
+# sequence with many concurrent websocket clients, and reports request latencies.
+# Sizes can be tuned through the environment.
+
+ROOMS = int(os.environ.get("JANUS_LOAD_ROOMS", "10"))
+PUBS = int(os.environ.get("JANUS_LOAD_PUBS", "3"))
+SUBS = int(os.environ.get("JANUS_LOAD_SUBS", "20"))
+TRICKLES = int(os.environ.get("JANUS_LOAD_TRICKLES", "5"))
+SECRET = "dfgdfgdvgLyATjHPvckg"
+
+latencies = {}
+errors = []
+
+
+class Client:
+    def __init__(self):
+        self.ws = None
+        self.pending = {}
+        self.reader = None
+
+    async def open(self):
+        for _ in range(1, 300):
+            try:
+                self.ws = await connect(
+                    "ws://127.0.0.1:9191/", subprotocols=["janus-protocol"]
+                )
+                break
+            except (FileNotFoundError, ConnectionRefusedError, OSError):
+                await asyncio.sleep(0.1)
+        self.reader = asyncio.ensure_future(self.read_loop())
+
+    async def read_loop(self):
+        try:
+            async for msg in self.ws:
+                res = json.loads(msg)
+                trans = res.get("transaction")
+                if trans is None:
+                    continue  # async notification
+                if res.get("janus") == "ack" and trans in self.pending:
+                    fut = self.pending[trans]
+                    if fut[1]:  # expects a following event
+                        continue
+                fut = self.pending.pop(trans, None)
+                if fut:
+                    fut[0].set_result(res)
+        except Exception:
+            pass
+
+    async def request(self, kind, msg, has_event=False):
+        trans = str(uuid.uuid4())
+        msg["transaction"] = trans
+        fut = asyncio.get_event_loop().create_future()
+        self.pending[trans] = (fut, has_event)
+        start = time.monotonic()
+        await self.ws.send(json.dumps(msg))
+        res = await asyncio.wait_for(fut, timeout=30)
+        latencies.setdefault(kind, []).append(time.monotonic() - start)
+        if res.get("janus") == "error":
+            errors.append((kind, res["error"]))
+        return res
+
+    async def close(self):
+        await self.ws.close()
+        if self.reader:
+            await self.reader
+
+
+async def start_session(client):
+    token = str(uuid.uuid4())
+    await client.request(
+        "add_token", {"janus": "add_token", "token": token, "admin_secret": SECRET}
+    )
+    res = await client.request(
+        "create", {"janus": "create", "token": token, "admin_secret": SECRET}
+    )
+    session = res["data"]["id"]
+    res = await client.request(
+        "attach",
+        {
+            "janus": "attach",
+            "plugin": "janus.plugin.videoroom",
+            "session_id": session,
+            "token": token,
+        },
+    )
+    return (token, session, res["data"]["id"])
+
+
+async def trickle(client, token, session, handle, port, ufrag):
+    for i in range(TRICKLES):
+        await client.request(
+            "trickle",
+            {
+                "janus": "trickle",
+                "candidate": {
+                    "candidate": "candidate:%u 1 udp 2113937151 203.0.113.2 %u typ host generation 0 ufrag %s"
+                    % (3279615273 + i, port + i, ufrag),
+                    "sdpMid": "audio",
+                },
+                "handle_id": handle,
+                "session_id": session,
+                "token": token,
+            },
+        )
+
+
+async def publisher(room, idx):
+    client = Client()
+    await client.open()
+    (token, session, handle) = await start_session(client)
+    res = await client.request(
+        "join_pub",
+        {
+            "janus": "message",
+            "body": {"request": "join", "ptype": "publisher", "room": room},
+            "handle_id": handle,
+            "session_id": session,
+            "token": token,
+        },
+        True,
+    )
+    feed = res["plugindata"]["data"]["id"]
+    ufrag = "pub%u" % idx
+    await client.request(
+        "configure",
+        {
+            "janus": "message",
+            "body": {"request": "configure", "room": room, "audio": True},
+            "jsep": {
+                "type": "offer",
+                "sdp": (
+                    "v=0\r\n"
+                    "o=x 123 123 IN IP4 203.0.113.2\r\n"
+                    "c=IN IP4 0.0.0.0\r\n"
+                    "s=foobar\r\n"
+                    "t=0 0\r\n"
+                    "m=audio 9 RTP/AVP 8 0\r\n"
+                    "a=mid:audio\r\n"
+                    "a=ice-ufrag:%s\r\n"
+                    "a=ice-pwd:WD1pLdamJOWH2WuEBb0vjyZr\r\n"
+                    "a=ice-options:trickle\r\n"
+                    "a=rtcp-mux\r\n"
+                    "a=sendonly\r\n" % ufrag
+                ),
+            },
+            "handle_id": handle,
+            "session_id": session,
+            "token": token,
+        },
+        True,
+    )
+    await trickle(client, token, session, handle, 30000 + idx * TRICKLES, ufrag)
+    return (client, feed)
+
+
+async def subscriber(room, feed, idx):
+    client = Client()
+    await client.open()
+    (token, session, handle) = await start_session(client)
+    await client.request(
+        "join_sub",
+        {
+            "janus": "message",
+            "body": {
+                "request": "join",
+                "ptype": "subscriber",
+                "room": room,
+                "feed": feed,
+            },
+            "handle_id": handle,
+            "session_id": session,
+            "token": token,
+        },
+        True,
+    )
+    await trickle(client, token, session, handle, 40000 + idx * TRICKLES, "sub%u" % idx)
+    return client
+
+
+async def run_room(r):
+    control = Client()
+    await control.open()
+    (token, session, handle) = await start_session(control)
+    res = await control.request(
+        "create_room",
+        {
+            "janus": "message",
+            "body": {"request": "create", "publishers": PUBS},
+            "handle_id": handle,
+            "session_id": session,
+            "token": token,
+        },
+    )
+    room = res["plugindata"]["data"]["room"]
+
+    pubs = await asyncio.gather(
+        *[publisher(room, r * PUBS + i) for i in range(PUBS)]
+    )
+    subs = await asyncio.gather(
+        *[
+            subscriber(room, pubs[i % PUBS][1], r * SUBS + i)
+            for i in range(SUBS)
+        ]
+    )
+
+    await control.request(
+        "destroy_room",
+        {
+            "janus": "message",
+            "body": {"request": "destroy", "room": room},
+            "handle_id": handle,
+            "session_id": session,
+            "token": token,
+        },
+    )
+
+    for c in subs:
+        await c.close()
+    for (c, _) in pubs:
+        await c.close()
+    await control.close()
+
+
+async def main():
+    start = time.monotonic()
+    await asyncio.gather(*[run_room(r) for r in range(ROOMS)])
+    total = time.monotonic() - start
+
+    num = 0
+    print("%-14s %8s %10s %10s %10s" % ("request", "count", "p50 ms", "p99 ms", "max ms"))
+    for kind in sorted(latencies):
+        lat = sorted(latencies[kind])
+        num += len(lat)
+        print(
+            "%-14s %8u %10.2f %10.2f %10.2f"
+            % (
+                kind,
+                len(lat),
+                lat[len(lat) // 2] * 1000,
+                lat[min(len(lat) - 1, int(len(lat) * 0.99))] * 1000,
+                lat[-1] * 1000,
+            )
+        )
+    print("%u requests in %.2f s (%.0f/s)" % (num, total, num / total))
+
+
+if __name__ == "__main__":
+    so = tempfile.NamedTemporaryFile(mode="wb", delete=False)
+    se = tempfile.NamedTemporaryFile(mode="wb", delete=False)
+    proc = subprocess.Popen(
+        [
+            os.environ.get("RTPE_BIN"),
+            "--config-file=none",
+            "-t",
+            "-1",
+            "-i",
+            "203.0.113.1",
+            "-f",
+            "-L",
+            "4",
+            "-E",
+            "--listen-http=127.0.0.1:9191",
+            "--janus-secret=" + SECRET,
+            "--delete-delay=0",
+            "--http-threads=" + os.environ.get("JANUS_LOAD_THREADS", "8"),
+        ],
+        stdout=so,
+        stderr=se,
+    )
+
+    code = 0
+
+    try:
+        eventloop = asyncio.new_event_loop()
+        eventloop.run_until_complete(main())
+        eventloop.close()
+        if errors:
+            print("%u requests failed, first: %s" % (len(errors), errors[0]))
+            code = 1
+    except:
+        traceback.print_exc()
+        code = 1
+
+    proc.terminate()
+    proc.wait()
+
+    so.close()
+    se.close()
+
+    if code == 0 and not os.environ.get("RETAIN_LOGS"):
+        os.unlink(so.name)
+        os.unlink(se.name)
+    else:
+        print("HINT: Stdout and stderr are {} and {}".format(so.name, se.name))
+    sys.exit(code)
@@ -0,0 +1,39 @@
+#!/bin/bash
+
+# Runs the XDP part of test-kernel-module over a veth pair. Needs root, the xt_RTPENGINE
+# module loaded, and the XDP program built (`make -C ../kernel-module xdp`). Packets come
+# from a network namespace on one end of the veth pair and are forwarded back into it by
+# the XDP program attached to the other end. No iptables rule is set up, so the regular
+# kernel forwarding path isn't involved.
+
+set -e
+
+NS=rtpe-xdp
+XDP_OBJ=${XDP_OBJ:-../kernel-module/xt_RTPENGINE_xdp.bpf.o}
+
+cleanup() {
+	ip link del rtpe-xdp0 2>/dev/null || true
+	ip netns del "$NS" 2>/dev/null || true
+	echo 'del 0' > /proc/rtpengine/control 2>/dev/null || true
+}
+trap cleanup EXIT
+cleanup
+
+ip netns add "$NS"
+ip link add rtpe-xdp0 type veth peer name rtpe-xdp1
+ip link set rtpe-xdp1 netns "$NS"
+ip addr add 10.99.0.1/24 dev rtpe-xdp0
+ip link set rtpe-xdp0 up
+ip netns exec "$NS" ip addr add 10.99.0.2/24 dev rtpe-xdp1
+ip netns exec "$NS" ip link set rtpe-xdp1 up
+ip netns exec "$NS" ip link set lo up
+
+# redirecting into a veth device needs XDP on the receiving end as well. the same
+# program does nothing there as it has no matching targets
+ip link set dev rtpe-xdp0 xdpdrv obj "$XDP_OBJ" sec xdp
+ip netns exec "$NS" ip link set dev rtpe-xdp1 xdpdrv obj "$XDP_OBJ" sec xdp
+
+# resolve the neighbour, the XDP path leaves it to the stack
+ping -c 1 -W 1 10.99.0.2 > /dev/null
+
+RTPE_XDP_NETNS="$NS" ./test-kernel-module
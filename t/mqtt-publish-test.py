@@ -0,0 +1,290 @@
+import json
+import os
+import re
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+import traceback
+
+
+# Sets up a number of calls on a local rtpengine publishing to a local Mosquitto
+# broker, sends RTP into a few of them, and compares the published message volume
+# and the daemon's CPU usage with and without --mqtt-publish-changed-only. This is
+# done for each scope in MQTT_SCOPES. Requires `mosquitto` and `mosquitto_sub`.
+# Sizes can be tuned through the environment.
+
+CALLS = int(os.environ.get("MQTT_CALLS", "500"))
+ACTIVE = int(os.environ.get("MQTT_ACTIVE", "20"))
+SCOPES = os.environ.get("MQTT_SCOPES", "media global").split()
+INTERVAL = int(os.environ.get("MQTT_INTERVAL", "500"))
+DURATION = float(os.environ.get("MQTT_DURATION", "5"))
+MQTT_PORT = int(os.environ.get("MQTT_PORT", "18830"))
+TOPIC = "rtpengine-test"
+NG = ("127.0.0.1", 2223)
+
+
+def bencode(v):
+    if isinstance(v, int):
+        return b"i%ie" % v
+    if isinstance(v, str):
+        v = v.encode()
+    if isinstance(v, bytes):
+        return b"%u:%s" % (len(v), v)
+    if isinstance(v, list):
+        return b"l" + b"".join(bencode(x) for x in v) + b"e"
+    if isinstance(v, dict):
+        return b"d" + b"".join(bencode(k) + bencode(v[k]) for k in sorted(v)) + b"e"
+    raise TypeError(v)
+
+
+def bdecode(s, i=0):
+    c = s[i : i + 1]
+    if c == b"i":
+        e = s.index(b"e", i)
+        return (int(s[i + 1 : e]), e + 1)
+    if c == b"l" or c == b"d":
+        i += 1
+        items = []
+        while s[i : i + 1] != b"e":
+            (x, i) = bdecode(s, i)
+            items.append(x)
+        if c == b"l":
+            return (items, i + 1)
+        return (dict(zip(items[0::2], items[1::2])), i + 1)
+    colon = s.index(b":", i)
+    n = int(s[i:colon])
+    return (s[colon + 1 : colon + 1 + n].decode(), colon + 1 + n)
+
+
+class Control:
+    def __init__(self):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.settimeout(5)
+        self.cookie = 0
+
+    def request(self, msg):
+        self.cookie += 1
+        cookie = b"%u" % self.cookie
+        self.sock.sendto(cookie + b" " + bencode(msg), NG)
+        while True:
+            res = self.sock.recv(65536)
+            (c, _, body) = res.partition(b" ")
+            if c == cookie:
+                break
+        res = bdecode(body)[0]
+        if res.get("result") not in ("ok", "pong"):
+            raise RuntimeError("%s failed: %s" % (msg["command"], res))
+        return res
+
+    def wait(self):
+        for _ in range(1, 300):
+            try:
+                self.request({"command": "ping"})
+                return
+            except (socket.timeout, ConnectionRefusedError):
+                time.sleep(0.1)
+        raise RuntimeError("rtpengine did not start")
+
+
+def sdp(port):
+    return (
+        "v=0\r\n"
+        "o=- 1 1 IN IP4 127.0.0.1\r\n"
+        "s=-\r\n"
+        "c=IN IP4 127.0.0.1\r\n"
+        "t=0 0\r\n"
+        "m=audio %u RTP/AVP 0\r\n" % port
+    )
+
+
+def sdp_port(s):
+    return int(re.search(r"m=audio (\d+) ", s).group(1))
+
+
+def call(ctl, idx):
+    cid = "mqtt-%u" % idx
+    ctl.request({"command": "offer", "call-id": cid, "from-tag": "a", "sdp": sdp(2000 + idx * 2)})
+    res = ctl.request(
+        {
+            "command": "answer",
+            "call-id": cid,
+            "from-tag": "a",
+            "to-tag": "b",
+            "sdp": sdp(40000 + idx * 2),
+        }
+    )
+    return ("127.0.0.1", sdp_port(res["sdp"]))
+
+
+class Sender:
+    """Plain RTP, 20 ms ptime, into the first ACTIVE calls."""
+
+    def __init__(self, dsts):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.dsts = dsts
+        self.running = True
+        self.thread = threading.Thread(target=self.loop)
+        self.thread.start()
+
+    def loop(self):
+        seq = 0
+        while self.running:
+            for (i, dst) in enumerate(self.dsts):
+                hdr = struct.pack("!BBHII", 0x80, 0, seq & 0xFFFF, seq * 160, 0x1000 + i)
+                self.sock.sendto(hdr + b"\xff" * 160, dst)
+            seq += 1
+            time.sleep(0.02)
+
+    def stop(self):
+        self.running = False
+        self.thread.join()
+
+
+class Subscriber:
+    def __init__(self):
+        self.proc = subprocess.Popen(
+            ["mosquitto_sub", "-h", "127.0.0.1", "-p", str(MQTT_PORT), "-t", TOPIC],
+            stdout=subprocess.PIPE,
+            stderr=subprocess.DEVNULL,
+        )
+        self.messages = []  # (receive time, payload)
+        self.thread = threading.Thread(target=self.loop)
+        self.thread.start()
+
+    def loop(self):
+        for line in self.proc.stdout:
+            self.messages.append((time.monotonic(), line.rstrip(b"\n")))
+
+    def stop(self):
+        self.proc.terminate()
+        self.proc.wait()
+        self.thread.join()
+
+    def window(self, start, end):
+        return [m for (t, m) in self.messages if start <= t < end]
+
+
+def cpu_time(pid):
+    with open("/proc/%u/stat" % pid) as f:
+        fields = f.read().rsplit(")", 1)[1].split()
+    return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+
+def call_ids(msgs):
+    ret = set()
+    for m in msgs:
+        j = json.loads(m)
+        if "call_id" in j:
+            ret.add(j["call_id"])
+        for c in j.get("calls", []):
+            ret.add(c["call_id"])
+    return ret
+
+
+def run(scope, changed_only):
+    so = tempfile.NamedTemporaryFile(mode="wb", delete=False)
+    se = tempfile.NamedTemporaryFile(mode="wb", delete=False)
+    args = [
+        os.environ.get("RTPE_BIN"),
+        "--config-file=none",
+        "-t",
+        "-1",
+        "-i",
+        "127.0.0.1",
+        "-f",
+        "-L",
+        "4",
+        "-E",
+        "--listen-ng=%s:%u" % NG,
+        "--mqtt-host=127.0.0.1",
+        "--mqtt-port=%u" % MQTT_PORT,
+        "--mqtt-publish-topic=" + TOPIC,
+        "--mqtt-publish-interval=%u" % INTERVAL,
+        "--mqtt-publish-scope=" + scope,
+    ]
+    if changed_only:
+        args.append("--mqtt-publish-changed-only")
+    proc = subprocess.Popen(args, stdout=so, stderr=se)
+
+    ok = False
+    sender = None
+    sub = None
+    try:
+        ctl = Control()
+        ctl.wait()
+        dsts = [call(ctl, i) for i in range(CALLS)]
+        sub = Subscriber()
+        sender = Sender(dsts[:ACTIVE])
+        # let all timers come around once, so that idle calls are known as such
+        time.sleep(INTERVAL / 1000.0 * 2)
+
+        start = time.monotonic()
+        cpu_start = cpu_time(proc.pid)
+        time.sleep(DURATION)
+        cpu = cpu_time(proc.pid) - cpu_start
+        end = time.monotonic()
+
+        sender.stop()
+        sender = None
+        msgs = sub.window(start, end)
+
+        print(
+            "scope %-6s %-12s %6u messages %9u bytes (%7.0f bytes/s), CPU %5.2f s"
+            % (
+                scope,
+                "changed-only" if changed_only else "full",
+                len(msgs),
+                sum(len(m) for m in msgs),
+                sum(len(m) for m in msgs) / (end - start),
+                cpu,
+            )
+        )
+
+        ids = call_ids(msgs)
+        active = set("mqtt-%u" % i for i in range(ACTIVE))
+        if changed_only:
+            ok = ids == active
+        else:
+            ok = ids == set("mqtt-%u" % i for i in range(CALLS))
+        if not ok:
+            print("  unexpected set of calls published: %u, expected %u" % (len(ids), len(active) if changed_only else CALLS))
+    except:
+        traceback.print_exc()
+        if sender:
+            sender.stop()
+
+    if sub:
+        sub.stop()
+    proc.terminate()
+    proc.wait()
+
+    so.close()
+    se.close()
+
+    if ok and not os.environ.get("RETAIN_LOGS"):
+        os.unlink(so.name)
+        os.unlink(se.name)
+    else:
+        print("HINT: Stdout and stderr are {} and {}".format(so.name, se.name))
+    return ok
+
+
+if __name__ == "__main__":
+    broker = subprocess.Popen(
+        ["mosquitto", "-p", str(MQTT_PORT)], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL
+    )
+    time.sleep(0.5)
+    code = 0
+    try:
+        for scope in SCOPES:
+            for changed_only in (False, True):
+                if not run(scope, changed_only):
+                    code = 1
+    finally:
+        broker.terminate()
+        broker.wait()
+    sys.exit(code)
@@ -0,0 +1,191 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include "call.h"
+#include "statistics.h"
+#include "poller.h"
+#include "control_ng.h"
+#include "call_interfaces.h"
+#include "ssllib.h"
+#include "ice.h"
+#include "main.h"
+#include "log_funcs.h"
+#include "bench.h"
+
+int _log_facility_rtcp;
+int _log_facility_cdr;
+int _log_facility_dtmf;
+struct rtpengine_config rtpe_config = {
+	.dtls_rsa_key_size = 2048,
+};
+struct rtpengine_config initial_rtpe_config;
+struct poller *rtpe_poller;
+struct poller_map *rtpe_poller_map;
+GString *dtmf_logs;
+GQueue rtpe_control_ng = G_QUEUE_INIT;
+
+#define NUM_CALLS 20000
+#define MONOLOGUES 2
+#define MEDIAS 2 // per monologue
+#define STREAMS 2 // per media
+
+static str callids[NUM_CALLS];
+static struct call *calls[NUM_CALLS];
+
+
+static long rss(void) {
+	FILE *fp = fopen("/proc/self/statm", "r");
+	assert(fp != NULL);
+	long size, res;
+	assert(fscanf(fp, "%li %li", &size, &res) == 2);
+	fclose(fp);
+	return res * sysconf(_SC_PAGESIZE);
+}
+
+// a typical two-party call: two monologues with audio and video, RTP and RTCP each
+static void populate(struct call *c) {
+	for (int m = 0; m < MONOLOGUES; m++) {
+		struct call_monologue *ml = __monologue_create(c);
+		for (int i = 0; i < MEDIAS; i++) {
+			struct call_media *md = call_media_new(c);
+			md->monologue = ml;
+			for (int s = 0; s < STREAMS; s++) {
+				struct packet_stream *ps = __packet_stream_new(c);
+				ps->media = md;
+				g_queue_push_tail(&md->streams, ps);
+			}
+		}
+	}
+}
+
+static void create_calls(void) {
+	for (int i = 0; i < NUM_CALLS; i++) {
+		struct call *c = call_get_or_create(&callids[i], true);
+		assert(c != NULL);
+		populate(c);
+		calls[i] = c;
+		rwlock_unlock_w(&c->master_lock);
+		log_info_pop();
+	}
+}
+
+static void destroy_calls(void) {
+	for (int i = 0; i < NUM_CALLS; i++) {
+		call_destroy(calls[i]);
+		obj_put(calls[i]);
+	}
+}
+
+
+static void test_memory(void) {
+	assert(atomic64_get(&rtpe_stats_gauge.call_memory) == 0);
+
+	struct call *c = call_get_or_create(&callids[0], true);
+	assert(c != NULL);
+	size_t base = c->mem_usage;
+	assert(base > 0); // the call-ID
+	assert(atomic64_get(&rtpe_stats_gauge.call_memory) == base);
+
+	// lookup tables which aren't used don't exist
+	assert(c->viabranches == NULL);
+	assert(c->labels == NULL);
+	struct call_monologue *ml = __monologue_create(c);
+	assert(ml->media_ids == NULL);
+	str id = STR_CONST_INIT("0");
+	assert(lazy_str_ht_lookup(ml->media_ids, &id) == NULL);
+	lazy_str_ht_remove(ml->media_ids, &id);
+
+	// objects share one chunk
+	struct call_media *a = call_media_new(c);
+	struct call_media *b = call_media_new(c);
+	assert(c->mem_usage > base);
+	size_t chunk = c->mem_usage;
+	assert((char *) b - (char *) a >= sizeof(*a));
+	assert((char *) b - (char *) a < sizeof(*a) + 16);
+	assert(((uintptr_t) a & 15) == 0);
+	assert(((uintptr_t) b & 15) == 0);
+	assert(a->call == c && b->call == c);
+	assert(a->unique_id == 0 && b->unique_id == 1);
+	__packet_stream_new(c);
+	assert(c->mem_usage == chunk);
+
+	a->media_id = id;
+	lazy_str_ht_insert(&ml->media_ids, &a->media_id, a);
+	assert(ml->media_ids != NULL);
+	assert(lazy_str_ht_lookup(ml->media_ids, &id) == a);
+	lazy_str_ht_replace(&c->labels, &id, ml);
+	assert(lazy_str_ht_lookup(c->labels, &id) == ml);
+
+	assert(atomic64_get(&rtpe_stats_gauge.call_memory) == c->mem_usage);
+
+	rwlock_unlock_w(&c->master_lock);
+	log_info_pop();
+	call_destroy(c);
+	obj_put(c);
+
+	// everything was released with the call
+	assert(atomic64_get(&rtpe_stats_gauge.call_memory) == 0);
+
+	printf("memory accounting ok\n");
+}
+
+static void bench(void) {
+	long rss_start = rss();
+	double start = bench_now();
+	create_calls();
+	double created = bench_now();
+	long rss_new = rss() - rss_start;
+	uint64_t mem = atomic64_get(&rtpe_stats_gauge.call_memory);
+	destroy_calls();
+	double end = bench_now();
+	printf("%i calls: create %.1f ms, destroy %.1f ms, %li kB "
+			"(%" PRIu64 " bytes per call)\n",
+			NUM_CALLS, (created - start) * 1000, (end - created) * 1000, rss_new / 1024,
+			mem / NUM_CALLS);
+
+	assert(atomic64_get(&rtpe_stats_gauge.total_sessions) == 0);
+	assert(atomic64_get(&rtpe_stats_gauge.call_memory) == 0);
+}
+
+
+int main(void) {
+	rtpe_common_config_ptr = &rtpe_config.common;
+
+	rtpe_ssl_init();
+	rtpe_poller = poller_new();
+	call_init();
+	statistics_init();
+	call_interfaces_init();
+	ice_init();
+	control_ng_init();
+	dtls_init();
+
+	gettimeofday(&rtpe_now, NULL);
+
+	for (int i = 0; i < NUM_CALLS; i++) {
+		char buf[32];
+		snprintf(buf, sizeof(buf), "call-memory-%i", i);
+		callids[i] = STR_INIT_DUP(buf);
+	}
+
+	test_memory();
+	if (bench_enabled())
+		bench();
+
+	for (int i = 0; i < NUM_CALLS; i++)
+		g_free(callids[i].s);
+
+	statistics_free();
+	call_free();
+	call_interfaces_free();
+	control_ng_cleanup();
+	dtls_cert_free();
+	ice_free();
+
+	return 0;
+}
+
+int get_local_log_level(unsigned int u) {
+	return -1;
+}
@@ -0,0 +1,174 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include "call.h"
+#include "statistics.h"
+#include "poller.h"
+#include "control_ng.h"
+#include "call_interfaces.h"
+#include "ssllib.h"
+#include "ice.h"
+#include "main.h"
+#include "log_funcs.h"
+#include "bench.h"
+
+int _log_facility_rtcp;
+int _log_facility_cdr;
+int _log_facility_dtmf;
+struct rtpengine_config rtpe_config = {
+	.dtls_rsa_key_size = 2048,
+};
+struct rtpengine_config initial_rtpe_config;
+struct poller *rtpe_poller;
+struct poller_map *rtpe_poller_map;
+GString *dtmf_logs;
+GQueue rtpe_control_ng = G_QUEUE_INIT;
+
+#define NUM_CALLS 10000
+#define BENCH_LOOKUPS 1000000
+#define BENCH_THREADS 8
+
+static str callids[NUM_CALLS];
+static struct call *calls[NUM_CALLS];
+
+
+static void test_basic(void) {
+	for (int i = 0; i < NUM_CALLS; i++) {
+		char buf[32];
+		snprintf(buf, sizeof(buf), "callhash-%i", i);
+		callids[i] = STR_INIT_DUP(buf);
+		struct call *c = call_get_or_create(&callids[i], true);
+		assert(c != NULL);
+		calls[i] = c;
+		rwlock_unlock_w(&c->master_lock);
+		log_info_pop();
+	}
+	assert(atomic64_get(&rtpe_stats_gauge.total_sessions) == NUM_CALLS);
+
+	// calls are spread over all shards
+	for (int i = 0; i < CALLHASH_SHARDS; i++)
+		assert(g_hash_table_size(rtpe_callhash[i].ht) > 0);
+
+	for (int i = 0; i < NUM_CALLS; i++) {
+		struct call *c = call_get(&callids[i]);
+		assert(c == calls[i]);
+		rwlock_unlock_w(&c->master_lock);
+		log_info_pop();
+		obj_put(c);
+
+		assert(call_get_or_create(&callids[i], true) == NULL);
+
+		c = call_get_or_create(&callids[i], false);
+		assert(c == calls[i]);
+		rwlock_unlock_w(&c->master_lock);
+		log_info_pop();
+		obj_put(c);
+	}
+	str nx = STR_CONST_INIT("no such call");
+	assert(call_get(&nx) == NULL);
+
+	printf("basic ok\n");
+}
+
+struct bench_args {
+	unsigned int seed;
+	pthread_barrier_t *barrier;
+};
+
+static void *bench_thread(void *a) {
+	struct bench_args *args = a;
+	uint32_t x = args->seed;
+
+	pthread_barrier_wait(args->barrier);
+
+	for (int i = 0; i < BENCH_LOOKUPS; i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		const str *callid = &callids[x % NUM_CALLS];
+		struct call *c = call_get(callid);
+		log_info_pop();
+		rwlock_unlock_w(&c->master_lock);
+		obj_put(c);
+	}
+	return NULL;
+}
+
+static double bench_one(int threads) {
+	pthread_barrier_t barrier;
+	pthread_barrier_init(&barrier, NULL, threads + 1);
+
+	pthread_t tids[BENCH_THREADS];
+	struct bench_args args[BENCH_THREADS];
+	for (int t = 0; t < threads; t++) {
+		args[t] = (struct bench_args) { .seed = 42 + t, .barrier = &barrier };
+		pthread_create(&tids[t], NULL, bench_thread, &args[t]);
+	}
+
+	pthread_barrier_wait(&barrier);
+	double start = bench_now();
+	for (int t = 0; t < threads; t++)
+		pthread_join(tids[t], NULL);
+	double end = bench_now();
+
+	pthread_barrier_destroy(&barrier);
+
+	return (double) threads * BENCH_LOOKUPS / (end - start);
+}
+
+static void bench(void) {
+	for (int threads = 1; threads <= BENCH_THREADS; threads *= 2)
+		printf("call lookups, %i thread(s), %i shards: %5.2f M/s\n",
+				threads, CALLHASH_SHARDS, bench_one(threads) / 1e6);
+}
+
+static void test_destroy(void) {
+	for (int i = 0; i < NUM_CALLS; i++) {
+		call_destroy(calls[i]);
+		assert(call_get(&callids[i]) == NULL);
+		// a second destroy is a no-op
+		call_destroy(calls[i]);
+		obj_put(calls[i]);
+		g_free(callids[i].s);
+	}
+	assert(atomic64_get(&rtpe_stats_gauge.total_sessions) == 0);
+	for (int i = 0; i < CALLHASH_SHARDS; i++)
+		assert(g_hash_table_size(rtpe_callhash[i].ht) == 0);
+
+	printf("destroy ok\n");
+}
+
+
+int main(void) {
+	rtpe_common_config_ptr = &rtpe_config.common;
+
+	rtpe_ssl_init();
+	rtpe_poller = poller_new();
+	call_init();
+	statistics_init();
+	call_interfaces_init();
+	ice_init();
+	control_ng_init();
+	dtls_init();
+
+	gettimeofday(&rtpe_now, NULL);
+
+	test_basic();
+	if (bench_enabled())
+		bench();
+	test_destroy();
+
+	statistics_free();
+	call_free();
+	call_interfaces_free();
+	control_ng_cleanup();
+	dtls_cert_free();
+	ice_free();
+
+	return 0;
+}
+
+int get_local_log_level(unsigned int u) {
+	return -1;
+}
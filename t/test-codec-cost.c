@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "codec.h"
+#include "statistics.h"
+#include "main.h"
+
+int _log_facility_rtcp;
+int _log_facility_cdr;
+int _log_facility_dtmf;
+struct rtpengine_config rtpe_config;
+struct rtpengine_config initial_rtpe_config;
+struct poller *rtpe_poller;
+struct poller_map *rtpe_poller_map;
+GString *dtmf_logs;
+GQueue rtpe_control_ng = G_QUEUE_INIT;
+
+// same as an entry created by a codec handler, with a measured cost
+static void add_chain(const char *chain, long long cost_ns) {
+	struct codec_stats *stats_entry = g_slice_alloc0(sizeof(*stats_entry));
+	stats_entry->chain = strdup(chain);
+	stats_entry->chain_brief = g_strdup(chain);
+	atomic64_set(&stats_entry->cost_ns, cost_ns);
+	mutex_lock(&rtpe_codec_stats_lock);
+	g_hash_table_insert(rtpe_codec_stats, stats_entry->chain, stats_entry);
+	mutex_unlock(&rtpe_codec_stats_lock);
+}
+
+static long long cost(const char *codec) {
+	str s = STR_INIT((char *) codec);
+	return codec_cost_estimate(&s);
+}
+
+static void test_defaults(void) {
+	assert(cost("PCMA") == 2000);
+	assert(cost("pcmu") == 2000);
+	assert(cost("opus/48000/2") == 150000);
+	assert(cost("G722/8000") == 20000);
+	// no prefix matching
+	assert(cost("AMR") == 150000);
+	assert(cost("AMR-WB") == 250000);
+	assert(cost("AMR-WB/16000") == 250000);
+	assert(cost("EVS") == 500000);
+
+	// unknown codecs
+	assert(cost("foobar") == 100000);
+	assert(cost("PCM") == 100000);
+	assert(cost("opus2/48000") == 100000);
+
+	printf("default costs ok\n");
+}
+
+static void test_chains(void) {
+	add_chain("PCMA/8000 -> opus/48000/2", 300000);
+	add_chain("G722/8000 -> PCMA/8000", 50000);
+	add_chain("AMR-WB/16000/1 -> PCMU/8000", 700000);
+	// not measured yet
+	add_chain("G729/8000 -> PCMU/8000", 0);
+
+	// either side of a chain, with and without parameters, and the most expensive
+	// chain the codec is part of
+	assert(cost("opus") == 300000);
+	assert(cost("OPUS/48000/2") == 300000);
+	assert(cost("PCMA") == 300000);
+	assert(cost("G722") == 50000);
+	assert(cost("PCMU") == 700000);
+	assert(cost("AMR-WB") == 700000);
+
+	// only whole codec names on either side
+	assert(cost("AMR") == 150000);
+	assert(cost("PCM") == 100000);
+	assert(cost("G72") == 100000);
+
+	// a zero figure falls back to the default
+	assert(cost("G729") == 60000);
+	add_chain("G729/8000 -> speex/16000", 90000);
+	assert(cost("G729") == 90000);
+	assert(cost("speex") == 90000);
+
+	printf("measured costs ok\n");
+}
+
+int main(void) {
+	statistics_init();
+
+	test_defaults();
+	test_chains();
+
+	return 0;
+}
+
+int get_local_log_level(unsigned int u) {
+	return -1;
+}
@@ -0,0 +1,121 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "dtls.h"
+#include "ssllib.h"
+#include "poller.h"
+#include "call.h"
+#include "main.h"
+#include "bench.h"
+
+int _log_facility_rtcp;
+int _log_facility_cdr;
+int _log_facility_dtmf;
+struct rtpengine_config rtpe_config = {
+	.dtls_mtu = 1200,
+	.dtls_ciphers = "DEFAULT:!NULL:!aNULL:!SHA256:!SHA384:!aECDH:!AESGCM+AES256:!aPSK",
+};
+struct rtpengine_config initial_rtpe_config;
+struct poller *rtpe_poller;
+struct poller_map *rtpe_poller_map;
+GString *dtmf_logs;
+GQueue rtpe_control_ng = G_QUEUE_INIT;
+
+// there is no packet stream to verify the fingerprint against
+static int accept_any(int ok, X509_STORE_CTX *store) {
+	return 1;
+}
+
+static void bio_move(BIO *from, BIO *to) {
+	char buf[0x10000];
+	int len;
+	while ((len = BIO_read(from, buf, sizeof(buf))) > 0)
+		BIO_write(to, buf, len);
+}
+
+// runs a handshake between two connected SSL objects over memory BIOs
+static void handshake(SSL *client, BIO *c_r, BIO *c_w, SSL *server, BIO *s_r, BIO *s_w) {
+	SSL_set_connect_state(client);
+	SSL_set_accept_state(server);
+	for (int i = 0; i < 20; i++) {
+		SSL_do_handshake(client);
+		bio_move(c_w, s_r);
+		SSL_do_handshake(server);
+		bio_move(s_w, c_r);
+		if (SSL_is_init_finished(client) && SSL_is_init_finished(server)) {
+			assert(SSL_get_selected_srtp_profile(client) != NULL);
+			assert(SSL_get_selected_srtp_profile(server) != NULL);
+			return;
+		}
+	}
+	printf("DTLS handshake did not complete\n");
+	abort();
+}
+
+static void handshake_pooled(struct dtls_cert *cert) {
+	struct dtls_connection c = {0}, s = {0};
+	assert(dtls_connection_init(&c, NULL, 1, cert) == 0);
+	assert(dtls_connection_init(&s, NULL, 0, cert) == 0);
+	assert(dtls_is_active(&c) == 1);
+	assert(dtls_is_active(&s) == 0);
+	SSL_set_verify(c.ssl, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, accept_any);
+	SSL_set_verify(s.ssl, SSL_VERIFY_PEER | SSL_VERIFY_FAIL_IF_NO_PEER_CERT, accept_any);
+	handshake(c.ssl, c.r_bio, c.w_bio, s.ssl, s.r_bio, s.w_bio);
+	dtls_connection_cleanup(&c);
+	dtls_connection_cleanup(&s);
+}
+
+static void bench(struct dtls_cert *cert) {
+	const int iter = 200;
+
+	double start = bench_now();
+	for (int i = 0; i < iter; i++) {
+		handshake_pooled(cert);
+		if (i % 16 == 0)
+			dtls_pool_fill(cert); // done by a background thread in the daemon
+	}
+	double end = bench_now();
+
+	printf("DTLS loopback handshakes: %.0f/s\n", iter / (end - start));
+
+	// connection setup alone, served from the pool
+	dtls_pool_fill(cert);
+	struct dtls_connection conns[16];
+	start = bench_now();
+	for (int i = 0; i < G_N_ELEMENTS(conns); i++) {
+		ZERO(conns[i]);
+		assert(dtls_connection_init(&conns[i], NULL, i & 1, cert) == 0);
+	}
+	end = bench_now();
+	for (int i = 0; i < G_N_ELEMENTS(conns); i++)
+		dtls_connection_cleanup(&conns[i]);
+	printf("DTLS connection setup from pool: %.1f us\n", (end - start) * 1e6 / G_N_ELEMENTS(conns));
+}
+
+
+int main(void) {
+	rtpe_common_config_ptr = &rtpe_config.common;
+
+	rtpe_ssl_init();
+	assert(dtls_init() == 0);
+
+	struct dtls_cert *cert = dtls_cert();
+	assert(cert != NULL);
+	assert(cert->ssl_ctx[0] != NULL);
+	assert(cert->ssl_ctx[1] != NULL);
+	assert(cert->ssl_pool[0].length > 0);
+	assert(cert->ssl_pool[1].length > 0);
+
+	handshake_pooled(cert);
+	if (bench_enabled())
+		bench(cert);
+
+	obj_put(cert);
+	dtls_cert_free();
+
+	return 0;
+}
+
+int get_local_log_level(unsigned int u) {
+	return -1;
+}
@@ -9,6 +9,9 @@
 #include <spandsp/dtmf.h>
 #include <glib.h>
 #include <string.h>
+#include <time.h>
+#include "dtmflib.h"
+#include "bench.h"
 
 static unsigned char samples[] = {
   0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -608,12 +611,12 @@ static void report_func(void *ptr, int code, int level, int delay) {
 	g_string_append_printf(output, "code %i level %i delay %i, ", code, level, delay);
 }
 
-int main(int argc, char **argv) {
-	if (htole16(0x1234) != 0x1234) {
-		printf("Wrong native byte order - skipping test\n");
-		return 0;
-	}
+#define EXPECTED "code 56 level -4 delay 1020, " \
+	"code 0 level -99 delay 918, " \
+	"code 56 level -4 delay 510, " \
+	"code 0 level -99 delay 816, "
 
+static void test_spandsp(void) {
 	GString *output = g_string_new("");
 
 	dtmf_rx_state_t *dtmf_dsp;
@@ -641,14 +644,193 @@ int main(int argc, char **argv) {
 	}
 
 	printf("result: %s\n", output->str);
-	if (strcmp(output->str, "code 56 level -4 delay 1020, "
-				"code 0 level -99 delay 918, "
-				"code 56 level -4 delay 510, "
-				"code 0 level -99 delay 816, "))
+	if (strcmp(output->str, EXPECTED))
 		abort();
 
 	g_string_free(output, TRUE);
 	dtmf_rx_free(dtmf_dsp);
+}
+
+static void test_native(void) {
+	GString *output = g_string_new("");
+
+	struct dtmf_detect det;
+	dtmf_detect_init(&det, report_func, output);
+
+	unsigned char *reader = samples;
+	unsigned char *end = samples + sizeof(samples);
+	int packetise = 160;
+
+	while (reader + packetise * 2 <= end) {
+		dtmf_detect_samples(&det, (void *) reader, packetise);
+		reader += packetise * 2;
+	}
+
+	printf("native result: %s\n", output->str);
+	if (strcmp(output->str, EXPECTED))
+		abort();
+
+	g_string_free(output, TRUE);
+}
+
+
+// synthesised signals: digit sequences with noise, twist, packet loss and odd packet sizes,
+// which must produce exactly the same events from both detectors
+
+#define SIGNAL_LEN (8000 * 20)
+
+static uint32_t signal_seed;
+
+static uint32_t signal_rand(void) {
+	signal_seed = signal_seed * 1103515245 + 12345;
+	return signal_seed >> 8;
+}
+
+static void signal_gen(int16_t *buf, unsigned int len, unsigned int volume, int twist, unsigned int noise) {
+	unsigned int pos = 0;
+	while (pos < len) {
+		unsigned int tone = 160 + signal_rand() % 800;
+		unsigned int pause = 80 + signal_rand() % 800;
+		tone = MIN(tone, len - pos);
+		unsigned int event = signal_rand() % 16;
+
+		if (!twist)
+			dtmf_samples_int16_t(buf + pos, pos, tone, event, volume, 8000, 1);
+		else {
+			// one tone attenuated against the other
+			static const unsigned int rows[] = { 941, 697, 697, 697, 770, 770, 770, 852, 852, 852,
+				941, 941, 697, 770, 852, 941 };
+			static const unsigned int cols[] = { 1336, 1209, 1336, 1477, 1209, 1336, 1477, 1209, 1336,
+				1477, 1209, 1477, 1633, 1633, 1633, 1633 };
+			int16_t row[tone], col[tone];
+			tone_samples_int16_t(row, pos, tone, rows[event], volume + 6 + (twist < 0 ? -twist : 0),
+					8000, 1);
+			tone_samples_int16_t(col, pos, tone, cols[event], volume + 6 + (twist > 0 ? twist : 0),
+					8000, 1);
+			for (unsigned int i = 0; i < tone; i++)
+				buf[pos + i] = row[i] + col[i];
+		}
+		pos += tone;
+
+		pause = MIN(pause, len - pos);
+		memset(buf + pos, 0, pause * sizeof(*buf));
+		pos += pause;
+	}
+
+	for (unsigned int i = 0; noise && i < len; i++) {
+		int s = buf[i] + (int) (signal_rand() % (noise * 2 + 1)) - (int) noise;
+		buf[i] = CLAMP(s, -32768, 32767);
+	}
+}
+
+static void compare_one(const int16_t *buf, unsigned int len, unsigned int packet, unsigned int loss) {
+	GString *spandsp_out = g_string_new(""), *native_out = g_string_new("");
+
+	dtmf_rx_state_t *dsp = dtmf_rx_init(NULL, NULL, NULL);
+	dtmf_rx_set_realtime_callback(dsp, report_func, spandsp_out);
+	struct dtmf_detect det;
+	dtmf_detect_init(&det, report_func, native_out);
+
+	unsigned int n = 0;
+	for (unsigned int pos = 0; pos < len; pos += packet, n++) {
+		unsigned int num = MIN(packet, len - pos);
+		if (loss && n % loss == loss - 1) {
+			dtmf_rx_fillin(dsp, num);
+			dtmf_detect_fillin(&det, num);
+			continue;
+		}
+		dtmf_rx(dsp, buf + pos, num);
+		dtmf_detect_samples(&det, buf + pos, num);
+	}
+
+	if (strcmp(spandsp_out->str, native_out->str)) {
+		printf("mismatch with packet size %u, loss %u\nspandsp: %s\nnative:  %s\n",
+				packet, loss, spandsp_out->str, native_out->str);
+		abort();
+	}
+
+	g_string_free(spandsp_out, TRUE);
+	g_string_free(native_out, TRUE);
+	dtmf_rx_free(dsp);
+}
+
+static void test_compare(void) {
+	static int16_t buf[SIGNAL_LEN];
+	static const unsigned int packets[] = { 160, 80, 320, 37, 1 };
+	static const int twists[] = { 0, -3, 3, -6, 6, -10, 10 };
+
+	for (unsigned int volume = 0; volume <= 45; volume += 5) {
+		for (unsigned int t = 0; t < G_N_ELEMENTS(twists); t++) {
+			for (unsigned int noise = 0; noise <= 2000; noise += 500) {
+				signal_seed = volume * 1000 + t * 10 + noise;
+				signal_gen(buf, SIGNAL_LEN / 4, volume, twists[t], noise);
+				for (unsigned int p = 0; p < G_N_ELEMENTS(packets); p++)
+					compare_one(buf, SIGNAL_LEN / 4, packets[p], p == 0 ? 7 : 0);
+			}
+		}
+	}
+	printf("synthesised signals match\n");
+}
+
+
+#define BENCH_ROUNDS 20
+
+// samples per second through the detector, fed in 20 ms packets
+static double bench_one(const int16_t *buf, unsigned int len) {
+	double start = bench_now();
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		struct dtmf_detect det;
+		dtmf_detect_init(&det, NULL, NULL);
+		for (unsigned int pos = 0; pos + 160 <= len; pos += 160)
+			dtmf_detect_samples(&det, buf + pos, 160);
+	}
+	double end = bench_now();
+	return (double) BENCH_ROUNDS * len / (end - start);
+}
+
+static void bench(void) {
+	static int16_t buf[SIGNAL_LEN];
+	static const struct {
+		const char *name;
+		unsigned int volume;
+		unsigned int noise;
+		bool silence;
+	} signals[] = {
+		{ "DTMF",	10,	100,	false },
+		{ "noise",	0,	1000,	true },
+		{ "silence",	0,	4,	true },
+	};
+
+	for (unsigned int i = 0; i < G_N_ELEMENTS(signals); i++) {
+		signal_seed = i;
+		if (signals[i].silence) {
+			for (unsigned int j = 0; j < SIGNAL_LEN; j++)
+				buf[j] = (int) (signal_rand() % (signals[i].noise * 2 + 1)) - (int) signals[i].noise;
+		}
+		else
+			signal_gen(buf, SIGNAL_LEN, signals[i].volume, 0, signals[i].noise);
+
+		printf("DTMF detection, %-8s: %6.1f Msamples/s\n",
+				signals[i].name, bench_one(buf, SIGNAL_LEN) / 1e6);
+	}
+}
+
+
+int main(int argc, char **argv) {
+	if (htole16(0x1234) != 0x1234) {
+		printf("Wrong native byte order - skipping test\n");
+		return 0;
+	}
+
+	test_spandsp();
+	test_native();
+	test_compare();
+	if (bench_enabled())
+		bench();
 
 	return 0;
 }
+
+int get_local_log_level(unsigned int u) {
+	return -1;
+}
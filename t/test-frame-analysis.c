@@ -0,0 +1,138 @@
+#include <assert.h>
+#include <time.h>
+#include "codeclib.h"
+#include "main.h"
+#include "bench.h"
+
+struct rtpengine_config rtpe_config;
+struct rtpengine_config initial_rtpe_config;
+
+
+static uint32_t rand_seed = 1;
+
+static uint32_t test_rand(void) {
+	rand_seed = rand_seed * 1103515245 + 12345;
+	return rand_seed >> 8;
+}
+
+// every third burst is silent, the others are always above the threshold, so that
+// the silence runs are known up front
+static bool burst_silent(unsigned int i, unsigned int burst) {
+	return (i / burst) % 3 == 0;
+}
+static double sample_gen(unsigned int i, unsigned int burst, double thres) {
+	double f = (double) (test_rand() % 10001) / 10000.0;
+	double amp = burst_silent(i, burst) ? f * 0.9 * thres : (2 + f) * thres;
+	return test_rand() % 2 ? amp : -amp;
+}
+
+// runs which have started within the first `done` samples
+static unsigned int expected_runs(struct silence_run *runs, unsigned int burst, unsigned int done) {
+	unsigned int n = 0;
+	for (unsigned int start = 0; start < done; start += burst * 3) {
+		unsigned int end = start + burst;
+		runs[n++] = (struct silence_run) {
+			.start = start,
+			.end = end < done ? end : 0,
+		};
+	}
+	return n;
+}
+
+#define test_type(type, fmt, thres_int, thres_double, thres) \
+static void test_ ## type(void) { \
+	static type buf[4000]; \
+	static struct silence_run exp[G_N_ELEMENTS(buf)]; \
+	for (unsigned int trial = 0; trial < 300; trial++) { \
+		unsigned int len = test_rand() % G_N_ELEMENTS(buf) + 1; \
+		unsigned int burst = trial % 70 + 1; \
+		for (unsigned int i = 0; i < len; i++) \
+			buf[i] = sample_gen(i, burst, thres); \
+\
+		struct silence_ring ring; \
+		silence_ring_init(&ring, 2); /* small to exercise growing */ \
+		unsigned int popped = 0; \
+		unsigned int frame = trial % 333 + 1; \
+		for (unsigned int pos = 0; pos < len; pos += frame) { \
+			unsigned int num = MIN(frame, len - pos); \
+			assert(frame_analyse(&ring, fmt, buf + pos, num, pos, thres_int, thres_double)); \
+			unsigned int n = expected_runs(exp, burst, pos + num); \
+			assert(ring.len == n - popped); \
+			for (unsigned int i = 0; i < ring.len; i++) { \
+				struct silence_run *r = &ring.runs[(ring.head + i) & (ring.size - 1)]; \
+				assert(r->start == exp[popped + i].start); \
+				assert(r->end == exp[popped + i].end); \
+			} \
+			/* consume some, as the encoder would */ \
+			while (ring.len > 3) { \
+				silence_ring_pop(&ring); \
+				popped++; \
+			} \
+		} \
+		silence_ring_free(&ring); \
+	} \
+	printf("frame analysis " #type " ok\n"); \
+}
+
+test_type(int16_t, AV_SAMPLE_FMT_S16, 10 << 16, 0, 10)
+test_type(int32_t, AV_SAMPLE_FMT_S32, 10 << 16, 0, 10 << 16)
+test_type(float, AV_SAMPLE_FMT_FLT, 0, 0.0003, 0.0003)
+test_type(double, AV_SAMPLE_FMT_DBL, 0, 0.0003, 0.0003)
+
+
+#define BENCH_FRAME 960 // 20 ms at 48 kHz
+#define BENCH_FRAMES 100
+#define BENCH_ROUNDS 200
+
+static void bench(void) {
+	static int16_t buf[BENCH_FRAME * BENCH_FRAMES];
+	static const struct {
+		const char *name;
+		unsigned int burst;
+	} signals[] = {
+		{ "speech",	400 },
+		{ "choppy",	7 },
+		{ "silence",	G_N_ELEMENTS(buf) },
+	};
+
+	for (unsigned int s = 0; s < G_N_ELEMENTS(signals); s++) {
+		for (unsigned int i = 0; i < G_N_ELEMENTS(buf); i++)
+			buf[i] = sample_gen(i, signals[s].burst, 10);
+
+		struct silence_ring ring;
+		silence_ring_init(&ring, 16);
+		double start = bench_now();
+		for (int r = 0; r < BENCH_ROUNDS; r++) {
+			for (unsigned int f = 0; f < BENCH_FRAMES; f++) {
+				frame_analyse(&ring, AV_SAMPLE_FMT_S16, buf + f * BENCH_FRAME, BENCH_FRAME,
+						f * BENCH_FRAME, 10 << 16, 0);
+				while (ring.len > 1)
+					silence_ring_pop(&ring);
+			}
+			ring.len = 0;
+		}
+		double end = bench_now();
+		silence_ring_free(&ring);
+
+		printf("Frame analysis, %-8s: %6.1f Msamples/s\n",
+				signals[s].name, (double) BENCH_ROUNDS * G_N_ELEMENTS(buf) / (end - start) / 1e6);
+	}
+}
+
+
+int main(void) {
+	rtpe_common_config_ptr = &rtpe_config.common;
+
+	test_int16_t();
+	test_int32_t();
+	test_float();
+	test_double();
+	if (bench_enabled())
+		bench();
+
+	return 0;
+}
+
+int get_local_log_level(unsigned int u) {
+	return -1;
+}
@@ -0,0 +1,124 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "graphite.h"
+#include "statistics.h"
+#include "call_interfaces.h"
+#include "main.h"
+
+int _log_facility_rtcp;
+int _log_facility_cdr;
+int _log_facility_dtmf;
+struct rtpengine_config rtpe_config;
+struct rtpengine_config initial_rtpe_config;
+struct poller *rtpe_poller;
+struct poller_map *rtpe_poller_map;
+GString *dtmf_logs;
+GQueue rtpe_control_ng = G_QUEUE_INIT;
+
+static void *graphite_thread(void *p) {
+	graphite_loop(NULL);
+	return NULL;
+}
+
+int main(void) {
+	rtpe_common_config_ptr = &rtpe_config.common;
+
+	call_init();
+	statistics_init();
+	call_interfaces_init();
+
+	// local stand-in for a graphite server, which doesn't read at first. the small
+	// receive buffer makes the sender run into a full socket quickly
+	int lfd = socket(AF_INET, SOCK_STREAM, 0);
+	assert(lfd != -1);
+	int rcvbuf = 2048;
+	assert(setsockopt(lfd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)) == 0);
+	struct sockaddr_in sin = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	assert(bind(lfd, (struct sockaddr *) &sin, sizeof(sin)) == 0);
+	socklen_t sinlen = sizeof(sin);
+	assert(getsockname(lfd, (struct sockaddr *) &sin, &sinlen) == 0);
+	assert(listen(lfd, 1) == 0);
+	char buf[64];
+	snprintf(buf, sizeof(buf), "127.0.0.1:%u", ntohs(sin.sin_port));
+	assert(endpoint_parse_any(&rtpe_config.graphite_ep, buf) == 0);
+	rtpe_config.graphite_interval = 1;
+
+	// short intervals, so that a few of them pass quickly
+	gettimeofday(&rtpe_latest_graphite_interval_start, NULL);
+	struct timeval intv = { 0, 200000 };
+	set_graphite_interval_tv(&intv);
+
+	pthread_t thr;
+	pthread_create(&thr, NULL, graphite_thread, NULL);
+
+	struct pollfd pfd = { .fd = lfd, .events = POLLIN };
+	assert(poll(&pfd, 1, 2000) == 1);
+	int fd = accept(lfd, NULL, NULL);
+	assert(fd != -1);
+	struct timeval start;
+	gettimeofday(&start, NULL);
+
+	// the sender must keep to its schedule even though nothing is read
+	usleep(1000000);
+	assert(timeval_diff(&rtpe_latest_graphite_interval_start, &start) >= 800000);
+
+	// now read everything and check that only complete lines were sent, in order
+	GString *stream = g_string_new("");
+	for (int tries = 0; tries < 15; tries++) {
+		char rbuf[65536];
+		ssize_t len;
+		while ((len = recv(fd, rbuf, sizeof(rbuf), MSG_DONTWAIT)) > 0)
+			g_string_append_len(stream, rbuf, len);
+		usleep(100000);
+	}
+
+	rtpe_shutdown = true;
+	pthread_join(thr, NULL);
+
+	assert(stream->len > 0);
+	assert(stream->str[stream->len - 1] == '\n');
+
+	unsigned int intervals = 0;
+	unsigned long long last_ts = 0;
+	char **lines = g_strsplit(stream->str, "\n", -1);
+	for (char **l = lines; *l && **l; l++) {
+		char name[128];
+		char value[64];
+		unsigned long long ts;
+		int n = 0;
+		if (sscanf(*l, "%127s %63s %llu%n", name, value, &ts, &n) != 3 || (*l)[n]) {
+			printf("malformed line: '%s'\n", *l);
+			abort();
+		}
+		assert(ts >= last_ts);
+		last_ts = ts;
+		if (!strcmp(name, "ping_time_min"))
+			intervals++;
+	}
+	g_strfreev(lines);
+
+	printf("%u complete intervals received, %zu bytes\n", intervals, stream->len);
+	assert(intervals >= 5);
+
+	g_string_free(stream, TRUE);
+	close(fd);
+	close(lfd);
+
+	statistics_free();
+	call_free();
+	call_interfaces_free();
+	free_prefix();
+
+	return 0;
+}
+
+int get_local_log_level(unsigned int u) {
+	return -1;
+}
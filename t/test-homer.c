@@ -0,0 +1,224 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "homer.h"
+#include "statistics.h"
+#include "main.h"
+
+int _log_facility_rtcp;
+int _log_facility_cdr;
+int _log_facility_dtmf;
+struct rtpengine_config rtpe_config;
+struct rtpengine_config initial_rtpe_config;
+struct poller *rtpe_poller;
+struct poller_map *rtpe_poller_map;
+GString *dtmf_logs;
+GQueue rtpe_control_ng = G_QUEUE_INIT;
+
+static endpoint_t src, dst;
+
+// local stand-in for a Homer server, returns the socket and fills in its address
+static int collector(int type, endpoint_t *ep) {
+	int fd = socket(AF_INET, type, 0);
+	assert(fd != -1);
+	struct sockaddr_in sin = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	assert(bind(fd, (struct sockaddr *) &sin, sizeof(sin)) == 0);
+	socklen_t sinlen = sizeof(sin);
+	assert(getsockname(fd, (struct sockaddr *) &sin, &sinlen) == 0);
+	if (type == SOCK_STREAM)
+		assert(listen(fd, 1) == 0);
+	char buf[64];
+	snprintf(buf, sizeof(buf), "127.0.0.1:%u", ntohs(sin.sin_port));
+	assert(endpoint_parse_any(ep, buf) == 0);
+	return fd;
+}
+
+static void start(int type, int queue, int sample) {
+	rtpe_config.homer_protocol = type;
+	rtpe_config.homer_queue = queue;
+	rtpe_config.homer_sample = sample;
+	homer_sender_init(&rtpe_config.homer_ep, type, 2001);
+	assert(has_homer());
+}
+
+static void send_msg(const char *callid, int i) {
+	char buf[64];
+	snprintf(buf, sizeof(buf), "{ \"msg\":%i }", i);
+	str s = STR_INIT(buf);
+	str id = STR_INIT((char *) callid);
+	homer_send(&s, &id, &src, &dst, &rtpe_now);
+}
+
+// checks a HEP packet and returns the number in its JSON payload
+static int check_hep(const char *buf, size_t len) {
+	assert(len > 6);
+	assert(memcmp(buf, "HEP3", 4) == 0);
+	uint16_t hlen;
+	memcpy(&hlen, buf + 4, 2);
+	assert(ntohs(hlen) == len);
+	const char *p = memmem(buf, len, "{ \"msg\":", 8);
+	assert(p != NULL);
+	return atoi(p + 8);
+}
+
+static void test_udp(void) {
+	int fd = collector(SOCK_DGRAM, &rtpe_config.homer_ep);
+	start(SOCK_DGRAM, 256, 1);
+
+	for (int i = 0; i < 100; i++)
+		send_msg("udp-call", i);
+	uint64_t sent = atomic64_get(&rtpe_stats.homer_messages);
+	homer_exporter();
+	assert(atomic64_get(&rtpe_stats.homer_messages) - sent == 100);
+
+	for (int i = 0; i < 100; i++) {
+		char buf[4096];
+		ssize_t len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+		assert(len > 0);
+		assert(check_hep(buf, len) == i);
+		assert(memmem(buf, len, "udp-call", 8) != NULL);
+	}
+
+	homer_sender_free();
+	assert(!has_homer());
+	close(fd);
+	printf("UDP ok\n");
+}
+
+static void test_overflow(void) {
+	int fd = collector(SOCK_DGRAM, &rtpe_config.homer_ep);
+	start(SOCK_DGRAM, 10, 1); // rounded up to 16
+
+	uint64_t drops = atomic64_get(&rtpe_stats.homer_drops);
+	for (int i = 0; i < 20; i++)
+		send_msg("overflow", i);
+	assert(atomic64_get(&rtpe_stats.homer_drops) - drops == 4);
+
+	homer_exporter();
+	// the oldest ones made it, and there's room again
+	send_msg("overflow", 100);
+	homer_exporter();
+	for (int i = 0; i < 17; i++) {
+		char buf[4096];
+		ssize_t len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+		assert(len > 0);
+		assert(check_hep(buf, len) == (i < 16 ? i : 100));
+	}
+
+	// too large for the queue
+	char big[5000];
+	memset(big, 'x', sizeof(big));
+	str s = STR_INIT_LEN(big, sizeof(big));
+	str id = STR_INIT("overflow");
+	drops = atomic64_get(&rtpe_stats.homer_drops);
+	homer_send(&s, &id, &src, &dst, &rtpe_now);
+	assert(atomic64_get(&rtpe_stats.homer_drops) - drops == 1);
+	send_msg("overflow", 200);
+	homer_exporter();
+	char buf[8192];
+	ssize_t len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+	assert(len > 0);
+	assert(check_hep(buf, len) == 200);
+
+	homer_sender_free();
+	close(fd);
+	printf("overflow ok\n");
+}
+
+static void test_sample(void) {
+	int fd = collector(SOCK_DGRAM, &rtpe_config.homer_ep);
+	start(SOCK_DGRAM, 256, 4);
+
+	int expected = 0;
+	for (int i = 0; i < 200; i++) {
+		char callid[32];
+		snprintf(callid, sizeof(callid), "call-%i", i);
+		str id = STR_INIT(callid);
+		if (str_hash(&id) % 4 == 0)
+			expected++;
+		send_msg(callid, i);
+	}
+	homer_exporter();
+
+	int received = 0;
+	char buf[4096];
+	while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+		received++;
+	assert(received == expected);
+	assert(expected > 0 && expected < 200);
+
+	homer_sender_free();
+	close(fd);
+	printf("sampling ok (%i of 200 calls)\n", received);
+}
+
+static void test_tcp(void) {
+	int lfd = collector(SOCK_STREAM, &rtpe_config.homer_ep);
+	start(SOCK_STREAM, 1024, 1);
+
+	for (int i = 0; i < 1000; i++)
+		send_msg("tcp-call", i);
+
+	// connect, possibly in progress
+	homer_exporter();
+	struct pollfd pfd = { .fd = lfd, .events = POLLIN };
+	assert(poll(&pfd, 1, 1000) == 1);
+	int fd = accept(lfd, NULL, NULL);
+	assert(fd != -1);
+
+	// read back the stream until all messages have arrived
+	GString *stream = g_string_new("");
+	int next = 0;
+	for (int tries = 0; next < 1000 && tries < 1000; tries++) {
+		homer_exporter();
+		char buf[65536];
+		ssize_t len;
+		while ((len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+			g_string_append_len(stream, buf, len);
+		while (stream->len >= 6) {
+			uint16_t hlen;
+			memcpy(&hlen, stream->str + 4, 2);
+			hlen = ntohs(hlen);
+			if (stream->len < hlen)
+				break;
+			assert(check_hep(stream->str, hlen) == next);
+			next++;
+			g_string_erase(stream, 0, hlen);
+		}
+		usleep(1000);
+	}
+	assert(next == 1000);
+	assert(stream->len == 0);
+	g_string_free(stream, TRUE);
+
+	homer_sender_free();
+	close(fd);
+	close(lfd);
+	printf("TCP ok\n");
+}
+
+
+int main(void) {
+	rtpe_common_config_ptr = &rtpe_config.common;
+
+	socket_init();
+	gettimeofday(&rtpe_now, NULL);
+	endpoint_parse_any(&src, "10.0.0.1:5000");
+	endpoint_parse_any(&dst, "10.0.0.2:6000");
+
+	test_udp();
+	test_overflow();
+	test_sample();
+	test_tcp();
+
+	return 0;
+}
+
+int get_local_log_level(unsigned int u) {
+	return -1;
+}
@@ -0,0 +1,373 @@
+#include "jsonlib.h"
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <json-glib/json-glib.h>
+
+
+static void writer_eq(struct json_writer *w, const char *exp) {
+	char *s = json_writer_finish(w);
+	if (strcmp(s, exp)) {
+		printf("writer mismatch:\n  got: %s\n  exp: %s\n", s, exp);
+		abort();
+	}
+	g_free(s);
+}
+
+static void test_writer(void) {
+	struct json_writer *w = json_writer_new();
+	json_writer_begin_object(w);
+	json_writer_end_object(w);
+	writer_eq(w, "{}");
+
+	w = json_writer_new();
+	json_writer_begin_object(w);
+	json_writer_key(w, "janus");
+	json_writer_string(w, "success");
+	json_writer_key(w, "session_id");
+	json_writer_int(w, 1234567890123LL);
+	json_writer_key(w, "data");
+	json_writer_begin_object(w);
+	json_writer_key(w, "id");
+	json_writer_uint(w, 18446744073709551615ULL);
+	json_writer_key(w, "list");
+	json_writer_begin_array(w);
+	json_writer_int(w, -1);
+	json_writer_begin_array(w);
+	json_writer_end_array(w);
+	json_writer_bool(w, true);
+	json_writer_bool(w, false);
+	json_writer_null(w);
+	json_writer_string(w, NULL);
+	json_writer_begin_object(w);
+	json_writer_key(w, "x");
+	json_writer_double(w, 0.5);
+	json_writer_end_object(w);
+	json_writer_double(w, 3);
+	json_writer_end_array(w);
+	json_writer_end_object(w);
+	json_writer_key(w, "raw");
+	json_writer_raw(w, "[1,2]", 5);
+	json_writer_key(w, "fmt");
+	json_writer_printf(w, "%u-%s", 5, "x");
+	json_writer_end_object(w);
+	writer_eq(w, "{\"janus\":\"success\",\"session_id\":1234567890123,\"data\":{\"id\":18446744073709551615,"
+			"\"list\":[-1,[],true,false,null,null,{\"x\":0.5},3.0]},\"raw\":[1,2],\"fmt\":\"5-x\"}");
+
+	// escaping
+	w = json_writer_new();
+	json_writer_begin_array(w);
+	json_writer_string(w, "a\"b\\c/d\b\f\n\r\t\x01\x1f \xc3\xa4");
+	json_writer_string_len(w, "nul\0byte", 8);
+	json_writer_end_array(w);
+	writer_eq(w, "[\"a\\\"b\\\\c/d\\b\\f\\n\\r\\t\\u0001\\u001f \xc3\xa4\",\"nul\\u0000byte\"]");
+
+	// long formatted string
+	w = json_writer_new();
+	char longstr[300];
+	memset(longstr, 'x', sizeof(longstr) - 1);
+	longstr[sizeof(longstr) - 1] = '\0';
+	json_writer_printf(w, "%s", longstr);
+	char exp[sizeof(longstr) + 2];
+	sprintf(exp, "\"%s\"", longstr);
+	writer_eq(w, exp);
+
+	// reusable buffer
+	GString *gs = g_string_new("");
+	struct json_writer sw;
+	json_writer_init(&sw, gs);
+	for (int i = 0; i < 3; i++) {
+		json_writer_reset(&sw);
+		json_writer_begin_object(&sw);
+		json_writer_key(&sw, "i");
+		json_writer_int(&sw, i);
+		json_writer_end_object(&sw);
+		char e[16];
+		sprintf(e, "{\"i\":%i}", i);
+		assert(strcmp(gs->str, e) == 0);
+	}
+	g_string_free(gs, TRUE);
+
+	// rolling back members and elements
+	w = json_writer_new();
+	struct json_writer_mark mark;
+	json_writer_begin_object(w);
+	json_writer_mark(w, &mark);
+	json_writer_key(w, "gone");
+	json_writer_int(w, 0);
+	json_writer_rollback(w, &mark);
+	json_writer_key(w, "a");
+	json_writer_begin_array(w);
+	json_writer_mark(w, &mark);
+	json_writer_begin_object(w);
+	json_writer_key(w, "x");
+	json_writer_begin_array(w);
+	json_writer_rollback(w, &mark);
+	json_writer_int(w, 1);
+	json_writer_mark(w, &mark);
+	json_writer_int(w, 2);
+	json_writer_rollback(w, &mark);
+	json_writer_end_array(w);
+	json_writer_mark(w, &mark);
+	json_writer_key(w, "b");
+	json_writer_string(w, "gone");
+	json_writer_rollback(w, &mark);
+	json_writer_end_object(w);
+	writer_eq(w, "{\"a\":[1]}");
+
+	printf("writer tests ok\n");
+}
+
+
+// renders the token stream in a compact form for comparison
+static char *tokens(const char *in) {
+	struct json_tokenizer t;
+	struct json_token tok;
+	GString *out = g_string_new("");
+	json_tokenizer_init(&t, in, strlen(in));
+
+	while (1) {
+		enum json_token_type type = json_tokenizer_next(&t, &tok);
+		char buf[256];
+		switch (type) {
+			case JSON_TOK_ERROR:
+				g_string_append(out, "ERR");
+				return g_string_free(out, FALSE);
+			case JSON_TOK_END:
+				g_string_append(out, "END");
+				return g_string_free(out, FALSE);
+			case JSON_TOK_OBJECT_BEGIN:
+				g_string_append(out, "{ ");
+				break;
+			case JSON_TOK_OBJECT_END:
+				g_string_append(out, "} ");
+				break;
+			case JSON_TOK_ARRAY_BEGIN:
+				g_string_append(out, "[ ");
+				break;
+			case JSON_TOK_ARRAY_END:
+				g_string_append(out, "] ");
+				break;
+			case JSON_TOK_KEY:
+			case JSON_TOK_STRING:
+				assert(tok.s.len < sizeof(buf));
+				size_t len = json_token_unescape(&tok, buf);
+				assert(len <= tok.s.len);
+				g_string_append_printf(out, "%s<%.*s> ", type == JSON_TOK_KEY ? "K" : "S",
+						(int) len, buf);
+				break;
+			case JSON_TOK_INT:
+				g_string_append_printf(out, "I%" PRId64 " ", tok.i);
+				break;
+			case JSON_TOK_DOUBLE:
+				g_string_append_printf(out, "D%g ", tok.d);
+				break;
+			case JSON_TOK_BOOL:
+				g_string_append_printf(out, "B%" PRId64 " ", tok.i);
+				break;
+			case JSON_TOK_NULL:
+				g_string_append(out, "N ");
+				break;
+		}
+	}
+}
+
+#define tok_test(in, exp) do { \
+		char *s = tokens(in); \
+		if (strcmp(s, exp)) { \
+			printf("tokenizer mismatch on line %i:\n  in:  %s\n  got: %s\n  exp: %s\n", \
+					__LINE__, in, s, exp); \
+			abort(); \
+		} \
+		g_free(s); \
+	} while (0)
+
+static void test_tokenizer(void) {
+	tok_test("{}", "{ } END");
+	tok_test("[]", "[ ] END");
+	tok_test(" { \"a\" : 1 , \"b\":[true,false,null,\"x\",-5,1.5e1,{}] }\n",
+			"{ K<a> I1 K<b> [ B1 B0 N S<x> I-5 D15 { } ] } END");
+	tok_test("\"top\"", "S<top> END");
+	tok_test("-0", "I0 END");
+	tok_test("9223372036854775807", "I9223372036854775807 END");
+	tok_test("-9223372036854775808", "I-9223372036854775808 END");
+	tok_test("9223372036854775808", "D9.22337e+18 END");
+	tok_test("[0.25,1E2,2e-1]", "[ D0.25 D100 D0.2 ] END");
+	tok_test("\"a\\\"b\\\\c\\/d\\n\\t\\u00e4\\u20ac\\ud83d\\ude00\"",
+			"S<a\"b\\c/d\n\t\xc3\xa4\xe2\x82\xac\xf0\x9f\x98\x80> END");
+	tok_test("\"\\ud83dx\"", "S<\xef\xbf\xbdx> END");
+	tok_test("{\"k\\u0041\":\"v\"}", "{ K<kA> S<v> } END");
+
+	// errors
+	tok_test("", "ERR");
+	tok_test("{", "{ ERR");
+	tok_test("{\"a\"}", "{ ERR");
+	tok_test("{\"a\":}", "{ K<a> ERR");
+	tok_test("{\"a\":1,}", "{ K<a> I1 ERR");
+	tok_test("[1,]", "[ I1 ERR");
+	tok_test("[1 2]", "[ I1 ERR");
+	tok_test("[1}", "[ I1 ERR");
+	tok_test("{1:2}", "{ ERR");
+	tok_test("{} x", "{ } ERR");
+	tok_test("01", "I0 ERR");
+	tok_test("1.", "ERR");
+	tok_test("-", "ERR");
+	tok_test("1e", "ERR");
+	tok_test("tru", "ERR");
+	tok_test("\"abc", "ERR");
+	tok_test("\"a\nb\"", "ERR");
+	tok_test("\"\\x\"", "ERR");
+	tok_test("\"\\u12g4\"", "ERR");
+
+	// nesting limit
+	char deep[JSON_MAX_DEPTH * 2 + 1];
+	memset(deep, '[', JSON_MAX_DEPTH);
+	memset(deep + JSON_MAX_DEPTH, ']', JSON_MAX_DEPTH);
+	deep[JSON_MAX_DEPTH * 2] = '\0';
+	char *s = tokens(deep);
+	assert(strcmp(s + strlen(s) - 3, "ERR") == 0);
+	g_free(s);
+
+	printf("tokenizer tests ok\n");
+}
+
+
+static const char *bench_doc = "{\"command\":\"offer\",\"call-id\":\"a84b4c76e66710@pc33.example.com\","
+	"\"from-tag\":\"1928301774\",\"flags\":[\"trust-address\",\"loop-protect\",\"strict-source\"],"
+	"\"replace\":[\"origin\",\"session-connection\"],\"rtcp-mux\":[\"demux\"],"
+	"\"ICE\":\"remove\",\"transport-protocol\":\"RTP/AVP\",\"received-from\":[\"IP4\",\"198.51.100.1\"],"
+	"\"sdp\":\"v=0\\r\\no=- 1545997027 1 IN IP4 198.51.100.1\\r\\ns=tester\\r\\nt=0 0\\r\\n"
+	"m=audio 2000 RTP/AVP 0 8 101\\r\\nc=IN IP4 198.51.100.1\\r\\na=rtpmap:101 telephone-event/8000\\r\\n"
+	"a=sendrecv\\r\\n\",\"record call\":\"no\",\"ptime\":20}";
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void build_glib(void) {
+	JsonBuilder *b = json_builder_new();
+	json_builder_begin_object(b);
+	json_builder_set_member_name(b, "janus");
+	json_builder_add_string_value(b, "event");
+	json_builder_set_member_name(b, "plugindata");
+	json_builder_begin_object(b);
+	json_builder_set_member_name(b, "plugin");
+	json_builder_add_string_value(b, "janus.plugin.videoroom");
+	json_builder_set_member_name(b, "data");
+	json_builder_begin_object(b);
+	json_builder_set_member_name(b, "videoroom");
+	json_builder_add_string_value(b, "joined");
+	json_builder_set_member_name(b, "room");
+	json_builder_add_int_value(b, 8234723498723ULL);
+	json_builder_set_member_name(b, "publishers");
+	json_builder_begin_array(b);
+	for (int i = 0; i < 5; i++) {
+		json_builder_begin_object(b);
+		json_builder_set_member_name(b, "id");
+		json_builder_add_int_value(b, 23487234987 + i);
+		json_builder_set_member_name(b, "display");
+		json_builder_add_string_value(b, "Some \"display\" name");
+		json_builder_end_object(b);
+	}
+	json_builder_end_array(b);
+	json_builder_end_object(b);
+	json_builder_end_object(b);
+	json_builder_set_member_name(b, "transaction");
+	json_builder_add_string_value(b, "NvE8ktmWwwrD");
+	json_builder_set_member_name(b, "session_id");
+	json_builder_add_int_value(b, 3874628736);
+	json_builder_end_object(b);
+
+	JsonGenerator *gen = json_generator_new();
+	JsonNode *root = json_builder_get_root(b);
+	json_generator_set_root(gen, root);
+	char *result = json_generator_to_data(gen, NULL);
+	json_node_free(root);
+	g_object_unref(gen);
+	g_object_unref(b);
+	g_free(result);
+}
+
+static void build_writer(void) {
+	struct json_writer *w = json_writer_new();
+	json_writer_begin_object(w);
+	json_writer_key(w, "janus");
+	json_writer_string(w, "event");
+	json_writer_key(w, "plugindata");
+	json_writer_begin_object(w);
+	json_writer_key(w, "plugin");
+	json_writer_string(w, "janus.plugin.videoroom");
+	json_writer_key(w, "data");
+	json_writer_begin_object(w);
+	json_writer_key(w, "videoroom");
+	json_writer_string(w, "joined");
+	json_writer_key(w, "room");
+	json_writer_int(w, 8234723498723ULL);
+	json_writer_key(w, "publishers");
+	json_writer_begin_array(w);
+	for (int i = 0; i < 5; i++) {
+		json_writer_begin_object(w);
+		json_writer_key(w, "id");
+		json_writer_int(w, 23487234987 + i);
+		json_writer_key(w, "display");
+		json_writer_string(w, "Some \"display\" name");
+		json_writer_end_object(w);
+	}
+	json_writer_end_array(w);
+	json_writer_end_object(w);
+	json_writer_end_object(w);
+	json_writer_key(w, "transaction");
+	json_writer_string(w, "NvE8ktmWwwrD");
+	json_writer_key(w, "session_id");
+	json_writer_int(w, 3874628736);
+	json_writer_end_object(w);
+	g_free(json_writer_finish(w));
+}
+
+static void parse_glib(void) {
+	JsonParser *p = json_parser_new();
+	if (!json_parser_load_from_data(p, bench_doc, -1, NULL))
+		abort();
+	g_object_unref(p);
+}
+
+static void parse_tokenizer(void) {
+	struct json_tokenizer t;
+	struct json_token tok;
+	char buf[512];
+	json_tokenizer_init(&t, bench_doc, strlen(bench_doc));
+	while (1) {
+		enum json_token_type type = json_tokenizer_next(&t, &tok);
+		if (type == JSON_TOK_END)
+			break;
+		if (type == JSON_TOK_ERROR)
+			abort();
+		if (tok.escaped)
+			json_token_unescape(&tok, buf);
+	}
+}
+
+static void bench(const char *name, void (*a)(void), void (*b)(void)) {
+	const int iter = 20000;
+	double start = now();
+	for (int i = 0; i < iter; i++)
+		a();
+	double mid = now();
+	for (int i = 0; i < iter; i++)
+		b();
+	double end = now();
+	printf("%s: json-glib %.0f/s, jsonlib %.0f/s (%.1fx)\n", name,
+			iter / (mid - start), iter / (end - mid), (mid - start) / (end - mid));
+}
+
+
+int main(void) {
+	test_writer();
+	test_tokenizer();
+	bench("build+serialize", build_glib, build_writer);
+	bench("parse", parse_glib, parse_tokenizer);
+	return 0;
+}
@@ -1,7 +1,449 @@
+#define _GNU_SOURCE
 #include <assert.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include "kernel.h"
 #include "../kernel-module/xt_RTPENGINE.h"
 
+#define ROUTE_CACHE_PORT 4480
+#define ROUTE_CACHE_PACKETS 100
+
+#define FANOUT_PORT 4460
+#define FANOUT_MAX_DESTS 8
+#define FANOUT_PACKETS 200000
+
+// addresses as set up by kernel-xdp-veth-test.sh
+#define XDP_LOCAL 0x0a630001 // 10.99.0.1, our end of the veth pair
+#define XDP_PEER 0x0a630002 // 10.99.0.2, in the namespace
+#define XDP_PORT 4470
+#define XDP_PACKETS 20000
+
+static int udp_socket_addr(uint32_t addr, unsigned int port) {
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	assert(fd != -1);
+	int bufsize = 4 * 1024 * 1024;
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+	struct sockaddr_in sin = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(addr),
+		.sin_port = htons(port),
+	};
+	assert(bind(fd, (struct sockaddr *) &sin, sizeof(sin)) == 0);
+	return fd;
+}
+
+static int udp_socket(unsigned int port) {
+	return udp_socket_addr(0x7f000001, port);
+}
+
+static unsigned int drain(int fd) {
+	char buf[2048];
+	unsigned int ret = 0;
+	while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+		ret++;
+	return ret;
+}
+
+static void route_cache_dest(unsigned int num, unsigned int src_port, unsigned int dst_port,
+		unsigned char tos)
+{
+	struct rtpengine_destination_info redi = {
+		.local = {
+			.family = AF_INET,
+			.u.ipv4 = htonl(0x7f000001),
+			.port = ROUTE_CACHE_PORT,
+		},
+		.num = num,
+		.output = {
+			.src_addr = {
+				.family = AF_INET,
+				.u.ipv4 = htonl(0x7f000001),
+				.port = src_port,
+			},
+			.dst_addr = {
+				.family = AF_INET,
+				.u.ipv4 = htonl(0x7f000001),
+				.port = dst_port,
+			},
+			.encrypt = {
+				.cipher = REC_NULL,
+				.hmac = REH_NULL,
+			},
+			.tos = tos,
+			.ssrc_subst = 1,
+			.ssrc_out = { htonl(0x9abc + num), 0, },
+			.seq_offset = { 1000 * (num + 1), 0, },
+		},
+	};
+	assert(kernel_add_destination(&redi) == 0);
+}
+
+static void route_cache_add(unsigned int dst_port) {
+	struct rtpengine_target_info reti = {
+		.local = {
+			.family = AF_INET,
+			.u.ipv4 = htonl(0x7f000001),
+			.port = ROUTE_CACHE_PORT,
+		},
+		.src_mismatch = MSM_IGNORE,
+		.num_destinations = 2,
+		.decrypt = {
+			.cipher = REC_NULL,
+			.hmac = REH_NULL,
+		},
+		.rtp = 1,
+		.ssrc = { htonl(0x1234), 0, },
+		.num_payload_types = 1,
+		.pt_input = {
+			{ 0, 8000, },
+		},
+	};
+	assert(kernel_add_stream(&reti) == 0);
+	route_cache_dest(0, ROUTE_CACHE_PORT + 2, dst_port, 0);
+	route_cache_dest(1, ROUTE_CACHE_PORT + 4, dst_port + 1, 0xb8);
+}
+
+// receives one forwarded packet and checks everything that comes from the output's
+// header template, plus the rewritten RTP header and the untouched payload
+static void route_cache_recv(int fd, unsigned int num, const unsigned char *pkt, size_t pkt_len,
+		uint16_t seq)
+{
+	unsigned char rbuf[2048];
+	char cbuf[CMSG_SPACE(sizeof(int))];
+	struct sockaddr_in from;
+	struct iovec iov = {
+		.iov_base = rbuf,
+		.iov_len = sizeof(rbuf),
+	};
+	struct msghdr mh = {
+		.msg_name = &from,
+		.msg_namelen = sizeof(from),
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = cbuf,
+		.msg_controllen = sizeof(cbuf),
+	};
+	ssize_t len = recvmsg(fd, &mh, 0);
+	assert(len == pkt_len);
+	assert(from.sin_addr.s_addr == htonl(0x7f000001));
+	assert(from.sin_port == htons(ROUTE_CACHE_PORT + 2 + num * 2));
+
+	int tos = -1;
+	for (struct cmsghdr *cm = CMSG_FIRSTHDR(&mh); cm; cm = CMSG_NXTHDR(&mh, cm)) {
+		if (cm->cmsg_level == IPPROTO_IP && cm->cmsg_type == IP_TOS)
+			tos = *(unsigned char *) CMSG_DATA(cm);
+	}
+	assert(tos == (num ? 0xb8 : 0));
+
+	uint16_t out_seq = htons(seq + 1000 * (num + 1));
+	assert(!memcmp(&rbuf[2], &out_seq, 2));
+	uint32_t ssrc = htonl(0x9abc + num);
+	assert(!memcmp(&rbuf[8], &ssrc, 4));
+	assert(!memcmp(&rbuf[12], &pkt[12], pkt_len - 12));
+}
+
+// Forwards plain RTP to two outputs on loopback with different source ports and TOS.
+// The first packet looks up the route and every later one goes through the cached
+// route and the pre-built headers, so each packet is checked individually. The target
+// is then replaced with one pointing to different ports, which must not reuse anything
+// from the old outputs. Packets must be directed into the module for this, e.g.:
+//   iptables -I INPUT -p udp -d 127.0.0.1 --dport 4480 -j RTPENGINE --id 0
+// Runs only if RTPE_ROUTE_CACHE_TEST is set in the environment.
+static void route_cache_test(void) {
+	if (!getenv("RTPE_ROUTE_CACHE_TEST"))
+		return;
+
+	unsigned int ports[2][2] = { { 7820, 7821 }, { 7830, 7831 } };
+	int rfds[2][2];
+	for (unsigned int i = 0; i < 2; i++) {
+		for (unsigned int j = 0; j < 2; j++) {
+			rfds[i][j] = udp_socket(ports[i][j]);
+			int on = 1;
+			assert(setsockopt(rfds[i][j], IPPROTO_IP, IP_RECVTOS, &on, sizeof(on)) == 0);
+			struct timeval tv = { 1, 0 };
+			setsockopt(rfds[i][j], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		}
+	}
+
+	int sfd = udp_socket(5557);
+	struct sockaddr_in dst = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(0x7f000001),
+		.sin_port = htons(ROUTE_CACHE_PORT),
+	};
+
+	unsigned char pkt[12 + 160];
+	pkt[0] = 0x80;
+	pkt[1] = 0;
+	memset(&pkt[4], 0, 4);
+	uint32_t ssrc = htonl(0x1234);
+	memcpy(&pkt[8], &ssrc, 4);
+
+	for (unsigned int round = 0; round < 2; round++) {
+		if (round) {
+			struct rtpengine_command_del_target_stats cmd = {
+				.local = {
+					.family = AF_INET,
+					.u.ipv4 = htonl(0x7f000001),
+					.port = ROUTE_CACHE_PORT,
+				},
+			};
+			assert(kernel_del_stream_stats(&cmd) == 0);
+		}
+		route_cache_add(ports[round][0]);
+
+		for (unsigned int n = 0; n < ROUTE_CACHE_PACKETS; n++) {
+			uint16_t seq = htons(n);
+			memcpy(&pkt[2], &seq, 2);
+			memset(&pkt[12], n, sizeof(pkt) - 12);
+			sendto(sfd, pkt, sizeof(pkt), 0, (struct sockaddr *) &dst, sizeof(dst));
+			for (unsigned int j = 0; j < 2; j++)
+				route_cache_recv(rfds[round][j], j, pkt, sizeof(pkt), n);
+		}
+	}
+
+	// nothing may still go to the ports of the replaced target
+	for (unsigned int j = 0; j < 2; j++)
+		assert(drain(rfds[0][j]) == 0);
+
+	printf("route cache and header templates: %u packets checked\n", ROUTE_CACHE_PACKETS * 4);
+
+	close(sfd);
+	for (unsigned int i = 0; i < 2; i++)
+		for (unsigned int j = 0; j < 2; j++)
+			close(rfds[i][j]);
+}
+
+// Forwards plain RTP from one target to `dests` outputs on loopback and reports the rate.
+static void fanout_bench_run(unsigned int dests) {
+	struct rtpengine_target_info reti = {
+		.local = {
+			.family = AF_INET,
+			.u.ipv4 = htonl(0x7f000001),
+			.port = FANOUT_PORT,
+		},
+		.src_mismatch = MSM_IGNORE,
+		.num_destinations = dests,
+		.decrypt = {
+			.cipher = REC_NULL,
+			.hmac = REH_NULL,
+		},
+		.rtp = 1,
+		.num_payload_types = 1,
+		.pt_input = {
+			{ 0, 8000, },
+		},
+	};
+	assert(kernel_add_stream(&reti) == 0);
+
+	int rfds[FANOUT_MAX_DESTS];
+	for (unsigned int i = 0; i < dests; i++) {
+		rfds[i] = udp_socket(7800 + i);
+		struct rtpengine_destination_info redi = {
+			.local = reti.local,
+			.num = i,
+			.output = {
+				.src_addr = {
+					.family = AF_INET,
+					.u.ipv4 = htonl(0x7f000001),
+					.port = FANOUT_PORT,
+				},
+				.dst_addr = {
+					.family = AF_INET,
+					.u.ipv4 = htonl(0x7f000001),
+					.port = 7800 + i,
+				},
+				.encrypt = {
+					.cipher = REC_NULL,
+					.hmac = REH_NULL,
+				},
+			},
+		};
+		assert(kernel_add_destination(&redi) == 0);
+	}
+
+	int sfd = udp_socket(5555);
+	struct sockaddr_in dst = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(0x7f000001),
+		.sin_port = htons(FANOUT_PORT),
+	};
+
+	// RTP header plus 20 ms of G.711
+	unsigned char pkt[12 + 160];
+	memset(pkt, 0xd5, sizeof(pkt));
+	pkt[0] = 0x80;
+	pkt[1] = 0;
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	unsigned long received = 0;
+	for (unsigned int n = 0; n < FANOUT_PACKETS; n++) {
+		uint16_t seq = htons(n);
+		memcpy(&pkt[2], &seq, 2);
+		sendto(sfd, pkt, sizeof(pkt), 0, (struct sockaddr *) &dst, sizeof(dst));
+		if (n % 64 == 63) {
+			for (unsigned int i = 0; i < dests; i++)
+				received += drain(rfds[i]);
+		}
+	}
+	for (unsigned int i = 0; i < dests; i++)
+		received += drain(rfds[i]);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("fan-out to %u destinations: %.0f packets/s in, %.0f packets/s out, %lu of %lu delivered\n",
+			dests, FANOUT_PACKETS / secs, received / secs,
+			received, (unsigned long) FANOUT_PACKETS * dests);
+
+	close(sfd);
+	for (unsigned int i = 0; i < dests; i++)
+		close(rfds[i]);
+
+	struct rtpengine_command_del_target_stats cmd = {
+		.local = reti.local,
+	};
+	assert(kernel_del_stream_stats(&cmd) == 0);
+}
+
+// Two destinations make a single copy, which doesn't share the payload. Packets must be
+// directed into the module for this, e.g.:
+//   iptables -I INPUT -p udp -d 127.0.0.1 --dport 4460 -j RTPENGINE --id 0
+// Runs only if RTPE_FANOUT_BENCH is set in the environment.
+static void fanout_bench(void) {
+	if (!getenv("RTPE_FANOUT_BENCH"))
+		return;
+
+	fanout_bench_run(2);
+	fanout_bench_run(FANOUT_MAX_DESTS);
+}
+
+// Forwards plain RTP from the peer end of a veth pair back to it. There is no iptables
+// rule for these addresses, so anything that arrives has gone through the XDP program.
+// The namespace and veth pair are set up by kernel-xdp-veth-test.sh, which passes the
+// name of the namespace in RTPE_XDP_NETNS.
+static void xdp_test(void) {
+	const char *netns = getenv("RTPE_XDP_NETNS");
+	if (!netns)
+		return;
+
+	struct rtpengine_target_info reti = {
+		.local = {
+			.family = AF_INET,
+			.u.ipv4 = htonl(XDP_LOCAL),
+			.port = XDP_PORT,
+		},
+		.src_mismatch = MSM_IGNORE,
+		.num_destinations = 1,
+		.decrypt = {
+			.cipher = REC_NULL,
+			.hmac = REH_NULL,
+		},
+		.rtp = 1,
+		.ssrc = { htonl(0x1234), 0, },
+		.num_payload_types = 1,
+		.pt_input = {
+			{ 0, 8000, },
+		},
+	};
+	assert(kernel_add_stream(&reti) == 0);
+	struct rtpengine_destination_info redi = {
+		.local = reti.local,
+		.num = 0,
+		.output = {
+			.src_addr = {
+				.family = AF_INET,
+				.u.ipv4 = htonl(XDP_LOCAL),
+				.port = XDP_PORT + 2,
+			},
+			.dst_addr = {
+				.family = AF_INET,
+				.u.ipv4 = htonl(XDP_PEER),
+				.port = 7900,
+			},
+			.encrypt = {
+				.cipher = REC_NULL,
+				.hmac = REH_NULL,
+			},
+			.ssrc_subst = 1,
+			.ssrc_out = { htonl(0x5678), 0, },
+			.seq_offset = { 100, 0, },
+		},
+	};
+	assert(kernel_add_destination(&redi) == 0);
+
+	char path[256];
+	snprintf(path, sizeof(path), "/var/run/netns/%s", netns);
+	int own_ns = open("/proc/self/ns/net", O_RDONLY);
+	assert(own_ns != -1);
+	int peer_ns = open(path, O_RDONLY);
+	assert(peer_ns != -1);
+	assert(setns(peer_ns, CLONE_NEWNET) == 0);
+
+	int rfd = udp_socket_addr(XDP_PEER, 7900);
+	int sfd = udp_socket_addr(XDP_PEER, 5556);
+	struct sockaddr_in dst = {
+		.sin_family = AF_INET,
+		.sin_addr.s_addr = htonl(XDP_LOCAL),
+		.sin_port = htons(XDP_PORT),
+	};
+
+	unsigned char pkt[12 + 160];
+	memset(pkt, 0xd5, sizeof(pkt));
+	pkt[0] = 0x80;
+	pkt[1] = 0;
+	uint32_t ssrc = htonl(0x1234);
+	memcpy(&pkt[8], &ssrc, 4);
+
+	// one packet first, checking what comes out
+	sendto(sfd, pkt, sizeof(pkt), 0, (struct sockaddr *) &dst, sizeof(dst));
+	struct timeval tv = { 1, 0 };
+	setsockopt(rfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	unsigned char rbuf[2048];
+	struct sockaddr_in from;
+	socklen_t fromlen = sizeof(from);
+	ssize_t len = recvfrom(rfd, rbuf, sizeof(rbuf), 0, (struct sockaddr *) &from, &fromlen);
+	assert(len == sizeof(pkt));
+	assert(from.sin_addr.s_addr == htonl(XDP_LOCAL));
+	assert(from.sin_port == htons(XDP_PORT + 2));
+	assert(rbuf[2] == 0 && rbuf[3] == 100); // seq
+	assert(!memcmp(&rbuf[8], "\x00\x00\x56\x78", 4)); // SSRC
+	assert(!memcmp(&rbuf[12], &pkt[12], 160));
+
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	unsigned long received = 0;
+	for (unsigned int n = 1; n <= XDP_PACKETS; n++) {
+		uint16_t seq = htons(n);
+		memcpy(&pkt[2], &seq, 2);
+		sendto(sfd, pkt, sizeof(pkt), 0, (struct sockaddr *) &dst, sizeof(dst));
+		if (n % 64 == 0)
+			received += drain(rfd);
+	}
+	usleep(100000);
+	received += drain(rfd);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	printf("XDP forwarding over veth: %.0f packets/s, %lu of %u delivered\n",
+			XDP_PACKETS / secs, received, XDP_PACKETS);
+	assert(received >= XDP_PACKETS * 9 / 10);
+
+	close(sfd);
+	close(rfd);
+	assert(setns(own_ns, CLONE_NEWNET) == 0);
+	close(own_ns);
+	close(peer_ns);
+}
+
 int main(void) {
 	int ret;
 
@@ -123,6 +565,10 @@ int main(void) {
 	ret = kernel_add_destination(&redi);
 	assert(ret == 0);
 
+	route_cache_test();
+	fanout_bench();
+	xdp_test();
+
 	return 0;
 }
 
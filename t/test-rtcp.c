@@ -0,0 +1,185 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "rtcp.h"
+#include "homer.h"
+#include "call.h"
+#include "media_socket.h"
+#include "main.h"
+#include "bench.h"
+
+int _log_facility_rtcp;
+int _log_facility_cdr;
+int _log_facility_dtmf;
+struct rtpengine_config rtpe_config;
+struct rtpengine_config initial_rtpe_config;
+struct poller *rtpe_poller;
+struct poller_map *rtpe_poller_map;
+GString *dtmf_logs;
+GQueue rtpe_control_ng = G_QUEUE_INIT;
+
+static struct call call;
+static struct call_media *media;
+static struct stream_fd sfd;
+static int homer_fd = -1;
+
+// SR with one report block, followed by an SDES with a CNAME that needs escaping
+static const unsigned char rtcp_packet[] = {
+	0x81, 200, 0x00, 12,
+	0x11, 0x11, 0x11, 0x11,		// SSRC
+	0xe0, 0x00, 0x00, 0x01,		// NTP MSW
+	0x00, 0x00, 0x00, 0x02,		// NTP LSW
+	0x00, 0x00, 0x00, 0x03,		// RTP TS
+	0x00, 0x00, 0x00, 0x00,		// packet count
+	0xff, 0xff, 0xff, 0xff,		// octet count
+	0x22, 0x22, 0x22, 0x22,		// report block: SSRC
+	0x06, 0x00, 0x00, 0x07,		// fraction lost, packets lost
+	0x00, 0x00, 0x00, 0x08,		// highest seq
+	0x00, 0x00, 0x00, 0x09,		// jitter
+	0x00, 0x00, 0x00, 0x0a,		// LSR
+	0x00, 0x00, 0x00, 0x0b,		// DLSR
+
+	0x81, 202, 0x00, 3,
+	0x11, 0x11, 0x11, 0x11,		// chunk SSRC
+	0x01, 0x05, 'a', '"',		// CNAME
+	'b', '\t', 'c', 0x00,
+};
+
+static const char expected_json[] = "{ "
+	"\"sender_information\":{\"ntp_timestamp_sec\":3758096385,\"ntp_timestamp_usec\":2,"
+	"\"octets\":4294967295,\"rtp_timestamp\":3, \"packets\":0},"
+	"\"ssrc\":286331153,\"type\":200,\"report_count\":1,\"report_blocks\":["
+	"{\"source_ssrc\":572662306,\"highest_seq_no\":8,\"fraction_lost\":6,\"ia_jitter\":9,"
+	"\"packets_lost\":7,\"lsr\":10,\"dlsr\":11}],"
+	"\"sdes_report_count\":1,\"sdes_information\": [ "
+	"{\"sdes_chunk_ssrc\":286331153,\"type\":1,\"text\":\"a\\\"b\\tc\"}]"
+	" }";
+
+static void setup(void) {
+	ZERO(call);
+	obj_hold(&call);
+	call.tags = g_hash_table_new(g_str_hash, g_str_equal);
+	str_init(&call.callid, "test-call");
+	bencode_buffer_init(&call.buffer);
+	struct call_monologue *ml = __monologue_create(&call);
+	media = call_media_new(&call);
+	media->monologue = ml;
+	media->protocol = &transport_protocols[PROTO_RTP_AVP];
+
+	ZERO(sfd);
+	endpoint_parse_any(&sfd.socket.local, "127.0.0.1:30000");
+
+	// receiving end of the Homer exporter
+	homer_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	assert(homer_fd != -1);
+	struct sockaddr_in sin = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+	assert(bind(homer_fd, (struct sockaddr *) &sin, sizeof(sin)) == 0);
+	socklen_t sinlen = sizeof(sin);
+	assert(getsockname(homer_fd, (struct sockaddr *) &sin, &sinlen) == 0);
+	char ep_buf[64];
+	snprintf(ep_buf, sizeof(ep_buf), "127.0.0.1:%u", ntohs(sin.sin_port));
+	assert(endpoint_parse_any(&rtpe_config.homer_ep, ep_buf) == 0);
+}
+
+static int parse(void) {
+	unsigned char buf[sizeof(rtcp_packet)];
+	memcpy(buf, rtcp_packet, sizeof(buf));
+
+	struct media_packet mp = {
+		.raw = STR_INIT_LEN((char *) buf, sizeof(buf)),
+		.sfd = &sfd,
+		.call = &call,
+		.media = media,
+		.tv = rtpe_now,
+	};
+	endpoint_parse_any(&mp.fsin, "127.0.0.1:40000");
+
+	GQueue q = G_QUEUE_INIT;
+	int ret = rtcp_parse(&q, &mp);
+	rtcp_list_free(&q);
+	return ret;
+}
+
+static void drain(void) {
+	char buf[4096];
+	while (recv(homer_fd, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+		;
+}
+
+static void test_homer(void) {
+	assert(parse() == 0);
+	homer_exporter(); // connects
+	homer_exporter();
+
+	char buf[4096];
+	ssize_t len = recv(homer_fd, buf, sizeof(buf), 0);
+	assert(len > 0);
+	// the JSON is the last chunk of the HEP packet
+	size_t jlen = strlen(expected_json);
+	if (len < jlen || memcmp(buf + len - jlen, expected_json, jlen)) {
+		printf("Homer JSON mismatch:\n%.*s\n!=\n%s\n", (int) len, buf, expected_json);
+		abort();
+	}
+	assert(memmem(buf, len, "test-call", 9) != NULL);
+	printf("Homer JSON ok\n");
+}
+
+static double bench_one(int iter) {
+	double start = bench_now();
+	for (int i = 0; i < iter; i++) {
+		if (parse())
+			abort();
+		if (i % 32 == 0) {
+			homer_exporter();
+			drain();
+		}
+	}
+	homer_exporter();
+	double ret = bench_now() - start;
+	drain();
+	return ret;
+}
+
+// syslog output would dominate the numbers, so only Homer export is measured
+static void bench(void) {
+	const int iter = 200000;
+	double t = bench_one(iter);
+	printf("RTCP SR+SDES parse + Homer export: %.0f packets/s, %.2f us/packet\n",
+			iter / t, t * 1e6 / iter);
+}
+
+
+int main(void) {
+	rtpe_common_config_ptr = &rtpe_config.common;
+	rtpe_config.homer_protocol = SOCK_DGRAM;
+	rtpe_config.homer_queue = 1024;
+	rtpe_config.homer_sample = 1;
+
+	socket_init();
+	gettimeofday(&rtpe_now, NULL);
+	setup();
+
+	homer_sender_init(&rtpe_config.homer_ep, rtpe_config.homer_protocol, 0);
+	assert(has_homer());
+	rtcp_init();
+	test_homer();
+	if (bench_enabled())
+		bench();
+
+	homer_sender_free();
+	close(homer_fd);
+	call_media_free(&media);
+	bencode_buffer_free(&call.buffer);
+	g_hash_table_destroy(call.tags);
+
+	return 0;
+}
+
+int get_local_log_level(unsigned int u) {
+	return -1;
+}
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include "ssrc.h"
+#include "main.h"
+#include "statistics.h"
+#include "bench.h"
+
+struct rtpengine_config rtpe_config;
+struct global_stats_gauge rtpe_stats_gauge;
+struct global_gauge_min_max rtpe_gauge_min_max;
+struct global_stats_counter rtpe_stats;
+struct global_stats_counter rtpe_stats_rate;
+struct global_stats_counter rtpe_stats_intv;
+struct global_stats_sampled rtpe_stats_sampled;
+struct global_sampled_min_max rtpe_sampled_min_max;
+struct global_sampled_min_max rtpe_sampled_graphite_min_max;
+struct global_sampled_min_max rtpe_sampled_graphite_min_max_sampled;
+
+
+static struct ssrc_entry *get(struct ssrc_hash *ht, uint32_t ssrc, bool *created) {
+	struct ssrc_entry *e = get_ssrc_full(ssrc, ht, created);
+	assert(e != NULL);
+	assert(e->ssrc == ssrc);
+	obj_put(e);
+	return e;
+}
+
+static void count_entry(void *e, void *p) {
+	(*(unsigned int *) p)++;
+}
+
+static unsigned int count(struct ssrc_hash *ht) {
+	unsigned int n = 0;
+	ssrc_hash_foreach(ht, count_entry, &n);
+	return n - (ht->precreat ? 1 : 0);
+}
+
+static void test_basic(void) {
+	struct ssrc_hash *ht = create_ssrc_hash_call();
+	bool created;
+
+	struct ssrc_entry *a = get(ht, 0x12345678, &created);
+	assert(created);
+	struct ssrc_entry *b = get(ht, 0x87654321, &created);
+	assert(created);
+	assert(a != b);
+	assert(get(ht, 0x12345678, &created) == a);
+	assert(!created);
+	assert(get(ht, 0x87654321, &created) == b);
+	assert(!created);
+	assert(count(ht) == 2);
+
+	free_ssrc_hash(&ht);
+	assert(ht == NULL);
+}
+
+// SSRCs which all want the same slot, to exercise probing and backward-shift deletion
+static void test_collisions(void) {
+	uint32_t colliding[SSRC_HASH_LIMIT + 5];
+	unsigned int num = 0;
+	for (uint32_t s = 1; num < G_N_ELEMENTS(colliding); s++) {
+		if (ssrc_hash_slot(s) == ssrc_hash_slot(1))
+			colliding[num++] = s;
+	}
+
+	struct ssrc_hash *ht = create_ssrc_hash_call();
+	struct ssrc_entry *ents[G_N_ELEMENTS(colliding)];
+	for (unsigned int i = 0; i < G_N_ELEMENTS(colliding); i++) {
+		bool created;
+		ents[i] = get(ht, colliding[i], &created);
+		assert(created);
+		assert(count(ht) <= SSRC_HASH_LIMIT + 1);
+	}
+
+	// the most recent ones must all still be there, no matter how they were shuffled
+	// around during deletion
+	for (unsigned int i = G_N_ELEMENTS(colliding) - SSRC_HASH_LIMIT; i < G_N_ELEMENTS(colliding); i++) {
+		bool created;
+		assert(get(ht, colliding[i], &created) == ents[i]);
+		assert(!created);
+	}
+
+	free_ssrc_hash(&ht);
+}
+
+static void test_eviction(void) {
+	struct ssrc_hash *ht = create_ssrc_hash_call();
+
+	bool created;
+
+	for (uint32_t s = 1; s <= SSRC_HASH_LIMIT + 1; s++)
+		get(ht, s, NULL);
+	assert(count(ht) == SSRC_HASH_LIMIT + 1);
+
+	// all entries are marked as used: the first eviction pass clears them all and then
+	// removes the oldest
+	get(ht, 1000, NULL);
+	assert(count(ht) == SSRC_HASH_LIMIT + 1);
+
+	// SSRC 2 is now the oldest, but gets a second chance because it's used again
+	get(ht, 2, &created);
+	assert(!created);
+	get(ht, 1001, NULL);
+	get(ht, 1002, NULL);
+	assert(count(ht) == SSRC_HASH_LIMIT + 1);
+	get(ht, 2, &created);
+	assert(!created);
+
+	// ... while 3 and 4 went away
+	get(ht, 4, &created);
+	assert(created);
+
+	free_ssrc_hash(&ht);
+}
+
+
+// traffic patterns: sequences of SSRCs as they would arrive on one monologue
+
+#define PATTERN_LEN 4096
+
+struct pattern {
+	const char *name;
+	uint32_t ssrcs[PATTERN_LEN];
+};
+
+static void pattern_single(struct pattern *p) {
+	p->name = "single stream";
+	for (int i = 0; i < PATTERN_LEN; i++)
+		p->ssrcs[i] = 0x1000;
+}
+
+// audio plus three simulcast video layers; video packets arrive in bursts per frame
+static void pattern_simulcast(struct pattern *p) {
+	p->name = "simulcast";
+	static const int burst[4] = { 1, 2, 4, 8 };
+	int i = 0;
+	while (i < PATTERN_LEN) {
+		for (int l = 0; l < 4 && i < PATTERN_LEN; l++)
+			for (int j = 0; j < burst[l] && i < PATTERN_LEN; j++)
+				p->ssrcs[i++] = 0x2000 + l;
+	}
+}
+
+// deterministic, so that runs are comparable
+static uint32_t pattern_rand(void) {
+	static uint32_t x = 42;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return x;
+}
+
+// 15 participants talking over each other
+static void pattern_conference(struct pattern *p) {
+	p->name = "conference";
+	for (int i = 0; i < PATTERN_LEN; i++)
+		p->ssrcs[i] = 0x3000 + pattern_rand() % 15;
+}
+
+// more SSRCs than the table holds, e.g. a misbehaving peer, so entries keep getting replaced
+static void pattern_churn(struct pattern *p) {
+	p->name = "SSRC churn";
+	for (int i = 0; i < PATTERN_LEN; i++)
+		p->ssrcs[i] = 0x4000 + pattern_rand() % (SSRC_HASH_LIMIT * 2);
+}
+
+#define BENCH_ROUNDS 500
+#define BENCH_THREADS 4
+
+struct bench_args {
+	const struct pattern *p;
+	struct ssrc_hash *ht;
+	pthread_barrier_t *barrier;
+};
+
+static void *bench_thread(void *a) {
+	struct bench_args *args = a;
+	const struct pattern *p = args->p;
+
+	gettimeofday(&rtpe_now, NULL);
+	pthread_barrier_wait(args->barrier);
+
+	for (int r = 0; r < BENCH_ROUNDS; r++) {
+		for (int i = 0; i < PATTERN_LEN; i++)
+			obj_put((struct ssrc_entry *) get_ssrc(p->ssrcs[i], args->ht));
+		if (r % 64 == 0)
+			rtpe_now.tv_sec++; // let time pass for the LRU
+	}
+	return NULL;
+}
+
+// lookups per second with the given number of threads sharing one table
+static double bench_one(const struct pattern *p, int threads) {
+	struct ssrc_hash *ht = create_ssrc_hash_call();
+	pthread_barrier_t barrier;
+	pthread_barrier_init(&barrier, NULL, threads + 1);
+
+	pthread_t tids[BENCH_THREADS];
+	struct bench_args args = { .p = p, .ht = ht, .barrier = &barrier };
+	for (int t = 0; t < threads; t++)
+		pthread_create(&tids[t], NULL, bench_thread, &args);
+
+	pthread_barrier_wait(&barrier);
+	double start = bench_now();
+	for (int t = 0; t < threads; t++)
+		pthread_join(tids[t], NULL);
+	double end = bench_now();
+
+	pthread_barrier_destroy(&barrier);
+	free_ssrc_hash(&ht);
+
+	return (double) threads * BENCH_ROUNDS * PATTERN_LEN / (end - start);
+}
+
+static void bench(void) {
+	static struct pattern patterns[4];
+	pattern_single(&patterns[0]);
+	pattern_simulcast(&patterns[1]);
+	pattern_conference(&patterns[2]);
+	pattern_churn(&patterns[3]);
+
+	for (int threads = 1; threads <= BENCH_THREADS; threads *= BENCH_THREADS) {
+		for (int i = 0; i < G_N_ELEMENTS(patterns); i++)
+			printf("SSRC lookups, %-13s %i thread(s): %5.1f M/s\n",
+					patterns[i].name, threads, bench_one(&patterns[i], threads) / 1e6);
+	}
+}
+
+
+int main(void) {
+	gettimeofday(&rtpe_now, NULL);
+
+	test_basic();
+	test_collisions();
+	test_eviction();
+	if (bench_enabled())
+		bench();
+
+	return 0;
+}
+
+int get_local_log_level(unsigned int u) {
+	return -1;
+}
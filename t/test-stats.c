@@ -348,6 +348,10 @@ int main(void) {
 			"errorrate\n"
 			"0\n"
 			"0\n"
+			"DTLS handshakes per second\n"
+			"dtlshandshakerate\n"
+			"0\n"
+			"0\n"
 			"Userspace-only media streams\n"
 			"media_userspace\n"
 			"0\n"
@@ -462,6 +466,26 @@ int main(void) {
 			"onewaystreams\n"
 			"0\n"
 			"0\n"
+			"Total DTLS handshakes\n"
+			"dtlshandshakes\n"
+			"0\n"
+			"0\n"
+			"Total failed DTLS handshakes\n"
+			"dtlshandshakefailures\n"
+			"0\n"
+			"0\n"
+			"Total CPU time spent on DTLS handshakes\n"
+			"dtlshandshaketime\n"
+			"0.000000 seconds\n"
+			"0.000000\n"
+			"Total messages sent to Homer\n"
+			"homermessages\n"
+			"0\n"
+			"0\n"
+			"Total messages to Homer dropped\n"
+			"homerdrops\n"
+			"0\n"
+			"0\n"
 			"Average call duration\n"
 			"avgcallduration\n"
 			"0.000000 seconds\n"
@@ -1123,6 +1147,16 @@ int main(void) {
 			"[\n"
 			"\n"
 			"]\n"
+			"codecworkers\n"
+			"\n"
+			"[\n"
+			"\n"
+			"]\n"
+			"threadload\n"
+			"\n"
+			"[\n"
+			"\n"
+			"]\n"
 			"}\n");
 
 	RTPE_STATS_INC(ng_commands[NGC_OFFER]);
@@ -1401,6 +1435,10 @@ int main(void) {
 			"errorrate\n"
 			"0\n"
 			"0\n"
+			"DTLS handshakes per second\n"
+			"dtlshandshakerate\n"
+			"0\n"
+			"0\n"
 			"Userspace-only media streams\n"
 			"media_userspace\n"
 			"0\n"
@@ -1515,6 +1553,26 @@ int main(void) {
 			"onewaystreams\n"
 			"0\n"
 			"0\n"
+			"Total DTLS handshakes\n"
+			"dtlshandshakes\n"
+			"0\n"
+			"0\n"
+			"Total failed DTLS handshakes\n"
+			"dtlshandshakefailures\n"
+			"0\n"
+			"0\n"
+			"Total CPU time spent on DTLS handshakes\n"
+			"dtlshandshaketime\n"
+			"0.000000 seconds\n"
+			"0.000000\n"
+			"Total messages sent to Homer\n"
+			"homermessages\n"
+			"0\n"
+			"0\n"
+			"Total messages to Homer dropped\n"
+			"homerdrops\n"
+			"0\n"
+			"0\n"
 			"Average call duration\n"
 			"avgcallduration\n"
 			"0.000000 seconds\n"
@@ -2176,6 +2234,16 @@ int main(void) {
 			"[\n"
 			"\n"
 			"]\n"
+			"codecworkers\n"
+			"\n"
+			"[\n"
+			"\n"
+			"]\n"
+			"threadload\n"
+			"\n"
+			"[\n"
+			"\n"
+			"]\n"
 			"}\n");
 
 	RTPE_STATS_INC(ng_commands[NGC_ANSWER]);
@@ -2451,6 +2519,10 @@ int main(void) {
 			"errorrate\n"
 			"0\n"
 			"0\n"
+			"DTLS handshakes per second\n"
+			"dtlshandshakerate\n"
+			"0\n"
+			"0\n"
 			"Userspace-only media streams\n"
 			"media_userspace\n"
 			"0\n"
@@ -2565,6 +2637,26 @@ int main(void) {
 			"onewaystreams\n"
 			"0\n"
 			"0\n"
+			"Total DTLS handshakes\n"
+			"dtlshandshakes\n"
+			"0\n"
+			"0\n"
+			"Total failed DTLS handshakes\n"
+			"dtlshandshakefailures\n"
+			"0\n"
+			"0\n"
+			"Total CPU time spent on DTLS handshakes\n"
+			"dtlshandshaketime\n"
+			"0.000000 seconds\n"
+			"0.000000\n"
+			"Total messages sent to Homer\n"
+			"homermessages\n"
+			"0\n"
+			"0\n"
+			"Total messages to Homer dropped\n"
+			"homerdrops\n"
+			"0\n"
+			"0\n"
 			"Average call duration\n"
 			"avgcallduration\n"
 			"0.000000 seconds\n"
@@ -3226,6 +3318,16 @@ int main(void) {
 			"[\n"
 			"\n"
 			"]\n"
+			"codecworkers\n"
+			"\n"
+			"[\n"
+			"\n"
+			"]\n"
+			"threadload\n"
+			"\n"
+			"[\n"
+			"\n"
+			"]\n"
 			"}\n");
 
 	// test cmd_ps_min/max/avg
@@ -3523,6 +3625,10 @@ int main(void) {
 			"errorrate\n"
 			"0\n"
 			"0\n"
+			"DTLS handshakes per second\n"
+			"dtlshandshakerate\n"
+			"0\n"
+			"0\n"
 			"Userspace-only media streams\n"
 			"media_userspace\n"
 			"0\n"
@@ -3637,6 +3743,26 @@ int main(void) {
 			"onewaystreams\n"
 			"0\n"
 			"0\n"
+			"Total DTLS handshakes\n"
+			"dtlshandshakes\n"
+			"0\n"
+			"0\n"
+			"Total failed DTLS handshakes\n"
+			"dtlshandshakefailures\n"
+			"0\n"
+			"0\n"
+			"Total CPU time spent on DTLS handshakes\n"
+			"dtlshandshaketime\n"
+			"0.000000 seconds\n"
+			"0.000000\n"
+			"Total messages sent to Homer\n"
+			"homermessages\n"
+			"0\n"
+			"0\n"
+			"Total messages to Homer dropped\n"
+			"homerdrops\n"
+			"0\n"
+			"0\n"
 			"Average call duration\n"
 			"avgcallduration\n"
 			"0.000000 seconds\n"
@@ -4298,6 +4424,16 @@ int main(void) {
 			"[\n"
 			"\n"
 			"]\n"
+			"codecworkers\n"
+			"\n"
+			"[\n"
+			"\n"
+			"]\n"
+			"threadload\n"
+			"\n"
+			"[\n"
+			"\n"
+			"]\n"
 			"}\n");
 
 	// test average call duration
@@ -4581,6 +4717,10 @@ int main(void) {
 			"errorrate\n"
 			"0\n"
 			"0\n"
+			"DTLS handshakes per second\n"
+			"dtlshandshakerate\n"
+			"0\n"
+			"0\n"
 			"Userspace-only media streams\n"
 			"media_userspace\n"
 			"0\n"
@@ -4695,6 +4835,26 @@ int main(void) {
 			"onewaystreams\n"
 			"0\n"
 			"0\n"
+			"Total DTLS handshakes\n"
+			"dtlshandshakes\n"
+			"0\n"
+			"0\n"
+			"Total failed DTLS handshakes\n"
+			"dtlshandshakefailures\n"
+			"0\n"
+			"0\n"
+			"Total CPU time spent on DTLS handshakes\n"
+			"dtlshandshaketime\n"
+			"0.000000 seconds\n"
+			"0.000000\n"
+			"Total messages sent to Homer\n"
+			"homermessages\n"
+			"0\n"
+			"0\n"
+			"Total messages to Homer dropped\n"
+			"homerdrops\n"
+			"0\n"
+			"0\n"
 			"Average call duration\n"
 			"avgcallduration\n"
 			"0.000000 seconds\n"
@@ -5356,6 +5516,16 @@ int main(void) {
 			"[\n"
 			"\n"
 			"]\n"
+			"codecworkers\n"
+			"\n"
+			"[\n"
+			"\n"
+			"]\n"
+			"threadload\n"
+			"\n"
+			"[\n"
+			"\n"
+			"]\n"
 			"}\n");
 
 
@@ -5634,6 +5804,10 @@ int main(void) {
 			"errorrate\n"
 			"0\n"
 			"0\n"
+			"DTLS handshakes per second\n"
+			"dtlshandshakerate\n"
+			"0\n"
+			"0\n"
 			"Userspace-only media streams\n"
 			"media_userspace\n"
 			"0\n"
@@ -5748,6 +5922,26 @@ int main(void) {
 			"onewaystreams\n"
 			"0\n"
 			"0\n"
+			"Total DTLS handshakes\n"
+			"dtlshandshakes\n"
+			"0\n"
+			"0\n"
+			"Total failed DTLS handshakes\n"
+			"dtlshandshakefailures\n"
+			"0\n"
+			"0\n"
+			"Total CPU time spent on DTLS handshakes\n"
+			"dtlshandshaketime\n"
+			"0.000000 seconds\n"
+			"0.000000\n"
+			"Total messages sent to Homer\n"
+			"homermessages\n"
+			"0\n"
+			"0\n"
+			"Total messages to Homer dropped\n"
+			"homerdrops\n"
+			"0\n"
+			"0\n"
 			"Average call duration\n"
 			"avgcallduration\n"
 			"0.000000 seconds\n"
@@ -6409,6 +6603,16 @@ int main(void) {
 			"[\n"
 			"\n"
 			"]\n"
+			"codecworkers\n"
+			"\n"
+			"[\n"
+			"\n"
+			"]\n"
+			"threadload\n"
+			"\n"
+			"[\n"
+			"\n"
+			"]\n"
 			"}\n");
 
 
@@ -6689,6 +6893,10 @@ int main(void) {
 			"errorrate\n"
 			"0\n"
 			"0\n"
+			"DTLS handshakes per second\n"
+			"dtlshandshakerate\n"
+			"0\n"
+			"0\n"
 			"Userspace-only media streams\n"
 			"media_userspace\n"
 			"0\n"
@@ -6803,6 +7011,26 @@ int main(void) {
 			"onewaystreams\n"
 			"0\n"
 			"0\n"
+			"Total DTLS handshakes\n"
+			"dtlshandshakes\n"
+			"0\n"
+			"0\n"
+			"Total failed DTLS handshakes\n"
+			"dtlshandshakefailures\n"
+			"0\n"
+			"0\n"
+			"Total CPU time spent on DTLS handshakes\n"
+			"dtlshandshaketime\n"
+			"0.000000 seconds\n"
+			"0.000000\n"
+			"Total messages sent to Homer\n"
+			"homermessages\n"
+			"0\n"
+			"0\n"
+			"Total messages to Homer dropped\n"
+			"homerdrops\n"
+			"0\n"
+			"0\n"
 			"Average call duration\n"
 			"avgcallduration\n"
 			"93.000000 seconds\n"
@@ -7464,6 +7692,16 @@ int main(void) {
 			"[\n"
 			"\n"
 			"]\n"
+			"codecworkers\n"
+			"\n"
+			"[\n"
+			"\n"
+			"]\n"
+			"threadload\n"
+			"\n"
+			"[\n"
+			"\n"
+			"]\n"
 			"}\n");
 
 
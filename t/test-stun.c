@@ -0,0 +1,182 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <openssl/hmac.h>
+#include "stun.h"
+#include "ssllib.h"
+#include "bench.h"
+
+
+// binding request as sent by a WebRTC client: header, USERNAME, PRIORITY,
+// ICE-CONTROLLED, MESSAGE-INTEGRITY, FINGERPRINT
+#define MSG_LEN (20 + 4+20 + 4+4 + 4+8 + 4+20 + 4+4)
+#define MI_POS (MSG_LEN - 8 - 24)
+#define FP_POS (MSG_LEN - 8)
+
+static const char pwd[] = "Xu3rW5hq1ZcGnTdEyIw9vB7s";
+
+static void put_attr(unsigned char **p, uint16_t type, const void *data, uint16_t len) {
+	uint16_t t = htons(type), l = htons(len);
+	memcpy(*p, &t, 2);
+	memcpy(*p + 2, &l, 2);
+	memcpy(*p + 4, data, len);
+	*p += 4 + len;
+}
+
+static void build_body(unsigned char *msg) {
+	unsigned char *p = msg;
+	uint16_t type = htons(0x0001), len = htons(MSG_LEN - 20);
+	uint32_t cookie = htonl(STUN_COOKIE);
+	memcpy(p, &type, 2);
+	memcpy(p + 2, &len, 2);
+	memcpy(p + 4, &cookie, 4);
+	memcpy(p + 8, "abcdefghijkl", 12);
+	p += 20;
+	put_attr(&p, 0x0006, "9s0W:rtpengine000000", 20);
+	uint32_t prio = htonl(1853824767);
+	put_attr(&p, 0x0024, &prio, 4);
+	put_attr(&p, 0x8029, "\x11\x22\x33\x44\x55\x66\x77\x88", 8);
+	assert(p - msg == MI_POS);
+}
+
+typedef void (*hmac_func)(const void *key, const unsigned char *msg, size_t len, unsigned char *digest);
+
+static void hmac_oneshot(const void *key, const unsigned char *msg, size_t len, unsigned char *digest) {
+	HMAC(EVP_sha1(), pwd, strlen(pwd), msg, len, digest, NULL);
+}
+
+static void hmac_prekeyed(const void *key, const unsigned char *msg, size_t len, unsigned char *digest) {
+	struct iovec iov = { .iov_base = (void *) msg, .iov_len = len };
+	hmac_sha1_iov(key, &iov, 1, digest);
+}
+
+// fills in MESSAGE-INTEGRITY and FINGERPRINT
+static void encode(unsigned char *msg, hmac_func hmac, const void *key) {
+	unsigned char digest[20];
+	unsigned char *p = msg + MI_POS;
+
+	// message length covers up to and including MESSAGE-INTEGRITY
+	uint16_t len = htons(MI_POS + 24 - 20);
+	memcpy(msg + 2, &len, 2);
+	hmac(key, msg, MI_POS, digest);
+	put_attr(&p, 0x0008, digest, 20);
+
+	len = htons(MSG_LEN - 20);
+	memcpy(msg + 2, &len, 2);
+	uint32_t crc = htonl(stun_crc32(0, msg, FP_POS) ^ 0x5354554eUL);
+	put_attr(&p, 0x8028, &crc, 4);
+}
+
+static bool verify(unsigned char *msg, hmac_func hmac, const void *key) {
+	uint32_t crc;
+	memcpy(&crc, msg + FP_POS + 4, 4);
+	if (ntohl(crc) != (stun_crc32(0, msg, FP_POS) ^ 0x5354554eUL))
+		return false;
+
+	unsigned char digest[20];
+	uint16_t len = htons(MI_POS + 24 - 20);
+	unsigned char tmp[MI_POS];
+	memcpy(tmp, msg, MI_POS);
+	memcpy(tmp + 2, &len, 2);
+	hmac(key, tmp, MI_POS, digest);
+	return memcmp(digest, msg + MI_POS + 4, 20) == 0;
+}
+
+static void test_hmac(void) {
+	unsigned char key[200], data[300], d1[20], d2[20];
+	for (int i = 0; i < sizeof(key); i++)
+		key[i] = i * 7 + 3;
+	for (int i = 0; i < sizeof(data); i++)
+		data[i] = i * 13;
+
+	static const int key_lens[] = { 1, 8, 22, 26, 64, 65, 200 };
+	for (int i = 0; i < G_N_ELEMENTS(key_lens); i++) {
+		struct hmac_sha1_key k = {0};
+		hmac_sha1_key_init(&k, key, key_lens[i]);
+		struct iovec iov[3] = {
+			{ data, 2 },
+			{ data + 2, 2 },
+			{ data + 4, 150 },
+		};
+		assert(hmac_sha1_iov(&k, iov, 3, d1));
+		HMAC(EVP_sha1(), key, key_lens[i], data, 154, d2, NULL);
+		if (memcmp(d1, d2, 20)) {
+			printf("HMAC mismatch with key length %i\n", key_lens[i]);
+			abort();
+		}
+		hmac_sha1_key_clear(&k);
+	}
+
+	struct hmac_sha1_key k = {0};
+	struct iovec iov = { data, 10 };
+	assert(!hmac_sha1_iov(&k, &iov, 1, d1));
+}
+
+static void test_crc(void) {
+	unsigned char data[300];
+	for (int i = 0; i < sizeof(data); i++)
+		data[i] = i * 31 + 1;
+	for (int len = 0; len < sizeof(data); len += 7) {
+		uint32_t a = crc32(0, data, len);
+		uint32_t b = stun_crc32(0, data, len);
+		// split into two chunks
+		uint32_t c = stun_crc32(stun_crc32(0, data, len / 3), data + len / 3, len - len / 3);
+		if (a != b || a != c) {
+			printf("CRC mismatch at length %i\n", len);
+			abort();
+		}
+	}
+}
+
+static void test_message(void) {
+	struct hmac_sha1_key k = {0};
+	hmac_sha1_key_init(&k, pwd, strlen(pwd));
+
+	unsigned char m1[MSG_LEN], m2[MSG_LEN];
+	build_body(m1);
+	build_body(m2);
+	encode(m1, hmac_oneshot, NULL);
+	encode(m2, hmac_prekeyed, &k);
+	assert(memcmp(m1, m2, MSG_LEN) == 0);
+
+	assert(verify(m1, hmac_prekeyed, &k));
+	assert(verify(m2, hmac_oneshot, NULL));
+	m2[30] ^= 1;
+	assert(!verify(m2, hmac_prekeyed, &k));
+
+	hmac_sha1_key_clear(&k);
+}
+
+static void bench(void) {
+	const int iter = 100000;
+	struct hmac_sha1_key k = {0};
+	hmac_sha1_key_init(&k, pwd, strlen(pwd));
+
+	unsigned char msg[MSG_LEN];
+	build_body(msg);
+	double start = bench_now();
+	for (int i = 0; i < iter; i++) {
+		msg[8] = i; // vary transaction ID
+		encode(msg, hmac_prekeyed, &k);
+		if (!verify(msg, hmac_prekeyed, &k))
+			abort();
+	}
+	double end = bench_now();
+	printf("STUN encode+verify: %.0f/s\n", iter / (end - start));
+
+	hmac_sha1_key_clear(&k);
+}
+
+
+int main(void) {
+	test_hmac();
+	test_crc();
+	test_message();
+	if (bench_enabled())
+		bench();
+	return 0;
+}
+
+int get_local_log_level(unsigned int u) {
+	return -1;
+}
@@ -371,13 +371,13 @@ static void end(void) {
 	g_queue_clear_full(&media_B->streams, free);
 	call_media_free(&media_A);
 	call_media_free(&media_B);
-	bencode_buffer_free(&call.buffer);
 	g_hash_table_destroy(call.tags);
 	g_queue_clear(&call.medias);
 	if (ml_A)
 		__monologue_free(ml_A);
 	if (ml_B)
 		__monologue_free(ml_B);
+	bencode_buffer_free(&call.buffer);
 	__cleanup();
 	printf("\n");
 }
@@ -532,6 +532,13 @@ int main(void) {
 	expect(B, "8/PCMA/8000");
 	packet(A, 0, PCMU_payload, 8, PCMA_payload);
 	packet(B, 8, PCMA_payload, 0, PCMU_payload);
+	// G.711 to G.711 is a table lookup, which can be left to the kernel
+	{
+		struct codec_handler *h = codec_handler_get(media_A, 0, media_B, NULL);
+		assert(h->kernelize && h->kernel_transcode == RTPE_PT_ULAW_TO_ALAW);
+		h = codec_handler_get(media_B, 8, media_A, NULL);
+		assert(h->kernelize && h->kernel_transcode == RTPE_PT_ALAW_TO_ULAW);
+	}
 	end();
 
 #ifdef WITH_AMR_TESTS